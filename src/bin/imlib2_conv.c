@@ -8,6 +8,7 @@
 #endif
 #include <Imlib2.h>
 
+#include <getopt.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -38,7 +39,15 @@
    "  -b 0xRRGGBB   : Render on solid background before saving\n" \
    "  -i key=value  : Attach tag with integer value for saver\n" \
    "  -j key=string : Attach tag with string value for saver\n" \
-   "  -g WxH        : Specify output image size\n"
+   "  -g WxH        : Specify output image size\n" \
+   "  -s, --stream  : Scale while loading (low memory, see -g)\n"
+
+#define OPTS "b:hi:j:g:n:s"
+
+static const struct option long_opts[] = {
+    {"stream", no_argument, NULL, 's'},
+    {NULL, 0, NULL, 0},
+};
 
 static void
 usage(void)
@@ -93,17 +102,18 @@ main(int argc, char **argv)
     const char     *dot;
     Imlib_Image     im;
     int             cnt, save_cnt;
-    bool            show_time;
+    bool            show_time, stream;
     unsigned int    t0;
     double          dt;
 
     wo = ho = 0;
     bgcol = 0x80000000;
     show_time = false;
+    stream = false;
     save_cnt = 1;
     t0 = 0;
 
-    while ((opt = getopt(argc, argv, "b:hi:j:g:n:")) != -1)
+    while ((opt = getopt_long(argc, argv, OPTS, long_opts, NULL)) != -1)
     {
         switch (opt)
         {
@@ -124,6 +134,9 @@ main(int argc, char **argv)
             save_cnt = atoi(optarg);
             show_time = true;
             break;
+        case 's':
+            stream = true;
+            break;
         }
     }
 
@@ -136,7 +149,16 @@ main(int argc, char **argv)
     fin = argv[optind];
     fout = argv[optind + 1];
 
-    im = imlib_load_image_with_errno_return(fin, &err);
+    if (stream)
+    {
+        im = imlib_load_image_streamed(fin, wo, ho);
+        err = imlib_get_error();
+        wo = ho = 0;            /* Done */
+    }
+    else
+    {
+        im = imlib_load_image_with_errno_return(fin, &err);
+    }
     if (!im)
     {
         fprintf(stderr, "*** Error %d:'%s' loading image: '%s'\n",
@@ -187,7 +209,7 @@ main(int argc, char **argv)
 
     /* Re-parse options to attach parameters to be used by savers */
     optind = 1;
-    while ((opt = getopt(argc, argv, "b:hi:j:g:n:")) != -1)
+    while ((opt = getopt_long(argc, argv, OPTS, long_opts, NULL)) != -1)
     {
         switch (opt)
         {
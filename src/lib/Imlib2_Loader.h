@@ -169,6 +169,9 @@ struct _ImlibImage {
     char            rsvd[3];
 
     int             frame;
+
+    int             hint_w, hint_h;     /* Load size hint (0: none) */
+    int             threads;    /* Decoder threads (0: default) */
 };
 
 #define LDR_ALPHA_NO            0       /* No alpha */
@@ -183,13 +186,21 @@ struct _ImlibImage {
 
 ImlibLoader    *__imlib_FindBestLoader(const char *file, const char *format,
                                        int for_save);
+ImlibLoader    *__imlib_SniffLoader(const void *fdata, size_t fsize);
 int             __imlib_LoadEmbedded(ImlibLoader * l, ImlibImage * im,
                                      int load_data, const char *file);
 int             __imlib_LoadEmbeddedMem(ImlibLoader * l, ImlibImage * im,
                                         int load_data, const void *fdata,
                                         unsigned int fsize);
+int             __imlib_LoadEmbeddedMemNamed(ImlibLoader * l,
+                                             ImlibImage * im, int load_data,
+                                             const char *name,
+                                             const void *fdata,
+                                             unsigned int fsize);
 
 uint32_t       *__imlib_AllocateData(ImlibImage * im);
+uint32_t       *__imlib_AllocateRows(ImlibImage * im, int nrows);
+uint32_t       *__imlib_LoadRow(ImlibImage * im, int row);
 void            __imlib_FreeData(ImlibImage * im);
 
 typedef void    (*ImlibDataDestructorFunction)(ImlibImage * im, void *data);
@@ -205,17 +216,36 @@ const char     *__imlib_GetKey(const ImlibImage * im);
 
 ImlibImageFrame *__imlib_GetFrame(ImlibImage * im);
 
+void           *__imlib_LoaderState(const ImlibImage * im);
+int             __imlib_LoaderStateSet(ImlibImage * im, void *state,
+                                       void (*free_state)(void *state));
+
 void            __imlib_LoadProgressSetPass(ImlibImage * im,
                                             int pass, int n_pass);
 int             __imlib_LoadProgress(ImlibImage * im,
                                      int x, int y, int w, int h);
 int             __imlib_LoadProgressRows(ImlibImage * im, int row, int nrows);
+int             __imlib_SaveWrite(ImlibImage * im, const void *buf, size_t len);
+int             __imlib_LoadSizeHint(const ImlibImage * im, int w, int h,
+                                     int *pw, int *ph);
+
+/* workers.h */
+
+/* Job function. job is 0..n_jobs-1, worker is 0..n_workers-1 */
+typedef void    (ImlibWorkFunc) (void *data, int job, int worker);
+
+int             __imlib_WorkersGet(void);
+
+int             __imlib_WorkersRun(ImlibWorkFunc * func, void *data,
+                                   int n_jobs, int n_workers);
 
 /* loader.h */
 
 #define IMLIB2_LOADER_VERSION 3
 
 #define LDR_FLAG_KEEP   0x01    /* Don't unload loader */
+#define LDR_FLAG_WRITE  0x02    /* Saver writes with __imlib_SaveWrite() */
+#define LDR_FLAG_FILE   0x04    /* Loader needs a real file (name, fp) */
 
 typedef struct {
     unsigned char   ldr_version;        /* Module ABI version */
@@ -247,6 +277,12 @@ typedef struct {
 #define IMLIB_LOADER_INEX(_fmts, _ldr, _svr, _inex) \
     IMLIB_LOADER_(_fmts, _ldr, _svr, _inex, 0)
 
+#define IMLIB_LOADER_WRITE(_fmts, _ldr, _svr) \
+    IMLIB_LOADER_(_fmts, _ldr, _svr, NULL, LDR_FLAG_WRITE)
+
+#define IMLIB_LOADER_FILE(_fmts, _ldr, _svr) \
+    IMLIB_LOADER_(_fmts, _ldr, _svr, NULL, LDR_FLAG_FILE)
+
 #define QUIT_WITH_RC(_err) { rc = _err; goto quit; }
 
 #define PCAST(T, p) ((T)(const void *)(p))
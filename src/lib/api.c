@@ -3,6 +3,7 @@
 #include "common.h"
 
 #include <errno.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
@@ -20,6 +21,7 @@
 #include "scale.h"
 #include "script.h"
 #include "updates.h"
+#include "workers.h"
 #ifdef BUILD_X11
 #include "x11_pixmap.h"
 #endif
@@ -27,6 +29,7 @@
 #define ILA0(ctx, imm, noc) \
    .pfunc = (ImlibProgressFunction)(ctx)->progress_func, \
    .pgran = (ctx)->progress_granularity, \
+   .threads = (ctx)->decode_threads, \
    .immed = imm, .nocache = noc
 
 typedef struct _ImlibContextItem {
@@ -62,12 +65,13 @@ static const ImlibContext ctx_default = DefaultContext;
 /* The initial context */
 static ImlibContext ctx0 = DefaultContext;
 
-/* Current context */
-ImlibContext   *ctx = &ctx0;
+/* Current context (per thread) */
+THREAD_LOCAL ImlibContext *ctx = &ctx0;
 
-/* a stack of contexts -- only used by context-handling functions. */
+/* a stack of contexts -- only used by context-handling functions.
+ * Each thread has its own stack, all starting out with the initial context. */
 static ImlibContextItem contexts0 = {.context = &ctx0 };
-static ImlibContextItem *contexts = &contexts0;
+static THREAD_LOCAL ImlibContextItem *contexts = &contexts0;
 
 /* Return Imlib2 version */
 int
@@ -264,6 +268,18 @@ imlib_context_get_anti_alias(void)
     return ctx->anti_alias;
 }
 
+EAPI void
+imlib_context_set_fill_rule(Imlib_Fill_Rule fill_rule)
+{
+    ctx->fill_rule = fill_rule;
+}
+
+EAPI            Imlib_Fill_Rule
+imlib_context_get_fill_rule(void)
+{
+    return (Imlib_Fill_Rule) ctx->fill_rule;
+}
+
 EAPI void
 imlib_context_set_dither(char dither)
 {
@@ -461,6 +477,18 @@ imlib_context_get_progress_granularity(void)
     return ctx->progress_granularity;
 }
 
+EAPI void
+imlib_context_set_decode_threads(int num)
+{
+    ctx->decode_threads = num <= 0 ? 0 : num > 64 ? 64 : num;
+}
+
+EAPI int
+imlib_context_get_decode_threads(void)
+{
+    return ctx->decode_threads;
+}
+
 EAPI void
 imlib_context_set_image(Imlib_Image image)
 {
@@ -478,21 +506,51 @@ imlib_context_get_image(void)
 EAPI int
 imlib_get_cache_used(void)
 {
-    return __imlib_CurrentCacheSize();
+    return MIN(__imlib_CurrentCacheSize(), INT_MAX);
 }
 
 EAPI int
 imlib_get_cache_size(void)
 {
-    return __imlib_GetCacheSize();
+    return MIN(__imlib_GetCacheSize(), INT_MAX);
 }
 
 EAPI void
 imlib_set_cache_size(int bytes)
+{
+    __imlib_SetCacheSize(MAX(bytes, 0));
+}
+
+EAPI uint64_t
+imlib_get_cache_used_64(void)
+{
+    return __imlib_CurrentCacheSize();
+}
+
+EAPI uint64_t
+imlib_get_cache_size_64(void)
+{
+    return __imlib_GetCacheSize();
+}
+
+EAPI void
+imlib_set_cache_size_64(uint64_t bytes)
 {
     __imlib_SetCacheSize(bytes);
 }
 
+EAPI int
+imlib_get_threads(void)
+{
+    return __imlib_WorkersGet();
+}
+
+EAPI void
+imlib_set_threads(int num)
+{
+    __imlib_WorkersSet(num);
+}
+
 EAPI int
 imlib_image_decache_file(const char *file)
 {
@@ -646,6 +704,57 @@ imlib_load_image_mem(const char *file, const void *data, size_t size)
     return im;
 }
 
+EAPI            Imlib_Image
+imlib_load_image_scaled(const char *file, int max_w, int max_h)
+{
+    Imlib_Image     im;
+    ImlibLoadArgs   ila = { ILA0(ctx, 0, 0),.hint_w = max_w,.hint_h = max_h };
+
+    CHECK_PARAM_POINTER_RETURN("file", file, NULL);
+
+    im = __imlib_LoadImage(file, &ila);
+    ctx->error = ila.err;
+
+    return im;
+}
+
+EAPI            Imlib_Image
+imlib_load_image_streamed(const char *file, int w, int h)
+{
+    ImlibImage     *im, *im_src;
+    ImlibScaleRows *sr;
+    ImlibLoadArgs   ila = { ILA0(ctx, 1, 1),.hint_w = w,.hint_h = h };
+    int             err;
+
+    CHECK_PARAM_POINTER_RETURN("file", file, NULL);
+
+    sr = __imlib_ScaleRowsNew(w, h, ctx->anti_alias);
+    if (!sr)
+    {
+        ctx->error = ENOMEM;
+        return NULL;
+    }
+
+    /* The source image never has all its data */
+    ila.pfunc = NULL;
+    ila.rfunc = __imlib_ScaleRowsPut;
+    ila.rdata = sr;
+
+    im_src = __imlib_LoadImage(file, &ila);
+
+    im = __imlib_ScaleRowsDone(sr, &err);
+    ctx->error = ila.err ? ila.err : err;
+
+    if (im_src)
+    {
+        if (im && im_src->format)
+            im->format = strdup(im_src->format);
+        __imlib_FreeImage(im_src);
+    }
+
+    return im;
+}
+
 EAPI            Imlib_Image
 imlib_load_image_frame(const char *file, int frame)
 {
@@ -710,6 +819,17 @@ imlib_image_get_frame_info(Imlib_Frame_Info *info)
     info->frame_delay = fp->frame_delay ? fp->frame_delay : 100;
 }
 
+EAPI            Imlib_Image
+imlib_image_frame_next(void)
+{
+    ImlibImage     *im;
+
+    CHECK_PARAM_POINTER_RETURN("image", ctx->image, NULL);
+    CAST_IMAGE(im, ctx->image);
+
+    return __imlib_FrameNext(im, &ctx->error);
+}
+
 EAPI void
 imlib_free_image(void)
 {
@@ -725,7 +845,7 @@ imlib_free_image_and_decache(void)
 
     CHECK_PARAM_POINTER("image", ctx->image);
     CAST_IMAGE(im, ctx->image);
-    IM_FLAG_SET(im, F_INVALID);
+    __imlib_DecacheImage(im);
     __imlib_FreeImage(im);
     ctx->image = NULL;
 }
@@ -1017,6 +1137,7 @@ imlib_clone_image(void)
     im->has_alpha = im_old->has_alpha;
     im->flags = im_old->flags;
     IM_FLAG_SET(im, F_UNCACHEABLE);
+    IM_FLAG_CLR(im, F_CACHED);
     im->moddate = im_old->moddate;
     im->border = im_old->border;
     im->loader = im_old->loader;
@@ -1297,6 +1418,20 @@ imlib_image_blur(int radius)
     __imlib_BlurImage(im, radius);
 }
 
+EAPI void
+imlib_image_blur_gaussian(double sigma)
+{
+    ImlibImage     *im;
+
+    CHECK_PARAM_POINTER("image", ctx->image);
+    CAST_IMAGE(im, ctx->image);
+    ctx->error = __imlib_LoadImageData(im);
+    if (ctx->error)
+        return;
+    __imlib_DirtyImage(im);
+    __imlib_BlurImageGaussian(im, sigma);
+}
+
 EAPI void
 imlib_image_sharpen(int radius)
 {
@@ -1935,6 +2070,103 @@ imlib_save_image_with_errno_return(const char *file, int *error_return)
         *error_return = ctx->error;
 }
 
+typedef struct {
+    char           *buf;
+    size_t          len, size;
+} ImlibMemSink;
+
+static int
+_mem_sink_write(void *data, const void *buf, size_t len)
+{
+    ImlibMemSink   *ms = data;
+    size_t          size;
+    char           *p;
+
+    if (len > ms->size - ms->len)
+    {
+        size = ms->size ? ms->size : 65536;
+        while (size - ms->len < len)
+        {
+            if (size > SIZE_MAX / 2)
+            {
+                errno = ENOMEM;
+                return -1;
+            }
+            size *= 2;
+        }
+        p = realloc(ms->buf, size);
+        if (!p)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        ms->buf = p;
+        ms->size = size;
+    }
+
+    memcpy(ms->buf + ms->len, buf, len);
+    ms->len += len;
+
+    return 0;
+}
+
+static void
+_imlib_save_image_cb(const char *file, ImlibWriteFunction func, void *data)
+{
+    ImlibImage     *im;
+    ImlibLoadArgs   ila = { ILA0(ctx, 0, 0) };
+
+    CHECK_PARAM_POINTER("image", ctx->image);
+    CAST_IMAGE(im, ctx->image);
+
+    ctx->error = __imlib_LoadImageData(im);
+    if (ctx->error)
+        return;
+
+    ila.wfunc = func;
+    ila.wdata = data;
+    __imlib_SaveImage(im, file, &ila);
+    ctx->error = ila.err;
+}
+
+EAPI void      *
+imlib_save_image_mem(const char *file, size_t *size_return)
+{
+    ImlibMemSink    ms = { NULL, 0, 0 };
+    char           *p;
+
+    CHECK_PARAM_POINTER_RETURN("size_return", size_return, NULL);
+
+    *size_return = 0;
+
+    _imlib_save_image_cb(file, _mem_sink_write, &ms);
+    if (ctx->error || !ms.buf)
+    {
+        if (!ctx->error)
+            ctx->error = IMLIB_ERR_INTERNAL;
+        free(ms.buf);
+        return NULL;
+    }
+
+    /* Release the unused tail */
+    p = realloc(ms.buf, ms.len);
+    if (p)
+        ms.buf = p;
+
+    *size_return = ms.len;
+
+    return ms.buf;
+}
+
+EAPI void
+imlib_save_image_with_callback(const char *file, Imlib_Write_Function func,
+                               void *data)
+{
+    CHECK_PARAM_POINTER("func", func);
+
+    _imlib_save_image_cb(file, func, data);
+}
+
 EAPI void
 imlib_save_image_fd(int fd, const char *file)
 {
@@ -2157,7 +2389,8 @@ imlib_image_fill_polygon(ImlibPolygon poly)
     __imlib_Polygon_FillToImage((ImlibPoly *) poly, ctx->pixel,
                                 im, ctx->cliprect.x, ctx->cliprect.y,
                                 ctx->cliprect.w, ctx->cliprect.h,
-                                ctx->operation, ctx->blend, ctx->anti_alias);
+                                ctx->operation, ctx->blend, ctx->anti_alias,
+                                ctx->fill_rule == IMLIB_FILL_RULE_NON_ZERO);
 }
 
 EAPI void
@@ -1,4 +1,5 @@
 
+#include "lock.h"
 #include "rgbadraw.h"
 #ifdef BUILD_X11
 #include "x11_types.h"
@@ -43,6 +44,7 @@ typedef struct {
 #endif
     int             error;
     char            anti_alias;
+    char            fill_rule;
     char            dither;
     char            blend;
     Imlib_Color_Modifier color_modifier;
@@ -54,6 +56,7 @@ typedef struct {
     Imlib_Image_Data_Memory_Function image_data_memory_func;
     Imlib_Progress_Function progress_func;
     char            progress_granularity;
+    int             decode_threads;
     char            dither_mask;
     int             mask_alpha_threshold;
     Imlib_Rectangle cliprect;
@@ -69,4 +72,4 @@ typedef struct {
 #endif
 } ImlibContext;
 
-extern ImlibContext *ctx;
+extern THREAD_LOCAL ImlibContext *ctx;
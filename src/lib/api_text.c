@@ -8,18 +8,30 @@
 #include "file.h"
 #include "image.h"
 #include "font.h"
+#include "lock.h"
+
+/* Serializes all access to the fonts, the font paths and the glyph caches */
+LOCK_STATIC(font_lock);
 
 EAPI            Imlib_Font
 imlib_load_font(const char *font_name)
 {
-    return __imlib_font_load_joined(font_name);
+    ImlibFont      *fn;
+
+    LOCK(font_lock);
+    fn = __imlib_font_load_joined(font_name);
+    UNLOCK(font_lock);
+
+    return fn;
 }
 
 EAPI void
 imlib_free_font(void)
 {
     CHECK_PARAM_POINTER("font", ctx->font);
+    LOCK(font_lock);
     __imlib_font_free(ctx->font);
+    UNLOCK(font_lock);
     ctx->font = NULL;
 }
 
@@ -62,16 +74,24 @@ imlib_context_get_angle(void)
 EAPI int
 imlib_insert_font_into_fallback_chain(Imlib_Font font, Imlib_Font fallback_font)
 {
+    int             err;
+
     CHECK_PARAM_POINTER_RETURN("font", font, 1);
     CHECK_PARAM_POINTER_RETURN("fallback_font", fallback_font, 1);
-    return __imlib_font_insert_into_fallback_chain_imp(font, fallback_font);
+    LOCK(font_lock);
+    err = __imlib_font_insert_into_fallback_chain_imp(font, fallback_font);
+    UNLOCK(font_lock);
+
+    return err;
 }
 
 EAPI void
 imlib_remove_font_from_fallback_chain(Imlib_Font fallback_font)
 {
     CHECK_PARAM_POINTER("fallback_font", fallback_font);
+    LOCK(font_lock);
     __imlib_font_remove_from_fallback_chain_imp(fallback_font);
+    UNLOCK(font_lock);
 }
 
 EAPI            Imlib_Font
@@ -118,12 +138,14 @@ imlib_text_draw_with_return_metrics(int x, int y, const char *text,
     if (ctx->direction == IMLIB_TEXT_TO_ANGLE && ctx->angle == 0.0)
         dir = IMLIB_TEXT_TO_RIGHT;
 
+    LOCK(font_lock);
     __imlib_render_str(im, fn, x, y, text, ctx->pixel, dir,
                        ctx->angle, width_return, height_return, 0,
                        horizontal_advance_return, vertical_advance_return,
                        ctx->operation,
                        ctx->cliprect.x, ctx->cliprect.y,
                        ctx->cliprect.w, ctx->cliprect.h);
+    UNLOCK(font_lock);
 }
 
 EAPI void
@@ -141,7 +163,9 @@ imlib_get_text_size(const char *text, int *width_return, int *height_return)
     if (ctx->direction == IMLIB_TEXT_TO_ANGLE && ctx->angle == 0.0)
         dir = IMLIB_TEXT_TO_RIGHT;
 
+    LOCK(font_lock);
     __imlib_font_query_size(fn, text, &w, &h);
+    UNLOCK(font_lock);
 
     switch (dir)
     {
@@ -228,7 +252,9 @@ imlib_get_text_advance(const char *text, int *horizontal_advance_return,
     CHECK_PARAM_POINTER("font", ctx->font);
     CHECK_PARAM_POINTER("text", text);
     fn = (ImlibFont *) ctx->font;
+    LOCK(font_lock);
     __imlib_font_query_advance(fn, text, &w, &h);
+    UNLOCK(font_lock);
     if (horizontal_advance_return)
         *horizontal_advance_return = w;
     if (vertical_advance_return)
@@ -239,33 +265,48 @@ EAPI int
 imlib_get_text_inset(const char *text)
 {
     ImlibFont      *fn;
+    int             inset;
 
     CHECK_PARAM_POINTER_RETURN("font", ctx->font, 0);
     CHECK_PARAM_POINTER_RETURN("text", text, 0);
     fn = (ImlibFont *) ctx->font;
-    return __imlib_font_query_inset(fn, text);
+    LOCK(font_lock);
+    inset = __imlib_font_query_inset(fn, text);
+    UNLOCK(font_lock);
+
+    return inset;
 }
 
 EAPI void
 imlib_add_path_to_font_path(const char *path)
 {
     CHECK_PARAM_POINTER("path", path);
+    LOCK(font_lock);
     if (!__imlib_font_path_exists(path))
         __imlib_font_add_font_path(path);
+    UNLOCK(font_lock);
 }
 
 EAPI void
 imlib_remove_path_from_font_path(const char *path)
 {
     CHECK_PARAM_POINTER("path", path);
+    LOCK(font_lock);
     __imlib_font_del_font_path(path);
+    UNLOCK(font_lock);
 }
 
 EAPI char     **
 imlib_list_font_path(int *number_return)
 {
+    char          **list;
+
     CHECK_PARAM_POINTER_RETURN("number_return", number_return, NULL);
-    return __imlib_font_list_font_path(number_return);
+    LOCK(font_lock);
+    list = __imlib_font_list_font_path(number_return);
+    UNLOCK(font_lock);
+
+    return list;
 }
 
 EAPI int
@@ -310,7 +351,9 @@ imlib_text_get_index_and_location(const char *text, int x, int y,
         return -1;
     }
 
+    LOCK(font_lock);
     cp = __imlib_font_query_text_at_pos(fn, text, xx, yy, &cx, &cy, &cw, &ch);
+    UNLOCK(font_lock);
 
     switch (dir)
     {
@@ -380,7 +423,9 @@ imlib_text_get_location_at_index(const char *text, int index,
     CHECK_PARAM_POINTER("text", text);
     fn = (ImlibFont *) ctx->font;
 
+    LOCK(font_lock);
     __imlib_font_query_char_coords(fn, text, index, &cx, &cy, &cw, &ch);
+    UNLOCK(font_lock);
 
     w = h = 0;
     imlib_get_text_size(text, &w, &h);
@@ -442,8 +487,14 @@ imlib_text_get_location_at_index(const char *text, int index,
 EAPI char     **
 imlib_list_fonts(int *number_return)
 {
+    char          **list;
+
     CHECK_PARAM_POINTER_RETURN("number_return", number_return, NULL);
-    return __imlib_font_list_fonts(number_return);
+    LOCK(font_lock);
+    list = __imlib_font_list_fonts(number_return);
+    UNLOCK(font_lock);
+
+    return list;
 }
 
 EAPI void
@@ -461,39 +512,81 @@ imlib_get_font_cache_size(void)
 EAPI void
 imlib_set_font_cache_size(int bytes)
 {
+    LOCK(font_lock);
     __imlib_font_cache_set(bytes);
+    UNLOCK(font_lock);
 }
 
 EAPI void
 imlib_flush_font_cache(void)
 {
+    LOCK(font_lock);
     __imlib_font_flush();
+    UNLOCK(font_lock);
+}
+
+EAPI int
+imlib_get_text_cache_size(void)
+{
+    return __imlib_font_run_cache_get();
+}
+
+EAPI void
+imlib_set_text_cache_size(int bytes)
+{
+    LOCK(font_lock);
+    __imlib_font_run_cache_set(bytes);
+    UNLOCK(font_lock);
 }
 
 EAPI int
 imlib_get_font_ascent(void)
 {
+    int             val;
+
     CHECK_PARAM_POINTER_RETURN("font", ctx->font, 0);
-    return __imlib_font_ascent_get(ctx->font);
+    LOCK(font_lock);
+    val = __imlib_font_ascent_get(ctx->font);
+    UNLOCK(font_lock);
+
+    return val;
 }
 
 EAPI int
 imlib_get_font_descent(void)
 {
+    int             val;
+
     CHECK_PARAM_POINTER_RETURN("font", ctx->font, 0);
-    return __imlib_font_descent_get(ctx->font);
+    LOCK(font_lock);
+    val = __imlib_font_descent_get(ctx->font);
+    UNLOCK(font_lock);
+
+    return val;
 }
 
 EAPI int
 imlib_get_maximum_font_ascent(void)
 {
+    int             val;
+
     CHECK_PARAM_POINTER_RETURN("font", ctx->font, 0);
-    return __imlib_font_max_ascent_get(ctx->font);
+    LOCK(font_lock);
+    val = __imlib_font_max_ascent_get(ctx->font);
+    UNLOCK(font_lock);
+
+    return val;
 }
 
 EAPI int
 imlib_get_maximum_font_descent(void)
 {
+    int             val;
+
     CHECK_PARAM_POINTER_RETURN("font", ctx->font, 0);
-    return __imlib_font_max_descent_get(ctx->font);
+    LOCK(font_lock);
+    val = __imlib_font_max_descent_get(ctx->font);
+    UNLOCK(font_lock);
+
+    return val;
 }
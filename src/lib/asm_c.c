@@ -3,6 +3,7 @@
 #include <stdlib.h>
 
 #include "asm_c.h"
+#include "lock.h"
 
 #if defined(DO_MMX_ASM) || defined(DO_AMD64_ASM)
 #if DO_MMX_ASM
@@ -11,24 +12,48 @@
 int             __imlib_get_cpuid(void);
 #endif
 
-int
-__imlib_do_asm(void)
+static char     _cpu_can_asm;
+#if DO_AMD64_ASM
+static char     _cpu_simd;
+#endif
+
+static void
+_cpu_check(void)
 {
-    static char     _cpu_can_asm = -1;
+    if (getenv("IMLIB2_ASM_OFF"))
+        return;
 
-    if (_cpu_can_asm < 0)
-    {
-        if (getenv("IMLIB2_ASM_OFF"))
-            _cpu_can_asm = 0;
-        else
 #if DO_MMX_ASM
-            _cpu_can_asm = !!(__imlib_get_cpuid() & CPUID_MMX);
+    _cpu_can_asm = !!(__imlib_get_cpuid() & CPUID_MMX);
 #elif DO_AMD64_ASM
-            _cpu_can_asm = 1;   // instruction set is always present
+    _cpu_can_asm = 1;           // instruction set is always present
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && !getenv("IMLIB2_ASM_NO_AVX2"))
+        _cpu_simd = CPU_SIMD_AVX2;
+    else if (__builtin_cpu_supports("sse4.1"))
+        _cpu_simd = CPU_SIMD_SSE41;
 #endif
-    }
+}
+
+int
+__imlib_do_asm(void)
+{
+    ONCE_STATIC(cpu_once);
+
+    ONCE(cpu_once, _cpu_check);
 
     return _cpu_can_asm;
 }
 
+#if DO_AMD64_ASM
+int
+__imlib_cpu_simd(void)
+{
+    __imlib_do_asm();
+
+    return _cpu_simd;
+}
+#endif
+
 #endif
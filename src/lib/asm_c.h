@@ -5,4 +5,13 @@
 int             __imlib_do_asm(void);
 #endif
 
+#if DO_AMD64_ASM
+/* Best SIMD level supported by the cpu (optional beyond amd64 baseline) */
+#define CPU_SIMD_NONE   0
+#define CPU_SIMD_SSE41  1
+#define CPU_SIMD_AVX2   2
+
+int             __imlib_cpu_simd(void);
+#endif
+
 #endif                          /* ASM_C_H */
@@ -6,7 +6,9 @@
 #include "blend.h"
 #include "colormod.h"
 #include "image.h"
+#include "lock.h"
 #include "scale.h"
+#include "workers.h"
 
 #define ADD_COPY(r, g, b, dest) \
                 ADD_COLOR(R_VAL(dest), r, R_VAL(dest)); \
@@ -25,16 +27,11 @@
 
 uint8_t         pow_lut[256][256];
 
-void
-__imlib_build_pow_lut(void)
+static void
+_build_pow_lut(void)
 {
-    static char     _pow_lut_initialized = 0;
     int             i, j;
 
-    if (_pow_lut_initialized)
-        return;
-    _pow_lut_initialized = 1;
-
     for (i = 0; i < 256; i++)
     {
         for (j = 0; j < 256; j++)
@@ -51,6 +48,14 @@ __imlib_build_pow_lut(void)
     }
 }
 
+void
+__imlib_build_pow_lut(void)
+{
+    ONCE_STATIC(pow_lut_once);
+
+    ONCE(pow_lut_once, _build_pow_lut);
+}
+
 /* COPY OPS */
 
 static void
@@ -1735,6 +1740,11 @@ __imlib_GetBlendFunction(ImlibOp op, char blend, char merge_alpha, char rgb_src,
     do_mmx = __imlib_do_asm();
 #endif
 
+    /* An identity modifier does nothing to RGBA sources, use the faster
+     * non-cmod functions (with RGB sources the results differ a bit) */
+    if (cm && !rgb_src && CMOD_IS_IDENTITY(cm))
+        cm = NULL;
+
     if (cm && rgb_src && (A_CMOD(cm, 0xff) == 0xff))
         blend = 0;
     if (blend && cm && rgb_src && (A_CMOD(cm, 0xff) == 0))
@@ -1801,6 +1811,43 @@ __imlib_BlendRGBAToData(const uint32_t *src, int src_w, int src_h,
 
 #define LINESIZE 16
 
+typedef struct {
+    const ImlibImage *im_src;
+    ImlibImage     *im_dst;
+    ImlibScaleInfo **scaleinfo; /* One per worker */
+    uint32_t       *buf;        /* LINESIZE lines per worker */
+    char            aa, blend, merge_alpha, rgb_src;
+    int             dxx, dyy, dx, dy, dwabs, dhabs;
+    const ImlibColorModifier *cm;
+    ImlibOp         op;
+} ImlibScaleBlendJob;
+
+/* scale and blend one LINESIZE lines band of the destination */
+static void
+__imlib_ScaleBlendBand(void *data, int job, int worker)
+{
+    const ImlibScaleBlendJob *sj = data;
+    uint32_t       *buf;
+    int             y, hh;
+
+    buf = sj->buf + worker * sj->dwabs * LINESIZE;
+    y = job * LINESIZE;
+    hh = sj->dhabs - y;
+    if (hh > LINESIZE)
+        hh = LINESIZE;
+
+    /* scale the imagedata for this LINESIZE lines chunk of image */
+    __imlib_Scale(sj->scaleinfo[worker], sj->aa, sj->im_src->has_alpha,
+                  sj->im_src->data, buf, sj->dxx, sj->dyy + y,
+                  0, 0, sj->dwabs, hh, sj->dwabs, sj->im_src->w);
+
+    __imlib_BlendRGBAToData(buf, sj->dwabs, hh,
+                            sj->im_dst->data, sj->im_dst->w, sj->im_dst->h,
+                            0, 0, sj->dx, sj->dy + y, sj->dwabs, sj->dhabs,
+                            sj->blend, sj->merge_alpha, sj->cm, sj->op,
+                            sj->rgb_src);
+}
+
 void
 __imlib_BlendImageToImage(const ImlibImage *im_src, ImlibImage *im_dst,
                           char aa, char blend, char merge_alpha,
@@ -1850,11 +1897,12 @@ __imlib_BlendImageToImage(const ImlibImage *im_src, ImlibImage *im_dst,
     }
     else
     {
-        ImlibScaleInfo *scaleinfo;
+        ImlibScaleBlendJob sj;
+        ImlibScaleInfo *scaleinfo[WORKERS_MAX];
         uint32_t       *buf;
         int             dwabs, dhabs, dxx, dyy, y2, x2, sw_org, sh_org;
         int             psx, psy, psw, psh;
-        int             y, h, hh;
+        int             i, n_workers;
 
         sw_org = sw;
         sh_org = sh;
@@ -1915,20 +1963,30 @@ __imlib_BlendImageToImage(const ImlibImage *im_src, ImlibImage *im_dst,
         if (sw <= 0 || sh <= 0)
             return;
 
-        scaleinfo = __imlib_CalcScaleInfo(im_src, sw_org, sh_org, dw, dh, aa);
-        if (!scaleinfo)
+        /* bands are spread over the worker threads if there are enough
+         * pixels to make it worthwhile */
+        n_workers = 1;
+        if ((int64_t)dwabs * dhabs >= WORKERS_MIN_PIXELS)
+            n_workers = __imlib_WorkersGet();
+
+        /* the scale info may carry scaler state so each worker gets its own */
+        for (i = 0; i < n_workers; i++)
+        {
+            scaleinfo[i] =
+                __imlib_CalcScaleInfo(im_src, sw_org, sh_org, dw, dh, aa);
+            if (!scaleinfo[i])
+                break;
+        }
+        n_workers = i;
+        if (n_workers <= 0)
             return;
+
         /* if we are scaling the image at all make a scaling buffer */
-        /* allocate a buffer to render scaled RGBA data into */
-        buf = malloc(dwabs * LINESIZE * sizeof(uint32_t));
+        /* allocate a buffer per worker to render scaled RGBA data into */
+        buf = malloc((size_t)n_workers * dwabs * LINESIZE * sizeof(uint32_t));
         if (!buf)
-        {
-            __imlib_FreeScaleInfo(scaleinfo);
-            return;
-        }
+            goto quit;
 
-        /* setup h */
-        h = dhabs;
         if (!im_dst->has_alpha)
             merge_alpha = 0;
         if (!im_src->has_alpha)
@@ -1938,25 +1996,31 @@ __imlib_BlendImageToImage(const ImlibImage *im_src, ImlibImage *im_dst,
                 blend = 1;
         }
 
+        sj.im_src = im_src;
+        sj.im_dst = im_dst;
+        sj.scaleinfo = scaleinfo;
+        sj.buf = buf;
+        sj.aa = aa;
+        sj.blend = blend;
+        sj.merge_alpha = merge_alpha;
+        sj.rgb_src = rgb_src;
+        sj.dxx = dxx;
+        sj.dyy = dyy;
+        sj.dx = dx;
+        sj.dy = dy;
+        sj.dwabs = dwabs;
+        sj.dhabs = dhabs;
+        sj.cm = cm;
+        sj.op = op;
+
         /* scale in LINESIZE Y chunks and convert to depth */
-        for (y = 0; y < dhabs; y += LINESIZE, h -= LINESIZE)
-        {
-            hh = LINESIZE;
-            if (h < LINESIZE)
-                hh = h;
-
-            /* scale the imagedata for this LINESIZE lines chunk of image */
-            __imlib_Scale(scaleinfo, aa, im_src->has_alpha,
-                          im_src->data, buf, dxx, dyy + y,
-                          0, 0, dwabs, hh, dwabs, im_src->w);
-
-            __imlib_BlendRGBAToData(buf, dwabs, hh,
-                                    im_dst->data, im_dst->w, im_dst->h,
-                                    0, 0, dx, dy + y, dwabs, dhabs,
-                                    blend, merge_alpha, cm, op, rgb_src);
-        }
+        __imlib_WorkersRun(__imlib_ScaleBlendBand, &sj,
+                           (dhabs + LINESIZE - 1) / LINESIZE, n_workers);
+
         /* free up our buffers and point tables */
         free(buf);
-        __imlib_FreeScaleInfo(scaleinfo);
+      quit:
+        for (i = 0; i < n_workers; i++)
+            __imlib_FreeScaleInfo(scaleinfo[i]);
     }
 }
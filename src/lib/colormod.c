@@ -4,10 +4,62 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "asm_c.h"
 #include "colormod.h"
 #include "image.h"
+#include "lock.h"
+#include "workers.h"
 
 static uint64_t mod_count = 0;
+LOCK_STATIC(mod_count_lock);
+
+/* Offset o if map[i] == clamp(i + o) for all i, else -1000 */
+static int
+_cmod_map_offset(const uint8_t *map)
+{
+    int             i, o, v;
+
+    o = map[0] > 0 ? map[0] : map[255] - 255;
+    for (i = 0; i < 256; i++)
+    {
+        v = i + o;
+        v = v < 0 ? 0 : v > 255 ? 255 : v;
+        if (map[i] != v)
+            return -1000;
+    }
+
+    return o;
+}
+
+/* Update the derived tables and flags */
+static void
+_cmod_update(ImlibColorModifier *cm)
+{
+    const uint8_t  *maps[4] = {
+        cm->blue_mapping, cm->green_mapping, cm->red_mapping,
+        cm->alpha_mapping,
+    };
+    int             c, i, o, sh;
+
+    cm->identity = cm->offset = cm->add = cm->sub = 0;
+    for (c = 0; c < 4; c++)
+    {
+        sh = 8 * c;
+        for (i = 0; i < 256; i++)
+            cm->tables[c][i] = (uint32_t)maps[c][i] << sh;
+
+        o = _cmod_map_offset(maps[c]);
+        if (o == -1000)
+            continue;
+        if (o == 0)
+            cm->identity |= 0xffu << sh;
+        cm->offset |= 0xffu << sh;
+        if (o > 0)
+            cm->add |= (uint32_t)o << sh;
+        else
+            cm->sub |= (uint32_t)-o << sh;
+    }
+}
 
 ImlibColorModifier *
 __imlib_CreateCmod(void)
@@ -18,7 +70,9 @@ __imlib_CreateCmod(void)
     cm = malloc(sizeof(ImlibColorModifier));
     if (!cm)
         return NULL;
+    LOCK(mod_count_lock);
     cm->modification_count = mod_count;
+    UNLOCK(mod_count_lock);
     for (i = 0; i < 256; i++)
     {
         cm->red_mapping[i] = (uint8_t) i;
@@ -26,6 +80,7 @@ __imlib_CreateCmod(void)
         cm->blue_mapping[i] = (uint8_t) i;
         cm->alpha_mapping[i] = (uint8_t) i;
     }
+    _cmod_update(cm);
     return cm;
 }
 
@@ -38,8 +93,10 @@ __imlib_FreeCmod(ImlibColorModifier *cm)
 void
 __imlib_CmodChanged(ImlibColorModifier *cm)
 {
-    mod_count++;
-    cm->modification_count = mod_count;
+    _cmod_update(cm);
+    LOCK(mod_count_lock);
+    cm->modification_count = ++mod_count;
+    UNLOCK(mod_count_lock);
 }
 
 void
@@ -77,46 +134,126 @@ __imlib_CmodReset(ImlibColorModifier *cm)
     __imlib_CmodChanged(cm);
 }
 
-void
-__imlib_DataCmodApply(uint32_t *data, int w, int h, int jump,
-                      bool has_alpha, ImlibColorModifier *cm)
+/*
+ * Apply color modifier
+ *
+ * Identity mappings are skipped, mappings that just add or subtract a
+ * constant are done with saturating byte arithmetic, and others with
+ * lookups in the pre-shifted 32 bit tables (AVX2 gathers if available).
+ * Bands of rows are spread over workers.
+ */
+typedef struct {
+    uint32_t       *data;
+    int             w, h, jump;
+    int             band;       /* Rows per job */
+    bool            has_alpha;
+    bool            offset;     /* Use add/sub */
+    uint32_t        add, sub;
+    const ImlibColorModifier *cm;
+} ImlibCmodJob;
+
+static void
+_cmod_span(uint32_t *p, int n, const ImlibColorModifier *cm, bool has_alpha)
 {
-    int             x, y;
-    uint32_t       *p;
+    uint32_t        v;
 
-    /* We might be adding alpha */
-    if (!has_alpha)
+#ifdef DO_AMD64_ASM
+    if (__imlib_cpu_simd() == CPU_SIMD_AVX2)
     {
-        p = data;
-        for (y = 0; y < h; y++)
+        __imlib_CmodApplySpan_avx2(p, n, cm, has_alpha);
+        return;
+    }
+#endif
+
+    if (has_alpha)
+    {
+        for (; n > 0; n--, p++)
         {
-            for (x = 0; x < w; x++)
-            {
-                R_VAL(p) = R_CMOD(cm, R_VAL(p));
-                G_VAL(p) = G_CMOD(cm, G_VAL(p));
-                B_VAL(p) = B_CMOD(cm, B_VAL(p));
-                p++;
-            }
-            p += jump;
+            v = *p;
+            *p = cm->tables[0][v & 0xff] | cm->tables[1][(v >> 8) & 0xff] |
+                cm->tables[2][(v >> 16) & 0xff] | cm->tables[3][v >> 24];
         }
-        return;
     }
+    else
+    {
+        /* We might be adding alpha, so leave it alone */
+        for (; n > 0; n--, p++)
+        {
+            v = *p;
+            *p = cm->tables[0][v & 0xff] | cm->tables[1][(v >> 8) & 0xff] |
+                cm->tables[2][(v >> 16) & 0xff] | (v & 0xff000000);
+        }
+    }
+}
+
+static void
+_cmod_band(void *data, int job, int worker)
+{
+    const ImlibCmodJob *cj = data;
+    uint32_t       *p;
+    int             y, y1;
+
+    y = job * cj->band;
+    y1 = y + cj->band;
+    if (y1 > cj->h)
+        y1 = cj->h;
 
-    p = data;
-    for (y = 0; y < h; y++)
+    p = cj->data + y * (cj->w + cj->jump);
+    for (; y < y1; y++, p += cj->w + cj->jump)
     {
-        for (x = 0; x < w; x++)
+#ifdef DO_AMD64_ASM
+        if (cj->offset)
         {
-            R_VAL(p) = R_CMOD(cm, R_VAL(p));
-            G_VAL(p) = G_CMOD(cm, G_VAL(p));
-            B_VAL(p) = B_CMOD(cm, B_VAL(p));
-            A_VAL(p) = A_CMOD(cm, A_VAL(p));
-            p++;
+            __imlib_CmodOffsetSpan_sse2(p, cj->w, cj->add, cj->sub);
+            continue;
         }
-        p += jump;
+#endif
+        _cmod_span(p, cj->w, cj->cm, cj->has_alpha);
     }
 }
 
+void
+__imlib_DataCmodApply(uint32_t *data, int w, int h, int jump,
+                      bool has_alpha, ImlibColorModifier *cm)
+{
+    ImlibCmodJob    cj;
+    uint32_t        mask;
+    int             n_workers, n_jobs;
+
+    if (w <= 0 || h <= 0)
+        return;
+
+    /* Pixel bits to modify */
+    mask = has_alpha ? 0xffffffff : 0x00ffffff;
+    if ((cm->identity & mask) == mask)
+        return;
+
+    cj.data = data;
+    cj.w = w;
+    cj.h = h;
+    cj.jump = jump;
+    cj.has_alpha = has_alpha;
+    cj.cm = cm;
+    cj.offset = false;
+#ifdef DO_AMD64_ASM
+    cj.offset = (cm->offset & mask) == mask &&
+        __imlib_cpu_simd() != CPU_SIMD_NONE;
+#endif
+    cj.add = cm->add & mask;
+    cj.sub = cm->sub & mask;
+
+    n_workers = 1;
+    if ((int64_t)w * h >= WORKERS_MIN_PIXELS)
+        n_workers = __imlib_WorkersGet();
+    n_jobs = n_workers > 1 ? 4 * n_workers : 1;
+    if (n_jobs > h)
+        n_jobs = h;
+    cj.band = (h + n_jobs - 1) / n_jobs;
+    n_jobs = (h + cj.band - 1) / cj.band;
+
+    __imlib_WorkersRun(_cmod_band, &cj, n_jobs, n_workers);
+}
+
 void
 __imlib_CmodGetTables(ImlibColorModifier *cm, uint8_t *r, uint8_t *g,
                       uint8_t *b, uint8_t *a)
@@ -167,6 +304,7 @@ __imlib_CmodModBrightness(ImlibColorModifier *cm, double v)
             val2 = 255;
         cm->alpha_mapping[i] = (uint8_t) val2;
     }
+    __imlib_CmodChanged(cm);
 }
 
 void
@@ -204,6 +342,7 @@ __imlib_CmodModContrast(ImlibColorModifier *cm, double v)
             val2 = 255;
         cm->alpha_mapping[i] = (uint8_t) val2;
     }
+    __imlib_CmodChanged(cm);
 }
 
 void
@@ -243,6 +382,7 @@ __imlib_CmodModGamma(ImlibColorModifier *cm, double v)
             val2 = 255;
         cm->alpha_mapping[i] = (uint8_t) val2;
     }
+    __imlib_CmodChanged(cm);
 }
 
 #if 0
@@ -9,8 +9,17 @@ struct _ImlibColorModifier {
     uint8_t         blue_mapping[256];
     uint8_t         alpha_mapping[256];
     uint64_t        modification_count;
+
+    /* Derived from the mappings when they change */
+    uint32_t        tables[4][256];     /* b, g, r, a mappings in place */
+    uint32_t        identity;   /* Pixel bits mapped to themselves */
+    uint32_t        offset;     /* Pixel bits mapped to clamp(v + offset) */
+    uint32_t        add, sub;   /* The offsets, as unsigned bytes */
 };
 
+/* All four channels are unmodified */
+#define CMOD_IS_IDENTITY(cm) ((cm)->identity == 0xffffffff)
+
 #define CMOD_APPLY_RGB(cm, r, g, b) \
 (r) = (cm)->red_mapping[(int)(r)]; \
 (g) = (cm)->green_mapping[(int)(g)]; \
@@ -55,4 +64,13 @@ void            __imlib_CmodGetTables(ImlibColorModifier * cm, uint8_t * r,
 void            __imlib_CmodModBrightness(ImlibColorModifier * cm, double v);
 void            __imlib_CmodModContrast(ImlibColorModifier * cm, double v);
 void            __imlib_CmodModGamma(ImlibColorModifier * cm, double v);
+
+#ifdef DO_AMD64_ASM
+void            __imlib_CmodApplySpan_avx2(uint32_t * p, int n,
+                                           const ImlibColorModifier * cm,
+                                           bool has_alpha);
+void            __imlib_CmodOffsetSpan_sse2(uint32_t * p, int n,
+                                            uint32_t add, uint32_t sub);
+#endif
+
 #endif
@@ -0,0 +1,81 @@
+#include "common.h"
+
+#include <immintrin.h>
+
+#include "colormod.h"
+
+/*
+ * SIMD color modifier spans.
+ *
+ * The AVX2 version looks up eight pixels per channel with gathers from the
+ * pre-shifted 32 bit tables and ORs the results together.
+ * The SSE2 version is for mappings that only add or subtract a constant
+ * per channel (with clamping), which is saturating byte arithmetic.
+ */
+
+#define TGT_AVX2  __attribute__((target("avx2")))
+
+void            TGT_AVX2
+__imlib_CmodApplySpan_avx2(uint32_t *p, int n, const ImlibColorModifier *cm,
+                           bool has_alpha)
+{
+    const int      *tb = (const int *)cm->tables[0];
+    const int      *tg = (const int *)cm->tables[1];
+    const int      *tr = (const int *)cm->tables[2];
+    const int      *ta = (const int *)cm->tables[3];
+    __m256i         ff, v, r;
+    uint32_t        u;
+
+    ff = _mm256_set1_epi32(0xff);
+
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        v = _mm256_loadu_si256((__m256i *) p);
+        r = _mm256_i32gather_epi32(tb, _mm256_and_si256(v, ff), 4);
+        r = _mm256_or_si256(r, _mm256_i32gather_epi32
+                            (tg, _mm256_and_si256(_mm256_srli_epi32(v, 8), ff),
+                             4));
+        r = _mm256_or_si256(r, _mm256_i32gather_epi32
+                            (tr, _mm256_and_si256(_mm256_srli_epi32(v, 16), ff),
+                             4));
+        if (has_alpha)
+            r = _mm256_or_si256(r, _mm256_i32gather_epi32
+                                (ta, _mm256_srli_epi32(v, 24), 4));
+        else
+            r = _mm256_or_si256(r, _mm256_andnot_si256
+                                (_mm256_srli_epi32(_mm256_set1_epi32(-1), 8),
+                                 v));
+        _mm256_storeu_si256((__m256i *) p, r);
+    }
+
+    for (; n > 0; n--, p++)
+    {
+        u = *p;
+        *p = cm->tables[0][u & 0xff] | cm->tables[1][(u >> 8) & 0xff] |
+            cm->tables[2][(u >> 16) & 0xff] |
+            (has_alpha ? cm->tables[3][u >> 24] : u & 0xff000000);
+    }
+}
+
+void
+__imlib_CmodOffsetSpan_sse2(uint32_t *p, int n, uint32_t add, uint32_t sub)
+{
+    __m128i         va, vs, v;
+
+    va = _mm_set1_epi32(add);
+    vs = _mm_set1_epi32(sub);
+
+    for (; n >= 4; n -= 4, p += 4)
+    {
+        v = _mm_loadu_si128((__m128i *) p);
+        v = _mm_subs_epu8(_mm_adds_epu8(v, va), vs);
+        _mm_storeu_si128((__m128i *) p, v);
+    }
+
+    for (; n > 0; n--, p++)
+    {
+        v = _mm_cvtsi32_si128(*p);
+        v = _mm_subs_epu8(_mm_adds_epu8(v, va), vs);
+        *p = _mm_cvtsi128_si32(v);
+    }
+}
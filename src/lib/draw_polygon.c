@@ -1,12 +1,17 @@
 #include "common.h"
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "blend.h"
 #include "image.h"
 #include "rgbadraw.h"
 #include "span.h"
+#include "workers.h"
 
 ImlibPoly      *
 __imlib_polygon_new(void)
@@ -23,29 +28,26 @@ __imlib_polygon_new(void)
 void
 __imlib_polygon_add_point(ImlibPoly *poly, int x, int y)
 {
-    if (!poly->points)
+    ImlibPoint     *points;
+    int             n;
+
+    if (poly->pointcount >= poly->pointalloc)
     {
-        poly->points = (ImlibPoint *) malloc(sizeof(ImlibPoint));
-        if (!poly->points)
+        n = poly->pointalloc ? 2 * poly->pointalloc : 16;
+        points = realloc(poly->points, n * sizeof(ImlibPoint));
+        if (!points)
             return;
+        poly->points = points;
+        poly->pointalloc = n;
+    }
 
-        poly->pointcount++;
+    if (poly->pointcount == 0)
+    {
         poly->lx = poly->rx = x;
         poly->ty = poly->by = y;
     }
     else
     {
-        poly->pointcount++;
-        poly->points =
-            (ImlibPoint *) realloc(poly->points,
-                                   (poly->pointcount * sizeof(ImlibPoint)));
-
-        if (!poly->points)
-        {
-            poly->pointcount = 0;
-            return;
-        }
-
         if (x < poly->lx)
             poly->lx = x;
         if (poly->rx < x)
@@ -56,8 +58,9 @@ __imlib_polygon_add_point(ImlibPoly *poly, int x, int y)
             poly->by = y;
     }
 
-    poly->points[poly->pointcount - 1].x = x;
-    poly->points[poly->pointcount - 1].y = y;
+    poly->points[poly->pointcount].x = x;
+    poly->points[poly->pointcount].y = y;
+    poly->pointcount++;
 }
 
 void
@@ -1094,13 +1097,18 @@ __imlib_Polygon_DrawToImage(ImlibPoly *poly, char close, uint32_t color,
 
 /** Polygon Filling **/
 
-/* aliased filling */
+/*
+ * Aliased even-odd filling.
+ * This is the original filler, stepping the edges row by row, kept for its
+ * exact output. The scanline filler below sets a few more pixels along
+ * sloped edges.
+ */
 
 static void
-__imlib_Polygon_FillToData(ImlibPoly *poly, uint32_t color,
-                           uint32_t *dst, int dstw,
-                           int clx, int cly, int clw, int clh,
-                           ImlibOp op, char dst_alpha, char blend)
+__imlib_Polygon_FillToData_Aliased(ImlibPoly *poly, uint32_t color,
+                                   uint32_t *dst, int dstw,
+                                   int clx, int cly, int clw, int clh,
+                                   ImlibOp op, char dst_alpha, char blend)
 {
     ImlibShapedSpanDrawFunction sfunc;
     IndexedValue   *ysort;
@@ -1410,393 +1418,601 @@ __imlib_Polygon_FillToData(ImlibPoly *poly, uint32_t color,
     DE_INIT_POLY();
 }
 
-/* anti-aliased filling */
+/*
+ * Scanline filling using an edge table sorted by top row, and a list of
+ * the edges on the current row, kept sorted by x.
+ *
+ * Vertices are at pixel centers.
+ * Aliased filling (non-zero rule only, even-odd uses the filler above) sets
+ * the pixels with their center inside the polygon, and the pixels the
+ * outline passes through.
+ * Anti-aliased filling accumulates the exact area covered by each edge
+ * (signed by edge direction) in a row buffer, the running sum over the
+ * row is then the coverage (as in FreeType's and font-rs' rasterizers).
+ * Where edges cross within a pixel the coverage is approximate.
+ *
+ * Each row is turned into sorted spans: runs of full coverage are drawn
+ * with the span functions, partially covered pixels (next to edges) with
+ * the shaped span functions.
+ * Rows are independent, so large fills are done in bands of rows spread
+ * over workers.
+ */
+
+typedef struct {
+    int             y0, y1;     /* Top and bottom row, y0 <= y1 */
+    int             x0, x1;     /* x at y0 and y1 */
+    int             dir;        /* 1: downwards, -1: upwards, 0: horizontal */
+    int64_t         dxx;        /* x step per row, 16.16 */
+    float           fdx;        /* x step per row */
+} PolyFillEdge;
+
+typedef struct {
+    const PolyFillEdge *e;
+    int64_t         xx;         /* x at current row, 16.16 */
+} PolyFillActive;
+
+typedef struct {
+    int             x0, x1;     /* Pixels, relative to clx */
+} PolyFillSpan;
+
+typedef struct {
+    const PolyFillEdge *edges;  /* Sorted by y0 */
+    int             nedges;
+    ImlibSpanDrawFunction func;
+    ImlibShapedSpanDrawFunction sfunc;
+    uint32_t        color;
+    uint32_t       *dst;
+    int             dstw;
+    int             clx, clw;   /* Columns to fill */
+    int             ty, by;     /* Rows to fill */
+    int             band;       /* Rows per job */
+    bool            anti_alias;
+    bool            non_zero;   /* Non-zero (else even-odd) fill rule */
+    uint8_t        *buf;        /* Row buffers, per worker */
+    size_t          buf_size;
+} PolyFillJob;
+
+/* Row buffers */
+typedef struct {
+    PolyFillActive *act;        /* Active edges */
+    PolyFillSpan   *spans;      /* Two per active edge */
+    float          *acc;        /* Accumulated area, clw + 2 */
+    uint8_t        *cov;        /* Coverage, clw */
+} PolyFillRow;
+
+static int
+_poly_edge_cmp(const void *a, const void *b)
+{
+    const PolyFillEdge *p = a, *q = b;
+
+    return p->y0 - q->y0;
+}
+
+/* x at half row y2 (row * 2 +- 1), 16.16 */
+static inline   int64_t
+_poly_edge_x2(const PolyFillEdge *e, int y2)
+{
+    if (y2 <= 2 * e->y0)
+        return (int64_t)e->x0 << 16;
+    if (y2 >= 2 * e->y1)
+        return (int64_t)e->x1 << 16;
+    return ((int64_t)e->x0 << 16) + (((y2 - 2 * e->y0) * e->dxx) >> 1);
+}
 
+/* Sort active edges on x at row center, the order changes little */
 static void
-__imlib_Polygon_FillToData_AA(ImlibPoly *poly, uint32_t color,
-                              uint32_t *dst, int dstw,
-                              int clx, int cly, int clw, int clh,
-                              ImlibOp op, char dst_alpha, char blend)
+_poly_act_sort(PolyFillActive *act, int nact, int y)
 {
-    ImlibShapedSpanDrawFunction sfunc;
-    IndexedValue   *ysort;
-    PolyEdge       *edge;
-    int             k, a_a = 1;
-    int             nactive_edges, nactive_horz_edges, nvertices;
-    int             clrx, clby, ty, by, y, yy, prev_y, prev_yy;
-    int             x0, x1, nx0, nx1;
-    uint32_t       *p;
-    uint8_t        *s0, *s1, *ps;
+    PolyFillActive  t;
+    int             i, j;
 
-    INIT_POLY();
+    for (i = 0; i < nact; i++)
+        act[i].xx = _poly_edge_x2(act[i].e, 2 * y);
 
-    yy = y << 16;
-    prev_y = y - 1;
-    prev_yy = prev_y << 16;
+    for (i = 1; i < nact; i++)
+    {
+        t = act[i];
+        for (j = i; j > 0 && act[j - 1].xx > t.xx; j--)
+            act[j] = act[j - 1];
+        act[j] = t;
+    }
+}
 
-    while (y <= by)
+/* Add span of pixels x0..x1 (absolute), clipped */
+static inline int
+_poly_span_add(PolyFillSpan *spans, int ns, int clx, int clw, int x0, int x1)
+{
+    x0 -= clx;
+    x1 -= clx;
+    if (x0 < 0)
+        x0 = 0;
+    if (x1 >= clw)
+        x1 = clw - 1;
+    if (x0 > x1)
+        return ns;
+    spans[ns].x0 = x0;
+    spans[ns].x1 = x1;
+    return ns + 1;
+}
+
+/* Sort spans on x0 (nearly sorted) and merge overlapping ones */
+static int
+_poly_span_merge(PolyFillSpan *spans, int ns, int gap)
+{
+    PolyFillSpan    t;
+    int             i, j;
+
+    for (i = 1; i < ns; i++)
     {
-        int             j;
+        t = spans[i];
+        for (j = i; j > 0 && spans[j - 1].x0 > t.x0; j--)
+            spans[j] = spans[j - 1];
+        spans[j] = t;
+    }
 
-        while ((k < nvertices) && (poly->points[ysort[k].index].y <= y))
+    for (i = 0, j = -1; i < ns; i++)
+    {
+        if (j >= 0 && spans[i].x0 <= spans[j].x1 + gap)
         {
-            int             i = ysort[k].index;
+            if (spans[i].x1 > spans[j].x1)
+                spans[j].x1 = spans[i].x1;
+        }
+        else
+        {
+            spans[++j] = spans[i];
+        }
+    }
 
-            if (i > 0)
-                j = i - 1;
-            else
-                j = nvertices - 1;
+    return j + 1;
+}
 
-            if (poly->points[j].y < y)
-                DEL_EDGE(j);
-            else
-                ADD_EDGE(j);
+static void
+_poly_fill_row(const PolyFillJob *pj, PolyFillRow *row, int nact, int y)
+{
+    PolyFillActive *a;
+    PolyFillSpan   *spans;
+    const PolyFillEdge *e;
+    uint32_t       *p;
+    int64_t         xa, xb, xs;
+    int             i, ns, w;
+    bool            in;
 
-            if (i < (nvertices - 1))
-                j = i + 1;
-            else
-                j = 0;
+    _poly_act_sort(row->act, nact, y);
 
-            if (poly->points[j].y < y)
-                DEL_EDGE(i);
-            else
-                ADD_EDGE(i);
+    spans = row->spans;
+    ns = 0;
+    w = 0;
+    xs = 0;
+    for (i = 0, a = row->act; i < nact; i++, a++)
+    {
+        e = a->e;
+
+        /* Outline */
+        xa = _poly_edge_x2(e, 2 * y - 1);
+        xb = _poly_edge_x2(e, 2 * y + 1);
+        if (xa < xb)
+            ns = _poly_span_add(spans, ns, pj->clx, pj->clw,
+                                (xa + 0x8000) >> 16, (xb + 0x8000) >> 16);
+        else
+            ns = _poly_span_add(spans, ns, pj->clx, pj->clw,
+                                (xb + 0x8000) >> 16, (xa + 0x8000) >> 16);
+
+        /* Pixel centers between crossings */
+        if (y >= e->y1)
+            continue;           /* Horizontal or ending here */
+        in = pj->non_zero ? w != 0 : w & 1;
+        w += e->dir;
+        if (in == (pj->non_zero ? w != 0 : w & 1))
+            continue;
+        if (!in)
+            xs = a->xx;
+        else
+            ns = _poly_span_add(spans, ns, pj->clx, pj->clw,
+                                (xs + 0xffff) >> 16, a->xx >> 16);
+    }
 
-            k++;
-        }
+    ns = _poly_span_merge(spans, ns, 1);
 
-        qsort(edge, nactive_edges, sizeof(PolyEdge), poly_edge_sorter);
+    p = pj->dst + y * pj->dstw + pj->clx;
+    for (i = 0; i < ns; i++)
+        pj->func(pj->color, p + spans[i].x0, spans[i].x1 - spans[i].x0 + 1);
+}
 
-        /* clear alpha buffer */
-        if (x0 <= x1)
-            memset(s1 + x0, 0, x1 - x0 + 1);
+/*
+ * Accumulate segment (xa,ya)-(xb,yb) within one row, ya <= yb in [0,1],
+ * x in [0,w].
+ */
+static void
+_poly_acc_line(float *acc, float xa, float xb, float d)
+{
+    float           x0, x1, x0f, x1f, s, a0, a1, a2, am, xmf;
+    int             x0i, x1i, i;
 
-        x0 = nx0;
-        x1 = nx1;
-        nx0 = clrx + 1;
-        nx1 = clx - 1;
-        /* draw to alpha buffer */
-        j = 0;
-        while (j < nactive_edges)
-        {
-            int             lx, rx;
-            int             le_lx, le_rx;
-            int             re_lx, re_rx;
-            PolyEdge       *le, *re;
+    if (xa < xb)
+    {
+        x0 = xa;
+        x1 = xb;
+    }
+    else
+    {
+        x0 = xb;
+        x1 = xa;
+    }
+    x0i = (int)x0;
+    x1i = (int)ceilf(x1);
 
-            if (j < (nactive_edges - 1))
-            {
-                le = edge + j;
-                re = le + 1;
-            }
-            else if (j > 0)
-            {
-                le = edge + (j - 1);
-                le->xx -= le->dxx;
-                re = le + 1;
-            }
-            else
-            {
-                re = le = edge;
-            }
+    if (x1i <= x0i + 1)
+    {
+        xmf = .5f * (xa + xb) - x0i;
+        acc[x0i] += d - d * xmf;
+        acc[x0i + 1] += d * xmf;
+        return;
+    }
 
-            GET_EDGE_RANGE(le, le_lx, le_rx);
-            if ((le_lx < le->v0->x) && (le->dxx > 0))
-                le_lx = le->v0->x;
-            GET_EDGE_RANGE(re, re_lx, re_rx);
-            if ((re_rx > re->v0->x) && (re->dxx < 0))
-                re_rx = re->v0->x;
+    s = 1.f / (x1 - x0);
+    x0f = x0 - x0i;
+    a0 = .5f * s * (1.f - x0f) * (1.f - x0f);
+    x1f = x1 - x1i + 1.f;
+    am = .5f * s * x1f * x1f;
+    acc[x0i] += d * a0;
+    if (x1i == x0i + 2)
+    {
+        acc[x0i + 1] += d * (1.f - a0 - am);
+    }
+    else
+    {
+        a1 = s * (1.5f - x0f);
+        acc[x0i + 1] += d * (a1 - a0);
+        for (i = x0i + 2; i < x1i - 1; i++)
+            acc[i] += d * s;
+        a2 = a1 + (x1i - x0i - 3) * s;
+        acc[x1i - 1] += d * (1.f - a2 - am);
+    }
+    acc[x1i] += d * am;
+}
 
-            /* draw left aa edge */
-            switch (le->type)
-            {
-            case STEEP_EDGE:
-                {
-                    uint32_t        tmp;
-                    uint8_t         aa;
+/*
+ * Accumulate segment clipped to [0,w].
+ * Parts left of the row only add their height at 0, parts right of it
+ * don't affect the row.
+ */
+static void
+_poly_acc_seg(float *acc, int w, float xa, float ya, float xb, float yb,
+              float dir)
+{
+    float           yc;
 
-                    if (le_lx < x0)
-                        x0 = le_lx;
-                    le_rx = le_lx + 1;
+    if ((xa < 0 && xb > 0) || (xa > 0 && xb < 0))
+    {
+        yc = ya + (yb - ya) * (0 - xa) / (xb - xa);
+        _poly_acc_seg(acc, w, xa, ya, 0, yc, dir);
+        _poly_acc_seg(acc, w, 0, yc, xb, yb, dir);
+        return;
+    }
+    if ((xa < w && xb > w) || (xa > w && xb < w))
+    {
+        yc = ya + (yb - ya) * (w - xa) / (xb - xa);
+        _poly_acc_seg(acc, w, xa, ya, w, yc, dir);
+        _poly_acc_seg(acc, w, w, yc, xb, yb, dir);
+        return;
+    }
+    if (xa > w || xb > w)
+        return;
+    if (xa < 0 || xb < 0)
+        xa = xb = 0;
 
-                    if (IN_SEGMENT(le_lx, clx, clw))
-                    {
-                        aa = 255 - ((le->xx - (le_lx << 16)) >> 8);
-                        ps = s0 + le_lx;
-                        BLEND_ALPHA(ps, aa, tmp);
-                    }
+    _poly_acc_line(acc, xa, xb, (yb - ya) * dir);
+}
 
-                    if ((le->v1->y == (y + 1)) && (y < clby))
-                    {
-                        lx = (le->xx + le->dxx) >> 16;
-                        if (IN_SEGMENT(lx, clx, clw))
-                        {
-                            aa = 255 - ((le->xx + le->dxx - (lx << 16)) >> 8);
-                            ps = s1 + lx;
-                            BLEND_ALPHA(ps, aa, tmp);
-                            if (lx < nx0)
-                                nx0 = lx;
-                        }
-                    }
-                    break;
-                }
-            case SHALLOW_EDGE:
-                {
-                    int             x, ey, eyy;
+static inline   uint8_t
+_poly_cov_val(float s, bool non_zero)
+{
+    float           v;
 
-                    if (le_lx < x0)
-                        x0 = le_lx;
-                    x = le_lx;
-                    eyy = ((le->v0->y) << 16) + (x - (le->v0->x)) * (le->dyy);
-                    ey = eyy >> 16;
+    v = fabsf(s);
+    if (non_zero)
+    {
+        if (v > 1.f)
+            v = 1.f;
+    }
+    else
+    {
+        v -= 2.f * (int)(v * .5f);
+        if (v > 1.f)
+            v = 2.f - v;
+    }
 
-                    if (le->dyy > 0)
-                    {
-                        while (ey < y)
-                        {
-                            uint32_t        tmp;
-                            uint8_t         aa;
+    return (uint8_t)(v * 255.f + .5f);
+}
 
-                            if ((ey == prev_y) && IN_SEGMENT(x, clx, clw))
-                            {
-                                aa = ((eyy - prev_yy) >> 8);
-                                ps = s0 + x;
-                                BLEND_ALPHA(ps, aa, tmp);
-                            }
-                            eyy += le->dyy;
-                            ey = eyy >> 16;
-                            x++;
-                        }
-                        le_rx = x;
+/* Running sum of acc, from s, to coverage, clearing acc. Returns the sum. */
+static float
+_poly_acc_cov(float *acc, uint8_t *cov, int n, float s, bool non_zero)
+{
+    int             i;
 
-                        if (((y + 1) == le->v1->y) && (y < clby))
-                        {
-                            if (x < nx0)
-                                nx0 = x;
-                            rx = le->v1->x;
-                            while ((ey == y) && (x <= rx))
-                            {
-                                uint32_t        tmp;
-                                uint8_t         aa;
+    i = 0;
 
-                                if (IN_SEGMENT(x, clx, clw))
-                                {
-                                    aa = ((eyy - yy) >> 8);
-                                    ps = s1 + x;
-                                    BLEND_ALPHA(ps, aa, tmp);
-                                }
-                                eyy += le->dyy;
-                                ey = eyy >> 16;
-                                x++;
-                            }
-                        }
-                        break;
-                    }
+#ifdef __SSE2__
+    __m128          vs, v, vt, one, two, half, k255, mabs;
+    __m128i         vi;
+    uint32_t        c4;
 
-                    while (ey >= y)
-                    {
-                        uint32_t        tmp;
-                        uint8_t         aa;
+    vs = _mm_set1_ps(s);
+    one = _mm_set1_ps(1.f);
+    two = _mm_set1_ps(2.f);
+    half = _mm_set1_ps(.5f);
+    k255 = _mm_set1_ps(255.f);
+    mabs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
 
-                        if ((ey == y) && IN_SEGMENT(x, clx, clw))
-                        {
-                            aa = 255 - ((eyy - yy) >> 8);
-                            ps = s0 + x;
-                            BLEND_ALPHA(ps, aa, tmp);
-                        }
-                        eyy += le->dyy;
-                        ey = eyy >> 16;
-                        x++;
-                    }
-                    le_rx = x;
-                    break;
-                }
-            case HORZ_EDGE:
-                {
-                    lx = le_lx;
-                    rx = le_rx;
-                    CLIP_SPAN(lx, rx, clx, clrx);
-                    if (lx <= rx)
-                    {
-                        memset(s0 + lx, 255, rx - lx + 1);
-                        if (lx < x0)
-                            x0 = lx;
-                    }
-                    le_rx++;
-                    break;
-                }
+    for (; i + 4 <= n; i += 4)
+    {
+        v = _mm_loadu_ps(acc + i);
+        _mm_storeu_ps(acc + i, _mm_setzero_ps());
+
+        /* Prefix sum */
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128
+                                           (_mm_castps_si128(v), 4)));
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128
+                                           (_mm_castps_si128(v), 8)));
+        v = _mm_add_ps(v, vs);
+        vs = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+
+        v = _mm_and_ps(v, mabs);
+        if (non_zero)
+        {
+            v = _mm_min_ps(v, one);
+        }
+        else
+        {
+            vt = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(v, half)));
+            v = _mm_sub_ps(v, _mm_add_ps(vt, vt));
+            v = _mm_min_ps(v, _mm_sub_ps(two, v));
+        }
 
-            default:
-                break;
-            }
+        vi = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, k255), half));
+        vi = _mm_packs_epi32(vi, vi);
+        vi = _mm_packus_epi16(vi, vi);
+        c4 = _mm_cvtsi128_si32(vi);
+        memcpy(cov + i, &c4, 4);
+    }
+    s = _mm_cvtss_f32(vs);
+#endif
 
-            /* draw right aa edge */
-            switch (re->type)
-            {
-            case STEEP_EDGE:
-                {
-                    uint32_t        tmp;
-                    uint8_t         aa;
+    for (; i < n; i++)
+    {
+        s += acc[i];
+        acc[i] = 0;
+        cov[i] = _poly_cov_val(s, non_zero);
+    }
 
-                    rx = re_lx + 1;
-                    if (rx > x1)
-                        x1 = rx;
+    return s;
+}
 
-                    if (IN_SEGMENT(rx, clx, clw))
-                    {
-                        aa = (re->xx - (re_lx << 16)) >> 8;
-                        ps = s0 + rx;
-                        BLEND_ALPHA(ps, aa, tmp);
-                    }
+/* n pixels with the coverage of sum s */
+static void
+_poly_fill_run(const PolyFillJob *pj, uint32_t *p, uint8_t *cov, int n,
+               float s)
+{
+    uint8_t         c;
 
-                    if ((re->v1->y == (y + 1)) && (y < clby))
-                    {
-                        lx = (re->xx + re->dxx) >> 16;
-                        rx = lx + 1;
-                        if (IN_SEGMENT(rx, clx, clw))
-                        {
-                            aa = ((re->xx + re->dxx - (lx << 16)) >> 8);
-                            ps = s1 + rx;
-                            BLEND_ALPHA(ps, aa, tmp);
-                            if (rx > nx1)
-                                nx1 = rx;
-                        }
-                    }
-                    break;
-                }
-            case SHALLOW_EDGE:
-                {
-                    int             x, ey, eyy;
+    if (n <= 0)
+        return;
+    c = _poly_cov_val(s, pj->non_zero);
+    if (c == 0)
+        return;
+    if (c == 255)
+    {
+        pj->func(pj->color, p, n);
+        return;
+    }
+    memset(cov, c, n);
+    pj->sfunc(cov, pj->color, p, n);
+}
 
-                    if (re_rx > x1)
-                        x1 = re_rx;
-                    x = re_rx;
-                    eyy = ((re->v0->y) << 16) + (x - (re->v0->x)) * (re->dyy);
-                    ey = eyy >> 16;
+static void
+_poly_fill_row_aa(const PolyFillJob *pj, PolyFillRow *row, int nact, int y)
+{
+    PolyFillActive *a;
+    PolyFillSpan   *spans;
+    const PolyFillEdge *e;
+    uint32_t       *p;
+    uint8_t        *cov;
+    float          *acc, ya, yb, xa, xb, u0, s;
+    int             i, n, ns, w, x;
 
-                    if (re->dyy > 0)
-                    {
-                        while (ey >= y)
-                        {
-                            uint32_t        tmp;
-                            uint8_t         aa;
+    _poly_act_sort(row->act, nact, y);
 
-                            if ((ey == y) && IN_SEGMENT(x, clx, clw))
-                            {
-                                aa = 255 - ((eyy - yy) >> 8);
-                                ps = s0 + x;
-                                BLEND_ALPHA(ps, aa, tmp);
-                            }
-                            eyy -= re->dyy;
-                            ey = eyy >> 16;
-                            x--;
-                        }
-                        re_lx = x;
-                        break;
-                    }
+    w = pj->clw;
+    acc = row->acc;
+    cov = row->cov;
+    spans = row->spans;
 
-                    while (ey < y)
-                    {
-                        uint32_t        tmp;
-                        uint8_t         aa;
+    /* Pixel x covers [x - .5, x + .5] */
+    u0 = pj->clx - .5f;
 
-                        if ((ey == prev_y) && IN_SEGMENT(x, clx, clw))
-                        {
-                            aa = ((eyy - prev_yy) >> 8);
-                            ps = s0 + x;
-                            BLEND_ALPHA(ps, aa, tmp);
-                        }
-                        eyy -= re->dyy;
-                        ey = eyy >> 16;
-                        x--;
-                    }
-                    re_lx = x;
+    ns = 0;
+    for (i = 0, a = row->act; i < nact; i++, a++)
+    {
+        e = a->e;
+        if (e->dir == 0)
+            continue;
 
-                    if (((y + 1) == re->v1->y) && (y < clby))
-                    {
-                        if (x > nx1)
-                            nx1 = x;
-                        lx = re->v1->x;
-                        while ((ey == y) && (x >= lx))
-                        {
-                            uint32_t        tmp;
-                            uint8_t         aa;
+        /* Part of edge within the row, y relative to row top */
+        ya = e->y0 == y ? .5f : 0.f;
+        yb = e->y1 == y ? .5f : 1.f;
+        xa = e->x0 + (y - .5f + ya - e->y0) * e->fdx - u0;
+        xb = e->x0 + (y - .5f + yb - e->y0) * e->fdx - u0;
 
-                            if (IN_SEGMENT(x, clx, clw))
-                            {
-                                aa = ((eyy - yy) >> 8);
-                                ps = s1 + x;
-                                BLEND_ALPHA(ps, aa, tmp);
-                            }
-                            eyy -= re->dyy;
-                            ey = eyy >> 16;
-                            x--;
-                        }
-                    }
-                    break;
-                }
-            case HORZ_EDGE:
-                {
-                    lx = re_lx;
-                    rx = re_rx;
-                    CLIP_SPAN(lx, rx, clx, clrx);
-                    if (lx <= rx)
-                    {
-                        memset(s0 + lx, 255, rx - lx + 1);
-                        if (rx > x1)
-                            x1 = rx;
-                    }
-                    re_lx--;
-                    break;
-                }
+        _poly_acc_seg(acc, w, xa, ya, xb, yb, e->dir);
 
-            default:
-                break;
-            }
+        /* Pixels touched */
+        if (xa > xb)
+        {
+            ya = xa;
+            xa = xb;
+            xb = ya;
+        }
+        if (xa >= w)
+            continue;
+        spans[ns].x0 = xa <= 0 ? 0 : (int)xa;
+        spans[ns].x1 = xb <= 0 ? 0 : xb >= w - 1 ? w - 1 : (int)ceilf(xb);
+        ns++;
+    }
 
-            /* draw span between edges */
-            lx = le_rx;
-            rx = re_lx;
-            CLIP_SPAN(lx, rx, clx, clrx);
-            if ((lx <= rx) && (y >= cly))
-                memset(s0 + lx, 255, rx - lx + 1);
+    ns = _poly_span_merge(spans, ns, 0);
 
-            le->xx += le->dxx;
-            if (le != re)
-                re->xx += re->dxx;
+    /* Constant coverage between the touched pixels */
+    p = pj->dst + y * pj->dstw + pj->clx;
+    s = 0;
+    x = 0;
+    for (i = 0; i < ns; i++)
+    {
+        _poly_fill_run(pj, p + x, cov + x, spans[i].x0 - x, s);
+        x = spans[i].x0;
+        n = spans[i].x1 - x + 1;
+        s = _poly_acc_cov(acc + x, cov + x, n, s, pj->non_zero);
+        pj->sfunc(cov + x, pj->color, p + x, n);
+        x += n;
+    }
+    _poly_fill_run(pj, p + x, cov + x, w - x, s);
 
-            j += 2;
-        }
+    acc[w] = acc[w + 1] = 0;
+}
 
-        if (nactive_horz_edges > 0)
-            DEL_HORZ_EDGES();
+static void
+_poly_fill_band(void *data, int job, int worker)
+{
+    const PolyFillJob *pj = data;
+    PolyFillRow     row;
+    uint8_t        *buf;
+    int             y, y1, k, i, j, nact;
+
+    y = pj->ty + job * pj->band;
+    y1 = y + pj->band - 1;
+    if (y1 > pj->by)
+        y1 = pj->by;
+
+    buf = pj->buf + worker * pj->buf_size;
+    row.act = (PolyFillActive *) buf;
+    row.spans = (PolyFillSpan *) (row.act + pj->nedges);
+    row.acc = (float *)(row.spans + 2 * pj->nedges);
+    row.cov = (uint8_t *)(row.acc + pj->clw + 2);
+
+    nact = 0;
+    k = 0;
+    for (; y <= y1; y++)
+    {
+        /* Add edges starting on this row, drop edges ending above */
+        for (; k < pj->nedges && pj->edges[k].y0 <= y; k++)
+            row.act[nact++].e = &pj->edges[k];
+        for (i = j = 0; i < nact; i++)
+        {
+            if (row.act[i].e->y1 >= y)
+                row.act[j++] = row.act[i];
+        }
+        nact = j;
 
-        /* draw alpha buffer to dst */
-        CLIP_SPAN(x0, x1, clx, clrx);
-        if ((x0 <= x1) && (y >= cly))
-            sfunc(s0 + x0, color, p + x0, x1 - x0 + 1);
+        if (pj->anti_alias)
+            _poly_fill_row_aa(pj, &row, nact, y);
+        else
+            _poly_fill_row(pj, &row, nact, y);
+    }
+}
 
-        /* exchange alpha buffers */
-        ps = s0;
-        s0 = s1;
-        s1 = ps;
+static void
+__imlib_Polygon_FillToData(ImlibPoly *poly, uint32_t color,
+                           uint32_t *dst, int dstw,
+                           int clx, int cly, int clw, int clh,
+                           ImlibOp op, char dst_alpha, char blend,
+                           char anti_alias, char non_zero)
+{
+    PolyFillJob     pj;
+    PolyFillEdge   *edges, *e;
+    const ImlibPoint *v0, *v1;
+    int             i, n, clrx, clby, n_workers, n_jobs;
+
+    pj.func = __imlib_GetSpanDrawFunction(op, dst_alpha, blend);
+    pj.sfunc = __imlib_GetShapedSpanDrawFunction(op, dst_alpha, blend);
+    if (!pj.func || !pj.sfunc)
+        return;
 
-        prev_yy = yy;
-        prev_y = y;
+    clrx = clx + clw - 1;
+    clby = cly + clh - 1;
+    CLIP_SPAN(clx, clrx, poly->lx, poly->rx);
+    if (clrx < clx)
+        return;
+    CLIP_SPAN(cly, clby, poly->ty, poly->by);
+    if (clby < cly)
+        return;
 
-        y++;
-        yy = y << 16;
+    n = poly->pointcount;
+    edges = malloc(n * sizeof(PolyFillEdge));
+    if (!edges)
+        return;
 
-        p += dstw;
+    for (i = 0; i < n; i++)
+    {
+        v0 = &poly->points[i];
+        v1 = &poly->points[i + 1 < n ? i + 1 : 0];
+        e = &edges[i];
+        e->dir = v0->y < v1->y ? 1 : v0->y > v1->y ? -1 : 0;
+        if (e->dir < 0)
+        {
+            v0 = v1;
+            v1 = &poly->points[i];
+        }
+        e->x0 = v0->x;
+        e->y0 = v0->y;
+        e->x1 = v1->x;
+        e->y1 = v1->y;
+        e->dxx = e->dir ? ((int64_t)(e->x1 - e->x0) << 16) /
+            (e->y1 - e->y0) : 0;
+        e->fdx = e->dir ? (float)(e->x1 - e->x0) / (e->y1 - e->y0) : 0;
     }
-
-    DE_INIT_POLY();
+    qsort(edges, n, sizeof(PolyFillEdge), _poly_edge_cmp);
+
+    pj.edges = edges;
+    pj.nedges = n;
+    pj.color = color;
+    pj.dst = dst;
+    pj.dstw = dstw;
+    pj.clx = clx;
+    pj.clw = clrx - clx + 1;
+    pj.ty = cly;
+    pj.by = clby;
+    pj.anti_alias = anti_alias;
+    pj.non_zero = non_zero;
+
+    clh = clby - cly + 1;
+    n_workers = 1;
+    if ((int64_t)pj.clw * clh >= WORKERS_MIN_PIXELS)
+        n_workers = __imlib_WorkersGet();
+    n_jobs = n_workers > 1 ? 4 * n_workers : 1;
+    if (n_jobs > clh)
+        n_jobs = clh;
+    pj.band = (clh + n_jobs - 1) / n_jobs;
+    n_jobs = (clh + pj.band - 1) / pj.band;
+    if (n_workers > n_jobs)
+        n_workers = n_jobs;
+
+    /* Row buffers, see _poly_fill_band() */
+    pj.buf_size = n * (sizeof(PolyFillActive) + 2 * sizeof(PolyFillSpan)) +
+        (pj.clw + 2) * sizeof(float) + pj.clw;
+    pj.buf_size = (pj.buf_size + 63) & ~(size_t)63;
+    pj.buf = calloc(n_workers, pj.buf_size);
+    if (pj.buf)
+        __imlib_WorkersRun(_poly_fill_band, &pj, n_jobs, n_workers);
+
+    free(pj.buf);
+    free(edges);
 }
 
 void
 __imlib_Polygon_FillToImage(ImlibPoly *poly, uint32_t color,
                             ImlibImage *im, int clx, int cly, int clw, int clh,
-                            ImlibOp op, char blend, char anti_alias)
+                            ImlibOp op, char blend, char anti_alias,
+                            char non_zero)
 {
     if ((!poly) || (!poly->points) || (poly->pointcount < 1) || (clw < 0))
         return;
@@ -1834,14 +2050,13 @@ __imlib_Polygon_FillToImage(ImlibPoly *poly, uint32_t color,
     if (blend && im->has_alpha)
         __imlib_build_pow_lut();
 
-    if (anti_alias)
-        __imlib_Polygon_FillToData_AA(poly, color,
-                                      im->data, im->w,
-                                      clx, cly, clw, clh,
-                                      op, im->has_alpha, blend);
+    if (!anti_alias && !non_zero)
+        __imlib_Polygon_FillToData_Aliased(poly, color,
+                                           im->data, im->w,
+                                           clx, cly, clw, clh,
+                                           op, im->has_alpha, blend);
     else
-        __imlib_Polygon_FillToData(poly, color,
-                                   im->data, im->w,
+        __imlib_Polygon_FillToData(poly, color, im->data, im->w,
                                    clx, cly, clw, clh, op, im->has_alpha,
-                                   blend);
+                                   blend, anti_alias, non_zero);
 }
@@ -1,9 +1,11 @@
 #include "common.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "filter.h"
 #include "image.h"
+#include "workers.h"
 
 /*\ Create and return an empty filter struct \*/
 ImlibFilter    *
@@ -78,10 +80,8 @@ __imlib_FilterSetColor(ImlibFilterColor *fil, int x, int y,
     {
         if (i >= 0)
         {
-            while (i < fil->entries)
-            {
+            for (; i < fil->entries - 1; i++)
                 pix[i] = pix[i + 1];
-            }
             fil->entries--;
         }
         return;
@@ -145,95 +145,518 @@ __imlib_FilterCalcDiv(ImlibFilterColor *fil)
     return ret;
 }
 
-static int
-__imlib_FilterGet(ImlibFilterColor *fil, uint32_t *data,
-                  int w, int h, int x, int y)
+/*\ Correct saturation from [-32768, 32767] to [0, 255] \*/
+#define SATURATE(x) ((((x) | (!((x) >> 8) - 1)) & (~((x) >> 31))) & 0xff)
+
+/*
+ * Compiled filter
+ *
+ * The taps of the four channel filters are merged, so every source pixel
+ * is fetched once per tap for all channels.
+ * Channels are indexed by pixel bit position / 8 (b, g, r, a).
+ */
+typedef struct {
+    int             xoff, yoff;
+    int             w[4][4];    /* Weights [output channel][input channel] */
+} ImlibFilterTap;
+
+typedef struct {
+    const uint32_t *src;
+    uint32_t       *dst;
+    int             w, h;
+    int             band;       /* Rows per job */
+    int             cons[4], div[4];
+    unsigned int    keep_mask;  /* Bits copied from source */
+    /* General */
+    int             ntaps;
+    ImlibFilterTap *taps;
+    int            *offs;       /* Linear source offsets of taps */
+    int             x0, x1, y0, y1;     /* Tap offset bounding box */
+    /* Separable (all active channels k(x, y) = u(y) * v(x)) */
+    int            *u, *v;
+    char            u_const, v_const;
+    int            *rowbuf;     /* Per worker row buffers */
+    int             rowbuf_size;
+} ImlibFilterJob;
+
+static const int ch_shift[4] = { 0, 8, 16, 24 };
+
+static              ImlibFilterColor *
+_filter_color(ImlibFilter *fil, int ch)
 {
-    int             i, off, ret;
-    ImlibFilterPixel *pix;
-    uint32_t       *p;
+    switch (ch)
+    {
+    default:
+    case 0:
+        return &fil->blue;
+    case 1:
+        return &fil->green;
+    case 2:
+        return &fil->red;
+    case 3:
+        return &fil->alpha;
+    }
+}
 
-    ret = fil->cons;
-    pix = fil->pixels;
-    for (i = fil->entries; --i >= 0;)
+static inline uint32_t
+_filter_pixel(const ImlibFilterJob *fj, const int *acc, uint32_t pix)
+{
+    int             ch, v;
+
+    pix &= fj->keep_mask;
+    for (ch = 0; ch < 4; ch++)
     {
-        off = x + pix->xoff;
-        if (off < 0)
-            off = 0;
-        if (off >= w)
-            off = w - 1;
-        p = data + off;
-        off = y + pix->yoff;
-        if (off < 0)
-            off = 0;
-        if (off >= h)
-            off = h - 1;
-        p += off * w;
-        ret += A_VAL(p) * pix->a + R_VAL(p) * pix->r +
-            G_VAL(p) * pix->g + B_VAL(p) * pix->b;
-        pix++;
+        if (fj->div[ch] == 0)
+            continue;
+        v = acc[ch] / fj->div[ch];
+        pix |= (uint32_t)SATURATE(v) << ch_shift[ch];
     }
-    return ret;
+
+    return pix;
 }
 
-/*\ Correct saturation from [-32768, 32767] to [0, 255] \*/
-#define SATURATE(x) ((((x) | (!((x) >> 8) - 1)) & (~((x) >> 31))) & 0xff)
+/* General filter, one band of rows */
+static void
+_filter_band(void *data, int job, int worker)
+{
+    const ImlibFilterJob *fj = data;
+    const ImlibFilterTap *tap;
+    const uint32_t *src, *p;
+    uint32_t       *dst, pix;
+    int             w, h, x, y, y1, i, oc, xx, yy, xi0, xi1;
+    int             acc[4], in[4];
 
-/*\ Filter an image with the a, r, g, b filters in fil
-|*|  NB: This is currently not very optimal, and could probably be improved
-\*/
-void
-__imlib_FilterImage(ImlibImage *im, ImlibFilter *fil)
+    src = fj->src;
+    w = fj->w;
+    h = fj->h;
+
+    /* Interior, no clamping needed */
+    xi0 = fj->x0 < 0 ? -fj->x0 : 0;
+    xi1 = fj->x1 > 0 ? w - fj->x1 : w;
+
+    y = job * fj->band;
+    y1 = y + fj->band;
+    if (y1 > h)
+        y1 = h;
+
+    for (; y < y1; y++)
+    {
+        dst = fj->dst + (size_t)y * w;
+
+        for (x = 0; x < w; x++)
+        {
+            if (x == xi0 && x < xi1 && y + fj->y0 >= 0 && y + fj->y1 < h)
+            {
+                /* Clamp free */
+                for (; x < xi1; x++)
+                {
+                    p = src + (size_t)y * w + x;
+                    for (oc = 0; oc < 4; oc++)
+                        acc[oc] = fj->cons[oc];
+                    for (i = 0, tap = fj->taps; i < fj->ntaps; i++, tap++)
+                    {
+                        pix = p[fj->offs[i]];
+                        in[0] = pix & 0xff;
+                        in[1] = (pix >> 8) & 0xff;
+                        in[2] = (pix >> 16) & 0xff;
+                        in[3] = pix >> 24;
+                        for (oc = 0; oc < 4; oc++)
+                            acc[oc] += in[0] * tap->w[oc][0] +
+                                in[1] * tap->w[oc][1] +
+                                in[2] * tap->w[oc][2] + in[3] * tap->w[oc][3];
+                    }
+                    dst[x] = _filter_pixel(fj, acc, p[0]);
+                }
+                if (x >= w)
+                    break;
+            }
+
+            for (oc = 0; oc < 4; oc++)
+                acc[oc] = fj->cons[oc];
+            for (i = 0, tap = fj->taps; i < fj->ntaps; i++, tap++)
+            {
+                xx = x + tap->xoff;
+                xx = xx < 0 ? 0 : xx >= w ? w - 1 : xx;
+                yy = y + tap->yoff;
+                yy = yy < 0 ? 0 : yy >= h ? h - 1 : yy;
+                pix = src[(size_t)yy * w + xx];
+                in[0] = pix & 0xff;
+                in[1] = (pix >> 8) & 0xff;
+                in[2] = (pix >> 16) & 0xff;
+                in[3] = pix >> 24;
+                for (oc = 0; oc < 4; oc++)
+                    acc[oc] += in[0] * tap->w[oc][0] +
+                        in[1] * tap->w[oc][1] +
+                        in[2] * tap->w[oc][2] + in[3] * tap->w[oc][3];
+            }
+            dst[x] = _filter_pixel(fj, acc, src[(size_t)y * w + x]);
+        }
+    }
+}
+
+/* Add k * row to 4 channel sums */
+static void
+_filter_row_add(int *sums, const uint32_t *row, int w, int k)
 {
-    int             x, y, a, r, g, b, ad, rd, gd, bd;
-    uint32_t       *data, *p1, *p2;
+    int             x;
 
-    data = malloc(im->w * im->h * sizeof(uint32_t));
-    if (!data)
-        return;
+    for (x = 0; x < w; x++, sums += 4)
+    {
+        sums[0] += k * (int)(row[x] & 0xff);
+        sums[1] += k * (int)((row[x] >> 8) & 0xff);
+        sums[2] += k * (int)((row[x] >> 16) & 0xff);
+        sums[3] += k * (int)(row[x] >> 24);
+    }
+}
+
+/* Separable filter, one band of rows */
+static void
+_filter_band_sep(void *data, int job, int worker)
+{
+    const ImlibFilterJob *fj = data;
+    const uint32_t *src;
+    uint32_t       *dst;
+    int            *tmp, *cols, *t;
+    int             w, h, kw, kh, pad, x, y, y1, j, yy, ch;
+    int             acc[4];
 
-    ad = __imlib_FilterCalcDiv(&fil->alpha);
-    rd = __imlib_FilterCalcDiv(&fil->red);
-    gd = __imlib_FilterCalcDiv(&fil->green);
-    bd = __imlib_FilterCalcDiv(&fil->blue);
+    src = fj->src;
+    w = fj->w;
+    h = fj->h;
+    kw = fj->x1 - fj->x0 + 1;
+    kh = fj->y1 - fj->y0 + 1;
+    pad = kw;
 
-    p1 = im->data;
-    p2 = data;
+    /* Row buffer, padded by kw pixels on both sides, and column sums */
+    tmp = fj->rowbuf + (size_t)worker * fj->rowbuf_size;
+    cols = tmp + (size_t)(w + 2 * pad) * 4;
 
-    for (y = 0; y < im->h; y++)
+    y = job * fj->band;
+    y1 = y + fj->band;
+    if (y1 > h)
+        y1 = h;
+
+    if (fj->u_const)
     {
-        for (x = 0; x < im->w; x++)
+        memset(cols, 0, (size_t)w * 4 * sizeof(int));
+        for (j = 0; j < kh; j++)
         {
-            *p2 = *p1;
-            if (ad)
+            yy = y + fj->y0 + j;
+            yy = yy < 0 ? 0 : yy >= h ? h - 1 : yy;
+            _filter_row_add(cols, src + (size_t)yy * w, w, 1);
+        }
+    }
+
+    for (; y < y1; y++)
+    {
+        /* Vertical pass into tmp[pad .. pad + w - 1] */
+        t = tmp + pad * 4;
+        if (fj->u_const)
+        {
+            if (y > job * fj->band)
+            {
+                yy = y + fj->y1;
+                yy = yy >= h ? h - 1 : yy;
+                _filter_row_add(cols, src + (size_t)yy * w, w, 1);
+                yy = y + fj->y0 - 1;
+                yy = yy < 0 ? 0 : yy;
+                _filter_row_add(cols, src + (size_t)yy * w, w, -1);
+            }
+            for (x = 0; x < 4 * w; x++)
+                t[x] = fj->u[0] * cols[x];
+        }
+        else
+        {
+            memset(t, 0, (size_t)w * 4 * sizeof(int));
+            for (j = 0; j < kh; j++)
+            {
+                if (fj->u[j] == 0)
+                    continue;
+                yy = y + fj->y0 + j;
+                yy = yy < 0 ? 0 : yy >= h ? h - 1 : yy;
+                _filter_row_add(t, src + (size_t)yy * w, w, fj->u[j]);
+            }
+        }
+
+        /* Replicate edges into the padding */
+        for (x = 0; x < pad; x++)
+        {
+            memcpy(tmp + 4 * x, t, 4 * sizeof(int));
+            memcpy(t + 4 * (w + x), t + 4 * (w - 1), 4 * sizeof(int));
+        }
+
+        /* Horizontal pass, t[x + xoff] is valid for all taps */
+        dst = fj->dst + (size_t)y * w;
+        if (fj->v_const)
+        {
+            for (ch = 0; ch < 4; ch++)
+                acc[ch] = 0;
+            for (j = fj->x0; j <= fj->x1; j++)
+                for (ch = 0; ch < 4; ch++)
+                    acc[ch] += t[4 * j + ch];
+            for (x = 0; x < w; x++)
             {
-                a = __imlib_FilterGet(&fil->alpha, im->data, im->w, im->h, x,
-                                      y);
-                a /= ad;
-                A_VAL(p2) = SATURATE(a);
+                int             out[4];
+
+                for (ch = 0; ch < 4; ch++)
+                {
+                    out[ch] = fj->cons[ch] + fj->v[0] * acc[ch];
+                    acc[ch] += t[4 * (x + fj->x1 + 1) + ch] -
+                        t[4 * (x + fj->x0) + ch];
+                }
+                dst[x] = _filter_pixel(fj, out, src[(size_t)y * w + x]);
             }
-            if (rd)
+        }
+        else
+        {
+            for (x = 0; x < w; x++)
             {
-                r = __imlib_FilterGet(&fil->red, im->data, im->w, im->h, x, y);
-                r /= rd;
-                R_VAL(p2) = SATURATE(r);
+                for (ch = 0; ch < 4; ch++)
+                    acc[ch] = fj->cons[ch];
+                for (j = 0; j < kw; j++)
+                {
+                    const int      *tp = t + 4 * (x + fj->x0 + j);
+
+                    for (ch = 0; ch < 4; ch++)
+                        acc[ch] += fj->v[j] * tp[ch];
+                }
+                dst[x] = _filter_pixel(fj, acc, src[(size_t)y * w + x]);
             }
-            if (gd)
+        }
+    }
+}
+
+static int
+_gcd(int a, int b)
+{
+    int             t;
+
+    a = a < 0 ? -a : a;
+    b = b < 0 ? -b : b;
+    while (b)
+    {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*
+ * Check whether all active channels use the same kernel on their own
+ * channel only, and whether that kernel k(x, y) is u(y) * v(x).
+ * Fills in fj->u, fj->v (allocated) if so.
+ */
+static int
+_filter_separable(ImlibFilterJob *fj)
+{
+    const ImlibFilterTap *tap;
+    int            *k, kw, kh, i, ch, ch0, x, y, px, py, g;
+    int64_t         su, sv;
+
+    kw = fj->x1 - fj->x0 + 1;
+    kh = fj->y1 - fj->y0 + 1;
+    if (kw * kh <= 9)
+        return 0;               /* Not worth it */
+
+    k = calloc((size_t)kw * kh, sizeof(int));
+    if (!k)
+        return 0;
+
+    for (ch0 = 0; ch0 < 4 && fj->div[ch0] == 0; ch0++)
+        ;
+
+    for (i = 0, tap = fj->taps; i < fj->ntaps; i++, tap++)
+    {
+        for (ch = 0; ch < 4; ch++)
+        {
+            for (x = 0; x < 4; x++)
             {
-                g = __imlib_FilterGet(&fil->green, im->data, im->w, im->h, x,
-                                      y);
-                g /= gd;
-                G_VAL(p2) = SATURATE(g);
+                if (fj->div[ch] == 0)
+                    continue;
+                if (x != ch && tap->w[ch][x] != 0)
+                    goto fail;  /* Cross channel */
             }
-            if (bd)
+            if (fj->div[ch] != 0 && tap->w[ch][ch] != tap->w[ch0][ch0])
+                goto fail;      /* Channels differ */
+        }
+        k[(tap->yoff - fj->y0) * kw + tap->xoff - fj->x0] = tap->w[ch0][ch0];
+    }
+
+    /* Pivot row py, column px */
+    for (i = 0; i < kw * kh && k[i] == 0; i++)
+        ;
+    if (i >= kw * kh)
+        goto fail;
+    py = i / kw;
+    px = i % kw;
+
+    fj->u = malloc((size_t)(kw + kh) * sizeof(int));
+    if (!fj->u)
+        goto fail;
+    fj->v = fj->u + kh;
+
+    /* v = pivot row / gcd, u(y) = k(px, y) / v(px) */
+    for (x = 0, g = 0; x < kw; x++)
+        g = _gcd(g, k[py * kw + x]);
+    for (x = 0; x < kw; x++)
+        fj->v[x] = k[py * kw + x] / g;
+    for (y = 0; y < kh; y++)
+    {
+        if (k[y * kw + px] % fj->v[px])
+            goto fail;
+        fj->u[y] = k[y * kw + px] / fj->v[px];
+    }
+    for (y = 0; y < kh; y++)
+        for (x = 0; x < kw; x++)
+            if (fj->u[y] * fj->v[x] != k[y * kw + x])
+                goto fail;
+
+    /* Intermediate sums must fit */
+    for (i = 0, su = sv = 0; i < kh; i++)
+        su += fj->u[i] < 0 ? -fj->u[i] : fj->u[i];
+    for (i = 0; i < kw; i++)
+        sv += fj->v[i] < 0 ? -fj->v[i] : fj->v[i];
+    for (ch = 0; ch < 4; ch++)
+        if (255 * su * sv + (fj->cons[ch] < 0 ? -fj->cons[ch] :
+                             fj->cons[ch]) > INT32_MAX)
+            goto fail;
+
+    fj->u_const = fj->v_const = 1;
+    for (y = 1; y < kh; y++)
+        if (fj->u[y] != fj->u[0])
+            fj->u_const = 0;
+    for (x = 1; x < kw; x++)
+        if (fj->v[x] != fj->v[0])
+            fj->v_const = 0;
+
+    free(k);
+    return 1;
+
+  fail:
+    free(fj->u);
+    fj->u = fj->v = NULL;
+    free(k);
+    return 0;
+}
+
+/* Merge the channel filters into one tap list */
+static int
+_filter_compile(ImlibFilterJob *fj, ImlibFilter *fil)
+{
+    const ImlibFilterColor *fc;
+    const ImlibFilterPixel *pix;
+    ImlibFilterTap *tap;
+    int             ch, i, j, n;
+
+    n = 0;
+    for (ch = 0; ch < 4; ch++)
+        if (fj->div[ch])
+            n += _filter_color(fil, ch)->entries;
+
+    fj->taps = calloc(n > 0 ? n : 1, sizeof(ImlibFilterTap));
+    fj->offs = malloc((n > 0 ? n : 1) * sizeof(int));
+    if (!fj->taps || !fj->offs)
+        return -1;
+
+    fj->ntaps = 0;
+    fj->x0 = fj->x1 = fj->y0 = fj->y1 = 0;
+    for (ch = 0; ch < 4; ch++)
+    {
+        if (!fj->div[ch])
+            continue;
+        fc = _filter_color(fil, ch);
+        for (i = 0, pix = fc->pixels; i < fc->entries; i++, pix++)
+        {
+            for (j = 0; j < fj->ntaps; j++)
+                if (fj->taps[j].xoff == pix->xoff &&
+                    fj->taps[j].yoff == pix->yoff)
+                    break;
+            tap = &fj->taps[j];
+            if (j == fj->ntaps)
             {
-                b = __imlib_FilterGet(&fil->blue, im->data, im->w, im->h, x, y);
-                b /= bd;
-                B_VAL(p2) = SATURATE(b);
+                fj->ntaps++;
+                tap->xoff = pix->xoff;
+                tap->yoff = pix->yoff;
+                fj->x0 = pix->xoff < fj->x0 ? pix->xoff : fj->x0;
+                fj->x1 = pix->xoff > fj->x1 ? pix->xoff : fj->x1;
+                fj->y0 = pix->yoff < fj->y0 ? pix->yoff : fj->y0;
+                fj->y1 = pix->yoff > fj->y1 ? pix->yoff : fj->y1;
             }
-            p1++;
-            p2++;
+            tap->w[ch][0] += pix->b;
+            tap->w[ch][1] += pix->g;
+            tap->w[ch][2] += pix->r;
+            tap->w[ch][3] += pix->a;
         }
     }
+
+    for (j = 0; j < fj->ntaps; j++)
+        fj->offs[j] = fj->taps[j].yoff * fj->w + fj->taps[j].xoff;
+
+    return 0;
+}
+
+/*\ Filter an image with the a, r, g, b filters in fil \*/
+void
+__imlib_FilterImage(ImlibImage *im, ImlibFilter *fil)
+{
+    ImlibFilterJob  fj;
+    uint32_t       *data;
+    int             ch, n_workers, n_jobs;
+
+    memset(&fj, 0, sizeof(fj));
+
+    fj.keep_mask = 0xffffffff;
+    for (ch = 0; ch < 4; ch++)
+    {
+        fj.div[ch] = __imlib_FilterCalcDiv(_filter_color(fil, ch));
+        fj.cons[ch] = _filter_color(fil, ch)->cons;
+        if (fj.div[ch])
+            fj.keep_mask &= ~(0xffu << ch_shift[ch]);
+    }
+    if (fj.keep_mask == 0xffffffff)
+        return;                 /* Nothing to do */
+
+    data = malloc((size_t)im->w * im->h * sizeof(uint32_t));
+    if (!data)
+        return;
+
+    fj.src = im->data;
+    fj.dst = data;
+    fj.w = im->w;
+    fj.h = im->h;
+
+    if (_filter_compile(&fj, fil))
+        goto quit;
+
+    n_workers = 1;
+    if ((int64_t)fj.w * fj.h >= WORKERS_MIN_PIXELS)
+        n_workers = __imlib_WorkersGet();
+
+    n_jobs = n_workers < fj.h ? n_workers : fj.h;
+    fj.band = (fj.h + n_jobs - 1) / n_jobs;
+    n_jobs = (fj.h + fj.band - 1) / fj.band;
+
+    if (_filter_separable(&fj))
+    {
+        fj.rowbuf_size = (fj.w + 2 * (fj.x1 - fj.x0 + 1)) * 4 + fj.w * 4;
+        fj.rowbuf = malloc((size_t)n_workers * fj.rowbuf_size * sizeof(int));
+        if (!fj.rowbuf)
+            goto quit;
+        __imlib_WorkersRun(_filter_band_sep, &fj, n_jobs, n_workers);
+    }
+    else
+    {
+        __imlib_WorkersRun(_filter_band, &fj, n_jobs, n_workers);
+    }
+
     __imlib_ReplaceData(im, data);
+    data = NULL;
+
+  quit:
+    free(fj.rowbuf);
+    free(fj.u);
+    free(fj.offs);
+    free(fj.taps);
+    free(data);
 }
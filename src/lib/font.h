@@ -18,7 +18,11 @@ typedef struct _Imlib_Font {
         FT_Face         face;
     } ft;
 
-    Imlib_Hash     *glyphs;
+    /* Glyph cache, keyed on glyph index */
+    Imlib_Hash      glyphs;
+    /* Glyph coverage bitmaps */
+    struct _Imlib_Font_Atlas *atlas;
+    int             atlas_size;
 
     int             usage;
 
@@ -29,11 +33,23 @@ typedef struct _Imlib_Font {
     struct _Imlib_Font *fallback_next;
 } ImlibFont;
 
-typedef struct {
-    FT_Glyph        glyph;
-    FT_BitmapGlyph  glyph_out;
+typedef struct _Imlib_Font_Glyph {
+    Imlib_Hash_Key  key;        /* Glyph index */
+    int             left, top;  /* Bitmap position relative to the pen */
+    int             width, height;
+    int             pitch;
+    int             advance;    /* Horizontal advance, 24.8 fixed point */
+    const uint8_t  *bitmap;     /* 8 bit coverage, in the font atlas */
 } Imlib_Font_Glyph;
 
+/* Shelf packed page of glyph bitmaps */
+typedef struct _Imlib_Font_Atlas {
+    struct _Imlib_Font_Atlas *next;
+    int             w, h;
+    int             x, y, row_h;        /* Current shelf */
+    uint8_t         data[];
+} Imlib_Font_Atlas;
+
 #define IMLIB_GLYPH_NONE ((Imlib_Font_Glyph*) 1)        /* Glyph not found */
 
 /* functions */
@@ -84,15 +100,15 @@ Imlib_Font_Glyph *__imlib_font_get_next_glyph(ImlibFont * fn,
                                               int *cindx,
                                               FT_UInt * pindex, int *pkern);
 Imlib_Font_Glyph *__imlib_font_cache_glyph_get(ImlibFont * fn, FT_UInt index);
+void            __imlib_font_glyphs_free(ImlibFont * fn);
+int             __imlib_font_run_cache_get(void);
+void            __imlib_font_run_cache_set(int size);
+void            __imlib_font_runs_flush(ImlibFont * fn);
 void            __imlib_render_str(ImlibImage * im, ImlibFont * f,
                                    int drx, int dry, const char *text,
                                    uint32_t pixel, int dir, double angle,
                                    int *retw, int *reth, int blur,
                                    int *nextx, int *nexty, ImlibOp op,
                                    int clx, int cly, int clw, int clh);
-void            __imlib_font_draw(ImlibImage * dst, uint32_t col,
-                                  ImlibFont * fn, int x, int y,
-                                  const char *text, int *nextx, int *nexty,
-                                  int clx, int cly, int clw, int clh);
 
 #endif                          /* FONT_H */
@@ -10,24 +10,105 @@
 #include "image.h"
 #include "rgbadraw.h"
 #include "rotate.h"
+#include "span.h"
 
 extern FT_Library ft_lib;
 
+/*
+ * Glyph cache
+ *
+ * Glyphs are kept in a hash table keyed on glyph index.
+ * The coverage bitmaps are packed on shelves in atlas pages. Glyphs too
+ * large for a page get a page of their own.
+ */
+
+#define ATLAS_W 256
+#define ATLAS_H 128
+
+static Imlib_Font_Atlas *
+_font_atlas_page_new(ImlibFont *fn, int w, int h)
+{
+    Imlib_Font_Atlas *pg;
+
+    pg = malloc(sizeof(Imlib_Font_Atlas) + (size_t)w * h);
+    if (!pg)
+        return NULL;
+
+    pg->next = NULL;
+    pg->w = w;
+    pg->h = h;
+    pg->x = pg->y = pg->row_h = 0;
+    fn->atlas_size += sizeof(Imlib_Font_Atlas) + w * h;
+
+    return pg;
+}
+
+static uint8_t *
+_font_atlas_alloc(ImlibFont *fn, int w, int h, int *pitch)
+{
+    Imlib_Font_Atlas *pg;
+    uint8_t        *p;
+
+    if (w > ATLAS_W || h > ATLAS_H)
+    {
+        pg = _font_atlas_page_new(fn, w, h);
+        if (!pg)
+            return NULL;
+        if (fn->atlas)
+        {
+            /* Keep packing in the current page */
+            pg->next = fn->atlas->next;
+            fn->atlas->next = pg;
+        }
+        else
+        {
+            pg->y = h;          /* Full */
+            fn->atlas = pg;
+        }
+        *pitch = w;
+        return pg->data;
+    }
+
+    pg = fn->atlas;
+    if (pg && pg->x + w > pg->w)
+    {
+        /* Next shelf */
+        pg->y += pg->row_h;
+        pg->x = pg->row_h = 0;
+    }
+    if (!pg || pg->y + h > pg->h)
+    {
+        pg = _font_atlas_page_new(fn, ATLAS_W, ATLAS_H);
+        if (!pg)
+            return NULL;
+        pg->next = fn->atlas;
+        fn->atlas = pg;
+    }
+
+    p = pg->data + pg->y * pg->w + pg->x;
+    pg->x += w;
+    if (h > pg->row_h)
+        pg->row_h = h;
+    *pitch = pg->w;
+
+    return p;
+}
+
+/*
+ * The returned glyph is valid until the next glyph is added to the font
+ */
 Imlib_Font_Glyph *
 __imlib_font_cache_glyph_get(ImlibFont *fn, FT_UInt index)
 {
     Imlib_Font_Glyph *fg;
-    char            key[6];
+    Imlib_Hash_Key  key = { NULL, index };
+    FT_Glyph        glyph;
+    FT_BitmapGlyph  bg;
     FT_Error        error;
+    int             y, pitch, src_pitch;
+    uint8_t        *dst;
 
-    key[0] = ((index) & 0x7f) + 1;
-    key[1] = ((index >> 7) & 0x7f) + 1;
-    key[2] = ((index >> 14) & 0x7f) + 1;
-    key[3] = ((index >> 21) & 0x7f) + 1;
-    key[4] = ((index >> 28) & 0x0f) + 1;
-    key[5] = 0;
-
-    fg = __imlib_hash_find(fn->glyphs, key);
+    fg = __imlib_hash_find(&fn->glyphs, &key);
     if (fg)
         return fg;
 
@@ -35,33 +116,415 @@ __imlib_font_cache_glyph_get(ImlibFont *fn, FT_UInt index)
     if (error)
         return NULL;
 
-    fg = malloc(sizeof(Imlib_Font_Glyph));
-    if (!fg)
+    error = FT_Get_Glyph(fn->ft.face->glyph, &glyph);
+    if (error)
         return NULL;
-    memset(fg, 0, sizeof(Imlib_Font_Glyph));
+    if (glyph->format != ft_glyph_format_bitmap)
+    {
+        error = FT_Glyph_To_Bitmap(&glyph, ft_render_mode_normal, 0, 1);
+        if (error)
+        {
+            FT_Done_Glyph(glyph);
+            return NULL;
+        }
+    }
+    bg = (FT_BitmapGlyph) glyph;
 
-    error = FT_Get_Glyph(fn->ft.face->glyph, &(fg->glyph));
-    if (error)
+    fg = __imlib_hash_insert(&fn->glyphs, &key);
+    if (!fg)
     {
-        free(fg);
+        FT_Done_Glyph(glyph);
         return NULL;
     }
-    if (fg->glyph->format != ft_glyph_format_bitmap)
+
+    fg->left = bg->left;
+    fg->top = bg->top;
+    fg->width = bg->bitmap.width;
+    fg->height = bg->bitmap.rows;
+    fg->advance = glyph->advance.x >> 8;
+    fg->bitmap = NULL;
+    fg->pitch = 0;
+
+    /* Only 8 bit coverage is drawn */
+    if (fg->width > 0 && fg->height > 0 &&
+        bg->bitmap.pixel_mode == ft_pixel_mode_grays &&
+        bg->bitmap.num_grays == 256)
     {
-        error = FT_Glyph_To_Bitmap(&(fg->glyph), ft_render_mode_normal, 0, 1);
-        if (error)
+        dst = _font_atlas_alloc(fn, fg->width, fg->height, &pitch);
+        if (!dst)
         {
-            FT_Done_Glyph(fg->glyph);
-            free(fg);
+            __imlib_hash_remove(&fn->glyphs, &key);
+            FT_Done_Glyph(glyph);
             return NULL;
         }
+        src_pitch = bg->bitmap.pitch;
+        if (src_pitch < fg->width)
+            src_pitch = fg->width;
+        for (y = 0; y < fg->height; y++)
+            memcpy(dst + y * pitch, bg->bitmap.buffer + y * src_pitch,
+                   fg->width);
+        fg->bitmap = dst;
+        fg->pitch = pitch;
     }
-    fg->glyph_out = (FT_BitmapGlyph) fg->glyph;
 
-    fn->glyphs = __imlib_hash_add(fn->glyphs, key, fg);
+    FT_Done_Glyph(glyph);
+
     return fg;
 }
 
+void
+__imlib_font_glyphs_free(ImlibFont *fn)
+{
+    Imlib_Font_Atlas *pg, *pg_next;
+
+    __imlib_hash_free(&fn->glyphs);
+
+    for (pg = fn->atlas; pg; pg = pg_next)
+    {
+        pg_next = pg->next;
+        free(pg);
+    }
+    fn->atlas = NULL;
+    fn->atlas_size = 0;
+}
+
+/*
+ * Text layout
+ *
+ * Composites the glyph coverage into the w x h mask, with the pen starting
+ * at (0, ascent). Overlapping glyphs are composited ("over"). Glyphs
+ * overlapping the box edges are clipped, layout stops at the first glyph
+ * starting beyond the box.
+ * Returns the horizontal pen advance.
+ */
+
+/* dst = dst + src - dst * src / 255, exact where either is 0 */
+static void
+_font_mask_row(uint8_t *dst, const uint8_t *src, int len)
+{
+    uint32_t        tmp;
+    int             i;
+
+    for (i = 0; i < len; i++)
+    {
+        tmp = dst[i] * src[i] + 0x80;
+        dst[i] += src[i] - ((tmp + (tmp >> 8)) >> 8);
+    }
+}
+
+static int
+_font_layout(ImlibFont *fn, const char *text, uint8_t *mask, int w, int h,
+             int ascent)
+{
+    Imlib_Font_Glyph *fg;
+    FT_UInt         index;
+    int             pen_x, chr, kern;
+    int             x, y, x0, x1, y0, y1, xe, xo;
+    uint8_t        *dst;
+
+    index = 0;
+    pen_x = 0;
+    xe = 0;                     /* The mask is clear from here on */
+    for (chr = 0; text[chr];)
+    {
+        fg = __imlib_font_get_next_glyph(fn, text, &chr, &index, &kern);
+        if (!fg)
+            break;
+        pen_x += kern;
+        if (fg == IMLIB_GLYPH_NONE)
+            continue;
+
+        x = (pen_x >> 8) + fg->left;
+        if (x >= w)
+            break;
+
+        if (fg->bitmap)
+        {
+            y = ascent - fg->top;
+            x0 = x < 0 ? -x : 0;
+            x1 = x + fg->width > w ? w - x : fg->width;
+            y0 = y < 0 ? -y : 0;
+            y1 = y + fg->height > h ? h - y : fg->height;
+            /* Composite where previous glyphs may be, copy the rest */
+            xo = xe - x;
+            if (xo < x0)
+                xo = x0;
+            if (xo > x1)
+                xo = x1;
+            for (; x0 < x1 && y0 < y1; y0++)
+            {
+                dst = mask + (y + y0) * w + x;
+                _font_mask_row(dst + x0, fg->bitmap + y0 * fg->pitch + x0,
+                               xo - x0);
+                memcpy(dst + xo, fg->bitmap + y0 * fg->pitch + xo, x1 - xo);
+            }
+            if (x + x1 > xe)
+                xe = x + x1;
+        }
+
+        pen_x += fg->advance;
+    }
+
+    return pen_x >> 8;
+}
+
+/* Destination rows, coverage is blended directly.
+ * Coverage is colorized and blended like the rotated/flipped text image,
+ * so the result does not depend on the direction. Pixels without coverage
+ * are left alone. */
+typedef struct {
+    ImlibBlendFunction func;
+    uint32_t        lut[256];   /* Colorized coverage */
+    uint32_t       *data;
+    int             dw;
+    int             x, y;       /* Text box position */
+    int             clx, cly, clw, clh;
+} FontDraw;
+
+static void
+_font_draw_row(const FontDraw *fd, const uint8_t *src, int x, int y, int len)
+{
+    uint32_t        buf[256];
+    int             n;
+
+    x += fd->x;
+    y += fd->y;
+    if (y < fd->cly || y >= fd->cly + fd->clh)
+        return;
+    if (x < fd->clx)
+    {
+        len -= fd->clx - x;
+        src += fd->clx - x;
+        x = fd->clx;
+    }
+    if (x + len > fd->clx + fd->clw)
+        len = fd->clx + fd->clw - x;
+
+    while (len > 0)
+    {
+        /* Skip zero coverage, blend up to 256 covered pixels */
+        for (; len > 0 && *src == 0; len--, src++, x++)
+            ;
+        for (n = 0; n < len && n < 256 && src[n]; n++)
+            buf[n] = fd->lut[src[n]];
+        if (n == 0)
+            break;
+        fd->func(buf, n, fd->data + y * fd->dw + x, fd->dw, n, 1, NULL);
+        len -= n;
+        src += n;
+        x += n;
+    }
+}
+
+/*
+ * Text run cache
+ *
+ * Rasterized coverage masks of recently drawn strings, keyed on font and
+ * string. The color is applied when blending, so runs are shared between
+ * colors, operations and directions.
+ * Disabled when the cache size is 0 (the default).
+ */
+
+typedef struct _ImlibTextRun ImlibTextRun;
+
+struct _ImlibTextRun {
+    ImlibTextRun   *prev, *next;        /* LRU list, most recent first */
+    ImlibFont      *fn;
+    int             size;
+    int             w, h;
+    int             nextx;
+    uint8_t        *mask;
+    char            text[];
+};
+
+typedef struct {
+    Imlib_Hash_Key  key;        /* Text, font */
+    ImlibTextRun   *run;
+} TextRunEntry;
+
+static Imlib_Hash runs_hash = IMLIB_HASH_INIT(sizeof(TextRunEntry));
+static ImlibTextRun *runs_first = NULL;
+static ImlibTextRun *runs_last = NULL;
+static int      run_cache = 0;
+static int      run_cache_usage = 0;
+
+static void
+_run_free(ImlibTextRun *run)
+{
+    Imlib_Hash_Key  key = { run->text, (uintptr_t) run->fn };
+
+    __imlib_hash_remove(&runs_hash, &key);
+    if (runs_hash.count == 0)
+        __imlib_hash_free(&runs_hash);
+
+    if (run->prev)
+        run->prev->next = run->next;
+    else
+        runs_first = run->next;
+    if (run->next)
+        run->next->prev = run->prev;
+    else
+        runs_last = run->prev;
+
+    run_cache_usage -= run->size;
+    free(run);
+}
+
+static void
+_runs_trim(int size)
+{
+    while (runs_last && run_cache_usage > size)
+        _run_free(runs_last);
+}
+
+void
+__imlib_font_runs_flush(ImlibFont *fn)
+{
+    ImlibTextRun   *run, *run_next;
+
+    for (run = runs_first; run; run = run_next)
+    {
+        run_next = run->next;
+        if (!fn || run->fn == fn)
+            _run_free(run);
+    }
+}
+
+int
+__imlib_font_run_cache_get(void)
+{
+    return run_cache;
+}
+
+void
+__imlib_font_run_cache_set(int size)
+{
+    run_cache = size > 0 ? size : 0;
+    _runs_trim(run_cache);
+}
+
+static ImlibTextRun *
+_run_find(ImlibFont *fn, const char *text)
+{
+    Imlib_Hash_Key  key = { text, (uintptr_t) fn };
+    TextRunEntry   *re;
+    ImlibTextRun   *run;
+
+    re = __imlib_hash_find(&runs_hash, &key);
+    if (!re)
+        return NULL;
+    run = re->run;
+    if (run == runs_first)
+        return run;
+
+    /* Move to front */
+    run->prev->next = run->next;
+    if (run->next)
+        run->next->prev = run->prev;
+    else
+        runs_last = run->prev;
+    run->prev = NULL;
+    run->next = runs_first;
+    runs_first->prev = run;
+    runs_first = run;
+
+    return run;
+}
+
+static ImlibTextRun *
+_run_new(ImlibFont *fn, const char *text, int w, int h, int ascent)
+{
+    ImlibTextRun   *run;
+    size_t          len, size;
+
+    len = strlen(text) + 1;
+    size = sizeof(ImlibTextRun) + len + (size_t)w * h;
+    run = malloc(size);
+    if (!run)
+        return NULL;
+
+    memset(run, 0, sizeof(ImlibTextRun));
+    run->fn = fn;
+    run->size = size;
+    run->w = w;
+    run->h = h;
+    memcpy(run->text, text, len);
+    run->mask = (uint8_t *) run->text + len;
+    memset(run->mask, 0, (size_t)w * h);
+
+    run->nextx = _font_layout(fn, text, run->mask, w, h, ascent);
+
+    return run;
+}
+
+static int
+_run_insert(ImlibTextRun *run)
+{
+    Imlib_Hash_Key  key = { run->text, (uintptr_t) run->fn };
+    TextRunEntry   *re;
+
+    _runs_trim(run_cache - run->size);
+
+    re = __imlib_hash_insert(&runs_hash, &key);
+    if (!re)
+        return 0;
+    re->run = run;
+
+    run->prev = NULL;
+    run->next = runs_first;
+    if (runs_first)
+        runs_first->prev = run;
+    else
+        runs_last = run;
+    runs_first = run;
+
+    run_cache_usage += run->size;
+
+    return 1;
+}
+
+/* Blend the run coverage straight into the image */
+static void
+_render_run_direct(ImlibImage *im, const ImlibTextRun *run,
+                   int drx, int dry, uint32_t pixel, ImlibOp op,
+                   int clx, int cly, int clw, int clh)
+{
+    FontDraw        fd;
+    int             y, i;
+
+    if (clw == 0)
+    {
+        clx = cly = 0;
+        clw = im->w;
+        clh = im->h;
+    }
+    else
+    {
+        CLIP(clx, cly, clw, clh, 0, 0, im->w, im->h);
+    }
+    CLIP(clx, cly, clw, clh, drx, dry, run->w, run->h);
+    if (clw <= 0 || clh <= 0)
+        return;
+
+    fd.func = __imlib_GetBlendFunction(op, 1, im->has_alpha, 0, NULL);
+    for (i = 0; i < 256; i++)
+        fd.lut[i] = (pixel & 0x00ffffff) |
+            ((((i + 1) * (pixel >> 24)) >> 8) << 24);
+    fd.data = im->data;
+    fd.dw = im->w;
+    fd.x = drx;
+    fd.y = dry;
+    fd.clx = clx;
+    fd.cly = cly;
+    fd.clw = clw;
+    fd.clh = clh;
+
+    __imlib_build_pow_lut();
+
+    for (y = cly - dry; y < cly - dry + clh; y++)
+        _font_draw_row(&fd, run->mask + y * run->w, 0, y, run->w);
+}
+
 void
 __imlib_render_str(ImlibImage *im, ImlibFont *fn, int drx, int dry,
                    const char *text, uint32_t pixel, int dir, double angle,
@@ -71,25 +534,59 @@ __imlib_render_str(ImlibImage *im, ImlibFont *fn, int drx, int dry,
 {
     int             w, h, ascent;
     ImlibImage     *im2;
+    ImlibTextRun   *run, *run_tmp;
     int             nx, ny;
+    uint32_t       *p;
+    int             i;
+
+    ascent = __imlib_font_max_ascent_get(fn);
+    h = ascent - __imlib_font_max_descent_get(fn);
+
+    run = run_tmp = NULL;
+    if (run_cache > 0)
+        run = _run_find(fn, text);
 
-    __imlib_font_query_advance(fn, text, &w, NULL);
-    h = __imlib_font_max_ascent_get(fn) - __imlib_font_max_descent_get(fn);
+    if (run)
+    {
+        w = run->w;
+    }
+    else
+    {
+        __imlib_font_query_advance(fn, text, &w, NULL);
+        if (!IMAGE_DIMENSIONS_OK(w, h))
+            return;
+        run = run_tmp = _run_new(fn, text, w, h, ascent);
+        if (!run)
+            return;
+        if (run->size <= run_cache && _run_insert(run))
+            run_tmp = NULL;
+    }
+
+    ny = __imlib_font_get_line_advance(fn);
+    nx = run->nextx;
 
-    /* TODO check if this is the right way of rendering. Esp for huge sizes */
+    if (dir == 0 && blur <= 0)
+    {
+        angle = 0.0;
+        _render_run_direct(im, run, drx, dry, pixel, op, clx, cly, clw, clh);
+        free(run_tmp);
+        goto done;
+    }
+
+    /* Colorized coverage to be transformed and blended */
     im2 = __imlib_CreateImage(w, h, NULL, 1);
     if (!im2)
+    {
+        free(run_tmp);
         return;
+    }
 
     im2->has_alpha = 1;
 
-    ascent = __imlib_font_max_ascent_get(fn);
-
-    nx = ny = 0;
-    __imlib_font_draw(im2, pixel, fn, 0, ascent, text, &nx, &ny, 0, 0, w, h);
-
-    /* OK, now we have small ImlibImage with text rendered, 
-     * have to blend it on im */
+    for (i = 0, p = im2->data; i < w * h; i++)
+        p[i] = (pixel & 0x00ffffff) |
+            ((((run->mask[i] + 1) * (pixel >> 24)) >> 8) << 24);
+    free(run_tmp);
 
     if (blur > 0)
         __imlib_BlurImage(im2, blur);
@@ -148,6 +645,7 @@ __imlib_render_str(ImlibImage *im, ImlibFont *fn, int drx, int dry,
 
     __imlib_FreeImage(im2);
 
+  done:
     /* finally deal with return values */
     switch (dir)
     {
@@ -233,162 +731,3 @@ __imlib_render_str(ImlibImage *im, ImlibFont *fn, int drx, int dry,
 
     /* TODO this function is purely my art -- check once more */
 }
-
-void
-__imlib_font_draw(ImlibImage *dst, uint32_t col, ImlibFont *fn, int x, int y,
-                  const char *text, int *nextx, int *nexty, int clx, int cly,
-                  int clw, int clh)
-{
-    int             pen_x, pen_y;
-    int             chr;
-    int             ext_x, ext_y, ext_w, ext_h;
-    uint32_t       *im;
-    int             im_w, im_h;
-    int             lut[256];
-    int             ii;
-
-    im = dst->data;
-    im_w = dst->w;
-    im_h = dst->h;
-
-    ext_x = 0;
-    ext_y = 0;
-    ext_w = im_w;
-    ext_h = im_h;
-
-    if (clw)
-    {
-        ext_x = clx;
-        ext_y = cly;
-        ext_w = clw;
-        ext_h = clh;
-    }
-    if (ext_x < 0)
-    {
-        ext_w += ext_x;
-        ext_x = 0;
-    }
-    if (ext_y < 0)
-    {
-        ext_h += ext_y;
-        ext_y = 0;
-    }
-    if ((ext_x + ext_w) > im_w)
-        ext_w = im_w - ext_x;
-    if ((ext_y + ext_h) > im_h)
-        ext_h = im_h - ext_y;
-
-    if (ext_w <= 0)
-        return;
-    if (ext_h <= 0)
-        return;
-
-    for (ii = 0; ii < 256; ii++)
-    {
-        lut[ii] = (col & 0x00ffffff);   /* TODO check endianess */
-        lut[ii] |= ((((ii + 1) * (col >> 24)) >> 8) << 24);
-    }
-
-    pen_x = x << 8;
-    pen_y = y << 8;
-    for (chr = 0; text[chr];)
-    {
-        FT_UInt         index;
-        Imlib_Font_Glyph *fg;
-        int             chr_x, chr_y, kern;
-
-        fg = __imlib_font_get_next_glyph(fn, text, &chr, &index, &kern);
-        if (!fg)
-            break;
-        pen_x += kern;
-        if (fg == IMLIB_GLYPH_NONE)
-            continue;
-
-        chr_x = (pen_x + (fg->glyph_out->left << 8)) >> 8;
-        chr_y = (pen_y + (fg->glyph_out->top << 8)) >> 8;
-
-        if (chr_x < (ext_x + ext_w))
-        {
-            uint8_t        *data;
-            int             i, j, w, h;
-
-            data = fg->glyph_out->bitmap.buffer;
-            j = fg->glyph_out->bitmap.pitch;
-            w = fg->glyph_out->bitmap.width;
-            if (j < w)
-                j = w;
-            h = fg->glyph_out->bitmap.rows;
-            if ((fg->glyph_out->bitmap.pixel_mode == ft_pixel_mode_grays) &&
-                (fg->glyph_out->bitmap.num_grays == 256))
-            {
-                if ((j > 0) && (chr_x + w > ext_x))
-                {
-                    for (i = 0; i < h; i++)
-                    {
-                        int             dx, dy;
-                        int             in_x, in_w;
-
-                        in_x = 0;
-                        in_w = 0;
-                        dx = chr_x;
-                        dy = y - (chr_y - i - y);
-                        if ((dx < (ext_x + ext_w)) && (dy >= (ext_y)) &&
-                            (dy < (ext_y + ext_h)))
-                        {
-                            if (dx + w > (ext_x + ext_w))
-                                in_w += (dx + w) - (ext_x + ext_w);
-                            if (dx < ext_x)
-                            {
-                                in_w += ext_x - dx;
-                                in_x = ext_x - dx;
-                                dx = ext_x;
-                            }
-                            if (in_w < w)
-                            {
-                                uint8_t        *src_ptr;
-                                uint32_t       *dst_ptr;
-                                uint32_t       *dst_end_ptr;
-
-                                src_ptr = data + (i * j) + in_x;
-                                dst_ptr = im + (dy * im_w) + dx;
-                                dst_end_ptr = dst_ptr + w - in_w;
-
-                                while (dst_ptr < dst_end_ptr)
-                                {
-                                    /* FIXME Oops! change this op */
-                                    if (!*dst_ptr)
-                                        *dst_ptr = lut[(unsigned char)*src_ptr];
-                                    else if (*src_ptr)
-                                    {
-                                        /* very rare case - I've never seen symbols 
-                                         * overlapped by kerning */
-                                        int             tmp;
-
-                                        tmp =
-                                            (*dst_ptr >> 24) +
-                                            (lut
-                                             [(unsigned char)*src_ptr] >> 24);
-                                        tmp = (tmp > 256) ? 256 : tmp;
-                                        *dst_ptr &= 0x00ffffff;
-                                        *dst_ptr |= (tmp << 24);
-                                    }
-
-                                    dst_ptr++;
-                                    src_ptr++;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        else
-            break;
-        pen_x += fg->glyph->advance.x >> 8;
-    }
-
-    if (nextx)
-        *nextx = (pen_x >> 8) - x;
-    if (nexty)
-        *nexty = __imlib_font_get_line_advance(fn);
-}
@@ -13,13 +13,39 @@ static int      font_cache_usage = 0;
 static int      font_cache = 0;
 static char   **fpath = NULL;
 static int      fpath_num = 0;
-static Imlib_Object_List *fonts = NULL;
+static Imlib_Object_List *fonts = NULL;       /* Most recently used first */
+
+/* Font lookup, keyed on name and size */
+typedef struct {
+    Imlib_Hash_Key  key;
+    ImlibFont      *fn;
+} FontHashEntry;
+
+static Imlib_Hash font_hash = IMLIB_HASH_INIT(sizeof(FontHashEntry));
 
 static ImlibFont *__imlib_font_load(const char *name, int faceidx, int size);
-static int      font_modify_cache_cb(Imlib_Hash * hash, const char *key,
-                                     void *data, void *fdata);
-static int      font_flush_free_glyph_cb(Imlib_Hash * hash, const char *key,
-                                         void *data, void *fdata);
+
+static void
+_font_hash_add(ImlibFont *fn)
+{
+    Imlib_Hash_Key  key = { fn->name, fn->size };
+    FontHashEntry  *fe;
+
+    /* If this fails the font is just not found again */
+    fe = __imlib_hash_insert(&font_hash, &key);
+    if (fe)
+        fe->fn = fn;
+}
+
+static void
+_font_hash_del(ImlibFont *fn)
+{
+    Imlib_Hash_Key  key = { fn->name, fn->size };
+
+    __imlib_hash_remove(&font_hash, &key);
+    if (font_hash.count == 0)
+        __imlib_hash_free(&font_hash);
+}
 
 /* FIXME now! listdir() from evas_object_text.c */
 
@@ -191,7 +217,9 @@ __imlib_font_load(const char *name, int faceidx, int size)
     fn->name = strdup(file);
     fn->size = size;
 
-    fn->glyphs = NULL;
+    __imlib_hash_init(&fn->glyphs, sizeof(Imlib_Font_Glyph));
+    fn->atlas = NULL;
+    fn->atlas_size = 0;
 
     fn->usage = 0;
 
@@ -201,6 +229,7 @@ __imlib_font_load(const char *name, int faceidx, int size)
     fn->fallback_next = NULL;
 
     fonts = __imlib_object_list_prepend(fonts, fn);
+    _font_hash_add(fn);
     return fn;
 }
 
@@ -235,12 +264,18 @@ __imlib_font_insert_into_fallback_chain_imp(ImlibFont *fn, ImlibFont *fallback)
     fallback->fallback_next = tmp;
     if (tmp)
         tmp->fallback_prev = fallback;
+
+    /* Cached text runs may have been drawn without the fallback */
+    __imlib_font_runs_flush(NULL);
     return 0;
 }
 
 void
 __imlib_font_remove_from_fallback_chain_imp(ImlibFont *fn)
 {
+    if (fn->fallback_prev || fn->fallback_next)
+        __imlib_font_runs_flush(NULL);
+
     /* if fn has a previous font in its font chain, then make its fallback_next fn's fallback_next since fn is going away */
     if (fn->fallback_prev)
         fn->fallback_prev->fallback_next = fn->fallback_next;
@@ -248,31 +283,16 @@ __imlib_font_remove_from_fallback_chain_imp(ImlibFont *fn)
     fn->fallback_next = NULL;
 }
 
-static int
-font_modify_cache_cb(Imlib_Hash *hash, const char *key, void *data, void *fdata)
-{
-    int            *dir;
-    Imlib_Font_Glyph *fg;
-
-    fg = data;
-    dir = fdata;
-    font_cache_usage += (*dir) * ((fg->glyph_out->bitmap.width * fg->glyph_out->bitmap.rows) + sizeof(Imlib_Font_Glyph) + sizeof(Imlib_Object_List) + 400);     /* fudge values */
-    return 1;
-}
-
 void
 __imlib_font_modify_cache_by(ImlibFont *fn, int dir)
 {
-    int             sz_name = 0, sz_file = 0, sz_hash = 0;
+    int             sz_name = 0, sz_file = 0;
 
     if (fn->name)
         sz_name = strlen(fn->name);
     if (fn->file)
         sz_file = strlen(fn->file);
-    if (fn->glyphs)
-        sz_hash = sizeof(Imlib_Hash);
-    __imlib_hash_foreach(fn->glyphs, font_modify_cache_cb, &dir);
-    font_cache_usage += dir * (sizeof(ImlibFont) + sz_name + sz_file + sz_hash + sizeof(FT_FaceRec) + 16384);   /* fudge values */
+    font_cache_usage += dir * (sizeof(ImlibFont) + sz_name + sz_file + fn->atlas_size + __imlib_hash_mem_size(&fn->glyphs) + sizeof(FT_FaceRec) + 16384);        /* fudge values */
 }
 
 int
@@ -297,18 +317,6 @@ __imlib_font_flush(void)
         __imlib_font_flush_last();
 }
 
-static int
-font_flush_free_glyph_cb(Imlib_Hash *hash, const char *key, void *data,
-                         void *fdata)
-{
-    Imlib_Font_Glyph *fg;
-
-    fg = data;
-    FT_Done_Glyph(fg->glyph);
-    free(fg);
-    return 1;
-}
-
 void
 __imlib_font_flush_last(void)
 {
@@ -327,10 +335,11 @@ __imlib_font_flush_last(void)
         return;
 
     fonts = __imlib_object_list_remove(fonts, fn);
+    _font_hash_del(fn);
     __imlib_font_modify_cache_by(fn, -1);
 
-    __imlib_hash_foreach(fn->glyphs, font_flush_free_glyph_cb, NULL);
-    __imlib_hash_free(fn->glyphs);
+    __imlib_font_runs_flush(fn);
+    __imlib_font_glyphs_free(fn);
 
     free(fn->file);
     free(fn->name);
@@ -341,24 +350,21 @@ __imlib_font_flush_last(void)
 ImlibFont      *
 __imlib_font_find(const char *name, int size)
 {
-    Imlib_Object_List *l;
+    Imlib_Hash_Key  key = { name, size };
+    FontHashEntry  *fe;
+    ImlibFont      *fn;
 
-    for (l = fonts; l; l = l->next)
-    {
-        ImlibFont      *fn;
+    fe = __imlib_hash_find(&font_hash, &key);
+    if (!fe)
+        return NULL;
 
-        fn = (ImlibFont *) l;
-        if ((fn->size == size) && (!strcmp(name, fn->name)))
-        {
-            if (fn->references == 0)
-                __imlib_font_modify_cache_by(fn, -1);
-            fn->references++;
-            fonts = __imlib_object_list_remove(fonts, fn);
-            fonts = __imlib_object_list_prepend(fonts, fn);
-            return fn;
-        }
-    }
-    return NULL;
+    fn = fe->fn;
+    if (fn->references == 0)
+        __imlib_font_modify_cache_by(fn, -1);
+    fn->references++;
+    fonts = __imlib_object_list_remove(fonts, fn);
+    fonts = __imlib_object_list_prepend(fonts, fn);
+    return fn;
 }
 
 /* font pathes */
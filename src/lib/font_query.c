@@ -33,16 +33,16 @@ __imlib_font_query_size(ImlibFont *fn, const char *text, int *w, int *h)
         if (fg == IMLIB_GLYPH_NONE)
             continue;
 
-        chr_x = (pen_x >> 8) + fg->glyph_out->left;
-/*      chr_y = (pen_y >> 8) + fg->glyph_out->top; */
-        chr_w = fg->glyph_out->bitmap.width;
+        chr_x = (pen_x >> 8) + fg->left;
+/*      chr_y = (pen_y >> 8) + fg->top; */
+        chr_w = fg->width;
 
         if (pen_x == 0)
             start_x = chr_x;
         if ((chr_x + chr_w) > end_x)
             end_x = chr_x + chr_w;
 
-        pen_x += fg->glyph->advance.x >> 8;
+        pen_x += fg->advance;
     }
     if (w)
         *w = (pen_x >> 8) - start_x;
@@ -66,7 +66,7 @@ __imlib_font_query_inset(ImlibFont *fn, const char *text)
     if (!fg || fg == IMLIB_GLYPH_NONE)
         return 0;
 
-    return -fg->glyph_out->left;
+    return -fg->left;
 }
 
 /* h & v advance */
@@ -93,7 +93,7 @@ __imlib_font_query_advance(ImlibFont *fn, const char *text, int *h_adv,
         if (fg == IMLIB_GLYPH_NONE)
             continue;
 
-        pen_x += fg->glyph->advance.x >> 8;
+        pen_x += fg->advance;
     }
     if (v_adv)
         *v_adv = __imlib_font_get_line_advance(fn);     /* TODO: compute this in the loop since we may be dealing with multiple fonts */
@@ -132,13 +132,13 @@ __imlib_font_query_char_coords(ImlibFont *fn, const char *text, int pos,
 
         if (kern < 0)
             kern = 0;
-        chr_x = ((pen_x - kern) >> 8) + fg->glyph_out->left;
-        chr_w = fg->glyph_out->bitmap.width + (kern >> 8);
+        chr_x = ((pen_x - kern) >> 8) + fg->left;
+        chr_w = fg->width + (kern >> 8);
         if (text[chr])
         {
             int             advw;
 
-            advw = ((fg->glyph->advance.x + (kern << 8)) >> 16);
+            advw = ((fg->advance + kern) >> 8);
             if (chr_w < advw)
                 chr_w = advw;
         }
@@ -160,7 +160,7 @@ __imlib_font_query_char_coords(ImlibFont *fn, const char *text, int pos,
             return 1;
         }
         prev_chr_end = chr_x + chr_w;
-        pen_x += fg->glyph->advance.x >> 8;
+        pen_x += fg->advance;
     }
     return 0;
 }
@@ -196,13 +196,13 @@ __imlib_font_query_text_at_pos(ImlibFont *fn, const char *text, int x, int y,
 
         if (kern < 0)
             kern = 0;
-        chr_x = ((pen_x - kern) >> 8) + fg->glyph_out->left;
-        chr_w = fg->glyph_out->bitmap.width + (kern >> 8);
+        chr_x = ((pen_x - kern) >> 8) + fg->left;
+        chr_w = fg->width + (kern >> 8);
         if (text[chr])
         {
             int             advw;
 
-            advw = ((fg->glyph->advance.x + (kern << 8)) >> 16);
+            advw = ((fg->advance + kern) >> 8);
             if (chr_w < advw)
                 chr_w = advw;
         }
@@ -224,7 +224,7 @@ __imlib_font_query_text_at_pos(ImlibFont *fn, const char *text, int x, int y,
             return pchr;
         }
         prev_chr_end = chr_x + chr_w;
-        pen_x += fg->glyph->advance.x >> 8;
+        pen_x += fg->advance;
     }
     return -1;
 }
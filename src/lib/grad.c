@@ -7,14 +7,8 @@
 #include "color_helpers.h"
 #include "grad.h"
 #include "image.h"
-
-#define ARGB_TO_R_G_B_A(argb, r, g, b, a) \
-    do { \
-        r = PIXEL_R(argb); \
-        g = PIXEL_G(argb); \
-        b = PIXEL_B(argb); \
-        a = PIXEL_A(argb); \
-    } while(0)
+#include "span.h"
+#include "workers.h"
 
 ImlibRange     *
 __imlib_CreateRange(void)
@@ -38,6 +32,7 @@ __imlib_FreeRange(ImlibRange *rg)
         p = p->next;
         free(pp);
     }
+    free(rg->map);
     free(rg);
 }
 
@@ -52,7 +47,13 @@ __imlib_AddRangeColor(ImlibRange *rg, uint8_t r, uint8_t g, uint8_t b,
     if (!rg->color)
         dist = 0;
 
+    /* Colors changed, drop cached map */
+    free(rg->map);
+    rg->map = NULL;
+
     rc = malloc(sizeof(ImlibRangeColor));
+    if (!rc)
+        return;
     rc->red = r;
     rc->green = g;
     rc->blue = b;
@@ -95,6 +96,12 @@ __imlib_MapRange(ImlibRange *rg, int len)
         ll += p->distance;
     map = malloc(len * sizeof(uint32_t));
     pmap = calloc(ll, sizeof(uint32_t));
+    if (!map || !pmap)
+    {
+        free(map);
+        free(pmap);
+        return NULL;
+    }
     i = 0;
     for (p = rg->color; p; p = p->next)
     {
@@ -125,7 +132,7 @@ __imlib_MapRange(ImlibRange *rg, int len)
     for (i = 0; i < len; i++)
     {
         v = pmap[l >> 16];
-        if ((l >> 16) < ll)
+        if ((l >> 16) < ll - 1)
             vv = pmap[(l >> 16) + 1];
         else
             vv = pmap[(l >> 16)];
@@ -167,6 +174,12 @@ __imlib_MapHsvaRange(ImlibRange *rg, int len)
         ll += p->distance;
     map = malloc(len * sizeof(uint32_t));
     pmap = calloc(ll, sizeof(uint32_t));
+    if (!map || !pmap)
+    {
+        free(map);
+        free(pmap);
+        return NULL;
+    }
     i = 0;
     for (p = rg->color; p; p = p->next)
     {
@@ -207,7 +220,7 @@ __imlib_MapHsvaRange(ImlibRange *rg, int len)
     for (i = 0; i < len; i++)
     {
         k = pmap[l >> 16];
-        if ((l >> 16) < ll)
+        if ((l >> 16) < ll - 1)
             kk = pmap[(l >> 16) + 1];
         else
             kk = pmap[(l >> 16)];
@@ -235,19 +248,131 @@ __imlib_MapHsvaRange(ImlibRange *rg, int len)
     return map;
 }
 
-typedef uint32_t *(ImlibRangeMapFunc) (ImlibRange * rg, int len);
+/* Get color map of length len, reusing the last one if possible */
+static const uint32_t *
+_range_map(ImlibRange *rg, int len, bool hsva)
+{
+    uint32_t       *map;
+
+    if (rg->map && rg->map_len == len && rg->map_hsva == hsva)
+        return rg->map;
+
+    map = hsva ? __imlib_MapHsvaRange(rg, len) : __imlib_MapRange(rg, len);
+    if (!map)
+        return NULL;
+
+    free(rg->map);
+    rg->map = map;
+    rg->map_len = len;
+    rg->map_hsva = hsva;
+
+    return map;
+}
+
+/*
+ * The color of a pixel is a function of s = vlut[y] + hlut[x] only.
+ * If there are fewer distinct s values than pixels the colors are looked
+ * up in a table indexed by s - smin, otherwise they are computed directly.
+ * Runs of equal color are drawn with the span functions, rows are spread
+ * over workers.
+ */
+typedef struct {
+    uint32_t       *data;       /* First pixel */
+    int             stride;     /* Image width */
+    int             w, h;
+    const int      *hlut;       /* Visible part, s offsets */
+    const int      *vlut;
+    const uint32_t *cmap;       /* Colors, or NULL */
+    int             smin;       /* cmap offset */
+    const uint32_t *map;
+    uint64_t        len;
+    int             maxlut;
+    ImlibSpanDrawFunction span;
+    ImlibSpanDrawFunction span_opaque;  /* For alpha = 255 */
+    int             band;       /* Rows per job */
+} ImlibGradJob;
+
+static inline   uint32_t
+_grad_color(const ImlibGradJob *gj, int s)
+{
+    uint64_t        ll;
+
+    ll = gj->len * s;
+    return gj->map[(ll > 0) ? (ll - 1) / gj->maxlut : 0];
+}
+
+static inline void
+_grad_span(const ImlibGradJob *gj, uint32_t col, uint32_t *p, int n)
+{
+    if (PIXEL_A(col) == 0xff)
+        gj->span_opaque(col, p, n);
+    else
+        gj->span(col, p, n);
+}
+
+static void
+_grad_band(void *data, int job, int worker)
+{
+    const ImlibGradJob *gj = data;
+    const int      *hlut = gj->hlut;
+    uint32_t       *p, col, c;
+    int             x, x0, y, y1, vl;
+
+    y = job * gj->band;
+    y1 = y + gj->band;
+    if (y1 > gj->h)
+        y1 = gj->h;
+
+    for (; y < y1; y++)
+    {
+        p = gj->data + y * gj->stride;
+        vl = gj->vlut[y];
+
+        if (gj->cmap)
+        {
+            const uint32_t *cm = gj->cmap + (vl - gj->smin);
+
+            col = cm[hlut[0]];
+            for (x0 = 0, x = 1; x < gj->w; x++)
+            {
+                c = cm[hlut[x]];
+                if (c == col)
+                    continue;
+                _grad_span(gj, col, p + x0, x - x0);
+                col = c;
+                x0 = x;
+            }
+        }
+        else
+        {
+            col = _grad_color(gj, vl + hlut[0]);
+            for (x0 = 0, x = 1; x < gj->w; x++)
+            {
+                c = _grad_color(gj, vl + hlut[x]);
+                if (c == col)
+                    continue;
+                _grad_span(gj, col, p + x0, x - x0);
+                col = c;
+                x0 = x;
+            }
+        }
+        _grad_span(gj, col, p + x0, gj->w - x0);
+    }
+}
 
 static void
 _DrawGradient(ImlibImage *im, int x, int y, int w, int h,
               ImlibRange *rg, double angle, ImlibOp op,
-              int clx, int cly, int clw, int clh, ImlibRangeMapFunc *rmf)
+              int clx, int cly, int clw, int clh, bool hsva)
 {
-    uint32_t       *map, *p;
+    ImlibGradJob    gj;
+    const uint32_t *map;
+    uint32_t       *cmap;
     int            *hlut, *vlut;
-    uint64_t        len, ll;
-    int             xx, yy, xoff, yoff, ww, hh, jump;
-    int             tmp, i, divw, divh, maxlut;
-    uint8_t         r, g, b, a;
+    uint64_t        len;
+    int             xx, yy, xoff, yoff, ww, hh;
+    int             i, divw, divh, maxlut, hmin, vmin, smax;
+    int             n_workers, n_jobs;
 
     xoff = yoff = 0;
     ww = w;
@@ -291,21 +416,31 @@ _DrawGradient(ImlibImage *im, int x, int y, int w, int h,
         yoff += (y - py);
     }
 
-    vlut = NULL;
-    map = NULL;
+    if (op == OP_COPY)
+    {
+        gj.span = __imlib_GetSpanDrawFunction(op, im->has_alpha, 1);
+        gj.span_opaque = __imlib_GetSpanDrawFunction(op, im->has_alpha, 0);
+    }
+    else
+    {
+        /* Destination alpha is left alone */
+        gj.span = gj.span_opaque = __imlib_GetSpanDrawFunction(op, 0, 1);
+    }
+    if (!gj.span)
+        return;
+
+    cmap = NULL;
 
-    hlut = malloc(sizeof(int) * ww);
+    hlut = malloc(sizeof(int) * (ww + hh));
     if (!hlut)
-        goto quit;
-    vlut = malloc(sizeof(int) * hh);
-    if (!vlut)
-        goto quit;
+        return;
+    vlut = hlut + ww;
 
     if (ww > hh)
         len = ww * 16;
     else
         len = hh * 16;
-    map = rmf(rg, len);
+    map = _range_map(rg, len, hsva);
     if (!map)
         goto quit;
 
@@ -342,94 +477,54 @@ _DrawGradient(ImlibImage *im, int x, int y, int w, int h,
             vlut[i] = (yy * i * len) / divh;
         maxlut += vlut[hh - 1];
     }
-    jump = im->w - w;
 
-    p = im->data + (y * im->w) + x;
-    switch (op)
+    gj.data = im->data + (y * im->w) + x;
+    gj.stride = im->w;
+    gj.w = w;
+    gj.h = h;
+    gj.map = map;
+    gj.len = len;
+    gj.maxlut = maxlut;
+
+    /* The luts are monotonic, so the visible s range is given by the ends */
+    gj.hlut = hlut + xoff;
+    gj.vlut = vlut + yoff;
+    hmin = MIN(gj.hlut[0], gj.hlut[w - 1]);
+    vmin = MIN(gj.vlut[0], gj.vlut[h - 1]);
+    smax = MAX(gj.hlut[0], gj.hlut[w - 1]) + MAX(gj.vlut[0], gj.vlut[h - 1]);
+
+    gj.cmap = NULL;
+    if ((int64_t)(smax - hmin - vmin) < (int64_t)w * h)
     {
-    case OP_COPY:
-        if (im->has_alpha)
-        {
-            __imlib_build_pow_lut();
-            for (yy = 0; yy < h; yy++)
-            {
-                for (xx = 0; xx < w; xx++)
-                {
-                    ll = len * (vlut[yoff + yy] + hlut[xoff + xx]);
-                    i = (ll > 0) ? (ll - 1) / maxlut : 0;
-                    ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                    BLEND_DST_ALPHA(r, g, b, a, p);
-                    p++;
-                }
-                p += jump;
-            }
-        }
-        else
-        {
-            for (yy = 0; yy < h; yy++)
-            {
-                for (xx = 0; xx < w; xx++)
-                {
-                    ll = len * (vlut[yoff + yy] + hlut[xoff + xx]);
-                    i = (ll > 0) ? (ll - 1) / maxlut : 0;
-                    ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                    BLEND(r, g, b, a, p);
-                    p++;
-                }
-                p += jump;
-            }
-        }
-        break;
-    case OP_ADD:
-        for (yy = 0; yy < h; yy++)
-        {
-            for (xx = 0; xx < w; xx++)
-            {
-                ll = len * (vlut[yoff + yy] + hlut[xoff + xx]);
-                i = (ll > 0) ? (ll - 1) / maxlut : 0;
-                ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                BLEND_SUB(r, g, b, a, p);
-                p++;
-            }
-            p += jump;
-        }
-        break;
-    case OP_SUBTRACT:
-        for (yy = 0; yy < h; yy++)
-        {
-            for (xx = 0; xx < w; xx++)
-            {
-                ll = len * (vlut[yoff + yy] + hlut[xoff + xx]);
-                i = (ll > 0) ? (ll - 1) / maxlut : 0;
-                ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                BLEND_SUB(r, g, b, a, p);
-                p++;
-            }
-            p += jump;
-        }
-        break;
-    case OP_RESHADE:
-        for (yy = 0; yy < h; yy++)
+        cmap = malloc((smax - hmin - vmin + 1) * sizeof(uint32_t));
+        if (cmap)
         {
-            for (xx = 0; xx < w; xx++)
-            {
-                ll = len * (vlut[yoff + yy] + hlut[xoff + xx]);
-                i = (ll > 0) ? (ll - 1) / maxlut : 0;
-                ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                BLEND_RE(r, g, b, a, p);
-                p++;
-            }
-            p += jump;
+            for (i = hmin + vmin; i <= smax; i++)
+                cmap[i - hmin - vmin] = _grad_color(&gj, i);
+            /* Index the table with hlut[x] + vlut[y] - vmin */
+            for (i = 0; i < w; i++)
+                hlut[xoff + i] -= hmin;
+            gj.smin = vmin;
+            gj.cmap = cmap;
         }
-        break;
-    default:
-        break;
     }
 
+    __imlib_build_pow_lut();
+
+    n_workers = 1;
+    if ((int64_t)w * h >= WORKERS_MIN_PIXELS)
+        n_workers = __imlib_WorkersGet();
+    n_jobs = n_workers > 1 ? 4 * n_workers : 1;
+    if (n_jobs > h)
+        n_jobs = h;
+    gj.band = (h + n_jobs - 1) / n_jobs;
+    n_jobs = (h + gj.band - 1) / gj.band;
+
+    __imlib_WorkersRun(_grad_band, &gj, n_jobs, n_workers);
+
   quit:
-    free(vlut);
+    free(cmap);
     free(hlut);
-    free(map);
 }
 
 void
@@ -437,8 +532,7 @@ __imlib_DrawGradient(ImlibImage *im, int x, int y, int w, int h,
                      ImlibRange *rg, double angle, ImlibOp op,
                      int clx, int cly, int clw, int clh)
 {
-    _DrawGradient(im, x, y, w, h, rg, angle, op, clx, cly, clw, clh,
-                  __imlib_MapRange);
+    _DrawGradient(im, x, y, w, h, rg, angle, op, clx, cly, clw, clh, false);
 }
 
 void
@@ -446,6 +540,5 @@ __imlib_DrawHsvaGradient(ImlibImage *im, int x, int y, int w, int h,
                          ImlibRange *rg, double angle, ImlibOp op,
                          int clx, int cly, int clw, int clh)
 {
-    _DrawGradient(im, x, y, w, h, rg, angle, op, clx, cly, clw, clh,
-                  __imlib_MapHsvaRange);
+    _DrawGradient(im, x, y, w, h, rg, angle, op, clx, cly, clw, clh, true);
 }
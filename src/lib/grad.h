@@ -11,6 +11,9 @@ typedef struct _ImlibRangeColor {
 
 typedef struct {
     ImlibRangeColor *color;
+    uint32_t       *map;        /* Last color map made from the colors */
+    int             map_len;
+    bool            map_hsva;
 } ImlibRange;
 
 ImlibRange     *__imlib_CreateRange(void);
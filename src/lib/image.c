@@ -9,14 +9,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include "blend.h"
 #include "debug.h"
 #include "file.h"
 #include "image.h"
 #include "loaders.h"
+#include "lock.h"
 #ifdef BUILD_X11
 #include "x11_pixmap.h"
 #endif
@@ -34,6 +37,8 @@ struct _ImlibImageFileInfo {
     /* vvv Private vvv */
     bool            keep_fp;
     bool            keep_mem;
+    ImlibWriteFunction wfunc;   /* Output sink (save) */
+    void           *wdata;
     /* ^^^ Private ^^^ */
 };
 
@@ -46,11 +51,36 @@ struct _ImlibLoaderCtx {
     char            granularity;
     int             pct, area, row;
     int             pass, n_pass;
+    ImlibRowFunction rfunc;     /* Row sink, when streaming */
+    void           *rdata;
+    uint32_t       *rows;       /* Row buffer, when streaming */
+    int             rrow;       /* Next row for the sink */
 };
 
-static ImlibImage *images = NULL;
+/* Image cache
+ * Cached images are indexed by a hash on the file name. All frames of a file
+ * hash to the same bucket, so decaching a file only has to visit one chain.
+ * Unreferenced cached images are also kept on a list, most recently released
+ * first. These are the ones that may be evicted, starting at the tail. */
+typedef struct {
+    ImlibImage    **buckets;
+    unsigned int    n_buckets;  /* Power of two */
+    unsigned int    n_images;
+    ImlibImage     *head, *tail;        /* LRU list */
+    uint64_t        bytes;      /* Data size of unreferenced images */
+} ImlibImageCache;
 
-static int      cache_size = 4096 * 1024;
+#define CACHE_BUCKETS_MIN 64
+
+static ImlibImageCache cache;
+
+/* Protects the cache, the flags and references of cached images, and
+ * cache_size. Never held while calling loaders or the pixmap cache. */
+LOCK_STATIC(cache_lock);
+
+static void     __imlib_CacheAccount(ImlibImage * im);
+
+static uint64_t cache_size = 4096 * 1024;
 
 __EXPORT__ uint32_t *
 __imlib_AllocateData(ImlibImage *im)
@@ -66,9 +96,55 @@ __imlib_AllocateData(ImlibImage *im)
     else
         im->data = malloc(w * h * sizeof(uint32_t));
 
+    if (IM_FLAG_ISSET(im, F_CACHED))
+    {
+        LOCK(cache_lock);
+        __imlib_CacheAccount(im);
+        UNLOCK(cache_lock);
+    }
+
     return im->data;
 }
 
+/* Allocate image data for a loader producing rows top to bottom, at most
+ * nrows at a time.
+ * When the image is streamed to a row sink, only a buffer for nrows rows is
+ * allocated. The rows must then be handed on by __imlib_LoadProgressRows()
+ * before the next ones are decoded.
+ * Use __imlib_LoadRow() to get the row pointers. */
+__EXPORT__ uint32_t *
+__imlib_AllocateRows(ImlibImage *im, int nrows)
+{
+    ImlibLoaderCtx *lc = im->lc;
+
+    if (!lc || !lc->rfunc)
+        return __imlib_AllocateData(im);
+
+    if (im->w <= 0 || im->h <= 0 || nrows <= 0)
+        return NULL;
+
+    free(lc->rows);
+    lc->rows = malloc((size_t)im->w * MIN(nrows, im->h) * sizeof(uint32_t));
+    lc->rrow = 0;
+
+    return lc->rows;
+}
+
+/* Where to put row number row */
+__EXPORT__ uint32_t *
+__imlib_LoadRow(ImlibImage *im, int row)
+{
+    ImlibLoaderCtx *lc = im->lc;
+
+    if (lc && lc->rows)
+        return lc->rows + (size_t)(row - lc->rrow) * im->w;
+
+    if (!im->data)
+        return NULL;
+
+    return im->data + (size_t)row * im->w;
+}
+
 __EXPORT__ void
 __imlib_FreeData(ImlibImage *im)
 {
@@ -81,6 +157,13 @@ __imlib_FreeData(ImlibImage *im)
         free(im->data);
 
     im->data = NULL;
+
+    if (IM_FLAG_ISSET(im, F_CACHED))
+    {
+        LOCK(cache_lock);
+        __imlib_CacheAccount(im);
+        UNLOCK(cache_lock);
+    }
 }
 
 __EXPORT__ void
@@ -181,11 +264,16 @@ __imlib_ProduceImage(void)
     ImlibImage     *im;
 
     im = calloc(1, sizeof(ImlibImage));
+    if (!im)
+        return NULL;
     im->flags = F_FORMAT_IRRELEVANT;
+    LOCK_INIT_RECURSIVE(im->data_lock);
 
     return im;
 }
 
+static void     __imlib_FrameSessionFree(ImlibFrameSession * fs);
+
 /* free an image struct */
 static void
 __imlib_ConsumeImage(ImlibImage *im)
@@ -208,101 +296,240 @@ __imlib_ConsumeImage(ImlibImage *im)
 
     free(im->pframe);
 
+    __imlib_FrameSessionFree(im->fsess);
+    if (im->ldr_state && im->ldr_state_free)
+        im->ldr_state_free(im->ldr_state);
+
+    LOCK_DESTROY(im->data_lock);
+
     free(im);
 }
 
+static unsigned int
+__imlib_CacheHash(const char *file)
+{
+    const unsigned char *p;
+    unsigned int    hash;
+
+    /* FNV-1a */
+    hash = 2166136261u;
+    for (p = (const unsigned char *)file; *p; p++)
+        hash = (hash ^ *p) * 16777619u;
+
+    return hash;
+}
+
+static int
+__imlib_CacheResize(unsigned int n_buckets)
+{
+    ImlibImage    **buckets, *im, *im_next;
+    unsigned int    i, ix;
+
+    buckets = calloc(n_buckets, sizeof(ImlibImage *));
+    if (!buckets)
+        return -1;
+
+    for (i = 0; i < cache.n_buckets; i++)
+    {
+        for (im = cache.buckets[i]; im; im = im_next)
+        {
+            im_next = im->hnext;
+            ix = im->hash & (n_buckets - 1);
+            im->hnext = buckets[ix];
+            buckets[ix] = im;
+        }
+    }
+
+    free(cache.buckets);
+    cache.buckets = buckets;
+    cache.n_buckets = n_buckets;
+
+    return 0;
+}
+
+static void
+__imlib_CacheListUnlink(ImlibImage *im)
+{
+    if (im->prev)
+        im->prev->next = im->next;
+    else
+        cache.head = im->next;
+    if (im->next)
+        im->next->prev = im->prev;
+    else
+        cache.tail = im->prev;
+    im->next = im->prev = NULL;
+}
+
+static void
+__imlib_CacheListPush(ImlibImage *im)
+{
+    im->prev = NULL;
+    im->next = cache.head;
+    if (cache.head)
+        cache.head->prev = im;
+    else
+        cache.tail = im;
+    cache.head = im;
+}
+
+static void
+__imlib_CacheListAppend(ImlibImage *im)
+{
+    im->next = NULL;
+    im->prev = cache.tail;
+    if (cache.tail)
+        cache.tail->next = im;
+    else
+        cache.head = im;
+    cache.tail = im;
+}
+
+/* Update cache byte count after change of image references or data */
+static void
+__imlib_CacheAccount(ImlibImage *im)
+{
+    size_t          bytes;
+
+    bytes = 0;
+    if (im->references <= 0 && im->data)
+        bytes = (size_t)im->w * im->h * sizeof(uint32_t);
+
+    cache.bytes = cache.bytes - im->cache_bytes + bytes;
+    im->cache_bytes = bytes;
+}
+
+/* Take a reference on a cached image */
+static void
+__imlib_CacheAcquire(ImlibImage *im)
+{
+    if (im->references <= 0)
+        __imlib_CacheListUnlink(im);    /* No longer evictable */
+    im->references++;
+    __imlib_CacheAccount(im);
+}
+
+/* Last reference on a cached image has been dropped */
+static void
+__imlib_CacheRelease(ImlibImage *im)
+{
+    __imlib_CacheListPush(im);
+    __imlib_CacheAccount(im);
+}
+
+/* Invalidate image. If it is cached and unreferenced move it to the LRU
+ * tail so it goes at the next cleanup. */
+static void
+__imlib_CacheInvalidate(ImlibImage *im)
+{
+    IM_FLAG_SET(im, F_INVALID);
+
+    if (!IM_FLAG_ISSET(im, F_CACHED) || im->references > 0)
+        return;
+
+    __imlib_CacheListUnlink(im);
+    __imlib_CacheListAppend(im);
+}
+
 static ImlibImage *
-__imlib_FindCachedImage(const char *file, int frame)
+__imlib_FindCachedImage(const char *file, const ImlibLoadArgs *ila)
 {
-    ImlibImage     *im, *im_prev;
+    ImlibImage     *im;
+    unsigned int    hash;
+
+    DP("%s: '%s' frame %d\n", __func__, file, ila->frame);
 
-    DP("%s: '%s' frame %d\n", __func__, file, frame);
+    if (cache.n_images == 0)
+        goto done;
 
-    for (im = images, im_prev = NULL; im; im_prev = im, im = im->next)
+    hash = __imlib_CacheHash(file);
+
+    for (im = cache.buckets[hash & (cache.n_buckets - 1)]; im; im = im->hnext)
     {
         /* if the filenames match and it's valid */
-        if (strcmp(file, im->file) || IM_FLAG_ISSET(im, F_INVALID))
+        if (im->hash != hash || IM_FLAG_ISSET(im, F_INVALID))
+            continue;
+        if (ila->frame != im->frame || strcmp(file, im->file))
             continue;
-        if (frame != im->frame)
+        /* Images loaded with different size hints may differ */
+        if (ila->hint_w != im->hint_w || ila->hint_h != im->hint_h)
             continue;
 
-        /* move the image to the head of the image list */
-        if (im_prev)
-        {
-            im_prev->next = im->next;
-            im->next = images;
-            images = im;
-        }
         DP(" got %p: '%s' frame %d\n", im, im->fi->name, im->frame);
         return im;
     }
+
+  done:
     DP(" got none\n");
     return NULL;
 }
 
-/* add an image to the cache of images (at the start) */
-static void
+/* add a (referenced) image to the cache of images */
+static int
 __imlib_AddImageToCache(ImlibImage *im)
 {
-    DP("%s: %p: '%s' frame %d\n", __func__, im, im->fi->name, im->frame);
-    im->next = images;
-    images = im;
-}
+    unsigned int    ix;
 
-/* Remove invalidated images from image cache */
-static void
-__imlib_PruneImageCache(void)
-{
-    ImlibImage     *im, *im_prev, *im_next;
+    DP("%s: %p: '%s' frame %d\n", __func__, im, im->fi->name, im->frame);
 
-    for (im = images, im_prev = NULL; im; im = im_next)
+    if (cache.n_images >= cache.n_buckets &&
+        __imlib_CacheResize(cache.n_buckets ?
+                            2 * cache.n_buckets : CACHE_BUCKETS_MIN))
     {
-        im_next = im->next;
+        if (!cache.buckets)
+            return -1;
+        /* Otherwise just go on with longer chains */
+    }
 
-        if (im->references <= 0 && IM_FLAG_ISSET(im, F_INVALID))
-        {
-            DP("%s: %p: '%s' frame %d\n", __func__,
-               im, im->fi->name, im->frame);
+    im->hash = __imlib_CacheHash(im->file);
+    ix = im->hash & (cache.n_buckets - 1);
+    im->hnext = cache.buckets[ix];
+    cache.buckets[ix] = im;
 
-            if (im_prev)
-                im_prev->next = im_next;
-            else
-                images = im_next;
-            __imlib_ConsumeImage(im);
-        }
-        else
-        {
-            im_prev = im;
-        }
-    }
+    cache.n_images++;
+
+    IM_FLAG_SET(im, F_CACHED);
+
+    return 0;
 }
 
-static int
-__imlib_ImageCacheSize(void)
+/* remove an image from the cache of images
+ * Unreferenced images must be unlinked from the LRU list first. */
+static void
+__imlib_RemoveImageFromCache(ImlibImage *im)
 {
-    ImlibImage     *im;
-    int             current_cache;
+    ImlibImage    **pim;
+
+    DP("%s: %p: '%s' frame %d\n", __func__, im, im->fi->name, im->frame);
 
-    current_cache = 0;
-    for (im = images; im; im = im->next)
+    for (pim = &cache.buckets[im->hash & (cache.n_buckets - 1)]; *pim;
+         pim = &(*pim)->hnext)
     {
-        if (im->references == 0 && im->data)
-            current_cache += im->w * im->h * sizeof(uint32_t);
+        if (*pim == im)
+        {
+            *pim = im->hnext;
+            break;
+        }
     }
+    im->hnext = NULL;
 
-    return current_cache;
+    cache.n_images--;
+
+    cache.bytes -= im->cache_bytes;
+    im->cache_bytes = 0;
+    IM_FLAG_CLR(im, F_CACHED);
 }
 
-/* work out how much we have floaitng aroudn in our speculative cache */
+/* work out how much we have floating around in our speculative cache */
 /* (images and pixmaps that have 0 reference counts) */
-int
+uint64_t
 __imlib_CurrentCacheSize(void)
 {
-    int             current_cache;
+    uint64_t        current_cache;
 
-    __imlib_PruneImageCache();
-
-    current_cache = __imlib_ImageCacheSize();
+    LOCK(cache_lock);
+    current_cache = cache.bytes;
+    UNLOCK(cache_lock);
 
 #ifdef BUILD_X11
     current_cache += __imlib_PixmapCacheSize();
@@ -315,34 +542,48 @@ __imlib_CurrentCacheSize(void)
 static void
 __imlib_CleanupImageCache(void)
 {
-    ImlibImage     *im;
-    int             current_cache;
+    ImlibImage     *im, *evicted;
+    uint64_t        pixmap_cache;
 
-    current_cache = __imlib_CurrentCacheSize();
+    pixmap_cache = 0;
+#ifdef BUILD_X11
+    pixmap_cache = __imlib_PixmapCacheSize();
+#endif
 
-    /* while the cache size of 0 ref coutn data is bigger than the set value */
-    /* clean out the oldest members of the imaeg cache */
-    while (current_cache > cache_size)
-    {
-        for (im = images; im; im = im->next)
-        {
-            if (im->references > 0)
-                continue;
+    LOCK(cache_lock);
 
-            IM_FLAG_SET(im, F_INVALID); /* Will be pruned shortly */
-            current_cache = __imlib_CurrentCacheSize();
+    /* Evict the least recently used unreferenced images until the cache
+     * fits. Invalidated images sit at the tail and are always evicted. */
+    evicted = NULL;
+    while ((im = cache.tail))
+    {
+        if (!IM_FLAG_ISSET(im, F_INVALID) &&
+            cache.bytes + pixmap_cache <= cache_size)
             break;
-        }
-        if (!im)
-            break;              /* Nothing left to clean out */
+
+        __imlib_CacheListUnlink(im);
+        __imlib_RemoveImageFromCache(im);
+        im->next = evicted;
+        evicted = im;
+    }
+
+    UNLOCK(cache_lock);
+
+    /* Free them outside the lock */
+    while ((im = evicted))
+    {
+        evicted = im->next;
+        __imlib_ConsumeImage(im);
     }
 }
 
 /* set the cache size */
 void
-__imlib_SetCacheSize(int size)
+__imlib_SetCacheSize(uint64_t size)
 {
+    LOCK(cache_lock);
     cache_size = size;
+    UNLOCK(cache_lock);
     __imlib_CleanupImageCache();
 #ifdef BUILD_X11
     __imlib_CleanupImagePixmapCache();
@@ -350,10 +591,16 @@ __imlib_SetCacheSize(int size)
 }
 
 /* return the cache size */
-int
+uint64_t
 __imlib_GetCacheSize(void)
 {
-    return cache_size;
+    uint64_t        size;
+
+    LOCK(cache_lock);
+    size = cache_size;
+    UNLOCK(cache_lock);
+
+    return size;
 }
 
 int
@@ -361,15 +608,25 @@ __imlib_DecacheFile(const char *file)
 {
     int             n = 0;
     ImlibImage     *im;
+    unsigned int    hash;
+
+    hash = __imlib_CacheHash(file);
 
-    for (im = images; im; im = im->next)
+    LOCK(cache_lock);
+    if (cache.n_images > 0)
     {
-        if (!strcmp(file, im->file))
+        for (im = cache.buckets[hash & (cache.n_buckets - 1)]; im;
+             im = im->hnext)
         {
-            IM_FLAG_SET(im, F_INVALID);
-            ++n;
+            if (im->hash == hash && !strcmp(file, im->file))
+            {
+                __imlib_CacheInvalidate(im);
+                ++n;
+            }
         }
     }
+    UNLOCK(cache_lock);
+
     if (n > 0)
         __imlib_CleanupImageCache();
     return n;
@@ -421,6 +678,8 @@ __imlib_ImageCheckAlpha(ImlibImage *im)
     const uint32_t *p;
 
     p = im->data;
+    if (!p)
+        return;                 /* Streamed */
 
     for (y = 0; y < im->h; y++)
     {
@@ -488,6 +747,10 @@ __imlib_LoadCtxInit(ImlibImage *im, ImlibLoaderCtx *lc,
     lc->area = 0;
     lc->pass = 0;
     lc->n_pass = 1;
+    lc->rfunc = NULL;
+    lc->rdata = NULL;
+    lc->rows = NULL;
+    lc->rrow = 0;
 }
 
 static int
@@ -516,8 +779,8 @@ ImlibImage     *
 __imlib_LoadImage(const char *file, ImlibLoadArgs *ila)
 {
     ImlibImage     *im;
-    ImlibLoader   **loaders, *best_loader, *l, *previous_l;
-    int             err, loader_ret;
+    ImlibLoader   **loaders, *best_loader, *sniffed, *l;
+    int             i, stage, err, loader_ret;
     ImlibLoaderCtx  ilc;
     struct stat     st;
     FILE           *fp;
@@ -528,8 +791,10 @@ __imlib_LoadImage(const char *file, ImlibLoadArgs *ila)
 
     if (!ila->nocache)
     {
+        LOCK(cache_lock);
+
         /* see if we already have the image cached */
-        im = __imlib_FindCachedImage(file, ila->frame);
+        im = __imlib_FindCachedImage(file, ila);
 
         /* if we found a cached image and we should always check that it is */
         /* accurate to the disk conents if they changed since we last loaded */
@@ -547,22 +812,26 @@ __imlib_LoadImage(const char *file, ImlibLoadArgs *ila)
                 if (current_modified_time != im->moddate)
                 {
                     /* invalidate image */
-                    IM_FLAG_SET(im, F_INVALID);
+                    __imlib_CacheInvalidate(im);
                 }
                 else
                 {
                     /* image is ok to re-use - program is just being stupid loading */
                     /* the same data twice */
-                    im->references++;
+                    __imlib_CacheAcquire(im);
+                    UNLOCK(cache_lock);
                     return im;
                 }
             }
             else
             {
-                im->references++;
+                __imlib_CacheAcquire(im);
+                UNLOCK(cache_lock);
                 return im;
             }
         }
+
+        UNLOCK(cache_lock);
     }
 
     fp = ila->fp;
@@ -615,6 +884,9 @@ __imlib_LoadImage(const char *file, ImlibLoadArgs *ila)
     im->file = strdup(file);
     im->key = im_key;
     im->frame = ila->frame;
+    im->hint_w = ila->hint_w;
+    im->hint_h = ila->hint_h;
+    im->threads = ila->threads;
 
     if (__imlib_ImageFileContextPush(im, im_file ? im_file : im->file) ||
         __imlib_FileContextOpen(im->fi, fp, ila->fdata, st.st_size))
@@ -630,37 +902,51 @@ __imlib_LoadImage(const char *file, ImlibLoadArgs *ila)
 
     im->data_memory_func = imlib_context_get_image_data_memory_function();
 
-    if (ila->pfunc)
+    if (ila->pfunc || ila->rfunc)
     {
         __imlib_LoadCtxInit(im, &ilc, ila->pfunc, ila->pgran);
+        ilc.rfunc = ila->rfunc;
+        ilc.rdata = ila->rdata;
         ila->immed = 1;
     }
 
-    /* take a guess by extension on the best loader to use */
+    /* take a guess by extension on the best loader to use (e.g. svgz),
+     * the signature is only checked if that fails */
     best_loader = __imlib_FindBestLoader(im->fi->name, NULL, 0);
+    sniffed = NULL;
 
     loader_ret = LOAD_FAIL;
     loaders = NULL;
 
-    for (l = previous_l = NULL;;)
+    for (i = 0, stage = 0;;)
     {
-        if (l == NULL && best_loader)
+        if (stage == 0)
         {
-            l = best_loader;    /* First try best_loader, if any */
+            stage = 1;
+            l = best_loader;    /* First try best_loader */
+            if (!l)
+                continue;
         }
-        else if (!loaders)
+        else if (stage == 1)
         {
-            loaders = __imlib_GetLoaderList();
-            l = *loaders;
-            if (best_loader && l == best_loader)
-                continue;       /* Skip best_loader that already failed */
+            /* Then the one by signature, if the guess was not it */
+            stage = 2;
+            sniffed = __imlib_SniffLoader(im->fi->fdata, im->fi->fsize);
+            l = sniffed;
+            if (!l || l == best_loader)
+                continue;
         }
         else
         {
-            previous_l = l;
-            l = l->next;
-            if (best_loader && l == best_loader)
-                continue;       /* Skip best_loader that already failed */
+            /* Walk a snapshot of the list, other threads may reorder it.
+             * It excludes the loaders already ruled out by signature. */
+            if (!loaders)
+                loaders = __imlib_GetLoaderList();
+            if (!loaders)
+                break;
+            l = loaders[i++];
+            if (l && (l == best_loader || l == sniffed))
+                continue;       /* Skip loaders that already failed */
         }
         if (!l)
             break;
@@ -676,12 +962,8 @@ __imlib_LoadImage(const char *file, ImlibLoadArgs *ila)
             im->loader = l;
 
             /* move the successful loader to the head of the list */
-            if (previous_l)
-            {
-                previous_l->next = l->next;
-                l->next = *loaders;
-                *loaders = l;
-            }
+            if (loaders && i > 1)
+                __imlib_LoaderToHead(l);
             break;
 
         case LOAD_FAIL:
@@ -707,6 +989,17 @@ __imlib_LoadImage(const char *file, ImlibLoadArgs *ila)
         break;
     }
 
+    free(loaders);
+
+    if (ila->rfunc)
+    {
+        /* Hand on what the loader didn't stream itself */
+        if (loader_ret == LOAD_SUCCESS && im->data && ilc.rrow < im->h)
+            ila->rfunc(ila->rdata, im, im->data + (size_t)ilc.rrow * im->w,
+                       ilc.rrow, im->h - ilc.rrow);
+        free(ilc.rows);
+    }
+
     im->lc = NULL;
 
     __imlib_FileContextClose(im->fi);
@@ -726,33 +1019,56 @@ __imlib_LoadImage(const char *file, ImlibLoadArgs *ila)
     if (loader_ret == LOAD_BREAK)
         ila->nocache = 1;
     if (!ila->nocache)
-        __imlib_AddImageToCache(im);
-    else
+    {
+        LOCK(cache_lock);
+        if (__imlib_AddImageToCache(im))
+            ila->nocache = 1;
+        UNLOCK(cache_lock);
+    }
+    if (ila->nocache)
         IM_FLAG_SET(im, F_UNCACHEABLE);
 
     return im;
 }
 
+/* Load the pixel data of an image loaded without it.
+ * A cached image may be shared by several threads, so the data is loaded
+ * with the image data lock held. Other threads wait for the loader to
+ * finish before they see im->data. The lock is recursive, so progress
+ * callbacks may access the partially loaded image. */
 int
 __imlib_LoadImageData(ImlibImage *im)
 {
     int             err;
 
+    LOCK(im->data_lock);
+
     if (im->data)
-        return 0;               /* Ok */
+    {
+        err = 0;                /* Ok */
+        goto done;
+    }
 
     /* Just checking - it should be impossible that loader is not set */
     if (!im->loader)
-        return IMLIB_ERR_INTERNAL;
+    {
+        err = IMLIB_ERR_INTERNAL;
+        goto done;
+    }
 
     err = __imlib_FileContextOpen(im->fi, NULL, NULL, 0);
     if (err)
-        return err;
+        goto done;
     err = __imlib_LoadImageWrapper(im->loader, im, 1);
 
     __imlib_FileContextClose(im->fi);
 
-    return __imlib_LoadErrorToErrno(err, 0);
+    err = __imlib_LoadErrorToErrno(err, 0);
+
+  done:
+    UNLOCK(im->data_lock);
+
+    return err;
 }
 
 __EXPORT__ int
@@ -760,45 +1076,120 @@ __imlib_LoadEmbedded(ImlibLoader *l, ImlibImage *im, int load_data,
                      const char *file)
 {
     int             rc;
+    unsigned int    keep_state;
 
     if (!l || !im)
         return LOAD_FAIL;
 
-    __imlib_ImageFileContextPush(im, strdup(file));
+    if (__imlib_ImageFileContextPush(im, strdup(file)))
+        return LOAD_OOM;
     rc = __imlib_FileContextOpen(im->fi, NULL, NULL, 0);
     if (rc)
+    {
+        __imlib_FileContextClose(im->fi);
+        __imlib_ImageFileContextPop(im);
         return LOAD_FAIL;
+    }
+
+    /* Loader state belongs to the outer loader */
+    keep_state = im->flags & F_LOADER_STATE;
+    IM_FLAG_CLR(im, F_LOADER_STATE);
 
     rc = __imlib_LoadImageWrapper(l, im, load_data);
 
+    IM_FLAG_SET(im, keep_state);
+
     __imlib_FileContextClose(im->fi);
     __imlib_ImageFileContextPop(im);
 
     return rc;
 }
 
+/* Load from a real file, for loaders that must have one.
+ * The data is put in a memory file, opened by name through /proc/self/fd.
+ * Where memfd_create() is not available or fails, a file in /tmp is used. */
+static int
+_load_embedded_file(ImlibLoader *l, ImlibImage *im, int load_data,
+                    const void *fdata, unsigned int fsize)
+{
+    int             rc, fd;
+    char            file[64];
+    ssize_t         n;
+
+#ifdef HAVE_MEMFD_CREATE
+    fd = memfd_create("imlib2_embedded", MFD_CLOEXEC);
+    if (fd >= 0)
+    {
+        n = write(fd, fdata, fsize);
+        snprintf(file, sizeof(file), "/proc/self/fd/%d", fd);
+        rc = n == (ssize_t) fsize ?
+            __imlib_LoadEmbedded(l, im, load_data, file) : LOAD_FAIL;
+        close(fd);
+        return rc;
+    }
+#endif
+
+    strcpy(file, "/tmp/imlib2_embedded-XXXXXX");
+    fd = mkstemp(file);
+    if (fd < 0)
+        return LOAD_OOM;
+
+    n = write(fd, fdata, fsize);
+    close(fd);
+
+    rc = n == (ssize_t) fsize ?
+        __imlib_LoadEmbedded(l, im, load_data, file) : LOAD_FAIL;
+
+    unlink(file);
+
+    return rc;
+}
+
 __EXPORT__ int
-__imlib_LoadEmbeddedMem(ImlibLoader *l, ImlibImage *im, int load_data,
-                        const void *fdata, unsigned int fsize)
+__imlib_LoadEmbeddedMemNamed(ImlibLoader *l, ImlibImage *im, int load_data,
+                             const char *name, const void *fdata,
+                             unsigned int fsize)
 {
     int             rc;
+    unsigned int    keep_state;
 
     if (!l || !im)
         return LOAD_FAIL;
 
-    __imlib_ImageFileContextPush(im, NULL);
+    if (l->module->ldr_flags & LDR_FLAG_FILE)
+        return _load_embedded_file(l, im, load_data, fdata, fsize);
+
+    if (__imlib_ImageFileContextPush(im, name ? strdup(name) : NULL))
+        return LOAD_OOM;
     rc = __imlib_FileContextOpen(im->fi, NULL, fdata, fsize);
     if (rc)
+    {
+        __imlib_FileContextClose(im->fi);
+        __imlib_ImageFileContextPop(im);
         return LOAD_FAIL;
+    }
+
+    /* Loader state belongs to the outer loader */
+    keep_state = im->flags & F_LOADER_STATE;
+    IM_FLAG_CLR(im, F_LOADER_STATE);
 
     rc = __imlib_LoadImageWrapper(l, im, load_data);
 
+    IM_FLAG_SET(im, keep_state);
+
     __imlib_FileContextClose(im->fi);
     __imlib_ImageFileContextPop(im);
 
     return rc;
 }
 
+__EXPORT__ int
+__imlib_LoadEmbeddedMem(ImlibLoader *l, ImlibImage *im, int load_data,
+                        const void *fdata, unsigned int fsize)
+{
+    return __imlib_LoadEmbeddedMemNamed(l, im, load_data, NULL, fdata, fsize);
+}
+
 __EXPORT__ void
 __imlib_LoadProgressSetPass(ImlibImage *im, int pass, int n_pass)
 {
@@ -814,6 +1205,9 @@ __imlib_LoadProgress(ImlibImage *im, int x, int y, int w, int h)
     ImlibLoaderCtx *lc = im->lc;
     int             rc;
 
+    if (!lc->progress)
+        return 0;
+
     lc->area += w * h;
     lc->pct = (100. * lc->area + .1) / (im->w * im->h);
 
@@ -830,6 +1224,17 @@ __imlib_LoadProgressRows(ImlibImage *im, int row, int nrows)
     int             rc = 0;
     int             pct, nrtot;
 
+    if (lc->rows && nrows > 0)
+    {
+        /* Streaming - hand the rows on, the buffer is reused for the next */
+        if (lc->rfunc(lc->rdata, im, lc->rows, row, nrows))
+            return 1;
+        lc->rrow = row + nrows;
+    }
+
+    if (!lc->progress)
+        return 0;
+
     if (nrows > 0)
     {
         /* Row index counting up */
@@ -855,6 +1260,45 @@ __imlib_LoadProgressRows(ImlibImage *im, int row, int nrows)
     return rc;
 }
 
+/* Check load size hint for image of size w x h
+ * If the image may be decoded at reduced size, return 1 and the smallest
+ * acceptable size in *pw, *ph (aspect preserving fit into the hint box).
+ * Otherwise return 0. */
+__EXPORT__ int
+__imlib_LoadSizeHint(const ImlibImage *im, int w, int h, int *pw, int *ph)
+{
+    int64_t         sw, sh;
+
+    if (im->hint_w <= 0 && im->hint_h <= 0)
+        return 0;
+    if (w <= 0 || h <= 0)
+        return 0;
+
+    if (im->hint_h <= 0 ||
+        (im->hint_w > 0 && (int64_t)im->hint_w * h <= (int64_t)im->hint_h * w))
+    {
+        /* Width limited */
+        sw = im->hint_w;
+        sh = ((int64_t)h * im->hint_w + w - 1) / w;
+    }
+    else
+    {
+        /* Height limited */
+        sh = im->hint_h;
+        sw = ((int64_t)w * im->hint_h + h - 1) / h;
+    }
+
+    if (sw >= w || sh >= h)
+        return 0;
+
+    *pw = sw > 0 ? sw : 1;
+    *ph = sh > 0 ? sh : 1;
+
+    D("%s: %dx%d -> >= %dx%d\n", __func__, w, h, *pw, *ph);
+
+    return 1;
+}
+
 __EXPORT__ ImlibImageFrame *
 __imlib_GetFrame(ImlibImage *im)
 {
@@ -863,27 +1307,320 @@ __imlib_GetFrame(ImlibImage *im)
     return im->pframe;
 }
 
+/* Loader state is only kept by frame session decoder images.
+ * __imlib_LoaderStateSet() returns 0 if the image took over the state
+ * (freed with free_state() when replaced or when the session ends),
+ * otherwise -1, in which case the loader must dispose of it itself. */
+__EXPORT__ void *
+__imlib_LoaderState(const ImlibImage *im)
+{
+    return IM_FLAG_ISSET(im, F_LOADER_STATE) ? im->ldr_state : NULL;
+}
+
+__EXPORT__ int
+__imlib_LoaderStateSet(ImlibImage *im, void *state,
+                       void (*free_state)(void *state))
+{
+    if (!IM_FLAG_ISSET(im, F_LOADER_STATE))
+        return -1;
+
+    if (im->ldr_state && im->ldr_state_free)
+        im->ldr_state_free(im->ldr_state);
+
+    im->ldr_state = state;
+    im->ldr_state_free = free_state;
+
+    return 0;
+}
+
+/* Frame session
+ * Keeps an open decoder image (file mapping + loader state) and the
+ * composited canvas, so stepping to the next frame only decodes that one. */
+struct _ImlibFrameSession {
+    ImlibImage     *dec;        /* Decoder image */
+    uint32_t       *canvas;
+    int             cw, ch;     /* Canvas size */
+    uint32_t       *save;       /* Area saved for FF_FRAME_DISPOSE_PREV */
+    int             frame;      /* Last composited frame */
+    int             frame_count;
+    int             px, py, pw, ph;     /* Previous frame area */
+    int             pflags;     /* Previous frame flags */
+};
+
+static void
+__imlib_FrameSessionFree(ImlibFrameSession *fs)
+{
+    if (!fs)
+        return;
+
+    if (fs->dec)
+    {
+        __imlib_FileContextClose(fs->dec->fi);
+        __imlib_ConsumeImage(fs->dec);
+    }
+    free(fs->canvas);
+    free(fs->save);
+    free(fs);
+}
+
+static int
+__imlib_FrameSessionNew(const ImlibImage *im, ImlibFrameSession **pfs)
+{
+    ImlibFrameSession *fs;
+    ImlibImage     *dec;
+    const ImlibImageFrame *pf = im->pframe;
+    char           *name;
+
+    *pfs = NULL;
+
+    if (!pf || !im->loader || !im->fi || !im->file)
+        return IMLIB_ERR_BAD_FRAME;
+    if (im->fi->keep_mem || im->fi->keep_fp)
+        return EINVAL;          /* Need a file to reopen */
+
+    fs = calloc(1, sizeof(ImlibFrameSession));
+    if (!fs)
+        return ENOMEM;
+
+    fs->cw = pf->canvas_w > 0 ? pf->canvas_w : im->w;
+    fs->ch = pf->canvas_h > 0 ? pf->canvas_h : im->h;
+    fs->frame_count = pf->frame_count;
+    if (!IMAGE_DIMENSIONS_OK(fs->cw, fs->ch))
+        goto bail_bad;
+    fs->canvas = calloc(fs->cw * fs->ch, sizeof(uint32_t));
+    if (!fs->canvas)
+        goto bail_oom;
+
+    fs->dec = dec = __imlib_ProduceImage();
+    if (!dec)
+        goto bail_oom;
+    IM_FLAG_SET(dec, F_LOADER_STATE);
+    dec->loader = im->loader;
+    dec->file = strdup(im->file);
+    dec->key = im->key ? strdup(im->key) : NULL;
+    name = strdup(im->fi->name);
+    if (!dec->file || !name || __imlib_ImageFileContextPush(dec, name))
+    {
+        free(name);
+        goto bail_oom;
+    }
+    if (__imlib_FileContextOpen(dec->fi, NULL, NULL, 0))
+    {
+        __imlib_FrameSessionFree(fs);
+        return errno;
+    }
+
+    *pfs = fs;
+    return 0;
+
+  bail_bad:
+    __imlib_FrameSessionFree(fs);
+    return IMLIB_ERR_BAD_IMAGE;
+  bail_oom:
+    __imlib_FrameSessionFree(fs);
+    return ENOMEM;
+}
+
+/* Decode the next frame and composite it onto the canvas */
+static int
+__imlib_FrameSessionStep(ImlibFrameSession *fs)
+{
+    ImlibImage     *dec = fs->dec;
+    ImlibImageFrame fi0 = { }, *pf;
+    int             rc, x, y, w, h, i;
+
+    if (fs->frame_count > 0 && fs->frame >= fs->frame_count)
+        return IMLIB_ERR_BAD_FRAME;
+
+    __imlib_FreeData(dec);
+    free(dec->pframe);
+    dec->pframe = NULL;
+    dec->w = dec->h = 0;
+    dec->has_alpha = 0;
+    dec->frame = fs->frame + 1;
+
+    rc = __imlib_LoadImageWrapper(dec->loader, dec, 1);
+    if (rc != LOAD_SUCCESS)
+        return __imlib_LoadErrorToErrno(rc, 0);
+
+    pf = dec->pframe ? dec->pframe : &fi0;
+    if (pf->frame_count > 0)
+        fs->frame_count = pf->frame_count;
+
+    /* Dispose of previous frame */
+    if (fs->pflags & FF_FRAME_DISPOSE_PREV && fs->save)
+    {
+        for (i = 0; i < fs->ph; i++)
+            memcpy(fs->canvas + (fs->py + i) * fs->cw + fs->px,
+                   fs->save + i * fs->pw, fs->pw * sizeof(uint32_t));
+    }
+    else if (fs->pflags & (FF_FRAME_DISPOSE_CLEAR | FF_FRAME_DISPOSE_PREV))
+    {
+        for (i = 0; i < fs->ph; i++)
+            memset(fs->canvas + (fs->py + i) * fs->cw + fs->px, 0,
+                   fs->pw * sizeof(uint32_t));
+    }
+
+    x = pf->frame_x;
+    y = pf->frame_y;
+    w = dec->w;
+    h = dec->h;
+    CLIP(x, y, w, h, 0, 0, fs->cw, fs->ch);
+    if (w < 0 || h < 0)
+        w = h = 0;
+    fs->px = x;
+    fs->py = y;
+    fs->pw = w;
+    fs->ph = h;
+    fs->pflags = pf->frame_flags;
+
+    /* Save area to revert to before rendering the next frame */
+    if (pf->frame_flags & FF_FRAME_DISPOSE_PREV)
+    {
+        free(fs->save);
+        fs->save = w * h > 0 ? malloc(w * h * sizeof(uint32_t)) : NULL;
+        for (i = 0; fs->save && i < h; i++)
+            memcpy(fs->save + i * w, fs->canvas + (y + i) * fs->cw + x,
+                   w * sizeof(uint32_t));
+    }
+
+    __imlib_BlendRGBAToData(dec->data, dec->w, dec->h,
+                            fs->canvas, fs->cw, fs->ch,
+                            0, 0, pf->frame_x, pf->frame_y, dec->w, dec->h,
+                            !!(pf->frame_flags & FF_FRAME_BLEND), 1, NULL,
+                            OP_COPY, !dec->has_alpha);
+
+    fs->frame = dec->frame;
+
+    return 0;
+}
+
+/* Return new image with the frame following im composited onto the canvas.
+ * The session moves from im to the returned image. */
+ImlibImage     *
+__imlib_FrameNext(ImlibImage *im, int *perr)
+{
+    ImlibFrameSession *fs;
+    ImlibImage     *im_next;
+    const ImlibImageFrame *pf;
+    int             err;
+
+    fs = im->fsess;
+    if (fs)
+    {
+        im->fsess = NULL;
+    }
+    else
+    {
+        /* Start session, composite frames up to and including im's */
+        err = __imlib_FrameSessionNew(im, &fs);
+        while (!err && fs->frame < im->frame)
+            err = __imlib_FrameSessionStep(fs);
+        if (err)
+            goto bail;
+    }
+
+    err = __imlib_FrameSessionStep(fs);
+    if (err == IMLIB_ERR_BAD_FRAME)
+    {
+        im->fsess = fs;         /* At end - keep for next time */
+        *perr = err;
+        return NULL;
+    }
+    if (err)
+        goto bail;
+
+    err = ENOMEM;
+    im_next = __imlib_CreateImage(fs->cw, fs->ch, NULL, 0);
+    if (!im_next)
+        goto bail;
+    memcpy(im_next->data, fs->canvas, fs->cw * fs->ch * sizeof(uint32_t));
+    im_next->has_alpha = 1;
+    im_next->frame = fs->frame;
+    if (fs->dec->format)
+        im_next->format = strdup(fs->dec->format);
+
+    /* Frame info describing the full canvas */
+    if (!__imlib_GetFrame(im_next))
+    {
+        __imlib_ConsumeImage(im_next);
+        goto bail;
+    }
+    pf = fs->dec->pframe;
+    if (pf)
+        *im_next->pframe = *pf;
+    im_next->pframe->canvas_w = fs->cw;
+    im_next->pframe->canvas_h = fs->ch;
+    im_next->pframe->frame_count = fs->frame_count;
+    im_next->pframe->frame_x = im_next->pframe->frame_y = 0;
+    im_next->pframe->frame_flags &= FF_IMAGE_ANIMATED;
+
+    im_next->fsess = fs;
+
+    *perr = 0;
+    return im_next;
+
+  bail:
+    __imlib_FrameSessionFree(fs);
+    *perr = err;
+    return NULL;
+}
+
 /* free and image - if its uncachable and refcoutn is 0 - free it in reality */
 void
 __imlib_FreeImage(ImlibImage *im)
 {
+    if (!IM_FLAG_ISSET(im, F_CACHED))
+    {
+        /* Not shared through the cache - no locking needed */
+        if (im->references > 0)
+            im->references--;
+        if (im->references <= 0)
+            __imlib_ConsumeImage(im);
+        return;
+    }
+
+    LOCK(cache_lock);
+
     if (im->references > 0)
         im->references--;
 
     if (im->references > 0)
+    {
+        UNLOCK(cache_lock);
         return;
+    }
 
-    if (IM_FLAG_ISSET(im, F_UNCACHEABLE))
+    if (IM_FLAG_ISSET(im, F_INVALID))
+    {
+        __imlib_RemoveImageFromCache(im);
+        UNLOCK(cache_lock);
         __imlib_ConsumeImage(im);
+    }
     else
+    {
+        __imlib_CacheRelease(im);
+        UNLOCK(cache_lock);
         __imlib_CleanupImageCache();
+    }
+}
+
+/* make sure image is not picked up from the cache again */
+void
+__imlib_DecacheImage(ImlibImage *im)
+{
+    LOCK(cache_lock);
+    __imlib_CacheInvalidate(im);
+    UNLOCK(cache_lock);
 }
 
 /* dirty and image by settings its invalid flag */
 void
 __imlib_DirtyImage(ImlibImage *im)
 {
-    IM_FLAG_SET(im, F_INVALID);
+    LOCK(cache_lock);
+    __imlib_CacheInvalidate(im);
+    UNLOCK(cache_lock);
 #ifdef BUILD_X11
     /* and dirty all pixmaps generated from it */
     __imlib_DirtyPixmapsForImage(im);
@@ -896,6 +1633,59 @@ __imlib_GetKey(const ImlibImage *im)
     return im->key;
 }
 
+/* Write saver output to the output sink or file, return 0 on success */
+__EXPORT__ int
+__imlib_SaveWrite(ImlibImage *im, const void *buf, size_t len)
+{
+    ImlibImageFileInfo *fi = im->fi;
+
+    if (len == 0)
+        return 0;
+
+    if (fi->wfunc)
+    {
+        errno = 0;
+        if (fi->wfunc(fi->wdata, buf, len) == 0)
+            return 0;
+        if (errno == 0)
+            errno = EIO;
+        return -1;
+    }
+
+    return fwrite(buf, 1, len, fi->fp) == len ? 0 : -1;
+}
+
+static int
+_save_write_out(const void *buf, size_t len,
+                ImlibWriteFunction wfunc, void *wdata)
+{
+    errno = 0;
+    if (wfunc(wdata, buf, len) == 0)
+        return LOAD_SUCCESS;
+    if (errno == 0)
+        errno = EIO;
+    return LOAD_BADFILE;
+}
+
+/* Copy temporary saver output file to output sink */
+static int
+_save_copy_out(FILE *fp, ImlibWriteFunction wfunc, void *wdata)
+{
+    char            buf[65536];
+    size_t          nr;
+
+    if (fflush(fp) != 0 || fseek(fp, 0, SEEK_SET) != 0)
+        return LOAD_BADFILE;
+
+    while ((nr = fread(buf, 1, sizeof(buf), fp)) > 0)
+    {
+        if (_save_write_out(buf, nr, wfunc, wdata) != LOAD_SUCCESS)
+            return LOAD_BADFILE;
+    }
+
+    return ferror(fp) ? LOAD_BADFILE : LOAD_SUCCESS;
+}
+
 void
 __imlib_SaveImage(ImlibImage *im, const char *file, ImlibLoadArgs *ila)
 {
@@ -903,8 +1693,11 @@ __imlib_SaveImage(ImlibImage *im, const char *file, ImlibLoadArgs *ila)
     ImlibLoaderCtx  ilc;
     FILE           *fp = ila->fp;
     int             loader_ret;
+    bool            direct, memout;
+    char           *mbuf = NULL;
+    size_t          msize = 0;
 
-    if (!file && !fp)
+    if (!file && !fp && !ila->wfunc)
     {
         ila->err = ENOENT;
         return;
@@ -919,7 +1712,31 @@ __imlib_SaveImage(ImlibImage *im, const char *file, ImlibLoadArgs *ila)
         return;
     }
 
-    if (!fp)
+    /* Savers not writing with __imlib_SaveWrite() get a memory stream,
+     * or a temporary file if they need a real one */
+    direct = ila->wfunc && (l->module->ldr_flags & LDR_FLAG_WRITE);
+    memout = false;
+
+    if (direct)
+    {
+        fp = NULL;
+    }
+    else if (ila->wfunc)
+    {
+#ifdef HAVE_OPEN_MEMSTREAM
+        memout = !(l->module->ldr_flags & LDR_FLAG_FILE);
+        if (memout)
+            fp = open_memstream(&mbuf, &msize);
+        else
+#endif
+            fp = tmpfile();
+        if (!fp)
+        {
+            ila->err = errno;
+            return;
+        }
+    }
+    else if (!fp)
     {
         fp = __imlib_FileOpen(file, "wb", NULL);
         if (!fp)
@@ -934,11 +1751,31 @@ __imlib_SaveImage(ImlibImage *im, const char *file, ImlibLoadArgs *ila)
 
     __imlib_ImageFileContextPush(im, file ? strdup(file) : NULL);
     im->fi->fp = fp;
+    if (direct)
+    {
+        im->fi->wfunc = ila->wfunc;
+        im->fi->wdata = ila->wdata;
+    }
 
     /* call the saver */
     loader_ret = l->module->save(im);
 
-    if (!ila->fp)
+    if (memout)
+    {
+        /* mbuf and msize are valid after fclose() */
+        if (fclose(fp) != 0 && loader_ret == LOAD_SUCCESS)
+            loader_ret = LOAD_OOM;
+        if (loader_ret == LOAD_SUCCESS)
+            loader_ret = _save_write_out(mbuf, msize, ila->wfunc, ila->wdata);
+        free(mbuf);
+    }
+    else if (ila->wfunc && !direct)
+    {
+        if (loader_ret == LOAD_SUCCESS)
+            loader_ret = _save_copy_out(fp, ila->wfunc, ila->wdata);
+        fclose(fp);
+    }
+    else if (!ila->fp && !direct)
     {
         if (fflush(im->fi->fp) != 0)
             loader_ret = LOAD_BADFILE;  /* Use errno */
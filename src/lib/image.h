@@ -6,6 +6,7 @@
 #include <time.h>
 
 #include "types.h"
+#include "lock.h"
 
 typedef void    (*ImlibDataDestructorFunction)(ImlibImage * im, void *data);
 typedef void   *(*ImlibImageDataMemoryFunction)(void *, size_t size);
@@ -13,12 +14,17 @@ typedef void   *(*ImlibImageDataMemoryFunction)(void *, size_t size);
 typedef int     (*ImlibProgressFunction)(ImlibImage * im, char percent,
                                          int update_x, int update_y,
                                          int update_w, int update_h);
+typedef int     (*ImlibRowFunction)(void *data, ImlibImage * im,
+                                    const uint32_t * rows, int row, int nrows);
+typedef int     (*ImlibWriteFunction)(void *data, const void *buf, size_t len);
 
 #define F_UNCACHEABLE           (1 << 1)
 #define F_ALWAYS_CHECK_DISK     (1 << 2)
 #define F_INVALID               (1 << 3)
 #define F_DONT_FREE_DATA        (1 << 4)
 #define F_FORMAT_IRRELEVANT     (1 << 5)
+#define F_CACHED                (1 << 6)
+#define F_LOADER_STATE          (1 << 7)        /* Keeps loader state */
 
 /* Must match the ones in Imlib2.h.in */
 #define FF_IMAGE_ANIMATED       (1 << 0)        /* Frames are an animated sequence    */
@@ -30,6 +36,8 @@ typedef struct _ImlibImageFileInfo ImlibImageFileInfo;
 
 typedef struct _ImlibLoaderCtx ImlibLoaderCtx;
 
+typedef struct _ImlibFrameSession ImlibFrameSession;
+
 typedef struct {
     int             left, right, top, bottom;
 } ImlibBorder;
@@ -64,9 +72,15 @@ struct _ImlibImage {
 
     int             frame;
 
+    int             hint_w, hint_h;     /* Load size hint (0: none) */
+    int             threads;    /* Decoder threads (0: default) */
+
     /* vvv Private vvv */
     ImlibLoader    *loader;
-    ImlibImage     *next;
+    ImlibImage     *next, *prev;        /* Cache LRU list   */
+    ImlibImage     *hnext;      /* Cache hash chain */
+    unsigned int    hash;       /* Cache hash value */
+    size_t          cache_bytes;        /* Bytes accounted in cache */
 
     char           *file;
     char           *key;
@@ -80,6 +94,12 @@ struct _ImlibImage {
     ImlibImageDataMemoryFunction data_memory_func;
 
     ImlibImageFrame *pframe;
+    ImlibFrameSession *fsess;   /* Frame iteration session */
+
+    void           *ldr_state;  /* Loader state kept between frames */
+    void            (*ldr_state_free)(void *state);
+
+    LOCK_MEMBER(data_lock);     /* Serializes lazy data loading */
     /* ^^^ Private ^^^ */
 };
 
@@ -93,10 +113,17 @@ typedef struct {
     char            nocache;
     int             err;
     int             frame;
+    int             hint_w, hint_h;
+    int             threads;    /* Decoder threads (0: default) */
+    ImlibRowFunction rfunc;     /* Row sink (streaming load) */
+    void           *rdata;
+    ImlibWriteFunction wfunc;   /* Output sink (save, fp if NULL) */
+    void           *wdata;
 } ImlibLoadArgs;
 
 ImlibLoader    *__imlib_FindBestLoader(const char *file, const char *format,
                                        int for_save);
+ImlibLoader    *__imlib_SniffLoader(const void *fdata, size_t fsize);
 
 ImlibImage     *__imlib_CreateImage(int w, int h, uint32_t * data, int zero);
 ImlibImage     *__imlib_LoadImage(const char *file, ImlibLoadArgs * ila);
@@ -105,13 +132,21 @@ int             __imlib_LoadEmbedded(ImlibLoader * l, ImlibImage * im,
 int             __imlib_LoadEmbeddedMem(ImlibLoader * l, ImlibImage * im,
                                         int load_data, const void *fdata,
                                         unsigned int fsize);
+int             __imlib_LoadEmbeddedMemNamed(ImlibLoader * l,
+                                             ImlibImage * im, int load_data,
+                                             const char *name,
+                                             const void *fdata,
+                                             unsigned int fsize);
 int             __imlib_LoadImageData(ImlibImage * im);
+void            __imlib_DecacheImage(ImlibImage * im);
 void            __imlib_DirtyImage(ImlibImage * im);
 void            __imlib_FreeImage(ImlibImage * im);
 void            __imlib_SaveImage(ImlibImage * im, const char *file,
                                   ImlibLoadArgs * ila);
 
 uint32_t       *__imlib_AllocateData(ImlibImage * im);
+uint32_t       *__imlib_AllocateRows(ImlibImage * im, int nrows);
+uint32_t       *__imlib_LoadRow(ImlibImage * im, int row);
 void            __imlib_FreeData(ImlibImage * im);
 void            __imlib_ReplaceData(ImlibImage * im, uint32_t * new_data);
 
@@ -120,6 +155,9 @@ void            __imlib_LoadProgressSetPass(ImlibImage * im,
 int             __imlib_LoadProgress(ImlibImage * im,
                                      int x, int y, int w, int h);
 int             __imlib_LoadProgressRows(ImlibImage * im, int row, int nrows);
+int             __imlib_SaveWrite(ImlibImage * im, const void *buf, size_t len);
+int             __imlib_LoadSizeHint(const ImlibImage * im, int w, int h,
+                                     int *pw, int *ph);
 
 const char     *__imlib_GetKey(const ImlibImage * im);
 
@@ -132,11 +170,16 @@ void            __imlib_FreeTag(ImlibImage * im, ImlibImageTag * t);
 void            __imlib_FreeAllTags(ImlibImage * im);
 
 ImlibImageFrame *__imlib_GetFrame(ImlibImage * im);
+ImlibImage     *__imlib_FrameNext(ImlibImage * im, int *perr);
+
+void           *__imlib_LoaderState(const ImlibImage * im);
+int             __imlib_LoaderStateSet(ImlibImage * im, void *state,
+                                       void (*free_state)(void *state));
 
-void            __imlib_SetCacheSize(int size);
+void            __imlib_SetCacheSize(uint64_t size);
 int             __imlib_DecacheFile(const char *file);
-int             __imlib_GetCacheSize(void);
-int             __imlib_CurrentCacheSize(void);
+uint64_t        __imlib_GetCacheSize(void);
+uint64_t        __imlib_CurrentCacheSize(void);
 
 #define IM_FLAG_SET(im, f)      ((im)->flags |= (f))
 #define IM_FLAG_CLR(im, f)      ((im)->flags &= ~(f))
@@ -10,21 +10,46 @@
 #include "file.h"
 #include "image.h"
 #include "loaders.h"
+#include "lock.h"
 
 #define DBG_PFX "LOAD"
 #define DP(fmt...) DC(DBG_LOAD, fmt)
 
 static ImlibLoader *loaders = NULL;
 static ImlibLoader *loaders_unloaded = NULL;
-static char     loaders_loaded = 0;
+static char     loaders_loaded = 0;     /* All but sig_only loaders loaded */
+
+/* Protects the loader lists. Not held while loaders are running. */
+LOCK_STATIC(loaders_lock);
+
+/* Signature: len bytes at offset offs must match magic (in mask bits) */
+typedef struct {
+    unsigned char   offs;       /* Offset in file */
+    unsigned char   len;        /* Length of magic */
+    const char     *magic;      /* Magic bytes */
+    const char     *mask;       /* Significant bits, NULL: all */
+} LoaderMagic;
+
+#define MAGIC(_m)           { 0, sizeof(_m) - 1, _m, NULL }
+#define MAGIC_AT(_o, _m)    { _o, sizeof(_m) - 1, _m, NULL }
+#define MAGIC_MASK(_m, _k)  { 0, sizeof(_m) - 1, _m, _k }
+#define MAGIC_END           { 0, 0, NULL, NULL }
+
+/* RIFF and IFF containers: type, any size, form type */
+#define MAGIC_RIFF(_t, _f) \
+    MAGIC_MASK(_t "\0\0\0\0" _f, "\377\377\377\377\0\0\0\0\377\377\377\377")
+/* ISO BMFF: any box size, "ftyp", major brand */
+#define MAGIC_FTYP(_b)      MAGIC_AT(4, "ftyp" _b)
 
 typedef struct {
     const char     *dso;
     const char     *const *ext;
+    const LoaderMagic *magic;   /* Signatures, NULL if none */
+    bool            sig_only;   /* Loader rejects anything else */
 } KnownLoader;
 
 static const char *const ext_ani[] = { "ani", NULL };
-static const char *const ext_argb[] = { "argb", NULL };
+static const char *const ext_argb[] = { "argb", "arg", NULL };
 #ifdef BUILD_AVIF_LOADER
 static const char *const ext_avif[] = { "avif", "avifs", NULL };
 #endif
@@ -96,73 +121,184 @@ static const char *const ext_zlib[] = { "gz", NULL };
 static const char *const ext_id3[] = { "mp3", NULL };
 #endif
 
+static const LoaderMagic sig_ani[] = { MAGIC_RIFF("RIFF", "ACON"), MAGIC_END };
+static const LoaderMagic sig_argb[] = { MAGIC("ARGB"), MAGIC_END };
+#ifdef BUILD_AVIF_LOADER
+static const LoaderMagic sig_avif[] = {
+    MAGIC_FTYP("avif"), MAGIC_FTYP("avis"), MAGIC_END
+};
+#endif
+static const LoaderMagic sig_bmp[] = { MAGIC("BM"), MAGIC_END };
+static const LoaderMagic sig_ff[] = { MAGIC("farbfeld"), MAGIC_END };
+#ifdef BUILD_GIF_LOADER
+static const LoaderMagic sig_gif[] = { MAGIC("GIF"), MAGIC_END };
+#endif
+#ifdef BUILD_HEIF_LOADER
+static const LoaderMagic sig_heif[] = {
+    MAGIC_FTYP("heic"), MAGIC_FTYP("heix"), MAGIC_FTYP("heim"),
+    MAGIC_FTYP("heis"), MAGIC_FTYP("hevc"), MAGIC_FTYP("hevx"),
+    MAGIC_FTYP("mif1"), MAGIC_FTYP("msf1"),
+#ifndef BUILD_AVIF_LOADER
+    MAGIC_FTYP("avif"), MAGIC_FTYP("avis"),
+#endif
+    MAGIC_END
+};
+#endif
+static const LoaderMagic sig_ico[] = {
+    MAGIC("\0\0\1\0"), MAGIC("\0\0\2\0"), MAGIC_END
+};
+#ifdef BUILD_JPEG_LOADER
+static const LoaderMagic sig_jpeg[] = { MAGIC("\377\330"), MAGIC_END };
+#endif
+#ifdef BUILD_J2K_LOADER
+static const LoaderMagic sig_j2k[] = {
+    MAGIC("\0\0\0\14jP  \r\n\207\n"), MAGIC("\r\n\207\n"),
+    MAGIC("\377\117\377\121"), MAGIC_END
+};
+#endif
+#ifdef BUILD_JXL_LOADER
+static const LoaderMagic sig_jxl[] = {
+    MAGIC("\377\12"), MAGIC("\0\0\0\14JXL \r\n\207\n"), MAGIC_END
+};
+#endif
+static const LoaderMagic sig_lbm[] = { MAGIC_RIFF("FORM", "ILBM"), MAGIC_END };
+#ifdef BUILD_PNG_LOADER
+static const LoaderMagic sig_png[] = { MAGIC("\211PNG\r\n\32\n"), MAGIC_END };
+#endif
+static const LoaderMagic sig_pnm[] = {
+    MAGIC_MASK("P0", "\377\370"), MAGIC("P8"), MAGIC_END
+};
+static const LoaderMagic sig_qoi[] = { MAGIC("qoif"), MAGIC_END };
+#ifdef BUILD_PS_LOADER
+static const LoaderMagic sig_ps[] = { MAGIC("%!PS"), MAGIC_END };
+#endif
+#ifdef BUILD_SVG_LOADER
+static const LoaderMagic sig_svg[] = { MAGIC("<svg"), MAGIC("<?xml"), MAGIC_END };
+#endif
+#ifdef BUILD_TIFF_LOADER
+static const LoaderMagic sig_tiff[] = {
+    MAGIC("II*\0"), MAGIC("MM\0*"), MAGIC_END
+};
+#endif
+#ifdef BUILD_WEBP_LOADER
+static const LoaderMagic sig_webp[] = { MAGIC_RIFF("RIFF", "WEBP"), MAGIC_END };
+#endif
+static const LoaderMagic sig_xbm[] = { MAGIC("#define"), MAGIC_END };
+static const LoaderMagic sig_xpm[] = { MAGIC("/* XPM */"), MAGIC_END };
+#ifdef BUILD_Y4M_LOADER
+static const LoaderMagic sig_y4m[] = { MAGIC("YUV4MPEG2 "), MAGIC_END };
+#endif
+
+#ifdef BUILD_BZ2_LOADER
+static const LoaderMagic sig_bz2[] = { MAGIC("BZh"), MAGIC_END };
+#endif
+#ifdef BUILD_LZMA_LOADER
+static const LoaderMagic sig_lzma[] = { MAGIC("\3757zXZ\0"), MAGIC_END };
+#endif
+#ifdef BUILD_ZLIB_LOADER
+static const LoaderMagic sig_zlib[] = { MAGIC("\37\213"), MAGIC_END };
+#endif
+
+#ifdef BUILD_ID3_LOADER
+static const LoaderMagic sig_id3[] = { MAGIC("ID3"), MAGIC_END };
+#endif
+
+/* Loaders marked sig_only reject files not matching their signatures, so
+ * they are never tried on files the sniffer did not assign to them.
+ * The others may accept more (text formats, secondary brands, ...). */
 static const KnownLoader loaders_known[] = {
-    { "ani", ext_ani },
-    { "argb", ext_argb },
+    { "ani", ext_ani, sig_ani, true },
+    { "argb", ext_argb, sig_argb, true },
 #ifdef BUILD_AVIF_LOADER
-    { "avif", ext_avif },
+    { "avif", ext_avif, sig_avif, false },
 #endif
-    { "bmp", ext_bmp },
-    { "ff", ext_ff },
+    { "bmp", ext_bmp, sig_bmp, true },
+    { "ff", ext_ff, sig_ff, true },
 #ifdef BUILD_GIF_LOADER
-    { "gif", ext_gif },
+    { "gif", ext_gif, sig_gif, true },
 #endif
 #ifdef BUILD_HEIF_LOADER
-    { "heif", ext_heif },
+    { "heif", ext_heif, sig_heif, false },
 #endif
-    { "ico", ext_ico },
+    { "ico", ext_ico, sig_ico, true },
 #ifdef BUILD_JPEG_LOADER
-    { "jpeg", ext_jpeg },
+    { "jpeg", ext_jpeg, sig_jpeg, true },
 #endif
 #ifdef BUILD_J2K_LOADER
-    { "j2k", ext_j2k },
+    { "j2k", ext_j2k, sig_j2k, true },
 #endif
 #ifdef BUILD_JXL_LOADER
-    { "jxl", ext_jxl },
+    { "jxl", ext_jxl, sig_jxl, true },
 #endif
-    { "lbm", ext_lbm },
+    { "lbm", ext_lbm, sig_lbm, true },
 #ifdef BUILD_PNG_LOADER
-    { "png", ext_png },
+    { "png", ext_png, sig_png, true },
 #endif
 #ifdef BUILD_PS_LOADER
-    { "ps", ext_ps },
+    { "ps", ext_ps, sig_ps, true },
 #endif
 #ifdef BUILD_RAW_LOADER
-    { "raw", ext_raw },
+    { "raw", ext_raw, NULL, false },
 #endif
-    { "pnm", ext_pnm },
-    { "qoi", ext_qoi },
+    { "pnm", ext_pnm, sig_pnm, true },
+    { "qoi", ext_qoi, sig_qoi, true },
 #ifdef BUILD_SVG_LOADER
-    { "svg", ext_svg },
+    { "svg", ext_svg, sig_svg, false },
 #endif
-    { "tga", ext_tga },
+    { "tga", ext_tga, NULL, false },
 #ifdef BUILD_TIFF_LOADER
-    { "tiff", ext_tiff },
+    { "tiff", ext_tiff, sig_tiff, true },
 #endif
 #ifdef BUILD_WEBP_LOADER
-    { "webp", ext_webp },
+    { "webp", ext_webp, sig_webp, true },
 #endif
-    { "xbm", ext_xbm },
-    { "xpm", ext_xpm },
+    { "xbm", ext_xbm, sig_xbm, false },
+    { "xpm", ext_xpm, sig_xpm, false },
 #ifdef BUILD_Y4M_LOADER
-    { "y4m", ext_y4m },
+    { "y4m", ext_y4m, sig_y4m, true },
 #endif
 
 #ifdef BUILD_BZ2_LOADER
-    { "bz2", ext_bz2 },
+    { "bz2", ext_bz2, sig_bz2, true },
 #endif
 #ifdef BUILD_LZMA_LOADER
-    { "lzma", ext_lzma },
+    { "lzma", ext_lzma, sig_lzma, false },
 #endif
 #ifdef BUILD_ZLIB_LOADER
-    { "zlib", ext_zlib },
+    { "zlib", ext_zlib, sig_zlib, true },
 #endif
 
 #ifdef BUILD_ID3_LOADER
-    { "id3", ext_id3 },
+    { "id3", ext_id3, sig_id3, false },
 #endif
 };
 
+/* Loaded loader per loaders_known[] entry, saves the module path lookup */
+static ImlibLoader *loaders_known_l[ARRAY_SIZE(loaders_known)];
+
+/* Find known loader from module file name (path/<dso>.so) */
+static const KnownLoader *
+_known_loader_by_file(const char *file)
+{
+    const char     *name, *ext;
+    unsigned int    i;
+    size_t          len;
+
+    name = strrchr(file, '/');
+    name = name ? name + 1 : file;
+    ext = strrchr(name, '.');
+    len = ext ? (size_t)(ext - name) : strlen(name);
+
+    for (i = 0; i < ARRAY_SIZE(loaders_known); i++)
+    {
+        if (strlen(loaders_known[i].dso) == len &&
+            memcmp(loaders_known[i].dso, name, len) == 0)
+            return &loaders_known[i];
+    }
+
+    return NULL;
+}
+
 static ImlibLoader *
 __imlib_LookupLoaderByModulePath(const char *file)
 {
@@ -184,6 +320,7 @@ __imlib_ProduceLoader(const char *file)
 {
     ImlibLoader    *l, *l_prev;
     ImlibLoaderModule *m;
+    const KnownLoader *kl;
 
     DP("%s: %s\n", __func__, file);
 
@@ -228,6 +365,8 @@ __imlib_ProduceLoader(const char *file)
 
     l->file = strdup(file);
     l->name = m->formats[0];
+    kl = _known_loader_by_file(file);
+    l->sig_only = kl && kl->sig_only;
 
   found:
     l->next = loaders;
@@ -271,6 +410,8 @@ __imlib_RemoveAllLoaders(void)
 {
     ImlibLoader    *l, *l_next;
 
+    /* NB! Loaders must not be in use by other threads */
+    LOCK(loaders_lock);
     for (l = loaders; l; l = l_next)
     {
         l_next = l->next;
@@ -278,15 +419,19 @@ __imlib_RemoveAllLoaders(void)
     }
     loaders = NULL;
     loaders_loaded = 0;
+    memset(loaders_known_l, 0, sizeof(loaders_known_l));
+    UNLOCK(loaders_lock);
 }
 
 /* find all the loaders we can find and load them up to see what they can */
-/* load / save */
+/* load / save. Known loaders only loading files with known signatures are */
+/* skipped, they are found by extension or signature when needed. */
 static void
 __imlib_LoadAllLoaders(void)
 {
     int             i, num;
     char          **list, *dso;
+    const KnownLoader *kl;
 
     DP("%s\n", __func__);
 
@@ -301,7 +446,8 @@ __imlib_LoadAllLoaders(void)
     for (i = num - 1; i >= 0; i--)
     {
         dso = list[i];
-        if (!__imlib_LookupLoaderByModulePath(dso))
+        kl = _known_loader_by_file(dso);
+        if (!(kl && kl->sig_only) && !__imlib_LookupLoaderByModulePath(dso))
             __imlib_ProduceLoader(dso);
         free(dso);
     }
@@ -310,12 +456,82 @@ __imlib_LoadAllLoaders(void)
     loaders_loaded = 1;
 }
 
+/* Return a NULL terminated snapshot of the loader list (to be freed).
+ * Loaders only accepting known signatures are left out, the caller is
+ * expected to have tried __imlib_SniffLoader() first. */
 ImlibLoader   **
 __imlib_GetLoaderList(void)
 {
+    ImlibLoader    *l, **list;
+    int             i, num;
+
+    LOCK(loaders_lock);
+
     if (!loaders_loaded)
         __imlib_LoadAllLoaders();
-    return &loaders;
+
+    for (l = loaders, num = 0; l; l = l->next)
+        num++;
+
+    list = malloc((num + 1) * sizeof(ImlibLoader *));
+    if (list)
+    {
+        for (l = loaders, i = 0; l; l = l->next)
+        {
+            if (!l->sig_only)
+                list[i++] = l;
+        }
+        list[i] = NULL;
+    }
+
+    UNLOCK(loaders_lock);
+
+    return list;
+}
+
+/* Move loader to the head of the list */
+void
+__imlib_LoaderToHead(ImlibLoader *l)
+{
+    ImlibLoader   **pl;
+
+    LOCK(loaders_lock);
+
+    for (pl = &loaders; *pl; pl = &(*pl)->next)
+    {
+        if (*pl != l)
+            continue;
+        *pl = l->next;
+        l->next = loaders;
+        loaders = l;
+        break;
+    }
+
+    UNLOCK(loaders_lock);
+}
+
+/* Get loader for known loader, load if necessary. Call with lock held. */
+static ImlibLoader *
+_known_loader_get(const KnownLoader *kl)
+{
+    ImlibLoader    *l, **pl;
+    char           *dso;
+
+    pl = &loaders_known_l[kl - loaders_known];
+    if (*pl)
+        return *pl;
+
+    dso = __imlib_ModuleFind(__imlib_PathToLoaders(), kl->dso);
+    if (!dso)
+        return NULL;
+    l = __imlib_LookupLoaderByModulePath(dso);
+    if (!l)
+        l = __imlib_ProduceLoader(dso);
+    free(dso);
+
+    *pl = l;
+
+    return l;
 }
 
 static ImlibLoader *
@@ -325,7 +541,6 @@ __imlib_LookupKnownLoader(const char *format)
     ImlibLoader    *l;
     unsigned int    i;
     const char     *const *exts;
-    char           *dso;
 
     kl = NULL;
     for (i = 0; i < ARRAY_SIZE(loaders_known); i++)
@@ -339,17 +554,66 @@ __imlib_LookupKnownLoader(const char *format)
         }
     }
 
+  done:
+    l = kl ? _known_loader_get(kl) : NULL;
+    DP("%s: '%s' -> '%s': %p\n", __func__, format, kl ? kl->dso : "-", l);
+    return l;
+}
+
+static bool
+_magic_match(const LoaderMagic *lm, const unsigned char *data, size_t size)
+{
+    unsigned int    i;
+
+    if (lm->offs + lm->len > size)
+        return false;
+
+    data += lm->offs;
+
+    if (!lm->mask)
+        return memcmp(data, lm->magic, lm->len) == 0;
+
+    for (i = 0; i < lm->len; i++)
+    {
+        if ((data[i] ^ lm->magic[i]) & lm->mask[i])
+            return false;
+    }
+
+    return true;
+}
+
+/* Find loader by signature in the initial file data, loading only that one */
+__EXPORT__ ImlibLoader *
+__imlib_SniffLoader(const void *fdata, size_t fsize)
+{
+    const KnownLoader *kl;
+    const LoaderMagic *lm;
+    ImlibLoader    *l;
+    unsigned int    i;
+
+    kl = NULL;
+    for (i = 0; i < ARRAY_SIZE(loaders_known); i++)
+    {
+        for (lm = loaders_known[i].magic; lm && lm->len; lm++)
+        {
+            if (!_magic_match(lm, fdata, fsize))
+                continue;
+            kl = &loaders_known[i];
+            goto done;
+        }
+    }
+
   done:
     l = NULL;
     if (kl)
     {
-        dso = __imlib_ModuleFind(__imlib_PathToLoaders(), kl->dso);
-        l = __imlib_LookupLoaderByModulePath(dso);
-        if (!l)
-            l = __imlib_ProduceLoader(dso);
-        free(dso);
+        LOCK(loaders_lock);
+        l = _known_loader_get(kl);
+        UNLOCK(loaders_lock);
+        if (l && !l->module->load)
+            l = NULL;
     }
-    DP("%s: '%s' -> '%s': %p\n", __func__, format, kl ? kl->dso : "-", l);
+    DP("%s: '%s': %p\n", __func__, kl ? kl->dso : "-", l);
     return l;
 }
 
@@ -416,11 +680,13 @@ __imlib_FindBestLoader(const char *file, const char *format, int for_save)
     if (!format || format[0] == '\0')
         return NULL;
 
+    LOCK(loaders_lock);
+
     if (loaders)
     {
         /* At least one loader loaded */
         l = __imlib_LookupLoadedLoader(format, for_save);
-        if (l || loaders_loaded)
+        if (l)
             goto done;
     }
 
@@ -428,11 +694,14 @@ __imlib_FindBestLoader(const char *file, const char *format, int for_save)
     if (l && _loader_ok_for(l, for_save))
         goto done;
 
-    __imlib_LoadAllLoaders();
+    if (!loaders_loaded)
+        __imlib_LoadAllLoaders();
 
     l = __imlib_LookupLoadedLoader(format, for_save);
 
   done:
+    UNLOCK(loaders_lock);
+
     DP("%s: fmt='%s': %s\n", __func__, format, l ? l->file : "-");
     return l;
 }
@@ -6,6 +6,8 @@
 #define IMLIB2_LOADER_VERSION 3
 
 #define LDR_FLAG_KEEP   0x01    /* Don't unload loader */
+#define LDR_FLAG_WRITE  0x02    /* Saver writes with __imlib_SaveWrite() */
+#define LDR_FLAG_FILE   0x04    /* Loader needs a real file (name, fp) */
 
 typedef struct {
     unsigned char   ldr_version;        /* Module ABI version */
@@ -24,9 +26,11 @@ struct _ImlibLoader {
     ImlibLoader    *next;
 
     const char     *name;
+    bool            sig_only;   /* Only loads files with known signature */
 };
 
 void            __imlib_RemoveAllLoaders(void);
 ImlibLoader   **__imlib_GetLoaderList(void);
+void            __imlib_LoaderToHead(ImlibLoader * l);
 
 #endif                          /* __LOADERS */
@@ -0,0 +1,58 @@
+#ifndef LOCK_H
+#define LOCK_H 1
+
+/* Locking primitives for the global caches and lists.
+ * They compile to nothing when thread safety is disabled.
+ * NB! Requires config.h to be included first. */
+
+#if ENABLE_THREADS
+
+#include <pthread.h>
+
+#define THREAD_LOCAL            __thread
+
+#define LOCK_STATIC(l)          static pthread_mutex_t l = PTHREAD_MUTEX_INITIALIZER
+#define LOCK_GLOBAL(l)          pthread_mutex_t l = PTHREAD_MUTEX_INITIALIZER
+#define LOCK_EXTERN(l)          extern pthread_mutex_t l
+#define LOCK(l)                 pthread_mutex_lock(&(l))
+#define UNLOCK(l)               pthread_mutex_unlock(&(l))
+
+#define ONCE_STATIC(o)          static pthread_once_t o = PTHREAD_ONCE_INIT
+#define ONCE(o, func)           pthread_once(&(o), func)
+
+/* Recursive lock embedded in an object */
+#define LOCK_MEMBER(l)          pthread_mutex_t l
+#define LOCK_INIT_RECURSIVE(l)  _lock_init_recursive(&(l))
+#define LOCK_DESTROY(l)         pthread_mutex_destroy(&(l))
+
+static inline void
+_lock_init_recursive(pthread_mutex_t *l)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(l, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+#else
+
+#define THREAD_LOCAL
+
+#define LOCK_STATIC(l)          static char l
+#define LOCK_GLOBAL(l)          char l
+#define LOCK_EXTERN(l)          extern char l
+#define LOCK(l)                 (void)(l)
+#define UNLOCK(l)               (void)(l)
+
+#define ONCE_STATIC(o)          static char o
+#define ONCE(o, func)           do { if (!o) { o = 1; func(); } } while (0)
+
+#define LOCK_MEMBER(l)          char l
+#define LOCK_INIT_RECURSIVE(l)  (void)(l)
+#define LOCK_DESTROY(l)         (void)(l)
+
+#endif                          /* ENABLE_THREADS */
+
+#endif                          /* LOCK_H */
@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include "file.h"
+#include "lock.h"
 #include "strutils.h"
 
 static char   **
@@ -46,30 +47,39 @@ _module_paths(const char *env, const char *mdir)
     return ppaths;
 }
 
+static char   **filter_paths = NULL;
+static char   **loader_paths = NULL;
+
+static void
+_filter_paths_init(void)
+{
+    filter_paths = _module_paths("IMLIB2_FILTER_PATH", "filters");
+}
+
+static void
+_loader_paths_init(void)
+{
+    loader_paths = _module_paths("IMLIB2_LOADER_PATH", "loaders");
+}
+
 char          **
 __imlib_PathToFilters(void)
 {
-    static char   **ppaths = NULL;
-
-    if (ppaths)
-        return ppaths;
+    ONCE_STATIC(filter_paths_once);
 
-    ppaths = _module_paths("IMLIB2_FILTER_PATH", "filters");
+    ONCE(filter_paths_once, _filter_paths_init);
 
-    return ppaths;
+    return filter_paths;
 }
 
 char          **
 __imlib_PathToLoaders(void)
 {
-    static char   **ppaths = NULL;
+    ONCE_STATIC(loader_paths_once);
 
-    if (ppaths)
-        return ppaths;
+    ONCE(loader_paths_once, _loader_paths_init);
 
-    ppaths = _module_paths("IMLIB2_LOADER_PATH", "loaders");
-
-    return ppaths;
+    return loader_paths;
 }
 
 static bool
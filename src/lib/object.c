@@ -5,21 +5,6 @@
 
 #include "object.h"
 
-typedef struct {
-    Imlib_Object_List _list_data;
-    char           *key;
-    void           *data;
-} Imlib_Hash_El;
-
-static int      _imlib_list_alloc_error = 0;
-static int      _imlib_hash_alloc_error = 0;
-
-static int
-__imlib_list_alloc_error(void)
-{
-    return _imlib_list_alloc_error;
-}
-
 void           *
 __imlib_object_list_prepend(void *in_list, void *in_item)
 {
@@ -73,178 +58,206 @@ __imlib_object_list_remove(void *in_list, void *in_item)
     return return_l;
 }
 
-static int
-__imlib_hash_gen(const char *key)
+/*
+ * Hash table
+ *
+ * Keys are hashed with FNV-1a over the string and the number, followed by
+ * the 64 bit MurmurHash3 finalizer. Slots hold the 32 bit hash (never 0)
+ * so probing rarely touches the entries themselves. The table grows at
+ * 3/4 load, removal shifts following entries back so no tombstones are
+ * needed.
+ */
+
+#define HASH_SIZE_MIN 16
+
+#define HASH_ENTRY(hash, i) ((hash)->entries + (size_t)(i) * (hash)->esize)
+
+static          uint32_t
+_hash_key(const Imlib_Hash_Key *key)
 {
-    unsigned int    hash_num = 0;
-    const unsigned char *ptr;
+    const unsigned char *p;
+    uint64_t        h;
 
-    if (!key)
-        return 0;
+    h = 14695981039346656037ULL ^ key->num;
+    if (key->str)
+        for (p = (const unsigned char *)key->str; *p; p++)
+            h = (h ^ *p) * 1099511628211ULL;
 
-    for (ptr = (unsigned char *)key; *ptr; ptr++)
-        hash_num ^= (int)(*ptr);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
 
-    hash_num &= 0xff;
-    return (int)hash_num;
+    return (uint32_t)h ? (uint32_t)h : 1;
 }
 
-Imlib_Hash     *
-__imlib_hash_add(Imlib_Hash *hash, const char *key, const void *data)
+static int
+_hash_key_eq(const Imlib_Hash_Key *k1, const Imlib_Hash_Key *k2)
 {
-    int             hash_num;
-    Imlib_Hash_El  *el;
+    if (k1->num != k2->num)
+        return 0;
+    if (!k1->str || !k2->str)
+        return k1->str == k2->str;
+    return !strcmp(k1->str, k2->str);
+}
 
-    _imlib_hash_alloc_error = 0;
+/* Slot of key, or of the empty slot where it would go */
+static unsigned int
+_hash_slot(const Imlib_Hash *hash, const Imlib_Hash_Key *key, uint32_t hv)
+{
+    unsigned int    i, mask;
 
-    if (!hash)
+    mask = hash->size - 1;
+    for (i = hv & mask; hash->hashes[i]; i = (i + 1) & mask)
     {
-        hash = calloc(1, sizeof(Imlib_Hash));
-        if (!hash)
-        {
-            _imlib_hash_alloc_error = 1;
-            return NULL;
-        }
+        if (hash->hashes[i] == hv &&
+            _hash_key_eq((const Imlib_Hash_Key *)HASH_ENTRY(hash, i), key))
+            break;
     }
 
-    if (!(el = malloc(sizeof(Imlib_Hash_El))))
-    {
-        if (hash->population <= 0)
-        {
-            free(hash);
-            hash = NULL;
-        }
-        _imlib_hash_alloc_error = 1;
-        return hash;
-    }
+    return i;
+}
+
+static int
+_hash_resize(Imlib_Hash *hash, unsigned int size)
+{
+    Imlib_Hash      new = *hash;
+    unsigned int    i, j, mask;
 
-    if (key)
+    new.size = size;
+    new.hashes = calloc(size, sizeof(uint32_t));
+    new.entries = malloc((size_t)size * hash->esize);
+    if (!new.hashes || !new.entries)
     {
-        el->key = strdup(key);
-        if (!el->key)
-        {
-            free(el);
-            _imlib_hash_alloc_error = 1;
-            return hash;
-        }
-        hash_num = __imlib_hash_gen(key);
+        free(new.hashes);
+        free(new.entries);
+        return 0;
     }
-    else
+
+    mask = size - 1;
+    for (i = 0; i < hash->size; i++)
     {
-        el->key = NULL;
-        hash_num = 0;
+        if (!hash->hashes[i])
+            continue;
+        for (j = hash->hashes[i] & mask; new.hashes[j]; j = (j + 1) & mask)
+            ;
+        new.hashes[j] = hash->hashes[i];
+        memcpy(HASH_ENTRY(&new, j), HASH_ENTRY(hash, i), hash->esize);
     }
 
-    el->data = (void *)data;
+    free(hash->hashes);
+    free(hash->entries);
+    *hash = new;
 
-    hash->buckets[hash_num] =
-        __imlib_object_list_prepend(hash->buckets[hash_num], el);
-
-    if (__imlib_list_alloc_error())
-    {
-        _imlib_hash_alloc_error = 1;
-        free(el->key);
-        free(el);
-        return hash;
-    }
+    return 1;
+}
 
-    hash->population++;
+void
+__imlib_hash_init(Imlib_Hash *hash, unsigned int esize)
+{
+    memset(hash, 0, sizeof(Imlib_Hash));
+    hash->esize = esize;
+}
 
-    return hash;
+void
+__imlib_hash_free(Imlib_Hash *hash)
+{
+    free(hash->hashes);
+    free(hash->entries);
+    __imlib_hash_init(hash, hash->esize);
 }
 
 void           *
-__imlib_hash_find(Imlib_Hash *hash, const char *key)
+__imlib_hash_find(const Imlib_Hash *hash, const Imlib_Hash_Key *key)
 {
-    int             hash_num;
-    Imlib_Hash_El  *el;
-    Imlib_Object_List *l;
+    unsigned int    i;
 
-    _imlib_hash_alloc_error = 0;
+    if (hash->count == 0)
+        return NULL;
 
-    if (!hash)
+    i = _hash_slot(hash, key, _hash_key(key));
+    if (!hash->hashes[i])
         return NULL;
 
-    hash_num = __imlib_hash_gen(key);
-    for (l = hash->buckets[hash_num]; l; l = l->next)
+    return HASH_ENTRY(hash, i);
+}
+
+/*
+ * Return the entry for key, adding a zeroed one with the key set if not
+ * present. NULL on allocation failure.
+ */
+void           *
+__imlib_hash_insert(Imlib_Hash *hash, const Imlib_Hash_Key *key)
+{
+    uint32_t        hv;
+    unsigned int    i;
+    char           *entry;
+
+    if ((hash->count + 1) * 4 > hash->size * 3)
     {
-        el = (Imlib_Hash_El *) l;
-        if (((el->key) && (key) && (!strcmp(el->key, key))) ||
-            ((!el->key) && (!key)))
-        {
-            if (l != hash->buckets[hash_num])
-            {
-                /* FIXME: move to front of list without alloc */
-                hash->buckets[hash_num] =
-                    __imlib_object_list_remove(hash->buckets[hash_num], el);
-                hash->buckets[hash_num] =
-                    __imlib_object_list_prepend(hash->buckets[hash_num], el);
-                if (__imlib_list_alloc_error())
-                {
-                    _imlib_hash_alloc_error = 1;
-                    return el->data;
-                }
-            }
-            return el->data;
-        }
+        if (!_hash_resize(hash, hash->size ? 2 * hash->size : HASH_SIZE_MIN))
+            return NULL;
     }
 
-    return NULL;
-}
+    hv = _hash_key(key);
+    i = _hash_slot(hash, key, hv);
+    entry = HASH_ENTRY(hash, i);
+    if (hash->hashes[i])
+        return entry;
 
-static int
-__imlib_hash_size(Imlib_Hash *hash)
-{
-    if (!hash)
-        return 0;
-    return 256;
+    hash->hashes[i] = hv;
+    hash->count++;
+    memset(entry, 0, hash->esize);
+    memcpy(entry, key, sizeof(Imlib_Hash_Key));
+
+    return entry;
 }
 
 void
-__imlib_hash_free(Imlib_Hash *hash)
+__imlib_hash_remove(Imlib_Hash *hash, const Imlib_Hash_Key *key)
 {
-    int             i, size;
+    unsigned int    i, j, k, mask;
 
-    if (!hash)
+    if (hash->count == 0)
         return;
 
-    size = __imlib_hash_size(hash);
-    for (i = 0; i < size; i++)
+    i = _hash_slot(hash, key, _hash_key(key));
+    if (!hash->hashes[i])
+        return;
+
+    /* Shift back entries that probed past the hole */
+    mask = hash->size - 1;
+    for (j = (i + 1) & mask; hash->hashes[j]; j = (j + 1) & mask)
     {
-        Imlib_Hash_El  *el, *el_next;
-
-        for (el = (Imlib_Hash_El *) hash->buckets[i]; el; el = el_next)
-        {
-            el_next = (Imlib_Hash_El *) el->_list_data.next;
-            free(el->key);
-            free(el);
-        }
+        k = hash->hashes[j] & mask;     /* Home slot */
+        if (((j - k) & mask) < ((j - i) & mask))
+            continue;
+        hash->hashes[i] = hash->hashes[j];
+        memcpy(HASH_ENTRY(hash, i), HASH_ENTRY(hash, j), hash->esize);
+        i = j;
     }
-    free(hash);
+    hash->hashes[i] = 0;
+    hash->count--;
 }
 
+/* func() must not insert or remove, iteration stops when it returns 0 */
 void
-__imlib_hash_foreach(Imlib_Hash *hash, Imlib_Hash_Func *func, const void *fdata)
+__imlib_hash_foreach(Imlib_Hash *hash, Imlib_Hash_Func *func, void *fdata)
 {
-    int             i, size;
-
-    if (!hash)
-        return;
+    unsigned int    i;
 
-    size = __imlib_hash_size(hash);
-    for (i = 0; i < size; i++)
+    for (i = 0; i < hash->size; i++)
     {
-        Imlib_Object_List *l, *next_l;
-
-        for (l = hash->buckets[i]; l;)
-        {
-            Imlib_Hash_El  *el;
-
-            next_l = l->next;
-            el = (Imlib_Hash_El *) l;
-            if (!func(hash, el->key, el->data, (void *)fdata))
-                return;
-            l = next_l;
-        }
+        if (!hash->hashes[i])
+            continue;
+        if (!func(HASH_ENTRY(hash, i), fdata))
+            return;
     }
 }
+
+size_t
+__imlib_hash_mem_size(const Imlib_Hash *hash)
+{
+    return (size_t)hash->size * (sizeof(uint32_t) + hash->esize);
+}
@@ -1,26 +1,48 @@
 #ifndef OBJECT_H
 #define OBJECT_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 typedef struct _Imlib_Object_List {
     struct _Imlib_Object_List *next, *prev;
 } Imlib_Object_List;
 
+void           *__imlib_object_list_prepend(void *in_list, void *in_item);
+void           *__imlib_object_list_remove(void *in_list, void *in_item);
+
+/*
+ * Open addressing (linear probing) hash table.
+ * Entries are stored in the table and must start with an Imlib_Hash_Key.
+ * Entry pointers are valid until the next insert or remove.
+ */
 typedef struct {
-    int             population;
-    Imlib_Object_List *buckets[256];
+    const char     *str;        /* Not copied, may be NULL */
+    uint64_t        num;
+} Imlib_Hash_Key;
+
+typedef struct {
+    unsigned int    size;       /* Number of slots, 0 or a power of 2 */
+    unsigned int    count;      /* Number of entries */
+    unsigned int    esize;      /* Entry size */
+    uint32_t       *hashes;     /* Key hash per slot, 0 if empty */
+    char           *entries;
 } Imlib_Hash;
 
-typedef int     (Imlib_Hash_Func) (Imlib_Hash * hash, const char *key,
-                                   void *data, void *fdata);
+#define IMLIB_HASH_INIT(esize) { 0, 0, esize, NULL, NULL }
 
-void           *__imlib_object_list_prepend(void *in_list, void *in_item);
-void           *__imlib_object_list_remove(void *in_list, void *in_item);
+typedef int     (Imlib_Hash_Func) (void *entry, void *fdata);
 
-Imlib_Hash     *__imlib_hash_add(Imlib_Hash * hash, const char *key,
-                                 const void *data);
-void           *__imlib_hash_find(Imlib_Hash * hash, const char *key);
+void            __imlib_hash_init(Imlib_Hash * hash, unsigned int esize);
 void            __imlib_hash_free(Imlib_Hash * hash);
+void           *__imlib_hash_find(const Imlib_Hash * hash,
+                                  const Imlib_Hash_Key * key);
+void           *__imlib_hash_insert(Imlib_Hash * hash,
+                                    const Imlib_Hash_Key * key);
+void            __imlib_hash_remove(Imlib_Hash * hash,
+                                    const Imlib_Hash_Key * key);
 void            __imlib_hash_foreach(Imlib_Hash * hash,
-                                     Imlib_Hash_Func * func, const void *fdata);
+                                     Imlib_Hash_Func * func, void *fdata);
+size_t          __imlib_hash_mem_size(const Imlib_Hash * hash);
 
 #endif                          /* OBJECT_H */
@@ -1,29 +1,80 @@
 #include "common.h"
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "image.h"
 #include "rgbadraw.h"
+#include "workers.h"
+
+/* Swap p1[i] and p2[-i], i = 0..n-1 (p2 range below the p1 range) */
+static void
+_flip_swap_reverse(uint32_t *p1, uint32_t *p2, int n)
+{
+    uint32_t        tmp;
+
+#ifdef __SSE2__
+    __m128i         v1, v2;
+
+    for (; n >= 4; n -= 4)
+    {
+        v1 = _mm_loadu_si128((__m128i *) p1);
+        v2 = _mm_loadu_si128((__m128i *) (p2 - 3));
+        _mm_storeu_si128((__m128i *) p1, _mm_shuffle_epi32(v2, 0x1b));
+        _mm_storeu_si128((__m128i *) (p2 - 3), _mm_shuffle_epi32(v1, 0x1b));
+        p1 += 4;
+        p2 -= 4;
+    }
+#endif
+    for (; n > 0; n--)
+    {
+        tmp = *p1;
+        *p1++ = *p2;
+        *p2-- = tmp;
+    }
+}
+
+/* Swap p1[i] and p2[i], i = 0..n-1 */
+static void
+_flip_swap(uint32_t *p1, uint32_t *p2, int n)
+{
+    uint32_t        tmp;
+
+#ifdef __SSE2__
+    __m128i         v1, v2;
+
+    for (; n >= 4; n -= 4)
+    {
+        v1 = _mm_loadu_si128((__m128i *) p1);
+        v2 = _mm_loadu_si128((__m128i *) p2);
+        _mm_storeu_si128((__m128i *) p1, v2);
+        _mm_storeu_si128((__m128i *) p2, v1);
+        p1 += 4;
+        p2 += 4;
+    }
+#endif
+    for (; n > 0; n--)
+    {
+        tmp = *p1;
+        *p1++ = *p2;
+        *p2++ = tmp;
+    }
+}
 
 void
 __imlib_FlipImageHoriz(ImlibImage *im)
 {
-    uint32_t       *p1, *p2, tmp;
+    uint32_t       *p;
     int             x, y;
 
     for (y = 0; y < im->h; y++)
     {
-        p1 = im->data + (y * im->w);
-        p2 = im->data + ((y + 1) * im->w) - 1;
-        for (x = 0; x < (im->w >> 1); x++)
-        {
-            tmp = *p1;
-            *p1 = *p2;
-            *p2 = tmp;
-            p1++;
-            p2--;
-        }
+        p = im->data + (y * im->w);
+        _flip_swap_reverse(p, p + im->w - 1, im->w >> 1);
     }
     x = im->border.left;
     im->border.left = im->border.right;
@@ -33,43 +84,23 @@ __imlib_FlipImageHoriz(ImlibImage *im)
 void
 __imlib_FlipImageVert(ImlibImage *im)
 {
-    uint32_t       *p1, *p2, tmp;
-    int             x, y;
+    int             y;
 
     for (y = 0; y < (im->h >> 1); y++)
-    {
-        p1 = im->data + (y * im->w);
-        p2 = im->data + ((im->h - 1 - y) * im->w);
-        for (x = 0; x < im->w; x++)
-        {
-            tmp = *p1;
-            *p1 = *p2;
-            *p2 = tmp;
-            p1++;
-            p2++;
-        }
-    }
-    x = im->border.top;
+        _flip_swap(im->data + (y * im->w),
+                   im->data + ((im->h - 1 - y) * im->w), im->w);
+    y = im->border.top;
     im->border.top = im->border.bottom;
-    im->border.bottom = x;
+    im->border.bottom = y;
 }
 
 void
 __imlib_FlipImageBoth(ImlibImage *im)
 {
-    uint32_t       *p1, *p2, tmp;
     int             x;
 
-    p1 = im->data;
-    p2 = im->data + (im->h * im->w) - 1;
-    for (x = (im->w * im->h) / 2; --x >= 0;)
-    {
-        tmp = *p1;
-        *p1 = *p2;
-        *p2 = tmp;
-        p1++;
-        p2--;
-    }
+    _flip_swap_reverse(im->data, im->data + (im->h * im->w) - 1,
+                       (im->w * im->h) / 2);
     x = im->border.top;
     im->border.top = im->border.bottom;
     im->border.bottom = x;
@@ -78,6 +109,114 @@ __imlib_FlipImageBoth(ImlibImage *im)
     im->border.right = x;
 }
 
+/*
+ * Diagonal flips/90 degree rotations
+ *
+ * Source pixel (x, y) goes to dst[x * ax + y * ay], where ax is +-(new
+ * width) and ay is +-1.
+ * Done in square tiles so both the source rows and the destination rows
+ * of a tile stay in cache, and (with SSE2) in 4x4 blocks transposed in
+ * registers. Tile rows are spread over workers.
+ */
+#define FLIP_TILE 32
+
+typedef struct {
+    const uint32_t *src;
+    uint32_t       *dst;
+    int             w, h;       /* Source size */
+    int             ax, ay;
+} ImlibFlipJob;
+
+static void
+_flip_diag_rect(const ImlibFlipJob *fj, int x0, int y0, int w, int h)
+{
+    const uint32_t *s;
+    uint32_t       *d;
+    int             x, y;
+
+    for (y = y0; y < y0 + h; y++)
+    {
+        s = fj->src + y * fj->w + x0;
+        d = fj->dst + x0 * fj->ax + y * fj->ay;
+        for (x = 0; x < w; x++, d += fj->ax)
+            *d = *s++;
+    }
+}
+
+#ifdef __SSE2__
+static inline void
+_flip_diag_4x4(const ImlibFlipJob *fj, int x0, int y0)
+{
+    const uint32_t *s;
+    uint32_t       *d;
+    __m128i         r0, r1, r2, r3, t0, t1, t2, t3, c[4];
+    int             k;
+
+    s = fj->src + y0 * fj->w + x0;
+    r0 = _mm_loadu_si128((__m128i *) s);
+    r1 = _mm_loadu_si128((__m128i *) (s + fj->w));
+    r2 = _mm_loadu_si128((__m128i *) (s + 2 * fj->w));
+    r3 = _mm_loadu_si128((__m128i *) (s + 3 * fj->w));
+
+    t0 = _mm_unpacklo_epi32(r0, r1);
+    t1 = _mm_unpacklo_epi32(r2, r3);
+    t2 = _mm_unpackhi_epi32(r0, r1);
+    t3 = _mm_unpackhi_epi32(r2, r3);
+    /* c[k] = pixels (x0 + k, y0 + 0..3) */
+    c[0] = _mm_unpacklo_epi64(t0, t1);
+    c[1] = _mm_unpackhi_epi64(t0, t1);
+    c[2] = _mm_unpacklo_epi64(t2, t3);
+    c[3] = _mm_unpackhi_epi64(t2, t3);
+
+    d = fj->dst + x0 * fj->ax + y0 * fj->ay;
+    if (fj->ay > 0)
+    {
+        for (k = 0; k < 4; k++, d += fj->ax)
+            _mm_storeu_si128((__m128i *) d, c[k]);
+    }
+    else
+    {
+        for (k = 0; k < 4; k++, d += fj->ax)
+            _mm_storeu_si128((__m128i *) (d - 3),
+                             _mm_shuffle_epi32(c[k], 0x1b));
+    }
+}
+#endif
+
+static void
+_flip_diag_band(void *data, int job, int worker)
+{
+    const ImlibFlipJob *fj = data;
+    int             x0, y0, tw, th;
+
+#ifdef __SSE2__
+    int             x, y, tw4, th4;
+#endif
+
+    y0 = job * FLIP_TILE;
+    th = fj->h - y0;
+    if (th > FLIP_TILE)
+        th = FLIP_TILE;
+
+    for (x0 = 0; x0 < fj->w; x0 += FLIP_TILE)
+    {
+        tw = fj->w - x0;
+        if (tw > FLIP_TILE)
+            tw = FLIP_TILE;
+#ifdef __SSE2__
+        tw4 = tw & ~3;
+        th4 = th & ~3;
+        for (y = 0; y < th4; y += 4)
+            for (x = 0; x < tw4; x += 4)
+                _flip_diag_4x4(fj, x0 + x, y0 + y);
+        _flip_diag_rect(fj, x0 + tw4, y0, tw - tw4, th4);
+        _flip_diag_rect(fj, x0, y0 + th4, tw, th - th4);
+#else
+        _flip_diag_rect(fj, x0, y0, tw, th);
+#endif
+    }
+}
+
 /*\ Directions (source is right/down):
 |*| 0 = down/right (flip over ul-dr diagonal)
 |*| 1 = down/left  (rotate 90 degrees clockwise)
@@ -87,14 +226,17 @@ __imlib_FlipImageBoth(ImlibImage *im)
 void
 __imlib_FlipImageDiagonal(ImlibImage *im, int direction)
 {
-    uint32_t       *data, *to, *from;
-    int             x, y, w, hw, tmp;
+    ImlibFlipJob    fj;
+    uint32_t       *data;
+    int             w, h, tmp, n_workers;
 
-    data = malloc(im->w * im->h * sizeof(uint32_t));
-    w = im->h;
-    im->h = im->w;
-    im->w = w;
-    hw = w * im->h;
+    w = im->w;
+    h = im->h;
+    data = malloc((size_t)w * h * sizeof(uint32_t));
+    if (!data)
+        return;
+
+    /* New width is h */
     switch (direction)
     {
     default:
@@ -105,8 +247,9 @@ __imlib_FlipImageDiagonal(ImlibImage *im, int direction)
         tmp = im->border.bottom;
         im->border.bottom = im->border.right;
         im->border.right = tmp;
-        to = data;
-        hw = -hw + 1;
+        fj.dst = data;
+        fj.ax = h;
+        fj.ay = 1;
         break;
     case 1:                    /*\ DOWN_LEFT \ */
         tmp = im->border.top;
@@ -114,8 +257,9 @@ __imlib_FlipImageDiagonal(ImlibImage *im, int direction)
         im->border.left = im->border.bottom;
         im->border.bottom = im->border.right;
         im->border.right = tmp;
-        to = data + w - 1;
-        hw = -hw - 1;
+        fj.dst = data + h - 1;
+        fj.ax = h;
+        fj.ay = -1;
         break;
     case 2:                    /*\ UP_RIGHT \ */
         tmp = im->border.top;
@@ -123,9 +267,9 @@ __imlib_FlipImageDiagonal(ImlibImage *im, int direction)
         im->border.right = im->border.bottom;
         im->border.bottom = im->border.left;
         im->border.left = tmp;
-        to = data + hw - w;
-        w = -w;
-        hw = hw + 1;
+        fj.dst = data + (w - 1) * h;
+        fj.ax = -h;
+        fj.ay = 1;
         break;
     case 3:                    /*\ UP_LEFT \ */
         tmp = im->border.top;
@@ -134,116 +278,273 @@ __imlib_FlipImageDiagonal(ImlibImage *im, int direction)
         tmp = im->border.bottom;
         im->border.bottom = im->border.left;
         im->border.left = tmp;
-        to = data + hw - 1;
-        w = -w;
-        hw = hw - 1;
+        fj.dst = data + (w - 1) * h + h - 1;
+        fj.ax = -h;
+        fj.ay = -1;
         break;
     }
 
-    from = im->data;
-    for (x = im->w; --x >= 0;)
+    fj.src = im->data;
+    fj.w = w;
+    fj.h = h;
+
+    n_workers = 1;
+    if ((int64_t)w * h >= WORKERS_MIN_PIXELS)
+        n_workers = __imlib_WorkersGet();
+
+    __imlib_WorkersRun(_flip_diag_band, &fj, (h + FLIP_TILE - 1) / FLIP_TILE,
+                       n_workers);
+
+    im->w = h;
+    im->h = w;
+    __imlib_ReplaceData(im, data);
+}
+
+/*
+ * Box blur
+ *
+ * Separable sliding window sums, so the cost per pixel does not depend on
+ * the radius. Windows are clipped at the image edges and the result is the
+ * average of the pixels inside the clipped window.
+ * Column sums are kept per band of rows, so bands can be done in parallel.
+ */
+typedef struct {
+    const uint32_t *src;
+    uint32_t       *dst;
+    uint32_t       *sums;       /* Column sums, 4 per column, per worker */
+    int             w, h;
+    int             rad;
+    int             band;       /* Rows per job */
+    int             round;      /* Round (or truncate) averages */
+} ImlibBlurJob;
+
+/* Add (sign > 0) or subtract row to/from column sums */
+static void
+_blur_sums_row(uint32_t *sums, const uint32_t *row, int w, int sign)
+{
+    int             x;
+
+    if (sign > 0)
     {
-        for (y = im->h; --y >= 0;)
+        for (x = 0; x < w; x++, sums += 4)
         {
-            *to = *from;
-            from++;
-            to += w;
+            sums[0] += row[x] & 0xff;
+            sums[1] += (row[x] >> 8) & 0xff;
+            sums[2] += (row[x] >> 16) & 0xff;
+            sums[3] += row[x] >> 24;
+        }
+    }
+    else
+    {
+        for (x = 0; x < w; x++, sums += 4)
+        {
+            sums[0] -= row[x] & 0xff;
+            sums[1] -= (row[x] >> 8) & 0xff;
+            sums[2] -= (row[x] >> 16) & 0xff;
+            sums[3] -= row[x] >> 24;
         }
-        to += hw;
     }
-    __imlib_ReplaceData(im, data);
 }
 
-void
-__imlib_BlurImage(ImlibImage *im, int rad)
+static void
+_blur_band(void *data, int job, int worker)
 {
-    uint32_t       *p1, *p2, *data;
-    int             x, y, mx, my, mw, mh, mt, xx, yy;
-    int             a, r, g, b;
-    int            *as, *rs, *gs, *bs;
-
-    if (rad < 1)
-        return;
-    data = malloc(im->w * im->h * sizeof(uint32_t));
-    as = malloc(sizeof(int) * im->w);
-    rs = malloc(sizeof(int) * im->w);
-    gs = malloc(sizeof(int) * im->w);
-    bs = malloc(sizeof(int) * im->w);
-
-    for (y = 0; y < im->h; y++)
+    const ImlibBlurJob *bj = data;
+    const uint32_t *src = bj->src;
+    uint32_t       *sums, *p;
+    uint64_t        b, g, r, a, mt;
+    int             w, h, rad, x, y, y0, y1, x1, x2, mw, mh;
+
+    w = bj->w;
+    h = bj->h;
+    rad = bj->rad;
+    sums = bj->sums + (size_t)worker * w * 4;
+
+    y0 = job * bj->band;
+    y1 = y0 + bj->band;
+    if (y1 > h)
+        y1 = h;
+
+    /* Column sums for the window of the first row */
+    memset(sums, 0, (size_t)w * 4 * sizeof(uint32_t));
+    for (y = y0 - rad; y <= y0 + rad; y++)
+        if (y >= 0 && y < h)
+            _blur_sums_row(sums, src + (size_t)y * w, w, 1);
+
+    for (y = y0; y < y1; y++)
     {
-        my = y - rad;
-        mh = (rad << 1) + 1;
-        if (my < 0)
+        if (y > y0)
         {
-            mh += my;
-            my = 0;
+            if (y + rad < h)
+                _blur_sums_row(sums, src + (size_t)(y + rad) * w, w, 1);
+            if (y - rad - 1 >= 0)
+                _blur_sums_row(sums, src + (size_t)(y - rad - 1) * w, w, -1);
         }
-        if ((my + mh) > im->h)
-            mh = im->h - my;
 
-        p1 = data + (y * im->w);
-        memset(as, 0, im->w * sizeof(int));
-        memset(rs, 0, im->w * sizeof(int));
-        memset(gs, 0, im->w * sizeof(int));
-        memset(bs, 0, im->w * sizeof(int));
+        mh = (y + rad < h ? y + rad : h - 1) - (y - rad > 0 ? y - rad : 0) + 1;
 
-        for (yy = 0; yy < mh; yy++)
+        /* Horizontal window sums of the column sums */
+        b = g = r = a = 0;
+        for (x = 0; x <= rad && x < w; x++)
         {
-            p2 = im->data + ((yy + my) * im->w);
-            for (x = 0; x < im->w; x++)
-            {
-                as[x] += (*p2 >> 24) & 0xff;
-                rs[x] += (*p2 >> 16) & 0xff;
-                gs[x] += (*p2 >> 8) & 0xff;
-                bs[x] += *p2 & 0xff;
-                p2++;
-            }
+            b += sums[4 * x + 0];
+            g += sums[4 * x + 1];
+            r += sums[4 * x + 2];
+            a += sums[4 * x + 3];
         }
-        if (im->w > ((rad << 1) + 1))
+
+        p = bj->dst + (size_t)y * w;
+        for (x = 0; x < w; x++)
         {
-            for (x = 0; x < im->w; x++)
+            x1 = x - rad;
+            x2 = x + rad;
+            mw = (x2 < w ? x2 : w - 1) - (x1 > 0 ? x1 : 0) + 1;
+            mt = (uint64_t)mw * mh;
+
+            if (bj->round)
+                p[x] = PIXEL_ARGB((a + mt / 2) / mt, (r + mt / 2) / mt,
+                                  (g + mt / 2) / mt, (b + mt / 2) / mt);
+            else
+                p[x] = PIXEL_ARGB(a / mt, r / mt, g / mt, b / mt);
+
+            if (x2 + 1 < w)
             {
-                a = 0;
-                r = 0;
-                g = 0;
-                b = 0;
-                mx = x - rad;
-                mw = (rad << 1) + 1;
-                if (mx < 0)
-                {
-                    mw += mx;
-                    mx = 0;
-                }
-                if ((mx + mw) > im->w)
-                    mw = im->w - mx;
-                mt = mw * mh;
-                for (xx = mx; xx < (mw + mx); xx++)
-                {
-                    a += as[xx];
-                    r += rs[xx];
-                    g += gs[xx];
-                    b += bs[xx];
-                }
-                a = a / mt;
-                r = r / mt;
-                g = g / mt;
-                b = b / mt;
-                *p1 = PIXEL_ARGB(a, r, g, b);
-                p1++;
+                b += sums[4 * (x2 + 1) + 0];
+                g += sums[4 * (x2 + 1) + 1];
+                r += sums[4 * (x2 + 1) + 2];
+                a += sums[4 * (x2 + 1) + 3];
+            }
+            if (x1 >= 0)
+            {
+                b -= sums[4 * x1 + 0];
+                g -= sums[4 * x1 + 1];
+                r -= sums[4 * x1 + 2];
+                a -= sums[4 * x1 + 3];
             }
         }
-        else
-        {
-        }
     }
-    free(as);
-    free(rs);
-    free(gs);
-    free(bs);
+}
+
+/* Box blur src into dst (must be different) */
+static int
+_blur_box(const uint32_t *src, uint32_t *dst, int w, int h, int rad,
+          int round)
+{
+    ImlibBlurJob    bj;
+    int             n_workers, n_jobs;
+
+    /* Windows larger than the image are clipped anyway */
+    if (rad > w && rad > h)
+        rad = w > h ? w : h;
+
+    n_workers = 1;
+    if ((int64_t)w * h >= WORKERS_MIN_PIXELS)
+        n_workers = __imlib_WorkersGet();
+
+    /* Each band starts by summing 2 * rad + 1 rows, so keep bands large */
+    n_jobs = n_workers;
+    if (n_jobs > h)
+        n_jobs = h;
+
+    bj.sums = malloc((size_t)n_jobs * w * 4 * sizeof(uint32_t));
+    if (!bj.sums)
+        return -1;
+
+    bj.src = src;
+    bj.dst = dst;
+    bj.w = w;
+    bj.h = h;
+    bj.rad = rad;
+    bj.band = (h + n_jobs - 1) / n_jobs;
+    bj.round = round;
+    n_jobs = (h + bj.band - 1) / bj.band;
+
+    __imlib_WorkersRun(_blur_band, &bj, n_jobs, n_workers);
+
+    free(bj.sums);
+
+    return 0;
+}
+
+void
+__imlib_BlurImage(ImlibImage *im, int rad)
+{
+    uint32_t       *data;
+
+    if (rad < 1)
+        return;
+
+    data = malloc((size_t)im->w * im->h * sizeof(uint32_t));
+    if (!data)
+        return;
+
+    if (_blur_box(im->data, data, im->w, im->h, rad, 0))
+    {
+        free(data);
+        return;
+    }
+
     __imlib_ReplaceData(im, data);
 }
 
+/*
+ * Gaussian blur, approximated by three successive box blurs
+ * (W. Jarosz, "Fast Image Convolutions").
+ */
+void
+__imlib_BlurImageGaussian(ImlibImage *im, double sigma)
+{
+    uint32_t       *buf[3];
+    int             rad[3], i, n, wl, m;
+    double          wi;
+
+    if (!(sigma > 0.))
+        return;
+
+    /* Box widths wl and wl + 2 giving variance closest to sigma^2 */
+    wi = sqrt(12. * sigma * sigma / 3 + 1);
+    wl = (int)wi;
+    if (wl > 2 * (im->w > im->h ? im->w : im->h) + 1)
+        wl = 2 * (im->w > im->h ? im->w : im->h) + 1;
+    if ((wl & 1) == 0)
+        wl--;
+    m = (int)((12. * sigma * sigma - 3 * wl * wl - 12 * wl - 9) /
+              (-4. * wl - 4) + .5);
+
+    for (i = n = 0; i < 3; i++)
+    {
+        rad[n] = ((i < m ? wl : wl + 2) - 1) / 2;
+        if (rad[n] > 0)
+            n++;
+    }
+    if (n == 0)
+        return;
+
+    /* im->data -> buf[1] -> buf[2] -> im->data */
+    buf[0] = im->data;
+    buf[1] = malloc((size_t)im->w * im->h * sizeof(uint32_t));
+    buf[2] = n > 1 ? malloc((size_t)im->w * im->h * sizeof(uint32_t)) : NULL;
+    if (!buf[1] || (n > 1 && !buf[2]))
+        goto quit;
+
+    for (i = 0; i < n; i++)
+    {
+        if (_blur_box(buf[i], buf[(i + 1) % 3], im->w, im->h, rad[i], 1))
+            goto quit;
+    }
+
+    /* Result is in buf[n % 3] */
+    if (n != 3)
+    {
+        __imlib_ReplaceData(im, buf[n]);
+        buf[n] = NULL;
+    }
+
+  quit:
+    free(buf[1]);
+    free(buf[2]);
+}
+
 void
 __imlib_SharpenImage(ImlibImage *im, int rad)
 {
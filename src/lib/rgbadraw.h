@@ -33,6 +33,7 @@ typedef struct {
 typedef struct {
     ImlibPoint     *points;
     int             pointcount;
+    int             pointalloc;
     int             lx, rx;
     int             ty, by;
 } ImlibPoly;
@@ -44,6 +45,7 @@ void            __imlib_FlipImageVert(ImlibImage * im);
 void            __imlib_FlipImageBoth(ImlibImage * im);
 void            __imlib_FlipImageDiagonal(ImlibImage * im, int direction);
 void            __imlib_BlurImage(ImlibImage * im, int rad);
+void            __imlib_BlurImageGaussian(ImlibImage * im, double sigma);
 void            __imlib_SharpenImage(ImlibImage * im, int rad);
 void            __imlib_TileImageHoriz(ImlibImage * im);
 void            __imlib_TileImageVert(ImlibImage * im);
@@ -122,6 +124,6 @@ void            __imlib_Polygon_FillToImage(ImlibPoly * poly,
                                             uint32_t color, ImlibImage * im,
                                             int clx, int cly, int clw,
                                             int clh, ImlibOp op, char blend,
-                                            char anti_alias);
+                                            char anti_alias, char non_zero);
 
 #endif
@@ -6,6 +6,7 @@
 #include "blend.h"
 #include "image.h"
 #include "rotate.h"
+#include "workers.h"
 
 /*\ Linear interpolation functions \*/
 /*\ Between two values \*/
@@ -53,149 +54,310 @@
         ((f1) & _ROTATE_PREC_BITS) * ((f2) & _ROTATE_PREC_BITS)) >> (2 * _ROTATE_PREC); \
 } while (0)
 
-/*\ Rotate by pixel sampling only, target inside source \*/
+/*\ Range [*i0, *i1) of i in [0, n) for which v + i * d is in [0, lim) \*/
 static void
-__imlib_RotateSampleInside(uint32_t *src, uint32_t *dest, int sow, int dow,
-                           int dw, int dh, int x, int y,
-                           int dxh, int dyh, int dxv, int dyv)
+_span_1d(int v, int d, int lim, int n, int *i0, int *i1)
 {
-    int             i;
+    int64_t         lo, hi, e;
 
-    if ((dw < 1) || (dh < 1))
-        return;
+    if (d == 0)
+    {
+        lo = 0;
+        hi = (v >= 0 && v < lim) ? n : 0;
+    }
+    else if (d > 0)
+    {
+        lo = v >= 0 ? 0 : ((int64_t) - v + d - 1) / d;
+        hi = v >= lim ? 0 : ((int64_t)lim - v + d - 1) / d;
+    }
+    else
+    {
+        e = -(int64_t)d;
+        lo = v < lim ? 0 : ((int64_t)v - lim) / e + 1;
+        hi = v < 0 ? 0 : v / e + 1;
+    }
+
+    if (lo > *i0)
+        *i0 = lo;
+    if (hi < *i1)
+        *i1 = hi;
+}
+
+/*\ Range of a row of n pixels with source coordinates in [0, sw) x [0, sh)
+|*| (in _ROTATE_PREC units). Returns the number of pixels in the range.
+\*/
+static int
+_span_inside(int x, int y, int dxh, int dyh, int n, int sw, int sh,
+             int *i0, int *i1)
+{
+    *i0 = 0;
+    *i1 = n;
+    _span_1d(x, dxh, sw, n, i0, i1);
+    _span_1d(y, dyh, sh, n, i0, i1);
+    if (*i0 > n)
+        *i0 = n;
+    if (*i1 < *i0)
+        *i1 = *i0;
+
+    return *i1 - *i0;
+}
+
+/*\ Rotate by pixel sampling, one row \*/
+static void
+_rotate_sample_row(const uint32_t *src, uint32_t *dest, int sow, int sw,
+                   int sh, int dw, int x, int y, int dxh, int dyh)
+{
+    int             i, i0, i1;
+
+    _span_inside(x, y, dxh, dyh, dw, sw << _ROTATE_PREC, sh << _ROTATE_PREC,
+                 &i0, &i1);
 
-    while (1)
+    for (i = 0; i < i0; i++)
+        dest[i] = 0;
+    x += i0 * dxh;
+    y += i0 * dyh;
+    for (; i < i1; i++)
     {
-        i = dw - 1;
-        do
-        {
-            *dest = src[(x >> _ROTATE_PREC) + ((y >> _ROTATE_PREC) * sow)];
-            /*\ RIGHT; \ */
-            x += dxh;
-            y += dyh;
-            dest++;
-        }
-        while (--i >= 0);
-        if (--dh <= 0)
-            break;
-        /*\ DOWN/LEFT; \ */
-        x += dxv - dw * dxh;
-        y += dyv - dw * dyh;
-        dest += (dow - dw);
+        dest[i] = src[(x >> _ROTATE_PREC) + ((y >> _ROTATE_PREC) * sow)];
+        x += dxh;
+        y += dyh;
     }
+    for (; i < dw; i++)
+        dest[i] = 0;
 }
 
-/*\ Same as last function, but with antialiasing \*/
+/*\ AA rotation, pixels with all four source pixels inside the source \*/
 static void
-__imlib_RotateAAInside(uint32_t *src, uint32_t *dest, int sow, int dow,
-                       int dw, int dh, int x, int y,
-                       int dxh, int dyh, int dxv, int dyv)
+_rotate_aa_span(const uint32_t *src, uint32_t *dest, int sow, int n,
+                int x, int y, int dxh, int dyh)
 {
-    int             i;
+    const uint32_t *src_x_y;
 
-    if ((dw < 1) || (dh < 1))
+#ifdef DO_AMD64_ASM
+    switch (__imlib_cpu_simd())
+    {
+    case CPU_SIMD_AVX2:
+        __imlib_RotateAASpan_avx2(src, dest, sow, n, x, y, dxh, dyh);
         return;
+    case CPU_SIMD_SSE41:
+        __imlib_RotateAASpan_sse41(src, dest, sow, n, x, y, dxh, dyh);
+        return;
+    }
+#endif
+
+    for (; n > 0; n--)
+    {
+        src_x_y = src + (x >> _ROTATE_PREC) + ((y >> _ROTATE_PREC) * sow);
+        INTERP_ARGB(dest, src_x_y, sow, x, y);
+        x += dxh;
+        y += dyh;
+        dest++;
+    }
+}
+
+/*\ AA rotation, one pixel near or outside the source edges
+|*| sw, sh are (width - 1, height - 1) << _ROTATE_PREC
+\*/
+static void
+_rotate_aa_edge(const uint32_t *src, uint32_t *dest, int sow, int sw, int sh,
+                int x, int y)
+{
+    const uint32_t *src_x_y = (src + (x >> _ROTATE_PREC) +
+                               ((y >> _ROTATE_PREC) * sow));
 
-    while (1)
+    if ((unsigned)x < (unsigned)sw)
     {
-        i = dw - 1;
-        do
+        if ((unsigned)y < (unsigned)sh)
         {
-            uint32_t       *src_x_y = (src + (x >> _ROTATE_PREC) +
-                                       ((y >> _ROTATE_PREC) * sow));
+            /*\  12
+             * |*|  34
+             * \ */
             INTERP_ARGB(dest, src_x_y, sow, x, y);
-            /*\ RIGHT; \ */
-            x += dxh;
-            y += dyh;
-            dest++;
         }
-        while (--i >= 0);
-        if (--dh <= 0)
-            break;
-        /*\ DOWN/LEFT; \ */
-        x += dxv - dw * dxh;
-        y += dyv - dw * dyh;
-        dest += (dow - dw);
+        else if ((unsigned)(y - sh) < _ROTATE_PREC_MAX)
+        {
+            /*\  12
+             * |*|  ..
+             * \ */
+            INTERP_RGB_A0(dest, src_x_y, src_x_y + 1, x, ~y);
+        }
+        else if ((unsigned)(~y) < _ROTATE_PREC_MAX)
+        {
+            /*\  ..
+             * |*|  34
+             * \ */
+            INTERP_RGB_A0(dest, src_x_y + sow, src_x_y + sow + 1, x, y);
+        }
+        else
+            *dest = 0;
     }
+    else if ((unsigned)(x - sw) < (_ROTATE_PREC_MAX))
+    {
+        if ((unsigned)y < (unsigned)sh)
+        {
+            /*\  1.
+             * |*|  3.
+             * \ */
+            INTERP_RGB_A0(dest, src_x_y, src_x_y + sow, y, ~x);
+        }
+        else if ((unsigned)(y - sh) < _ROTATE_PREC_MAX)
+        {
+            /*\  1.
+             * |*|  ..
+             * \ */
+            INTERP_A000(dest, src_x_y, ~x, ~y);
+        }
+        else if ((unsigned)(~y) < _ROTATE_PREC_MAX)
+        {
+            /*\  ..
+             * |*|  3.
+             * \ */
+            INTERP_A000(dest, src_x_y + sow, ~x, y);
+        }
+        else
+            *dest = 0;
+    }
+    else if ((unsigned)(~x) < _ROTATE_PREC_MAX)
+    {
+        if ((unsigned)y < (unsigned)sh)
+        {
+            /*\  .2
+             * |*|  .4
+             * \ */
+            INTERP_RGB_A0(dest, src_x_y + 1, src_x_y + sow + 1, y, x);
+        }
+        else if ((unsigned)(y - sh) < _ROTATE_PREC_MAX)
+        {
+            /*\  .2
+             * |*|  ..
+             * \ */
+            INTERP_A000(dest, src_x_y + 1, x, ~y);
+        }
+        else if ((unsigned)(~y) < _ROTATE_PREC_MAX)
+        {
+            /*\  ..
+             * |*|  .4
+             * \ */
+            INTERP_A000(dest, src_x_y + sow + 1, x, y);
+        }
+        else
+            *dest = 0;
+    }
+    else
+        *dest = 0;
 }
 
-/*\ NOTE: To check if v is in [b .. t) ((v >= b) && (v < t))
-|*|  it's quicker to do ((unsigned)(v - b) < (t - b))
-|*|  as negative values, cast to unsigned, become large positive
-|*|  values, and fall through the compare.
-|*|  v in [0 .. t) is a special case: ((unsigned)v < t)
-|*|  v in [-t .. 0) is also special, as its the same as ~v in [0 .. t)
+/*\ AA rotation, one row.
+|*| The pixels whose four source pixels are all inside the source are
+|*| found up front, so only the pixels around the edges need checking.
 \*/
-static int
-__check_inside_coords(int x, int y, int dxh, int dyh, int dxv, int dyv,
-                      int dw, int dh, int sw, int sh)
+static void
+_rotate_aa_row(const uint32_t *src, uint32_t *dest, int sow, int sw, int sh,
+               int dw, int x, int y, int dxh, int dyh)
 {
-    sw <<= _ROTATE_PREC;
-    sh <<= _ROTATE_PREC;
-
-    if (((unsigned)x >= (unsigned)sw) || ((unsigned)y >= (unsigned)sh))
-        return 0;
-    x += dxh * dw;
-    y += dyh * dw;
-    if (((unsigned)x >= (unsigned)sw) || ((unsigned)y >= (unsigned)sh))
-        return 0;
-    x += dxv * dh;
-    y += dyv * dh;
-    if (((unsigned)x >= (unsigned)sw) || ((unsigned)y >= (unsigned)sh))
-        return 0;
-    x -= dxh * dw;
-    y -= dyh * dw;
-    if (((unsigned)x >= (unsigned)sw) || ((unsigned)y >= (unsigned)sh))
-        return 0;
-
-    return 1;
+    int             i, i0, i1;
+
+    sw = (sw - 1) << _ROTATE_PREC;
+    sh = (sh - 1) << _ROTATE_PREC;
+
+    _span_inside(x, y, dxh, dyh, dw, sw, sh, &i0, &i1);
+
+    for (i = 0; i < i0; i++)
+        _rotate_aa_edge(src, dest + i, sow, sw, sh, x + i * dxh, y + i * dyh);
+
+    if (i1 > i0)
+        _rotate_aa_span(src, dest + i0, sow, i1 - i0,
+                        x + i0 * dxh, y + i0 * dyh, dxh, dyh);
+
+    for (i = i1; i < dw; i++)
+        _rotate_aa_edge(src, dest + i, sow, sw, sh, x + i * dxh, y + i * dyh);
 }
 
-/*\ These ones don't need the target to be inside the source \*/
-void
-__imlib_RotateSample(uint32_t *src, uint32_t *dest, int sow, int sw, int sh,
-                     int dow, int dw, int dh, int x, int y,
-                     int dxh, int dyh, int dxv, int dyv)
+typedef struct {
+    const uint32_t *src;
+    uint32_t       *dest;
+    int             sow, sw, sh;
+    int             dow, dw, dh;
+    int             x, y, dxh, dyh, dxv, dyv;
+    int             band;       /* Rows per job */
+    char            aa;
+} ImlibRotateJob;
+
+static void
+_rotate_band(void *data, int job, int worker)
 {
-    int             i;
+    const ImlibRotateJob *rj = data;
+    int             row, row1;
 
-    if ((dw < 1) || (dh < 1))
-        return;
+    row = job * rj->band;
+    row1 = row + rj->band;
+    if (row1 > rj->dh)
+        row1 = rj->dh;
 
-    if (__check_inside_coords(x, y, dxh, dyh, dxv, dyv, dw, dh, sw, sh))
+    for (; row < row1; row++)
     {
-        __imlib_RotateSampleInside(src, dest, sow, dow, dw, dh, x, y,
-                                   dxh, dyh, dxv, dyv);
-        return;
-
+        if (rj->aa)
+            _rotate_aa_row(rj->src, rj->dest + (size_t)row * rj->dow,
+                           rj->sow, rj->sw, rj->sh, rj->dw,
+                           rj->x + row * rj->dxv, rj->y + row * rj->dyv,
+                           rj->dxh, rj->dyh);
+        else
+            _rotate_sample_row(rj->src, rj->dest + (size_t)row * rj->dow,
+                               rj->sow, rj->sw, rj->sh, rj->dw,
+                               rj->x + row * rj->dxv, rj->y + row * rj->dyv,
+                               rj->dxh, rj->dyh);
     }
+}
 
-    sw <<= _ROTATE_PREC;
-    sh <<= _ROTATE_PREC;
-    while (1)
-    {
-        i = dw - 1;
-        do
-        {
-            if (((unsigned)x < (unsigned)sw) && ((unsigned)y < (unsigned)sh))
-                *dest = src[(x >> _ROTATE_PREC) + ((y >> _ROTATE_PREC) * sow)];
-            else
-                *dest = 0;
-            /*\ RIGHT; \ */
-            x += dxh;
-            y += dyh;
-            dest++;
+/*\ Rotate rows, spread over the worker threads if big enough \*/
+static void
+_rotate(const uint32_t *src, uint32_t *dest, int sow, int sw, int sh,
+        int dow, int dw, int dh, int x, int y,
+        int dxh, int dyh, int dxv, int dyv, char aa)
+{
+    ImlibRotateJob  rj;
+    int             n_workers, n_jobs;
 
-        }
-        while (--i >= 0);
-        if (--dh <= 0)
-            break;
-        /*\ DOWN/LEFT; \ */
-        x += dxv - dw * dxh;
-        y += dyv - dw * dyh;
-        dest += (dow - dw);
+    if ((dw < 1) || (dh < 1))
+        return;
 
-    }
+    rj.src = src;
+    rj.dest = dest;
+    rj.sow = sow;
+    rj.sw = sw;
+    rj.sh = sh;
+    rj.dow = dow;
+    rj.dw = dw;
+    rj.dh = dh;
+    rj.x = x;
+    rj.y = y;
+    rj.dxh = dxh;
+    rj.dyh = dyh;
+    rj.dxv = dxv;
+    rj.dyv = dyv;
+    rj.aa = aa;
+
+    n_workers = 1;
+    if ((int64_t)dw * dh >= WORKERS_MIN_PIXELS)
+        n_workers = __imlib_WorkersGet();
+
+    /* A few bands per worker to even out the load */
+    n_jobs = n_workers > 1 ? 4 * n_workers : 1;
+    if (n_jobs > dh)
+        n_jobs = dh;
+    rj.band = (dh + n_jobs - 1) / n_jobs;
+    n_jobs = (dh + rj.band - 1) / rj.band;
+
+    __imlib_WorkersRun(_rotate_band, &rj, n_jobs, n_workers);
+}
+
+/*\ These ones don't need the target to be inside the source \*/
+void
+__imlib_RotateSample(uint32_t *src, uint32_t *dest, int sow, int sw, int sh,
+                     int dow, int dw, int dh, int x, int y,
+                     int dxh, int dyh, int dxv, int dyv)
+{
+    _rotate(src, dest, sow, sw, sh, dow, dw, dh, x, y, dxh, dyh, dxv, dyv, 0);
 }
 
 /*\ With antialiasing.
@@ -209,8 +371,6 @@ __imlib_RotateAA(uint32_t *src, uint32_t *dest, int sow, int sw, int sh,
                  int dow, int dw, int dh, int x, int y,
                  int dxh, int dyh, int dxv, int dyv)
 {
-    int             i;
-
     if ((dw < 1) || (dh < 1))
         return;
 
@@ -223,124 +383,155 @@ __imlib_RotateAA(uint32_t *src, uint32_t *dest, int sow, int sw, int sh,
     }
 #endif
 
-    if (__check_inside_coords(x, y, dxh, dyh, dxv, dyv, dw, dh, sw - 1, sh - 1))
+    _rotate(src, dest, sow, sw, sh, dow, dw, dh, x, y, dxh, dyh, dxv, dyv, 1);
+}
+
+/*\ Should this be in blend.c ?? \*/
+#define LINESIZE 16
+
+typedef struct {
+    const ImlibImage *im_src;
+    ImlibImage     *im_dst;
+    const uint32_t *src;
+    uint32_t       *buf;        /* LINESIZE lines per worker */
+    int             ssw, ssh;
+    int             x, y, dxh, dyh, dxv, dyv;
+    char            aa, blend, merge_alpha;
+    const ImlibColorModifier *cm;
+    ImlibOp         op;
+} ImlibSkewJob;
+
+/*\ Rotate and blend one LINESIZE lines band of the destination \*/
+static void
+_skew_band(void *job_data, int job, int worker)
+{
+    const ImlibSkewJob *sj = job_data;
+    const ImlibImage *im_src = sj->im_src;
+    ImlibImage     *im_dst = sj->im_dst;
+    uint32_t       *src = (uint32_t *) sj->src;
+    uint32_t       *data;
+    int             ssw = sj->ssw, ssh = sj->ssh;
+    int             dxh = sj->dxh, dyh = sj->dyh;
+    int             dxv = sj->dxv, dyv = sj->dyv;
+    char            aa = sj->aa;
+    int             i, x, y, x2, y2, w, h, l, r;
+
+    data = sj->buf + (size_t)worker * im_dst->w * LINESIZE;
+    i = job * LINESIZE;
+    x = sj->x + i * dxv;
+    y = sj->y + i * dyv;
+
+
+    h = MIN(LINESIZE, im_dst->h - i);
+
+    x2 = x + h * dxv;
+    y2 = y + h * dyv;
+
+    w = ssw << _ROTATE_PREC;
+    h = ssh << _ROTATE_PREC;
+    if (aa)
     {
-        __imlib_RotateAAInside(src, dest, sow, dow, dw, dh, x, y,
-                               dxh, dyh, dxv, dyv);
-        return;
+        /*\ Account for virtual transparent border \ */
+        w += 2 << _ROTATE_PREC;
+        h += 2 << _ROTATE_PREC;
+    }
+    /*\ Pretty similar code \ */
+    if (dxh > 0)
+    {
+        if (dyh > 0)
+        {
+            l = MAX(-MAX(y, y2) / dyh, -MAX(x, x2) / dxh);
+            r = MIN((h - MIN(y, y2)) / dyh, (w - MIN(x, x2)) / dxh);
+
+        }
+        else if (dyh < 0)
+        {
+            l = MAX(-MAX(x, x2) / dxh, (h - MIN(y, y2)) / dyh);
+            r = MIN(-MAX(y, y2) / dyh, (w - MIN(x, x2)) / dxh);
+
+        }
+        else
+        {
+            l = -MAX(x, x2) / dxh;
+            r = (w - MIN(x, x2)) / dxh;
 
+        }
     }
+    else if (dxh < 0)
+    {
+        if (dyh > 0)
+        {
+            l = MAX(-MAX(y, y2) / dyh, (w - MIN(x, x2)) / dxh);
+            r = MIN(-MAX(x, x2) / dxh, (h - MIN(y, y2)) / dyh);
 
-    sw--;
-    sh--;
-    sw <<= _ROTATE_PREC;
-    sh <<= _ROTATE_PREC;
-    while (1)
+        }
+        else if (dyh < 0)
+        {
+            l = MAX((h - MIN(y, y2)) / dyh, (w - MIN(x, x2)) / dxh);
+            r = MIN(-MAX(y, y2) / dyh, -MAX(x, x2) / dxh);
+
+        }
+        else
+        {
+            l = (w - MIN(x, x2)) / dxh;
+            r = -MAX(x, x2) / dxh;
+
+        }
+
+    }
+    else
     {
-        i = dw - 1;
-        do
+        if (dyh > 0)
+        {
+            l = -MAX(y, y2) / dyh;
+            r = (h - MIN(y, y2)) / dyh;
+
+        }
+        else if (dyh < 0)
+        {
+            l = (h - MIN(y, y2)) / dyh;
+            r = -MAX(y, y2) / dyh;
+
+        }
+        else
         {
-            uint32_t       *src_x_y = (src + (x >> _ROTATE_PREC) +
-                                       ((y >> _ROTATE_PREC) * sow));
-            if ((unsigned)x < (unsigned)sw)
-            {
-                if ((unsigned)y < (unsigned)sh)
-                {
-                    /*\  12
-                     * |*|  34
-                     * \ */
-                    INTERP_ARGB(dest, src_x_y, sow, x, y);
-                }
-                else if ((unsigned)(y - sh) < _ROTATE_PREC_MAX)
-                {
-                    /*\  12
-                     * |*|  ..
-                     * \ */
-                    INTERP_RGB_A0(dest, src_x_y, src_x_y + 1, x, ~y);
-                }
-                else if ((unsigned)(~y) < _ROTATE_PREC_MAX)
-                {
-                    /*\  ..
-                     * |*|  34
-                     * \ */
-                    INTERP_RGB_A0(dest, src_x_y + sow, src_x_y + sow + 1, x, y);
-                }
-                else
-                    *dest = 0;
-            }
-            else if ((unsigned)(x - sw) < (_ROTATE_PREC_MAX))
-            {
-                if ((unsigned)y < (unsigned)sh)
-                {
-                    /*\  1.
-                     * |*|  3.
-                     * \ */
-                    INTERP_RGB_A0(dest, src_x_y, src_x_y + sow, y, ~x);
-                }
-                else if ((unsigned)(y - sh) < _ROTATE_PREC_MAX)
-                {
-                    /*\  1.
-                     * |*|  ..
-                     * \ */
-                    INTERP_A000(dest, src_x_y, ~x, ~y);
-                }
-                else if ((unsigned)(~y) < _ROTATE_PREC_MAX)
-                {
-                    /*\  ..
-                     * |*|  3.
-                     * \ */
-                    INTERP_A000(dest, src_x_y + sow, ~x, y);
-                }
-                else
-                    *dest = 0;
-            }
-            else if ((unsigned)(~x) < _ROTATE_PREC_MAX)
-            {
-                if ((unsigned)y < (unsigned)sh)
-                {
-                    /*\  .2
-                     * |*|  .4
-                     * \ */
-                    INTERP_RGB_A0(dest, src_x_y + 1, src_x_y + sow + 1, y, x);
-                }
-                else if ((unsigned)(y - sh) < _ROTATE_PREC_MAX)
-                {
-                    /*\  .2
-                     * |*|  ..
-                     * \ */
-                    INTERP_A000(dest, src_x_y + 1, x, ~y);
-                }
-                else if ((unsigned)(~y) < _ROTATE_PREC_MAX)
-                {
-                    /*\  ..
-                     * |*|  .4
-                     * \ */
-                    INTERP_A000(dest, src_x_y + sow + 1, x, y);
-                }
-                else
-                    *dest = 0;
-            }
-            else
-                *dest = 0;
-            /*\ RIGHT; \ */
-            x += dxh;
-            y += dyh;
-            dest++;
+            l = 0;
+            r = 0;
 
         }
-        while (--i >= 0);
-        if (--dh <= 0)
-            break;
-        /*\ DOWN/LEFT; \ */
-        x += dxv - dw * dxh;
-        y += dyv - dw * dyh;
-        dest += (dow - dw);
 
     }
-}
+    l--;
+    r += 2;                 /*\ Be paranoid about roundoff errors \ */
+    if (l < 0)
+        l = 0;
+    if (r > im_dst->w)
+        r = im_dst->w;
+    if (r <= l)
+        return;
 
-/*\ Should this be in blend.c ?? \*/
-#define LINESIZE 16
+    w = r - l;
+    h = MIN(LINESIZE, im_dst->h - i);
+    x += l * dxh;
+    y += l * dyh;
+    if (aa)
+    {
+        x -= _ROTATE_PREC_MAX;
+        y -= _ROTATE_PREC_MAX;
+        __imlib_RotateAA(src, data, im_src->w, ssw, ssh, w, w, h,
+                         x, y, dxh, dyh, dxv, dyv);
+
+    }
+    else
+    {
+        __imlib_RotateSample(src, data, im_src->w, ssw, ssh, w, w, h,
+                             x, y, dxh, dyh, dxv, dyv);
+
+    }
+    __imlib_BlendRGBAToData(data, w, h, im_dst->data,
+                            im_dst->w, im_dst->h, 0, 0, l, i, w, h,
+                            sj->blend, sj->merge_alpha, sj->cm, sj->op, 0);
+}
 
 void
 __imlib_BlendImageToImageSkewed(ImlibImage *im_src, ImlibImage *im_dst,
@@ -351,7 +542,8 @@ __imlib_BlendImageToImageSkewed(ImlibImage *im_src, ImlibImage *im_dst,
                                 ImlibColorModifier *cm, ImlibOp op,
                                 int clx, int cly, int clw, int clh)
 {
-    int             x, y, dxh, dyh, dxv, dyv, i;
+    ImlibSkewJob    sj;
+    int             x, y, dxh, dyh, dxv, dyv, n_jobs, n_workers;
     double          xy2;
     uint32_t       *data, *src;
 
@@ -408,10 +600,6 @@ __imlib_BlendImageToImageSkewed(ImlibImage *im_src, ImlibImage *im_dst,
         ssh = im_src->h - ssy;
 
     src = im_src->data + ssx + ssy * im_src->w;
-    data = malloc(im_dst->w * LINESIZE * sizeof(uint32_t));
-    if (!data)
-        return;
-
     if (aa)
     {
         /*\ Account for virtual transparent border \ */
@@ -419,127 +607,38 @@ __imlib_BlendImageToImageSkewed(ImlibImage *im_src, ImlibImage *im_dst,
         y += _ROTATE_PREC_MAX;
     }
 
-    for (i = 0; i < im_dst->h; i += LINESIZE)
-    {
-        int             x2, y2, w, h, l, r;
-
-        h = MIN(LINESIZE, im_dst->h - i);
-
-        x2 = x + h * dxv;
-        y2 = y + h * dyv;
-
-        w = ssw << _ROTATE_PREC;
-        h = ssh << _ROTATE_PREC;
-        if (aa)
-        {
-            /*\ Account for virtual transparent border \ */
-            w += 2 << _ROTATE_PREC;
-            h += 2 << _ROTATE_PREC;
-        }
-        /*\ Pretty similar code \ */
-        if (dxh > 0)
-        {
-            if (dyh > 0)
-            {
-                l = MAX(-MAX(y, y2) / dyh, -MAX(x, x2) / dxh);
-                r = MIN((h - MIN(y, y2)) / dyh, (w - MIN(x, x2)) / dxh);
-
-            }
-            else if (dyh < 0)
-            {
-                l = MAX(-MAX(x, x2) / dxh, (h - MIN(y, y2)) / dyh);
-                r = MIN(-MAX(y, y2) / dyh, (w - MIN(x, x2)) / dxh);
-
-            }
-            else
-            {
-                l = -MAX(x, x2) / dxh;
-                r = (w - MIN(x, x2)) / dxh;
-
-            }
-        }
-        else if (dxh < 0)
-        {
-            if (dyh > 0)
-            {
-                l = MAX(-MAX(y, y2) / dyh, (w - MIN(x, x2)) / dxh);
-                r = MIN(-MAX(x, x2) / dxh, (h - MIN(y, y2)) / dyh);
-
-            }
-            else if (dyh < 0)
-            {
-                l = MAX((h - MIN(y, y2)) / dyh, (w - MIN(x, x2)) / dxh);
-                r = MIN(-MAX(y, y2) / dyh, -MAX(x, x2) / dxh);
-
-            }
-            else
-            {
-                l = (w - MIN(x, x2)) / dxh;
-                r = -MAX(x, x2) / dxh;
-
-            }
+    /* bands are spread over the worker threads if there are enough
+     * pixels to make it worthwhile */
+    n_jobs = (im_dst->h + LINESIZE - 1) / LINESIZE;
+    n_workers = 1;
+    if ((int64_t)im_dst->w * im_dst->h >= WORKERS_MIN_PIXELS)
+        n_workers = __imlib_WorkersGet();
+    if (n_workers > n_jobs)
+        n_workers = n_jobs;
 
-        }
-        else
-        {
-            if (dyh > 0)
-            {
-                l = -MAX(y, y2) / dyh;
-                r = (h - MIN(y, y2)) / dyh;
-
-            }
-            else if (dyh < 0)
-            {
-                l = (h - MIN(y, y2)) / dyh;
-                r = -MAX(y, y2) / dyh;
-
-            }
-            else
-            {
-                l = 0;
-                r = 0;
-
-            }
-
-        }
-        l--;
-        r += 2;                 /*\ Be paranoid about roundoff errors \ */
-        if (l < 0)
-            l = 0;
-        if (r > im_dst->w)
-            r = im_dst->w;
-        if (r <= l)
-        {
-            x = x2;
-            y = y2;
-            continue;
-
-        }
-
-        w = r - l;
-        h = MIN(LINESIZE, im_dst->h - i);
-        x += l * dxh;
-        y += l * dyh;
-        if (aa)
-        {
-            x -= _ROTATE_PREC_MAX;
-            y -= _ROTATE_PREC_MAX;
-            __imlib_RotateAA(src, data, im_src->w, ssw, ssh, w, w, h,
-                             x, y, dxh, dyh, dxv, dyv);
-
-        }
-        else
-        {
-            __imlib_RotateSample(src, data, im_src->w, ssw, ssh, w, w, h,
-                                 x, y, dxh, dyh, dxv, dyv);
+    data = malloc((size_t)n_workers * im_dst->w * LINESIZE * sizeof(uint32_t));
+    if (!data)
+        return;
 
-        }
-        __imlib_BlendRGBAToData(data, w, h, im_dst->data,
-                                im_dst->w, im_dst->h, 0, 0, l, i, w, h,
-                                blend, merge_alpha, cm, op, 0);
-        x = x2;
-        y = y2;
+    sj.im_src = im_src;
+    sj.im_dst = im_dst;
+    sj.src = src;
+    sj.buf = data;
+    sj.ssw = ssw;
+    sj.ssh = ssh;
+    sj.x = x;
+    sj.y = y;
+    sj.dxh = dxh;
+    sj.dyh = dyh;
+    sj.dxv = dxv;
+    sj.dyv = dyv;
+    sj.aa = aa;
+    sj.blend = blend;
+    sj.merge_alpha = merge_alpha;
+    sj.cm = cm;
+    sj.op = op;
+
+    __imlib_WorkersRun(_skew_band, &sj, n_jobs, n_workers);
 
-    }
     free(data);
 }
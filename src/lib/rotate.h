@@ -32,6 +32,15 @@ void            __imlib_BlendImageToImageSkewed(ImlibImage * im_src,
                                                 int clx, int cly,
                                                 int clw, int clh);
 
+#ifdef DO_AMD64_ASM
+void            __imlib_RotateAASpan_sse41(const uint32_t * src,
+                                           uint32_t * dest, int sow, int n,
+                                           int x, int y, int dxh, int dyh);
+void            __imlib_RotateAASpan_avx2(const uint32_t * src,
+                                          uint32_t * dest, int sow, int n,
+                                          int x, int y, int dxh, int dyh);
+#endif
+
 #ifdef DO_MMX_ASM
 void            __imlib_mmx_RotateAA(uint32_t * src, uint32_t * dest,
                                      int sow, int sw, int sh, int dow,
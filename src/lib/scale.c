@@ -1,11 +1,15 @@
+#include "config.h"
+#include <Imlib2.h>
 #include "common.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "asm_c.h"
 #include "image.h"
+#include "lock.h"
 #include "scale.h"
 
 #ifdef ENABLE_USCALER
@@ -15,22 +19,17 @@
 #pragma GCC diagnostic ignored "-Wunused-function"
 #include "third-party/uscaler.h"
 #pragma GCC diagnostic pop
-#endif
 
-#undef DO_MMX_ASM               // __imlib_Scale_mmx_AARGBA() is broken
+static float    usc_weights[256][4];
 
-/*\ NB: If you change this, don't forget asm_scale.S \*/
-struct _imlib_scale_info {
-    int            *xpoints;
-    int            *ypoints;
-    int            *xapoints;
-    int            *yapoints;
-    int             xup_yup;
-    uint32_t       *pix_assert;
-#ifdef ENABLE_USCALER
-    UscContext     *usc_ctx;
+static void
+_usc_weights_init(void)
+{
+    usc_build_bicubic_weight_table(usc_weights, 0.0f, 0.5f);
+}
 #endif
-};
+
+#undef DO_MMX_ASM               // __imlib_Scale_mmx_AARGBA() is broken
 
 #define INV_XAP                   (256 - xapoints[x])
 #define XAP                       (xapoints[x])
@@ -215,9 +214,9 @@ __imlib_FreeScaleInfo(ImlibScaleInfo *isi)
     return NULL;
 }
 
-ImlibScaleInfo *
-__imlib_CalcScaleInfo(const ImlibImage *im, int sw, int sh, int dw, int dh,
-                      bool aa)
+static ImlibScaleInfo *
+_calc_scale_info(const ImlibImage *im, int sw, int sh, int dw, int dh,
+                 bool aa, bool usc)
 {
     ImlibScaleInfo *isi;
     int             scw, sch;
@@ -229,22 +228,18 @@ __imlib_CalcScaleInfo(const ImlibImage *im, int sw, int sh, int dw, int dh,
     if (!isi)
         return NULL;
 
-    isi->pix_assert = im->data + im->w * im->h;
+    if (im->data)
+        isi->pix_assert = im->data + im->w * im->h;
 
 #ifdef ENABLE_USCALER
-    if (aa && !im->border.left && !im->border.right &&
+    if (usc && aa && !im->border.left && !im->border.right &&
         !im->border.top && !im->border.bottom)
     {
-        static float    weights[256][4];
-        static int      weights_initialized;
-        UscExtra        extra = {.bicubic_weights = weights };
+        ONCE_STATIC(usc_weights_once);
+        UscExtra        extra = {.bicubic_weights = usc_weights };
         UscFlipFlags    flip = USC_FLIP_NONE;
 
-        if (!weights_initialized)
-        {
-            usc_build_bicubic_weight_table(weights, 0.0f, 0.5f);
-            weights_initialized = 1;
-        }
+        ONCE(usc_weights_once, _usc_weights_init);
 
         isi->usc_ctx = calloc(1, sizeof(*isi->usc_ctx));
         if (!isi->usc_ctx)
@@ -304,6 +299,13 @@ __imlib_CalcScaleInfo(const ImlibImage *im, int sw, int sh, int dw, int dh,
     return __imlib_FreeScaleInfo(isi);
 }
 
+ImlibScaleInfo *
+__imlib_CalcScaleInfo(const ImlibImage *im, int sw, int sh, int dw, int dh,
+                      bool aa)
+{
+    return _calc_scale_info(im, sw, sh, dw, dh, aa, true);
+}
+
 /* scale by pixel sampling only */
 static void
 __imlib_ScaleSampleRGBA(const ImlibScaleInfo *isi,
@@ -357,6 +359,19 @@ __imlib_ScaleAARGBA(const ImlibScaleInfo *isi,
         return;
     }
 #endif
+#ifdef DO_AMD64_ASM
+    switch (__imlib_cpu_simd())
+    {
+    case CPU_SIMD_AVX2:
+        __imlib_ScaleAA_avx2(isi, true, srce, dest,
+                             dxx, dyy, dx, dy, dw, dh, dow, sow);
+        return;
+    case CPU_SIMD_SSE41:
+        __imlib_ScaleAA_sse41(isi, true, srce, dest,
+                              dxx, dyy, dx, dy, dw, dh, dow, sow);
+        return;
+    }
+#endif
 
     ypoints = isi->ypoints;
     xpoints = isi->xpoints;
@@ -763,6 +778,19 @@ __imlib_ScaleAARGB(const ImlibScaleInfo *isi,
         return;
     }
 #endif
+#ifdef DO_AMD64_ASM
+    switch (__imlib_cpu_simd())
+    {
+    case CPU_SIMD_AVX2:
+        __imlib_ScaleAA_avx2(isi, false, srce, dest,
+                             dxx, dyy, dx, dy, dw, dh, dow, sow);
+        return;
+    case CPU_SIMD_SSE41:
+        __imlib_ScaleAA_sse41(isi, false, srce, dest,
+                              dxx, dyy, dx, dy, dw, dh, dow, sow);
+        return;
+    }
+#endif
 
     ypoints = isi->ypoints;
     xpoints = isi->xpoints;
@@ -1139,3 +1167,220 @@ __imlib_Scale(const ImlibScaleInfo *isi, bool aa, bool alpha,
         __imlib_ScaleSampleRGBA(isi, srce, dest, dxx, dyy, dx, dy, dw, dh,
                                 dow, sow);
 }
+
+/* Streaming scaler
+ * Source rows are handed in top to bottom, and are only kept until the
+ * destination rows that need them have been scaled.
+ * This uses the point based scalers (not uscaler), as they read a known
+ * range of source rows for each destination row. */
+struct _imlib_scale_rows {
+    int             dw, dh;     /* Requested size (<= 0: keep aspect) */
+    bool            aa;
+    int             err;
+    ImlibScaleInfo *isi;
+    ImlibImage     *im;         /* Destination */
+    int            *ypoints;    /* Source rows relative to buf */
+    uint32_t       *buf;        /* Source rows row0 to row1 - 1 */
+    int             buf_rows;
+    int             row0, row1;
+    int             y;          /* Next destination row */
+};
+
+ImlibScaleRows *
+__imlib_ScaleRowsNew(int dw, int dh, bool aa)
+{
+    ImlibScaleRows *sr;
+
+    sr = calloc(1, sizeof(ImlibScaleRows));
+    if (!sr)
+        return NULL;
+
+    sr->dw = dw;
+    sr->dh = dh;
+    sr->aa = aa;
+
+    return sr;
+}
+
+static int
+_scale_rows_init(ImlibScaleRows *sr, const ImlibImage *im)
+{
+    ImlibImage      sim = {.w = im->w,.h = im->h };
+    int64_t         dw, dh;
+
+    dw = sr->dw;
+    dh = sr->dh;
+    if (dw <= 0 && dh <= 0)
+    {
+        dw = im->w;
+        dh = im->h;
+    }
+    else if (dw <= 0)
+    {
+        dw = ((int64_t)im->w * dh + im->h / 2) / im->h;
+    }
+    else if (dh <= 0)
+    {
+        dh = ((int64_t)im->h * dw + im->w / 2) / im->w;
+    }
+    dw = MAX(dw, 1);
+    dh = MAX(dh, 1);
+
+    if (!IMAGE_DIMENSIONS_OK(dw, dh))
+        return IMLIB_ERR_BAD_IMAGE;
+
+    sr->im = __imlib_CreateImage(dw, dh, NULL, 0);
+    sr->isi = _calc_scale_info(&sim, im->w, im->h, dw, dh, sr->aa, false);
+    sr->ypoints = malloc(dh * sizeof(int));
+    if (!sr->im || !sr->isi || !sr->ypoints)
+        return ENOMEM;
+
+    sr->im->has_alpha = !!im->has_alpha;
+
+    return 0;
+}
+
+/* Last source row read for destination row y */
+static int
+_scale_rows_last(const ImlibScaleInfo *isi, int y)
+{
+    int             yap, n, cy;
+
+    if (!isi->yapoints)
+        return isi->ypoints[y];
+
+    yap = isi->yapoints[y];
+    if (isi->xup_yup & 2)
+        return isi->ypoints[y] + (yap > 0);
+
+    n = (1 << 14) - (yap & 0xffff);
+    cy = yap >> 16;
+
+    return isi->ypoints[y] + (n > 0 ? (n + cy - 1) / cy : 0);
+}
+
+/* Row sink (ImlibRowFunction) for streaming loads */
+int
+__imlib_ScaleRowsPut(void *data, ImlibImage *im, const uint32_t *rows,
+                     int row, int nrows)
+{
+    ImlibScaleRows *sr = data;
+    ImlibScaleInfo  si;
+    uint32_t       *p;
+    int             sw, dh, first, n, y;
+
+    if (sr->err)
+        return 1;
+
+    if (!sr->isi)
+    {
+        sr->err = _scale_rows_init(sr, im);
+        if (sr->err)
+            return 1;
+    }
+
+    if (row != sr->row1)
+    {
+        sr->err = IMLIB_ERR_INTERNAL;   /* Rows out of order */
+        return 1;
+    }
+
+    sw = im->w;
+    dh = sr->im->h;
+
+    /* Drop the rows no remaining destination row needs */
+    first = sr->y < dh ? sr->isi->ypoints[sr->y] : im->h;
+    if (first >= sr->row1)
+    {
+        /* All buffered rows, and maybe some of the new ones */
+        n = MIN(first - sr->row1, nrows);
+        rows += (size_t)n * sw;
+        nrows -= n;
+        sr->row0 = sr->row1 = row + n;
+    }
+    else if (first > sr->row0)
+    {
+        memmove(sr->buf, sr->buf + (size_t)(first - sr->row0) * sw,
+                (size_t)(sr->row1 - first) * sw * sizeof(uint32_t));
+        sr->row0 = first;
+    }
+
+    if (nrows <= 0)
+        return 0;
+
+    n = sr->row1 - sr->row0 + nrows;
+    if (n > sr->buf_rows)
+    {
+        p = realloc(sr->buf, (size_t)n * sw * sizeof(uint32_t));
+        if (!p)
+        {
+            sr->err = ENOMEM;
+            return 1;
+        }
+        sr->buf = p;
+        sr->buf_rows = n;
+    }
+    memcpy(sr->buf + (size_t)(sr->row1 - sr->row0) * sw, rows,
+           (size_t)nrows * sw * sizeof(uint32_t));
+    sr->row1 += nrows;
+
+    /* Scale the destination rows whose source rows are all here */
+    for (y = sr->y; y < dh; y++)
+    {
+        if (sr->row1 < im->h && _scale_rows_last(sr->isi, y) >= sr->row1)
+            break;
+        sr->ypoints[y] = sr->isi->ypoints[y] - sr->row0;
+    }
+    if (y == sr->y)
+        return 0;
+
+    si = *sr->isi;
+    si.ypoints = sr->ypoints;
+    si.pix_assert = sr->buf + (size_t)(sr->row1 - sr->row0) * sw;
+
+    __imlib_Scale(&si, sr->aa, sr->im->has_alpha, sr->buf, sr->im->data,
+                  0, sr->y, 0, sr->y, sr->im->w, y - sr->y, sr->im->w, sw);
+
+    if (!sr->im->has_alpha)
+    {
+        /* The RGB scalers leave alpha alone */
+        p = sr->im->data + (size_t)sr->y * sr->im->w;
+        for (n = (y - sr->y) * sr->im->w; n > 0; n--, p++)
+            *p |= 0xff000000;
+    }
+    sr->y = y;
+
+    return 0;
+}
+
+/* Free the streaming scaler, return the destination image if complete */
+ImlibImage     *
+__imlib_ScaleRowsDone(ImlibScaleRows *sr, int *perr)
+{
+    ImlibImage     *im;
+    int             err;
+
+    im = NULL;
+    err = sr->err;
+    if (!err && (!sr->im || sr->y < sr->im->h))
+        err = IMLIB_ERR_BAD_IMAGE;      /* Incomplete */
+
+    if (err)
+    {
+        if (sr->im)
+            __imlib_FreeImage(sr->im);
+    }
+    else
+    {
+        im = sr->im;
+    }
+
+    __imlib_FreeScaleInfo(sr->isi);
+    free(sr->ypoints);
+    free(sr->buf);
+    free(sr);
+
+    *perr = err;
+
+    return im;
+}
@@ -5,6 +5,19 @@
 
 typedef struct _imlib_scale_info ImlibScaleInfo;
 
+/*\ NB: If you change this, don't forget asm_scale.S \*/
+struct _imlib_scale_info {
+    int            *xpoints;
+    int            *ypoints;
+    int            *xapoints;
+    int            *yapoints;
+    int             xup_yup;
+    uint32_t       *pix_assert;
+#ifdef ENABLE_USCALER
+    struct UscContext *usc_ctx;
+#endif
+};
+
 ImlibScaleInfo *__imlib_CalcScaleInfo(const ImlibImage * im,
                                       int sw, int sh, int dw, int dh, bool aa);
 ImlibScaleInfo *__imlib_FreeScaleInfo(ImlibScaleInfo * isi);
@@ -14,6 +27,14 @@ void            __imlib_Scale(const ImlibScaleInfo * isi, bool aa, bool alpha,
                               int dxx, int dyy, int dx, int dy,
                               int dw, int dh, int dow, int sow);
 
+typedef struct _imlib_scale_rows ImlibScaleRows;
+
+ImlibScaleRows *__imlib_ScaleRowsNew(int dw, int dh, bool aa);
+int             __imlib_ScaleRowsPut(void *data, ImlibImage * im,
+                                     const uint32_t * rows,
+                                     int row, int nrows);
+ImlibImage     *__imlib_ScaleRowsDone(ImlibScaleRows * sr, int *perr);
+
 #ifdef DO_MMX_ASM
 void            __imlib_Scale_mmx_AARGBA(const ImlibScaleInfo * isi,
                                          uint32_t * dest,
@@ -21,4 +42,15 @@ void            __imlib_Scale_mmx_AARGBA(const ImlibScaleInfo * isi,
                                          int dw, int dh, int dow, int sow);
 #endif
 
+#ifdef DO_AMD64_ASM
+void            __imlib_ScaleAA_sse41(const ImlibScaleInfo * isi, bool alpha,
+                                      const uint32_t * srce, uint32_t * dest,
+                                      int dxx, int dyy, int dx, int dy,
+                                      int dw, int dh, int dow, int sow);
+void            __imlib_ScaleAA_avx2(const ImlibScaleInfo * isi, bool alpha,
+                                     const uint32_t * srce, uint32_t * dest,
+                                     int dxx, int dyy, int dx, int dy,
+                                     int dw, int dh, int dow, int sow);
+#endif
+
 #endif
@@ -0,0 +1,508 @@
+#include "common.h"
+
+#include <immintrin.h>
+
+#include "scale.h"
+
+/*
+ * SSE4.1 and AVX2 versions of __imlib_ScaleAARGBA() and __imlib_ScaleAARGB().
+ *
+ * The arithmetic is exactly that of the C versions in scale.c, only done on
+ * all four channels at once (one 32 bit lane per channel).
+ * All intermediate values are non-negative and well within 31 bits, and the
+ * results never exceed 255, so the output is bit identical.
+ *
+ * The AVX2 versions process two pixels (or two source rows) per vector.
+ *
+ * alpha = false gives the __imlib_ScaleAARGB() behaviour:
+ * Output alpha is 0xff, except for copied pixels when scaling up and for
+ * down-down scaling, where the destination alpha is left untouched.
+ */
+
+#define TGT_SSE41 __attribute__((target("sse4.1")))
+#define TGT_AVX2  __attribute__((target("avx2")))
+
+#define INV_XAP                   (256 - xapoints[x])
+#define XAP                       (xapoints[x])
+#define INV_YAP                   (256 - yapoints[dyy + y])
+#define YAP                       (yapoints[dyy + y])
+
+#define ALPHA_MASK  0xff000000
+
+/*
+ * One pixel, 4 x 32 bit
+ */
+
+static inline   TGT_SSE41 __m128i
+_px_get(const uint32_t *p)
+{
+    return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(*p));
+}
+
+static inline   TGT_SSE41 uint32_t
+_px_pack(__m128i v)
+{
+    v = _mm_packus_epi32(v, v);
+    v = _mm_packus_epi16(v, v);
+    return _mm_cvtsi128_si32(v);
+}
+
+static inline   TGT_SSE41 __m128i
+_px_mul(__m128i v, int w)
+{
+    return _mm_mullo_epi32(v, _mm_set1_epi32(w));
+}
+
+static inline   TGT_SSE41 __m128i
+_px_shr(__m128i v, int n)
+{
+    return _mm_srl_epi32(v, _mm_cvtsi32_si128(n));
+}
+
+/* Area sample along a line, sum((pix * weight) >> n) */
+static inline   TGT_SSE41 __m128i
+_px_area(const uint32_t *pix, int step, int ap, int C, int n)
+{
+    __m128i         v;
+    int             j;
+
+    v = _px_shr(_px_mul(_px_get(pix), ap), n);
+    for (j = (1 << 14) - ap; j > C; j -= C)
+    {
+        pix += step;
+        v = _mm_add_epi32(v, _px_shr(_px_mul(_px_get(pix), C), n));
+    }
+    if (j > 0)
+    {
+        pix += step;
+        v = _mm_add_epi32(v, _px_shr(_px_mul(_px_get(pix), j), n));
+    }
+
+    return v;
+}
+
+/* Scaling up both ways */
+static inline   TGT_SSE41 uint32_t
+_px_up_up(const uint32_t *pix, int xap, int yap, int sow, bool alpha)
+{
+    __m128i         v, vv;
+    uint32_t        p;
+
+    /* Do the full calculation, weights may be 0 (result is the same) */
+    v = _mm_add_epi32(_px_mul(_px_get(pix), 256 - xap),
+                      _px_mul(_px_get(pix + (xap > 0)), xap));
+    if (yap > 0)
+    {
+        pix += sow;
+        vv = _mm_add_epi32(_px_mul(_px_get(pix), 256 - xap),
+                           _px_mul(_px_get(pix + (xap > 0)), xap));
+        v = _px_shr(_mm_add_epi32(_px_mul(vv, yap), _px_mul(v, 256 - yap)),
+                    16);
+    }
+    else
+    {
+        v = _px_shr(v, 8);
+    }
+
+    p = _px_pack(v);
+    if (!alpha && (xap > 0 || yap > 0))
+        p |= ALPHA_MASK;
+
+    return p;
+}
+
+/* Scaling down vertically */
+static inline   TGT_SSE41 uint32_t
+_px_up_down(const uint32_t *pix, int xap, int yap, int Cy, int sow,
+            bool alpha)
+{
+    __m128i         v, vv;
+    uint32_t        p;
+
+    v = _px_area(pix, sow, yap, Cy, 10);
+    if (xap > 0)
+    {
+        vv = _px_area(pix + 1, sow, yap, Cy, 10);
+        v = _px_shr(_mm_add_epi32(_px_mul(v, 256 - xap), _px_mul(vv, xap)),
+                    12);
+    }
+    else
+    {
+        v = _px_shr(v, 4);
+    }
+
+    p = _px_pack(v);
+    if (!alpha)
+        p |= ALPHA_MASK;
+
+    return p;
+}
+
+/* Scaling down horizontally */
+static inline   TGT_SSE41 uint32_t
+_px_down_up(const uint32_t *pix, int xap, int Cx, int yap, int sow,
+            bool alpha)
+{
+    __m128i         v, vv;
+    uint32_t        p;
+
+    v = _px_area(pix, 1, xap, Cx, 10);
+    if (yap > 0)
+    {
+        vv = _px_area(pix + sow, 1, xap, Cx, 10);
+        v = _px_shr(_mm_add_epi32(_px_mul(v, 256 - yap), _px_mul(vv, yap)),
+                    12);
+    }
+    else
+    {
+        v = _px_shr(v, 4);
+    }
+
+    p = _px_pack(v);
+    if (!alpha)
+        p |= ALPHA_MASK;
+
+    return p;
+}
+
+/* Scaling down horizontally & vertically */
+static inline   TGT_SSE41 __m128i
+_px_down_down(const uint32_t *pix, int xap, int Cx, int yap, int Cy, int sow)
+{
+    __m128i         v;
+    int             j;
+
+    v = _px_shr(_px_mul(_px_area(pix, 1, xap, Cx, 9), yap), 14);
+    for (j = (1 << 14) - yap; j > Cy; j -= Cy)
+    {
+        pix += sow;
+        v = _mm_add_epi32(v, _px_shr(_px_mul(_px_area(pix, 1, xap, Cx, 9),
+                                             Cy), 14));
+    }
+    if (j > 0)
+    {
+        pix += sow;
+        v = _mm_add_epi32(v, _px_shr(_px_mul(_px_area(pix, 1, xap, Cx, 9),
+                                             j), 14));
+    }
+
+    return _px_shr(v, 5);
+}
+
+static inline   TGT_SSE41 void
+_px_put_down_down(uint32_t *dptr, __m128i v, bool alpha)
+{
+    uint32_t        p;
+
+    p = _px_pack(v);
+    if (!alpha)
+        p = (*dptr & ALPHA_MASK) | (p & ~ALPHA_MASK);
+    *dptr = p;
+}
+
+void            TGT_SSE41
+__imlib_ScaleAA_sse41(const ImlibScaleInfo *isi, bool alpha,
+                      const uint32_t *srce, uint32_t *dest,
+                      int dxx, int dyy, int dx, int dy, int dw, int dh,
+                      int dow, int sow)
+{
+    const uint32_t *sptr;
+    uint32_t       *dptr;
+    int             x, y, end;
+    const int      *ypoints = isi->ypoints;
+    const int      *xpoints = isi->xpoints;
+    const int      *xapoints = isi->xapoints;
+    const int      *yapoints = isi->yapoints;
+
+    end = dxx + dw;
+    for (y = 0; y < dh; y++)
+    {
+        sptr = srce + ypoints[dyy + y] * sow;
+        dptr = dest + dx + (y + dy) * dow;
+
+        switch (isi->xup_yup)
+        {
+        case 3:
+            for (x = dxx; x < end; x++)
+                *dptr++ = _px_up_up(sptr + xpoints[x], XAP, YAP, sow, alpha);
+            break;
+        case 1:
+            for (x = dxx; x < end; x++)
+                *dptr++ = _px_up_down(sptr + xpoints[x], XAP, YAP & 0xffff,
+                                      YAP >> 16, sow, alpha);
+            break;
+        case 2:
+            for (x = dxx; x < end; x++)
+                *dptr++ = _px_down_up(sptr + xpoints[x], XAP & 0xffff,
+                                      XAP >> 16, YAP, sow, alpha);
+            break;
+        default:
+            for (x = dxx; x < end; x++, dptr++)
+                _px_put_down_down(dptr,
+                                  _px_down_down(sptr + xpoints[x],
+                                                XAP & 0xffff, XAP >> 16,
+                                                YAP & 0xffff, YAP >> 16,
+                                                sow), alpha);
+            break;
+        }
+    }
+}
+
+/*
+ * Two pixels, 8 x 32 bit (pixel a in the low, pixel b in the high lane)
+ */
+
+static inline   TGT_AVX2 __m256i
+_px2_get(const uint32_t *pa, const uint32_t *pb)
+{
+    return _mm256_cvtepu8_epi32(_mm_unpacklo_epi32(_mm_cvtsi32_si128(*pa),
+                                                   _mm_cvtsi32_si128(*pb)));
+}
+
+/* Store pixel a at p[0] and pixel b at p[1] */
+static inline   TGT_AVX2 void
+_px2_put(uint32_t *p, __m256i v)
+{
+    __m128i         t;
+
+    t = _mm_packus_epi32(_mm256_castsi256_si128(v),
+                         _mm256_extracti128_si256(v, 1));
+    t = _mm_packus_epi16(t, t);
+    _mm_storel_epi64((__m128i *) p, t);
+}
+
+/* Sum of pixel a and pixel b */
+static inline   TGT_AVX2 __m128i
+_px2_sum(__m256i v)
+{
+    return _mm_add_epi32(_mm256_castsi256_si128(v),
+                         _mm256_extracti128_si256(v, 1));
+}
+
+static inline   TGT_AVX2 __m256i
+_px2_weights(int wa, int wb)
+{
+    return _mm256_setr_epi32(wa, wa, wa, wa, wb, wb, wb, wb);
+}
+
+static inline   TGT_AVX2 __m256i
+_px2_mul(__m256i v, int w)
+{
+    return _mm256_mullo_epi32(v, _mm256_set1_epi32(w));
+}
+
+static inline   TGT_AVX2 __m256i
+_px2_shr(__m256i v, int n)
+{
+    return _mm256_srl_epi32(v, _mm_cvtsi32_si128(n));
+}
+
+/* Area sample along two lines with identical weights */
+static inline   TGT_AVX2 __m256i
+_px2_area(const uint32_t *pa, const uint32_t *pb, int step, int ap, int C,
+          int n)
+{
+    __m256i         v;
+    int             j;
+
+    v = _px2_shr(_px2_mul(_px2_get(pa, pb), ap), n);
+    for (j = (1 << 14) - ap; j > C; j -= C)
+    {
+        pa += step;
+        pb += step;
+        v = _mm256_add_epi32(v, _px2_shr(_px2_mul(_px2_get(pa, pb), C), n));
+    }
+    if (j > 0)
+    {
+        pa += step;
+        pb += step;
+        v = _mm256_add_epi32(v, _px2_shr(_px2_mul(_px2_get(pa, pb), j), n));
+    }
+
+    return v;
+}
+
+/* Scaling up both ways, two adjacent destination pixels */
+static inline   TGT_AVX2 void
+_px2_up_up(uint32_t *dptr, const uint32_t *pa, const uint32_t *pb,
+           int xapa, int xapb, int yap, int sow, bool alpha)
+{
+    __m256i         v, vv, wx, iwx;
+
+    wx = _px2_weights(xapa, xapb);
+    iwx = _mm256_sub_epi32(_mm256_set1_epi32(256), wx);
+
+    v = _mm256_add_epi32(_mm256_mullo_epi32(_px2_get(pa, pb), iwx),
+                         _mm256_mullo_epi32(_px2_get(pa + (xapa > 0),
+                                                     pb + (xapb > 0)), wx));
+    if (yap > 0)
+    {
+        pa += sow;
+        pb += sow;
+        vv = _mm256_add_epi32(_mm256_mullo_epi32(_px2_get(pa, pb), iwx),
+                              _mm256_mullo_epi32(_px2_get(pa + (xapa > 0),
+                                                          pb + (xapb > 0)),
+                                                 wx));
+        v = _px2_shr(_mm256_add_epi32(_px2_mul(vv, yap),
+                                      _px2_mul(v, 256 - yap)), 16);
+    }
+    else
+    {
+        v = _px2_shr(v, 8);
+    }
+
+    _px2_put(dptr, v);
+    if (!alpha)
+    {
+        if (xapa > 0 || yap > 0)
+            dptr[0] |= ALPHA_MASK;
+        if (xapb > 0 || yap > 0)
+            dptr[1] |= ALPHA_MASK;
+    }
+}
+
+/* Scaling down vertically, two adjacent destination pixels */
+static inline   TGT_AVX2 void
+_px2_up_down(uint32_t *dptr, const uint32_t *pa, const uint32_t *pb,
+             int xapa, int xapb, int yap, int Cy, int sow, bool alpha)
+{
+    __m256i         v, vv, wx;
+
+    v = _px2_area(pa, pb, sow, yap, Cy, 10);
+    if (xapa > 0 || xapb > 0)
+    {
+        /* With weight 0 the pixel itself is used (result is the same) */
+        vv = _px2_area(pa + (xapa > 0), pb + (xapb > 0), sow, yap, Cy, 10);
+        wx = _px2_weights(xapa, xapb);
+        v = _mm256_mullo_epi32(v, _mm256_sub_epi32(_mm256_set1_epi32(256),
+                                                   wx));
+        v = _px2_shr(_mm256_add_epi32(v, _mm256_mullo_epi32(vv, wx)), 12);
+    }
+    else
+    {
+        v = _px2_shr(v, 4);
+    }
+
+    _px2_put(dptr, v);
+    if (!alpha)
+    {
+        dptr[0] |= ALPHA_MASK;
+        dptr[1] |= ALPHA_MASK;
+    }
+}
+
+/* Scaling down horizontally, both source lines at once */
+static inline   TGT_AVX2 uint32_t
+_px2_down_up(const uint32_t *pix, int xap, int Cx, int yap, int sow,
+             bool alpha)
+{
+    __m256i         v;
+    uint32_t        p;
+
+    v = _px2_area(pix, pix + sow, 1, xap, Cx, 10);
+    v = _mm256_mullo_epi32(v, _px2_weights(256 - yap, yap));
+
+    p = _px_pack(_px_shr(_px2_sum(v), 12));
+    if (!alpha)
+        p |= ALPHA_MASK;
+
+    return p;
+}
+
+/* Scaling down horizontally & vertically, two source lines at a time */
+static inline   TGT_AVX2 __m128i
+_px2_down_down(const uint32_t *pix, int xap, int Cx, int yap, int Cy,
+               int nmid, int jend, int sow)
+{
+    __m256i         v2, vx;
+    __m128i         v;
+    int             i, n, wa, wb;
+
+    /* Line weights are yap, nmid x Cy, jend (if > 0) */
+    n = 1 + nmid + (jend > 0);
+
+    v2 = _mm256_setzero_si256();
+    for (i = 0; i + 1 < n; i += 2, pix += 2 * sow)
+    {
+        wa = i == 0 ? yap : Cy;
+        wb = i + 1 <= nmid ? Cy : jend;
+        vx = _px2_area(pix, pix + sow, 1, xap, Cx, 9);
+        vx = _mm256_mullo_epi32(vx, _px2_weights(wa, wb));
+        v2 = _mm256_add_epi32(v2, _px2_shr(vx, 14));
+    }
+    v = _px2_sum(v2);
+    if (i < n)
+    {
+        wa = i == 0 ? yap : i <= nmid ? Cy : jend;
+        v = _mm_add_epi32(v, _px_shr(_px_mul(_px_area(pix, 1, xap, Cx, 9),
+                                             wa), 14));
+    }
+
+    return _px_shr(v, 5);
+}
+
+void            TGT_AVX2
+__imlib_ScaleAA_avx2(const ImlibScaleInfo *isi, bool alpha,
+                     const uint32_t *srce, uint32_t *dest,
+                     int dxx, int dyy, int dx, int dy, int dw, int dh,
+                     int dow, int sow)
+{
+    const uint32_t *sptr;
+    uint32_t       *dptr;
+    int             x, y, end, j, Cy, yap, nmid;
+    const int      *ypoints = isi->ypoints;
+    const int      *xpoints = isi->xpoints;
+    const int      *xapoints = isi->xapoints;
+    const int      *yapoints = isi->yapoints;
+
+    end = dxx + dw;
+    for (y = 0; y < dh; y++)
+    {
+        sptr = srce + ypoints[dyy + y] * sow;
+        dptr = dest + dx + (y + dy) * dow;
+
+        switch (isi->xup_yup)
+        {
+        case 3:
+            for (x = dxx; x + 1 < end; x += 2, dptr += 2)
+                _px2_up_up(dptr, sptr + xpoints[x], sptr + xpoints[x + 1],
+                           xapoints[x], xapoints[x + 1], YAP, sow, alpha);
+            if (x < end)
+                *dptr = _px_up_up(sptr + xpoints[x], XAP, YAP, sow, alpha);
+            break;
+        case 1:
+            Cy = YAP >> 16;
+            yap = YAP & 0xffff;
+            for (x = dxx; x + 1 < end; x += 2, dptr += 2)
+                _px2_up_down(dptr, sptr + xpoints[x], sptr + xpoints[x + 1],
+                             xapoints[x], xapoints[x + 1], yap, Cy, sow,
+                             alpha);
+            if (x < end)
+                *dptr = _px_up_down(sptr + xpoints[x], XAP, yap, Cy, sow,
+                                    alpha);
+            break;
+        case 2:
+            if (YAP > 0)
+                for (x = dxx; x < end; x++)
+                    *dptr++ = _px2_down_up(sptr + xpoints[x], XAP & 0xffff,
+                                           XAP >> 16, YAP, sow, alpha);
+            else
+                for (x = dxx; x < end; x++)
+                    *dptr++ = _px_down_up(sptr + xpoints[x], XAP & 0xffff,
+                                          XAP >> 16, 0, sow, alpha);
+            break;
+        default:
+            Cy = YAP >> 16;
+            yap = YAP & 0xffff;
+            for (j = (1 << 14) - yap, nmid = 0; j > Cy; j -= Cy)
+                nmid++;
+            for (x = dxx; x < end; x++, dptr++)
+                _px_put_down_down(dptr,
+                                  _px2_down_down(sptr + xpoints[x],
+                                                 XAP & 0xffff, XAP >> 16,
+                                                 yap, Cy, nmid, j, sow),
+                                  alpha);
+            break;
+        }
+    }
+}
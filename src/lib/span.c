@@ -1,6 +1,9 @@
 #include "common.h"
 
 #include <stddef.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "blend.h"
 #include "span.h"
@@ -190,6 +193,13 @@ __imlib_ReBlendToRGBA(uint32_t color, uint32_t *dst)
 static void
 __imlib_CopySpanToRGBA(uint32_t color, uint32_t *dst, int len)
 {
+#ifdef __SSE2__
+    __m128i         c;
+
+    c = _mm_set1_epi32(color);
+    for (; len >= 4; len -= 4, dst += 4)
+        _mm_storeu_si128((__m128i *) dst, c);
+#endif
     while (len--)
     {
         *dst = color;
@@ -200,6 +210,18 @@ __imlib_CopySpanToRGBA(uint32_t color, uint32_t *dst, int len)
 static void
 __imlib_CopySpanToRGB(uint32_t color, uint32_t *dst, int len)
 {
+#ifdef __SSE2__
+    __m128i         c, m, v;
+
+    c = _mm_set1_epi32(color & 0x00ffffff);
+    m = _mm_set1_epi32(0xff000000);
+    for (; len >= 4; len -= 4, dst += 4)
+    {
+        v = _mm_loadu_si128((__m128i *) dst);
+        v = _mm_or_si128(_mm_and_si128(v, m), c);
+        _mm_storeu_si128((__m128i *) dst, v);
+    }
+#endif
     while (len--)
     {
         *dst = (*dst & 0xff000000) | (color & 0x00ffffff);
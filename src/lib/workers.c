@@ -0,0 +1,185 @@
+#include "common.h"
+
+#include <stdlib.h>
+
+#include "debug.h"
+#include "lock.h"
+#include "workers.h"
+
+#define DBG_PFX "WORK"
+
+/* Worker pool
+ * The calling thread acts as worker 0, pool threads as workers 1..n-1.
+ * Jobs are handed out one at a time so uneven jobs balance out.
+ * Only one job set is run at a time, other callers run theirs serially. */
+
+static int      n_workers_want = 1;     /* Set by application */
+
+#if ENABLE_THREADS
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond_work;  /* New job set posted */
+    pthread_cond_t  cond_done;  /* Last busy worker done */
+    int             n_threads;  /* Pool threads started */
+    unsigned int    generation; /* Job set counter */
+    unsigned int    start_generation;   /* Generation at thread start */
+    ImlibWorkFunc  *func;
+    void           *data;
+    int             n_jobs;
+    int             n_workers;  /* Workers used for current job set */
+    int             next_job;
+    int             n_busy;
+} ImlibWorkers;
+
+static ImlibWorkers workers = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond_work = PTHREAD_COND_INITIALIZER,
+    .cond_done = PTHREAD_COND_INITIALIZER,
+};
+
+LOCK_STATIC(run_lock);
+
+/* Run jobs until there are no more. Called with workers.lock held. */
+static void
+_workers_do_jobs(int worker)
+{
+    ImlibWorkFunc  *func;
+    void           *data;
+    int             job;
+
+    while (workers.next_job < workers.n_jobs)
+    {
+        job = workers.next_job++;
+        func = workers.func;
+        data = workers.data;
+
+        pthread_mutex_unlock(&workers.lock);
+        func(data, job, worker);
+        pthread_mutex_lock(&workers.lock);
+    }
+}
+
+static void    *
+_workers_thread(void *arg)
+{
+    int             worker = (int)(intptr_t) arg;
+    unsigned int    generation;
+
+    pthread_mutex_lock(&workers.lock);
+
+    generation = workers.start_generation;
+
+    for (;;)
+    {
+        while (generation == workers.generation)
+            pthread_cond_wait(&workers.cond_work, &workers.lock);
+        generation = workers.generation;
+
+        if (worker >= workers.n_workers)
+            continue;
+
+        workers.n_busy++;
+        _workers_do_jobs(worker);
+        if (--workers.n_busy == 0)
+            pthread_cond_signal(&workers.cond_done);
+    }
+
+    return NULL;
+}
+
+/* Start pool threads up to n_workers - 1. Called with workers.lock held. */
+static void
+_workers_start(int n_workers)
+{
+    pthread_attr_t  attr;
+    pthread_t       thr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    /* New threads pick up the job set about to be posted */
+    workers.start_generation = workers.generation;
+
+    while (workers.n_threads < n_workers - 1)
+    {
+        if (pthread_create(&thr, &attr, _workers_thread,
+                           (void *)(intptr_t) (workers.n_threads + 1)))
+            break;
+        workers.n_threads++;
+        D("%s: Started worker %d\n", __func__, workers.n_threads);
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+#endif                          /* ENABLE_THREADS */
+
+void
+__imlib_WorkersSet(int num)
+{
+    if (num < 1)
+        num = 1;
+    if (num > WORKERS_MAX)
+        num = WORKERS_MAX;
+
+    n_workers_want = num;
+}
+
+__EXPORT__ int
+__imlib_WorkersGet(void)
+{
+#if ENABLE_THREADS
+    return n_workers_want;
+#else
+    return 1;
+#endif
+}
+
+/* Run func(data, job, worker) for job = 0..n_jobs-1, using up to n_workers
+ * workers (normally __imlib_WorkersGet()). Returns when all jobs are done.
+ * Returns the number of workers used. */
+__EXPORT__ int
+__imlib_WorkersRun(ImlibWorkFunc *func, void *data, int n_jobs, int n_workers)
+{
+    int             job;
+
+#if ENABLE_THREADS
+    if (n_workers > n_jobs)
+        n_workers = n_jobs;
+
+    if (n_workers > 1 && pthread_mutex_trylock(&run_lock) == 0)
+    {
+        pthread_mutex_lock(&workers.lock);
+
+        _workers_start(n_workers);
+        if (n_workers > workers.n_threads + 1)
+            n_workers = workers.n_threads + 1;
+
+        workers.func = func;
+        workers.data = data;
+        workers.n_jobs = n_jobs;
+        workers.n_workers = n_workers;
+        workers.next_job = 0;
+        workers.generation++;
+        pthread_cond_broadcast(&workers.cond_work);
+
+        _workers_do_jobs(0);
+
+        while (workers.n_busy > 0)
+            pthread_cond_wait(&workers.cond_done, &workers.lock);
+
+        pthread_mutex_unlock(&workers.lock);
+
+        UNLOCK(run_lock);
+
+        return n_workers;
+    }
+#endif
+
+    /* Not threaded, pool busy, or not worth it */
+    for (job = 0; job < n_jobs; job++)
+        func(data, job, 0);
+
+    return 1;
+}
@@ -0,0 +1,19 @@
+#ifndef WORKERS_H
+#define WORKERS_H 1
+
+/* Maximum number of workers */
+#define WORKERS_MAX             64
+
+/* Minimum number of pixels worth spreading over worker threads */
+#define WORKERS_MIN_PIXELS      (256 * 256)
+
+/* Job function. job is 0..n_jobs-1, worker is 0..n_workers-1 */
+typedef void    (ImlibWorkFunc) (void *data, int job, int worker);
+
+void            __imlib_WorkersSet(int num);
+int             __imlib_WorkersGet(void);
+
+int             __imlib_WorkersRun(ImlibWorkFunc * func, void *data,
+                                   int n_jobs, int n_workers);
+
+#endif                          /* WORKERS_H */
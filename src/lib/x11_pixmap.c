@@ -7,6 +7,7 @@
 #include "blend.h"
 #include "colormod.h"
 #include "image.h"
+#include "lock.h"
 #include "x11_pixmap.h"
 #include "x11_rend.h"
 
@@ -30,6 +31,10 @@ typedef struct _ImlibImagePixmap {
 
 static ImlibImagePixmap *pixmaps = NULL;
 
+/* Protects the pixmap list. The image cache lock must not be taken while
+ * holding it. */
+LOCK_STATIC(pixmap_lock);
+
 /* create a pixmap cache data struct */
 static ImlibImagePixmap *
 __imlib_ProduceImagePixmap(void)
@@ -144,6 +149,7 @@ __imlib_PixmapUnrefImage(const ImlibImage *im)
 {
     ImlibImagePixmap *ip;
 
+    LOCK(pixmap_lock);
     for (ip = pixmaps; ip; ip = ip->next)
     {
         if (ip->image == im)
@@ -152,6 +158,7 @@ __imlib_PixmapUnrefImage(const ImlibImage *im)
             ip->dirty = 1;
         }
     }
+    UNLOCK(pixmap_lock);
 }
 
 /* remove a pixmap cache struct from the pixmap cache */
@@ -173,14 +180,42 @@ __imlib_RemoveImagePixmapFromCache(ImlibImagePixmap *ip_del)
     }
 }
 
+/* data size of a pixmap cache struct */
+static uint64_t
+__imlib_ImagePixmapSize(const ImlibImagePixmap *ip)
+{
+    uint64_t        size = 0;
+
+    if (ip->pixmap)
+    {
+        if (ip->depth < 8)
+            size += ip->w * ip->h * (ip->depth / 8);
+        else if (ip->depth == 8)
+            size += ip->w * ip->h;
+        else if (ip->depth <= 16)
+            size += ip->w * ip->h * 2;
+        else if (ip->depth <= 32)
+            size += ip->w * ip->h * 4;
+    }
+    /* if theres a mask add it too */
+    if (ip->mask)
+        size += ip->w * ip->h / 8;
+
+    return size;
+}
+
 /* clean out 0 reference count & dirty pixmaps from the cache */
 void
 __imlib_CleanupImagePixmapCache(void)
 {
     ImlibImagePixmap *ip, *ip_next, *ip_del;
-    int             current_cache;
+    uint64_t        current_cache, cache_size;
 
+    /* Query the image cache before locking the pixmap list */
     current_cache = __imlib_CurrentCacheSize();
+    cache_size = __imlib_GetCacheSize();
+
+    LOCK(pixmap_lock);
 
     for (ip = pixmaps; ip; ip = ip_next)
     {
@@ -192,7 +227,7 @@ __imlib_CleanupImagePixmapCache(void)
         }
     }
 
-    while (current_cache > __imlib_GetCacheSize())
+    while (current_cache > cache_size)
     {
         for (ip = pixmaps, ip_del = NULL; ip; ip = ip->next)
         {
@@ -203,10 +238,11 @@ __imlib_CleanupImagePixmapCache(void)
             break;
 
         __imlib_RemoveImagePixmapFromCache(ip_del);
+        current_cache -= MIN(current_cache, __imlib_ImagePixmapSize(ip_del));
         __imlib_ConsumeImagePixmap(ip_del);
-
-        current_cache = __imlib_CurrentCacheSize();
     }
+
+    UNLOCK(pixmap_lock);
 }
 
 /* find an imagepixmap cache entry by the display and pixmap id */
@@ -236,25 +272,29 @@ void
 __imlib_FreePixmap(Display *d, Pixmap p)
 {
     ImlibImagePixmap *ip;
+    int             refs = -1;
 
+    LOCK(pixmap_lock);
     /* find the pixmap in the cache by display and id */
     ip = __imlib_FindImlibImagePixmapByID(d, p);
-    if (ip)
+    /* if tis positive reference count */
+    if (ip && ip->references > 0)
     {
-        /* if tis positive reference count */
-        if (ip->references > 0)
-        {
-            /* dereference it by one */
-            ip->references--;
+        /* dereference it by one */
+        refs = --ip->references;
 #ifdef DEBUG_CACHE
-            fprintf(stderr,
-                    "[Imlib2]  Reference count is now %d for pixmap 0x%08lx\n",
-                    ip->references, ip->pixmap);
+        fprintf(stderr,
+                "[Imlib2]  Reference count is now %d for pixmap 0x%08lx\n",
+                ip->references, ip->pixmap);
 #endif
-            /* if it becaume 0 reference count - clean the cache up */
-            if (ip->references == 0)
-                __imlib_CleanupImagePixmapCache();
-        }
+    }
+    UNLOCK(pixmap_lock);
+
+    if (ip)
+    {
+        /* if it becaume 0 reference count - clean the cache up */
+        if (refs == 0)
+            __imlib_CleanupImagePixmapCache();
     }
     else
     {
@@ -273,21 +313,25 @@ __imlib_DirtyPixmapsForImage(const ImlibImage *im)
 {
     ImlibImagePixmap *ip;
 
+    LOCK(pixmap_lock);
     for (ip = pixmaps; ip; ip = ip->next)
     {
         /* if image matches */
         if (ip->image == im)
             ip->dirty = 1;
     }
+    UNLOCK(pixmap_lock);
     __imlib_CleanupImagePixmapCache();
 }
 
-int
+uint64_t
 __imlib_PixmapCacheSize(void)
 {
-    int             current_cache = 0;
+    uint64_t        current_cache = 0;
     ImlibImagePixmap *ip, *ip_next;
 
+    LOCK(pixmap_lock);
+
     for (ip = pixmaps; ip; ip = ip_next)
     {
         ip_next = ip->next;
@@ -304,24 +348,13 @@ __imlib_PixmapCacheSize(void)
             else
             {
                 /* add the pixmap data size to the cache size */
-                if (ip->pixmap)
-                {
-                    if (ip->depth < 8)
-                        current_cache += ip->w * ip->h * (ip->depth / 8);
-                    else if (ip->depth == 8)
-                        current_cache += ip->w * ip->h;
-                    else if (ip->depth <= 16)
-                        current_cache += ip->w * ip->h * 2;
-                    else if (ip->depth <= 32)
-                        current_cache += ip->w * ip->h * 4;
-                }
-                /* if theres a mask add it too */
-                if (ip->mask)
-                    current_cache += ip->w * ip->h / 8;
+                current_cache += __imlib_ImagePixmapSize(ip);
             }
         }
     }
 
+    UNLOCK(pixmap_lock);
+
     return current_cache;
 }
 
@@ -339,6 +372,7 @@ __imlib_CreatePixmapsForImage(const ImlibContextX11 *x11, Drawable w,
 
     if (cmod)
         mod_count = cmod->modification_count;
+    LOCK(pixmap_lock);
     ip = __imlib_FindCachedImagePixmap(x11, im, dw, dh, sx, sy, sw, sh,
                                        antialias, hiq, dither_mask, mod_count);
     if (ip)
@@ -353,8 +387,11 @@ __imlib_CreatePixmapsForImage(const ImlibContextX11 *x11, Drawable w,
                 "[Imlib2]  Match found in cache.  Reference count is %d, pixmap 0x%08lx, mask 0x%08lx\n",
                 ip->references, ip->pixmap, ip->mask);
 #endif
+        UNLOCK(pixmap_lock);
         return 2;
     }
+    UNLOCK(pixmap_lock);
+
     if (p)
     {
         pmap = XCreatePixmap(x11->dpy, w, dw, dh, x11->depth);
@@ -369,6 +406,7 @@ __imlib_CreatePixmapsForImage(const ImlibContextX11 *x11, Drawable w,
     __imlib_RenderImage(x11, im, pmap, mask, sx, sy, sw, sh, 0, 0,
                         dw, dh, antialias, hiq, 0, dither_mask, mat, cmod,
                         OP_COPY);
+    LOCK(pixmap_lock);
     ip = __imlib_AddImagePixmapToCache(x11, im, pmap, mask,
                                        dw, dh, sx, sy, sw, sh,
                                        antialias, hiq, dither_mask, mod_count);
@@ -377,5 +415,6 @@ __imlib_CreatePixmapsForImage(const ImlibContextX11 *x11, Drawable w,
             "[Imlib2]  Created pixmap.  Reference count is %d, pixmap 0x%08lx, mask 0x%08lx\n",
             ip->references, ip->pixmap, ip->mask);
 #endif
+    UNLOCK(pixmap_lock);
     return 1;
 }
@@ -5,7 +5,7 @@
 #include "x11_types.h"
 
 void            __imlib_CleanupImagePixmapCache(void);
-int             __imlib_PixmapCacheSize(void);
+uint64_t        __imlib_PixmapCacheSize(void);
 
 void            __imlib_FreePixmap(Display * d, Pixmap p);
 void            __imlib_DirtyPixmapsForImage(const ImlibImage * im);
@@ -1,8 +1,21 @@
 #ifndef COMPRESSION_H
 #define COMPRESSION_H 1
 
+#include <stddef.h>
+
+typedef struct {
+    unsigned char  *data;
+    size_t          size;       /* Bytes decompressed */
+    size_t          alloc;      /* Bytes allocated */
+    size_t          size_hint;  /* Expected size (0: unknown) */
+} ImlibDecompressBuf;
+
 typedef int     (imlib_decompress_load_f) (const void *fdata,
-                                           unsigned int fsize, int dest);
+                                           unsigned int fsize,
+                                           ImlibDecompressBuf * dbuf);
+
+void           *decompress_buf_space(ImlibDecompressBuf * dbuf,
+                                     size_t *avail);
 
 int             decompress_load(ImlibImage * im, int load_data,
                                 const char *const *pext, int next,
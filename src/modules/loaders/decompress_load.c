@@ -2,64 +2,113 @@
 #include "Imlib2_Loader.h"
 #include "compression.h"
 
+#include <limits.h>
+
+#define DBUF_SIZE_MIN   (64 * 1024)
+/* The decompressed image is handed to the loaders as one memory block */
+#define DBUF_SIZE_MAX   UINT_MAX
+
+/* Return free space at the end of the decompression buffer (at least one
+ * byte, growing the buffer if needed), NULL on failure */
+void           *
+decompress_buf_space(ImlibDecompressBuf *dbuf, size_t *avail)
+{
+    size_t          size;
+    unsigned char  *data;
+
+    if (dbuf->size >= dbuf->alloc)
+    {
+        if (dbuf->alloc == 0)
+            size = dbuf->size_hint > 0 ? dbuf->size_hint : DBUF_SIZE_MIN;
+        else if (dbuf->alloc <= DBUF_SIZE_MAX / 2)
+            size = 2 * dbuf->alloc;
+        else
+            size = DBUF_SIZE_MAX;
+        if (size <= dbuf->alloc || size > DBUF_SIZE_MAX)
+            return NULL;
+
+        data = realloc(dbuf->data, size);
+        if (!data)
+            return NULL;
+        dbuf->data = data;
+        dbuf->alloc = size;
+    }
+
+    *avail = dbuf->alloc - dbuf->size;
+
+    return dbuf->data + dbuf->size;
+}
+
 int
 decompress_load(ImlibImage *im, int load_data, const char *const *pext,
                 int next, imlib_decompress_load_f *fdec)
 {
     int             rc, i;
     ImlibLoader    *loader;
-    int             dest, res;
+    int             res;
     const char     *s, *p, *q;
-    char            tmp[] = "/tmp/imlib2_loader_dec-XXXXXX";
-    char           *real_ext;
+    char           *real_ext, *name;
+    ImlibDecompressBuf dbuf = { 0 };
 
     rc = LOAD_FAIL;
+    loader = NULL;
+    name = NULL;
 
-    /* make sure this file ends in a known name and that there's another ext
-     * (e.g. "foo.png.bz2") */
-    for (p = s = im->fi->name, q = NULL; *s; s++)
+    /* if the name has another ext (e.g. "foo.png.bz2") use that, otherwise
+     * pick the loader by signature after decompression */
+    p = q = NULL;
+    if (im->fi->name)
     {
-        if (*s != '.' && *s != '/')
-            continue;
-        q = p;
-        p = s + 1;
+        for (p = s = im->fi->name; *s; s++)
+        {
+            if (*s != '.' && *s != '/')
+                continue;
+            q = p;
+            p = s + 1;
+        }
     }
 
-    if (!q)
-        return rc;
-
     res = 0;
-    for (i = 0; i < next; i++)
+    for (i = 0; q && i < next; i++)
     {
         if (strcasecmp(p, pext[i]))
             continue;
         res = 1;
         break;
     }
-    if (!res)
-        return rc;
-
-    if (!(real_ext = strndup(q, p - q - 1)))
-        return LOAD_OOM;
 
-    loader = __imlib_FindBestLoader(NULL, real_ext, 0);
-    free(real_ext);
-    if (!loader)
-        return rc;
-
-    if ((dest = mkstemp(tmp)) < 0)
-        QUIT_WITH_RC(LOAD_OOM);
+    if (res)
+    {
+        /* The inner file is named without the compression extension */
+        if (!(name = strndup(im->fi->name, p - im->fi->name - 1)))
+            return LOAD_OOM;
 
-    res = fdec(im->fi->fdata, im->fi->fsize, dest);
+        if (q > im->fi->name && q[-1] == '.' && p - q > 1)
+        {
+            if (!(real_ext = strndup(q, p - q - 1)))
+                QUIT_WITH_RC(LOAD_OOM);
 
-    close(dest);
+            loader = __imlib_FindBestLoader(NULL, real_ext, 0);
+            free(real_ext);
+        }
+    }
 
-    if (res)
-        rc = __imlib_LoadEmbedded(loader, im, load_data, tmp);
+    /* Decompress to memory and load from there */
+    res = fdec(im->fi->fdata, im->fi->fsize, &dbuf);
 
-    unlink(tmp);
+    if (res && dbuf.size > 0)
+    {
+        if (!loader)
+            loader = __imlib_SniffLoader(dbuf.data, dbuf.size);
+        if (loader)
+            rc = __imlib_LoadEmbeddedMemNamed(loader, im, load_data,
+                                              name ? name : im->fi->name,
+                                              dbuf.data, dbuf.size);
+    }
 
   quit:
+    free(dbuf.data);
+    free(name);
 
     return rc;
 }
@@ -28,12 +28,14 @@ get_saver_params(const ImlibImage *im, ImlibSaverParam *imsp)
     imsp->compression = 6;
     imsp->quality = 75;
     imsp->interlacing = 0;
+    imsp->effort = -1;
+    imsp->threads = 0;
 
     /* Compression type */
     if ((tag = __imlib_GetTag(im, "compression_type")))
         imsp->compr_type = tag->val;
 
-    /* Compression (effort) */
+    /* Compression */
     if ((tag = __imlib_GetTag(im, "compression")))
         imsp->compression = CLAMP(tag->val, 0, 9);
 
@@ -47,4 +49,16 @@ get_saver_params(const ImlibImage *im, ImlibSaverParam *imsp)
     /* Interlacing */
     if ((tag = __imlib_GetTag(im, "interlacing")))
         imsp->interlacing = !!tag->val;
+
+    /* Encoder effort, or speed (9 - effort). Only set by these tags,
+     * savers that used compression as effort fall back to it. */
+    if ((tag = __imlib_GetTag(im, "effort")))
+        imsp->effort = CLAMP(tag->val, 0, 9);
+    else if ((tag = __imlib_GetTag(im, "speed")))
+        imsp->effort = 9 - CLAMP(tag->val, 0, 9);
+
+    /* Encoder threads (<= 0: as set by imlib_set_threads()) */
+    if ((tag = __imlib_GetTag(im, "threads")))
+        imsp->threads = CLAMP(tag->val > 0 ? tag->val : __imlib_WorkersGet(),
+                              1, 64);
 }
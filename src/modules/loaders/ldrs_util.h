@@ -8,6 +8,8 @@ typedef struct {
     int             compression;        /* 0 -   9 */
     int             quality;    /* 1 - 100 */
     int             interlacing;        /* 0 or 1 */
+    int             effort;     /* 0 -   9, -1: not set */
+    int             threads;    /* Encoder threads (0: default) */
 } ImlibSaverParam;
 
 void            get_saver_params(const ImlibImage * im, ImlibSaverParam * imsp);
@@ -28,8 +28,13 @@ static const char *const _formats[] = { "ani" };
 typedef struct {
     unsigned char   nest;
     int             nframes, nfsteps;
+    unsigned int    rate;       /* Default rate (1/60 s) */
     const uint32_t *rates;
     const uint32_t *seq;
+    /* Index of icon chunks (when kept across frames) */
+    char            index;
+    int             nicons;
+    const char    **icons;
 } riff_ctx_t;
 
 typedef struct __PACKED__ {
@@ -77,7 +82,8 @@ _load_embedded(ImlibImage *im, int load_data, const char *data,
     im->frame = 0;
     im->lc = NULL;
 
-    rc = __imlib_LoadEmbeddedMem(loader, im, load_data, data, size);
+    rc = __imlib_LoadEmbeddedMemNamed(loader, im, load_data, im->fi->name,
+                                      data, size);
 
     im->frame = frame;
     im->lc = lc;
@@ -161,6 +167,21 @@ _riff_parse(ImlibImage *im, riff_ctx_t *ctx, const char *fdata,
             break;
         case RIFF_TYPE_icon:
             Dx("\n");
+            if (ctx->index)
+            {
+                const char    **icons;
+
+                icons = realloc(ctx->icons,
+                                (ctx->nicons + 1) * sizeof(const char *));
+                if (!icons)
+                {
+                    rc = LOAD_OOM;
+                    break;
+                }
+                ctx->icons = icons;
+                ctx->icons[ctx->nicons++] = fptr;
+                break;
+            }
             fcount++;
             if (im->frame > 0)
             {
@@ -169,7 +190,9 @@ _riff_parse(ImlibImage *im, riff_ctx_t *ctx, const char *fdata,
                 if (i != fcount)
                     break;
             }
-            if (pf && ctx->rates)
+            /* Icons are in a nested LIST, pf is not set here */
+            pf = (ctx->rates) ? __imlib_GetFrame(im) : NULL;
+            if (pf)
                 pf->frame_delay =
                     (1000 * SWAP_LE_32(ctx->rates[im->frame - 1])) / 60;
             rc = _load_embedded(im, 1, fptr + 8, size);
@@ -185,6 +208,7 @@ _riff_parse(ImlibImage *im, riff_ctx_t *ctx, const char *fdata,
 /**INDENT-ON**/
             ctx->nframes = SWAP_LE_32(AH.frames);
             ctx->nfsteps = SWAP_LE_32(AH.steps);
+            ctx->rate = SWAP_LE_32(AH.rate);
             if (im->frame <= 0)
                 break;
             if (ctx->nfsteps < ctx->nframes)
@@ -241,15 +265,82 @@ _riff_parse(ImlibImage *im, riff_ctx_t *ctx, const char *fdata,
     return rc;
 }
 
+static void
+_ctx_free(void *state)
+{
+    riff_ctx_t     *ctx = state;
+
+    free(ctx->icons);
+    free(ctx);
+}
+
+/* Load frame from icon chunk index */
+static int
+_load_indexed(ImlibImage *im, riff_ctx_t *ctx)
+{
+    ImlibImageFrame *pf;
+    const ani_chunk_t *chunk;
+    int             frame, i;
+
+    frame = im->frame;
+    if (frame > ctx->nfsteps)
+        return LOAD_BADFRAME;
+
+    pf = __imlib_GetFrame(im);
+    if (!pf)
+        return LOAD_OOM;
+    pf->frame_count = ctx->nfsteps;
+    if (ctx->nframes > 1)
+        pf->frame_flags = FF_IMAGE_ANIMATED;
+    pf->frame_delay = (1000 * (ctx->rates ?
+                               SWAP_LE_32(ctx->rates[frame - 1]) :
+                               ctx->rate)) / 60;
+
+    i = (ctx->seq) ? (int)SWAP_LE_32(ctx->seq[frame - 1]) : frame - 1;
+    if (i < 0 || i >= ctx->nicons)
+        return LOAD_BADFRAME;
+
+    chunk = PCAST(const ani_chunk_t *, ctx->icons[i]);
+
+    return _load_embedded(im, 1, ctx->icons[i] + 8,
+                          SWAP_LE_32(chunk->hdr.size));
+}
+
 static int
 _load(ImlibImage *im, int load_data)
 {
     int             rc;
-    riff_ctx_t      ctx = { };
+    riff_ctx_t      ctx0 = { }, *ctx;
 
-    rc = _riff_parse(im, &ctx, im->fi->fdata, im->fi->fsize, im->fi->fdata);
+    if (im->frame <= 0)
+        return _riff_parse(im, &ctx0, im->fi->fdata, im->fi->fsize,
+                           im->fi->fdata);
 
-    return rc;
+    /* When iterating frames index the icons once */
+    ctx = __imlib_LoaderState(im);
+    if (!ctx)
+    {
+        ctx = calloc(1, sizeof(riff_ctx_t));
+        if (!ctx)
+            return LOAD_OOM;
+        if (__imlib_LoaderStateSet(im, ctx, _ctx_free))
+        {
+            free(ctx);
+            return _riff_parse(im, &ctx0, im->fi->fdata, im->fi->fsize,
+                               im->fi->fdata);
+        }
+
+        ctx->index = 1;
+        rc = _riff_parse(im, ctx, im->fi->fdata, im->fi->fsize,
+                         im->fi->fdata);
+        if (rc != LOAD_FAIL || ctx->nicons <= 0)
+        {
+            __imlib_LoaderStateSet(im, NULL, NULL);
+            return rc;
+        }
+    }
+
+    return _load_indexed(im, ctx);
 }
 
 IMLIB_LOADER(_formats, _load, NULL);
@@ -1,9 +1,10 @@
 #include "config.h"
 #include "Imlib2_Loader.h"
+#include "lock.h"
 
 static const char *const _formats[] = { "argb", "arg" };
 
-static struct {
+static THREAD_LOCAL struct {
     const unsigned char *data, *dptr;
     unsigned int    size;
 } mdata;
@@ -109,10 +110,9 @@ static int
 _save(ImlibImage *im)
 {
     int             rc;
-    FILE           *f = im->fi->fp;
     const uint32_t *imdata;
-    int             y, alpha = 0;
-    size_t          nw;
+    int             y, n, alpha = 0;
+    char            hdr[64];
 
 #ifdef WORDS_BIGENDIAN
     uint32_t       *buf = (uint32_t *) malloc(im->w * 4);
@@ -124,7 +124,8 @@ _save(ImlibImage *im)
 
     alpha = !!im->has_alpha;
 
-    if (fprintf(f, "ARGB %i %i %i\n", im->w, im->h, alpha) <= 0)
+    n = snprintf(hdr, sizeof(hdr), "ARGB %i %i %i\n", im->w, im->h, alpha);
+    if (__imlib_SaveWrite(im, hdr, n))
         goto quit;
 
     imdata = im->data;
@@ -137,13 +138,13 @@ _save(ImlibImage *im)
             memcpy(buf, imdata, im->w * 4);
             for (x = 0; x < im->w; x++)
                 SWAP_LE_32_INPLACE(buf[x]);
-            nw = fwrite(buf, 4, im->w, f);
+            if (__imlib_SaveWrite(im, buf, 4 * im->w))
+                goto quit;
         }
 #else
-        nw = fwrite(imdata, 4, im->w, f);
-#endif
-        if (nw != (size_t)im->w)
+        if (__imlib_SaveWrite(im, imdata, 4 * im->w))
             goto quit;
+#endif
 
         if (im->lc && __imlib_LoadProgressRows(im, y, 1))
             QUIT_WITH_RC(LOAD_BREAK);
@@ -160,4 +161,4 @@ _save(ImlibImage *im)
     return rc;
 }
 
-IMLIB_LOADER(_formats, _load, _save);
+IMLIB_LOADER_WRITE(_formats, _load, _save);
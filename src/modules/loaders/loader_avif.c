@@ -16,13 +16,14 @@ _load(ImlibImage *im, int load_data)
     avifRGBImage    rgb;
     avifImageTiming timing;
     int             rc;
-    int             frame, fcount;
+    int             frame, fcount, n_threads;
     ImlibImageFrame *pf;
 
     dec = avifDecoderCreate();
     if (!dec)
         return LOAD_OOM;
-    dec->maxThreads = MAX_THREADS;
+    n_threads = im->threads > 0 ? im->threads : MAX_THREADS;
+    dec->maxThreads = n_threads;
 
     if (avifDecoderSetIOMemory(dec, im->fi->fdata, im->fi->fsize) !=
         AVIF_RESULT_OK)
@@ -87,7 +88,7 @@ _load(ImlibImage *im, int load_data)
     rgb.depth = 8;
     rgb.pixels = (uint8_t *) im->data;
     rgb.rowBytes = im->w * 4;
-    rgb.maxThreads = MAX_THREADS;
+    rgb.maxThreads = n_threads;
 #ifdef WORDS_BIGENDIAN          /* NOTE(NRK): untested on big endian */
     rgb.format = AVIF_RGB_FORMAT_ARGB;
 #else
@@ -116,7 +117,6 @@ _save(ImlibImage *im)
     avifImage      *avim = NULL;
     avifRGBImage    rgb;
     avifRWData      avout = AVIF_DATA_EMPTY;
-    unsigned int    nw;
 
     enc = avifEncoderCreate();
     if (!enc)
@@ -145,14 +145,18 @@ _save(ImlibImage *im)
 
     get_saver_params(im, &imsp);
 
-    enc->speed = 10 - imsp.compression;
+    /* Effort 0-9 -> speed 10-1 */
+    enc->speed = 10 - (imsp.effort >= 0 ? imsp.effort : imsp.compression);
+    if (imsp.threads > 0)
+        enc->maxThreads = imsp.threads;
     if (imsp.quality == 100)
         enc->quality = enc->qualityAlpha = AVIF_QUALITY_LOSSLESS;
     else
         enc->quality = enc->qualityAlpha = imsp.quality;
 
     D("Quality/compr: %d/%d\n", imsp.quality, imsp.compression);
-    D("Quality/speed: %d/%d\n", enc->quality, enc->speed);
+    D("Quality/speed/threads: %d/%d/%d\n", enc->quality, enc->speed,
+      enc->maxThreads);
 
     avrc = avifEncoderAddImage(enc, avim, 1, AVIF_ADD_IMAGE_FLAG_SINGLE);
     if (avrc != AVIF_RESULT_OK)
@@ -162,9 +166,8 @@ _save(ImlibImage *im)
     if (avrc != AVIF_RESULT_OK)
         QUIT_WITH_RC(LOAD_FAIL);
 
-    nw = fwrite(avout.data, 1, avout.size, im->fi->fp);
-    if (nw != avout.size)
-        QUIT_WITH_RC(LOAD_FAIL);
+    if (__imlib_SaveWrite(im, avout.data, avout.size))
+        QUIT_WITH_RC(LOAD_BADFILE);
 
     rc = LOAD_SUCCESS;
 
@@ -178,4 +181,4 @@ _save(ImlibImage *im)
     return rc;
 }
 
-IMLIB_LOADER(_formats, _load, _save);
+IMLIB_LOADER_WRITE(_formats, _load, _save);
@@ -9,13 +9,14 @@
  */
 #include "config.h"
 #include "Imlib2_Loader.h"
+#include "lock.h"
 
 #define DBG_PFX "LDR-bmp"
 #define DD(fmt...)
 
 static const char *const _formats[] = { "bmp" };
 
-static struct {
+static THREAD_LOCAL struct {
     const unsigned char *data, *dptr;
     unsigned int    size;
 } mdata;
@@ -106,52 +107,24 @@ enum {
     RLE_MOVE = 2                /* Move by X and Y (Offset is stored in two next bytes) */
 };
 
-static int
-_WriteleByte(FILE *file, unsigned char val)
+static uint8_t *
+_PutleShort(uint8_t *p, unsigned short val)
 {
-    int             rc;
-
-    rc = fputc((int)val & 0xff, file);
-    if (rc == EOF)
-        return 0;
+    *p++ = val & 0xff;
+    *p++ = (val >> 8) & 0xff;
 
-    return 1;
+    return p;
 }
 
-static int
-_WriteleShort(FILE *file, unsigned short val)
+static uint8_t *
+_PutleLong(uint8_t *p, unsigned long val)
 {
-    int             rc;
+    *p++ = val & 0xff;
+    *p++ = (val >> 8) & 0xff;
+    *p++ = (val >> 16) & 0xff;
+    *p++ = (val >> 24) & 0xff;
 
-    rc = fputc((int)(val & 0xff), file);
-    if (rc == EOF)
-        return 0;
-    rc = fputc((int)((val >> 8) & 0xff), file);
-    if (rc == EOF)
-        return 0;
-
-    return 1;
-}
-
-static int
-_WriteleLong(FILE *file, unsigned long val)
-{
-    int             rc;
-
-    rc = fputc((int)(val & 0xff), file);
-    if (rc == EOF)
-        return 0;
-    rc = fputc((int)((val >> 8) & 0xff), file);
-    if (rc == EOF)
-        return 0;
-    rc = fputc((int)((val >> 16) & 0xff), file);
-    if (rc == EOF)
-        return 0;
-    rc = fputc((int)((val >> 24) & 0xff), file);
-    if (rc == EOF)
-        return 0;
-
-    return 1;
+    return p;
 }
 
 static int
@@ -755,59 +728,67 @@ _load(ImlibImage *im, int load_data)
     return rc;
 }
 
-#define WriteleByte(file, val)  if (!_WriteleByte(file, val)) goto quit
-#define WriteleShort(file, val) if (!_WriteleShort(file, val)) goto quit
-#define WriteleLong(file, val)  if (!_WriteleLong(file, val)) goto quit
-
 static int
 _save(ImlibImage *im)
 {
     int             rc;
-    FILE           *f = im->fi->fp;
-    int             i, j, pad;
+    int             i, j, pad, len;
     uint32_t        pixel;
+    uint8_t         hdr[54], *p, *buf;
 
     rc = LOAD_BADFILE;
 
     /* calculate number of bytes to pad on end of each row */
     pad = (4 - ((im->w * 3) % 4)) & 0x03;
-
-    /* write BMP file header */
-    WriteleShort(f, 0x4d42);    /* prefix */
-    WriteleLong(f, 54 + ((3 * im->w) + pad) * im->h);   /* filesize (padding should be considered) */
-    WriteleShort(f, 0x0000);    /* reserved #1 */
-    WriteleShort(f, 0x0000);    /* reserved #2 */
-    WriteleLong(f, 54);         /* offset to image data */
-
-    /* write BMP bitmap header */
-    WriteleLong(f, 40);         /* 40-byte header */
-    WriteleLong(f, im->w);
-    WriteleLong(f, im->h);
-    WriteleShort(f, 1);         /* one plane      */
-    WriteleShort(f, 24);        /* bits per pixel */
-    WriteleLong(f, 0);          /* no compression */
-    WriteleLong(f, ((3 * im->w) + pad) * im->h);        /* padding should be counted */
+    len = 3 * im->w + pad;
+
+    buf = calloc(1, len);
+    if (!buf)
+        return LOAD_OOM;
+
+    /* BMP file header */
+    p = hdr;
+    p = _PutleShort(p, 0x4d42); /* prefix */
+    p = _PutleLong(p, 54 + len * im->h);        /* filesize (padding should be considered) */
+    p = _PutleShort(p, 0x0000); /* reserved #1 */
+    p = _PutleShort(p, 0x0000); /* reserved #2 */
+    p = _PutleLong(p, 54);      /* offset to image data */
+
+    /* BMP bitmap header */
+    p = _PutleLong(p, 40);      /* 40-byte header */
+    p = _PutleLong(p, im->w);
+    p = _PutleLong(p, im->h);
+    p = _PutleShort(p, 1);      /* one plane      */
+    p = _PutleShort(p, 24);     /* bits per pixel */
+    p = _PutleLong(p, 0);       /* no compression */
+    p = _PutleLong(p, len * im->h);     /* padding should be counted */
     for (i = 0; i < 4; i++)
-        WriteleLong(f, 0x0000); /* pad to end of header */
+        p = _PutleLong(p, 0x0000);      /* pad to end of header */
+
+    if (__imlib_SaveWrite(im, hdr, sizeof(hdr)))
+        goto quit;
 
     /* write actual BMP data */
     for (i = 0; i < im->h; i++)
     {
+        p = buf;
         for (j = 0; j < im->w; j++)
         {
             pixel = im->data[im->w * (im->h - i - 1) + j];
-            WriteleByte(f, PIXEL_B(pixel));
-            WriteleByte(f, PIXEL_G(pixel));
-            WriteleByte(f, PIXEL_R(pixel));
+            *p++ = PIXEL_B(pixel);
+            *p++ = PIXEL_G(pixel);
+            *p++ = PIXEL_R(pixel);
         }
-        for (j = 0; j < pad; j++)
-            WriteleByte(f, 0);
+        /* padding bytes stay zero */
+        if (__imlib_SaveWrite(im, buf, len))
+            goto quit;
     }
 
     rc = LOAD_SUCCESS;
 
   quit:
+    free(buf);
     return rc;
 }
 
-IMLIB_LOADER(_formats, _load, _save);
+IMLIB_LOADER_WRITE(_formats, _load, _save);
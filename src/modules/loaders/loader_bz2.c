@@ -4,18 +4,16 @@
 
 #include <bzlib.h>
 
-#define OUTBUF_SIZE 16384
-#define INBUF_SIZE 1024
-
 static const char *const _formats[] = { "bz2" };
 
 static int
-uncompress_file(const void *fdata, unsigned int fsize, int dest)
+uncompress_file(const void *fdata, unsigned int fsize,
+                ImlibDecompressBuf *dbuf)
 {
     int             ok;
     bz_stream       strm = { 0 };
-    int             ret, bytes;
-    char            outbuf[OUTBUF_SIZE];
+    int             ret;
+    size_t          avail;
 
     ok = 0;
 
@@ -28,20 +26,24 @@ uncompress_file(const void *fdata, unsigned int fsize, int dest)
 
     for (;;)
     {
-        strm.next_out = outbuf;
-        strm.avail_out = sizeof(outbuf);
+        strm.next_out = decompress_buf_space(dbuf, &avail);
+        if (!strm.next_out)
+            goto quit;
+        strm.avail_out = avail;
 
         ret = BZ2_bzDecompress(&strm);
 
         if (ret != BZ_OK && ret != BZ_STREAM_END)
             goto quit;
 
-        bytes = sizeof(outbuf) - strm.avail_out;
-        if (write(dest, outbuf, bytes) != bytes)
-            goto quit;
+        dbuf->size += avail - strm.avail_out;
 
         if (ret == BZ_STREAM_END)
             break;
+
+        /* Truncated input */
+        if (strm.avail_in == 0 && strm.avail_out > 0)
+            goto quit;
     }
 
     ok = 1;
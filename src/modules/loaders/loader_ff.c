@@ -84,7 +84,6 @@ static int
 _save(ImlibImage *im)
 {
     int             rc;
-    FILE           *f = im->fi->fp;
     size_t          rowlen, i, j;
     uint32_t        tmp32;
     uint16_t       *row;
@@ -94,14 +93,15 @@ _save(ImlibImage *im)
     row = NULL;
 
     /* write header */
-    fputs("farbfeld", f);
+    if (__imlib_SaveWrite(im, "farbfeld", 8))
+        goto quit;
 
     tmp32 = htonl(im->w);
-    if (fwrite(&tmp32, sizeof(uint32_t), 1, f) != 1)
+    if (__imlib_SaveWrite(im, &tmp32, sizeof(uint32_t)))
         goto quit;
 
     tmp32 = htonl(im->h);
-    if (fwrite(&tmp32, sizeof(uint32_t), 1, f) != 1)
+    if (__imlib_SaveWrite(im, &tmp32, sizeof(uint32_t)))
         goto quit;
 
     /* write data */
@@ -124,7 +124,7 @@ _save(ImlibImage *im)
             row[j + 2] = htons(imdata[j + 0] * 257);
             row[j + 3] = htons(imdata[j + 3] * 257);
         }
-        if (fwrite(row, sizeof(uint16_t), rowlen, f) != rowlen)
+        if (__imlib_SaveWrite(im, row, rowlen * sizeof(uint16_t)))
             goto quit;
 
         if (im->lc && __imlib_LoadProgressRows(im, i, 1))
@@ -139,4 +139,4 @@ _save(ImlibImage *im)
     return rc;
 }
 
-IMLIB_LOADER(_formats, _load, _save);
+IMLIB_LOADER_WRITE(_formats, _load, _save);
@@ -7,28 +7,115 @@
 
 static const char *const _formats[] = { "gif" };
 
-static struct {
+typedef struct {
+    GifFileType    *gif;
     const unsigned char *data, *dptr;
     unsigned int    size;
-} mdata;
+    int             fcount;     /* Number of frames (when iterating) */
+} gif_ctx_t;
+
+static int
+mm_read(GifFileType *gif, GifByteType *dst, int len)
+{
+    gif_ctx_t      *ctx = gif->UserData;
+
+    if (ctx->dptr + len > ctx->data + ctx->size)
+        return -1;              /* Out of data */
+
+    memcpy(dst, ctx->dptr, len);
+    ctx->dptr += len;
+
+    return len;
+}
+
+static GifFileType *
+_gif_open(gif_ctx_t *ctx, const void *data, unsigned int size)
+{
+#if GIFLIB_MAJOR >= 5
+    int             err;
+#endif
+
+    ctx->data = ctx->dptr = data;
+    ctx->size = size;
+
+#if GIFLIB_MAJOR >= 5
+    ctx->gif = DGifOpen(ctx, mm_read, &err);
+#else
+    ctx->gif = DGifOpen(ctx, mm_read);
+#endif
+
+    return ctx->gif;
+}
+
+static void
+_gif_close(GifFileType *gif)
+{
+#if GIFLIB_MAJOR > 5 || (GIFLIB_MAJOR == 5 && GIFLIB_MINOR >= 1)
+    DGifCloseFile(gif, NULL);
+#else
+    DGifCloseFile(gif);
+#endif
+}
 
 static void
-mm_init(const void *src, unsigned int size)
+_ctx_free(void *state)
 {
-    mdata.data = mdata.dptr = src;
-    mdata.size = size;
+    gif_ctx_t      *ctx = state;
+
+    _gif_close(ctx->gif);
+    free(ctx);
 }
 
+/* Count frames, skipping the image data without decoding it */
 static int
-mm_read(GifFileType *gif, GifByteType *dst, int len)
+_gif_count_frames(const void *data, unsigned int size)
 {
-    if (mdata.dptr + len > mdata.data + mdata.size)
-        return -1;              /* Out of data */
+    gif_ctx_t       ctx;
+    GifFileType    *gif;
+    GifRecordType   rec;
+    GifByteType    *ptr;
+    int             n, code;
 
-    memcpy(dst, mdata.dptr, len);
-    mdata.dptr += len;
+    gif = _gif_open(&ctx, data, size);
+    if (!gif)
+        return 0;
 
-    return len;
+    for (n = 0;;)
+    {
+        if (DGifGetRecordType(gif, &rec) == GIF_ERROR ||
+            rec == TERMINATE_RECORD_TYPE)
+            break;
+
+        if (rec == IMAGE_DESC_RECORD_TYPE)
+        {
+            if (DGifGetImageDesc(gif) == GIF_ERROR)
+                break;
+            n++;
+            if (DGifGetCode(gif, &code, &ptr) == GIF_ERROR)
+                break;
+            while (ptr)
+            {
+                if (DGifGetCodeNext(gif, &ptr) == GIF_ERROR)
+                    goto done;
+            }
+        }
+        else if (rec == EXTENSION_RECORD_TYPE)
+        {
+            ptr = NULL;
+            if (DGifGetExtension(gif, &code, &ptr) == GIF_ERROR)
+                break;
+            while (ptr)
+            {
+                if (DGifGetExtensionNext(gif, &ptr) == GIF_ERROR)
+                    goto done;
+            }
+        }
+    }
+
+  done:
+    _gif_close(gif);
+
+    return n;
 }
 
 static void
@@ -56,8 +143,9 @@ make_colormap(uint32_t *cmi, ColorMapObject *cmg, int bg, int tr)
 static int
 _load(ImlibImage *im, int load_data)
 {
-    int             rc, err;
+    int             rc;
     uint32_t       *ptr;
+    gif_ctx_t       ctx0, *ctx;
     GifFileType    *gif;
     GifRowType     *rows;
     GifRecordType   rec;
@@ -66,21 +154,44 @@ _load(ImlibImage *im, int load_data)
     int             transp;
     uint32_t        colormap[256];
     int             fcount, frame;
-    bool            multiframe;
+    bool            multiframe, keep;
     ImlibImageFrame *pf;
 
     rc = LOAD_FAIL;
     rows = NULL;
+    keep = false;
 
-    mm_init(im->fi->fdata, im->fi->fsize);
+    /* When iterating frames continue where the previous frame ended */
+    ctx = __imlib_LoaderState(im);
+    if (ctx && im->frame > 1 && ctx->gif->ImageCount == im->frame - 1)
+    {
+        keep = true;
+        gif = ctx->gif;
+    }
+    else
+    {
+        gif = _gif_open(&ctx0, im->fi->fdata, im->fi->fsize);
+        if (!gif)
+            goto quit;
 
-#if GIFLIB_MAJOR >= 5
-    gif = DGifOpen(NULL, mm_read, &err);
-#else
-    gif = DGifOpen(NULL, mm_read);
-#endif
-    if (!gif)
-        goto quit;
+        ctx = im->frame > 0 ? malloc(sizeof(gif_ctx_t)) : NULL;
+        if (ctx)
+        {
+            *ctx = ctx0;
+            gif->UserData = ctx;
+            keep = __imlib_LoaderStateSet(im, ctx, _ctx_free) == 0;
+            if (keep)
+            {
+                ctx->fcount = _gif_count_frames(im->fi->fdata,
+                                                im->fi->fsize);
+            }
+            else
+            {
+                gif->UserData = &ctx0;
+                free(ctx);
+            }
+        }
+    }
 
     rc = LOAD_BADIMAGE;         /* Format accepted */
 
@@ -221,8 +332,9 @@ _load(ImlibImage *im, int load_data)
                 }
             }
 
-            /* Break if no specific frame was requested */
-            if (!pf)
+            /* Break if no specific frame was requested, or if iterating
+             * (frame count is known, continue from here next time) */
+            if (!pf || keep)
                 break;
         }
         else if (rec == EXTENSION_RECORD_TYPE)
@@ -253,8 +365,10 @@ _load(ImlibImage *im, int load_data)
                     if (pf)
                     {
                         pf->frame_delay = frame_delay;
-                        if (disp == 2 || disp == 3)
+                        if (disp == 2)
                             pf->frame_flags |= FF_FRAME_DISPOSE_CLEAR;
+                        else if (disp == 3)
+                            pf->frame_flags |= FF_FRAME_DISPOSE_PREV;
                         pf->frame_flags |= FF_FRAME_BLEND;
                     }
                 }
@@ -273,7 +387,7 @@ _load(ImlibImage *im, int load_data)
     multiframe = false;
     if (pf)
     {
-        pf->frame_count = fcount;
+        pf->frame_count = keep ? ctx->fcount : fcount;
         multiframe = pf->frame_count > 1;
         if (multiframe)
             pf->frame_flags |= FF_IMAGE_ANIMATED;
@@ -320,11 +434,8 @@ _load(ImlibImage *im, int load_data)
         free(rows);
     }
 
-#if GIFLIB_MAJOR > 5 || (GIFLIB_MAJOR == 5 && GIFLIB_MINOR >= 1)
-    DGifCloseFile(gif, NULL);
-#else
-    DGifCloseFile(gif);
-#endif
+    if (gif && !keep)
+        _gif_close(gif);
 
     return rc;
 }
@@ -82,6 +82,11 @@ _load(ImlibImage *im, int load_data)
     if (!ctx)
         goto quit;
 
+#if LIBHEIF_HAVE_VERSION(1, 13, 0)
+    if (im->threads > 0)
+        heif_context_set_max_decoding_threads(ctx, im->threads);
+#endif
+
     error = heif_context_read_from_memory_without_copy(ctx, im->fi->fdata,
                                                        im->fi->fsize, NULL);
     if (IS_ERROR(error))
@@ -184,11 +189,9 @@ _heif_writer(struct heif_context *ctx, const void *data, size_t size,
              void *userdata)
 {
     struct heif_error error = heif_error_success;
-    FILE           *fp = userdata;
-    size_t          nw;
+    ImlibImage     *im = userdata;
 
-    nw = fwrite(data, 1, size, fp);
-    if (nw != size)
+    if (__imlib_SaveWrite(im, data, size))
     {
         error.code = heif_error_Encoding_error;
         error.subcode = errno;
@@ -198,7 +201,7 @@ _heif_writer(struct heif_context *ctx, const void *data, size_t size,
 }
 
 static int
-_heif_write(struct heif_context *ctx, FILE *fp)
+_heif_write(struct heif_context *ctx, ImlibImage *im)
 {
     struct heif_error error;
     struct heif_writer writer;
@@ -206,11 +209,35 @@ _heif_write(struct heif_context *ctx, FILE *fp)
     writer.writer_api_version = 1;
     writer.write = _heif_writer;
 
-    error = heif_context_write(ctx, &writer, fp);
+    error = heif_context_write(ctx, &writer, im);
 
     return IS_ERROR(error) ? LOAD_FAIL : LOAD_SUCCESS;
 }
 
+/* Encoder speed and threads. Parameters unknown to the plugin are rejected. */
+static void
+_heif_encoder_setup(struct heif_encoder *encoder, const ImlibSaverParam *imsp)
+{
+    static const char *const x265_presets[] = {
+        "ultrafast", "superfast", "veryfast", "faster", "fast",
+        "medium", "slow", "slower", "veryslow", "placebo",
+    };
+
+    D("Effort/threads: %d/%d\n", imsp->effort, imsp->threads);
+
+    if (imsp->effort >= 0)
+    {
+        /* x265 */
+        heif_encoder_set_parameter_string(encoder, "preset",
+                                          x265_presets[imsp->effort]);
+        /* AV1 encoders, higher is faster */
+        heif_encoder_set_parameter_integer(encoder, "speed", 9 - imsp->effort);
+    }
+
+    if (imsp->threads > 0)
+        heif_encoder_set_parameter_integer(encoder, "threads", imsp->threads);
+}
+
 static int
 _save(ImlibImage *im)
 {
@@ -260,6 +287,8 @@ _save(ImlibImage *im)
         heif_encoder_set_lossy_quality(encoder, imsp.quality);
     }
 
+    _heif_encoder_setup(encoder, &imsp);
+
     has_alpha = im->has_alpha;
 
     error = heif_image_create(im->w, im->h, heif_colorspace_RGB,
@@ -299,7 +328,7 @@ _save(ImlibImage *im)
 
     heif_context_encode_image(ctx, image, encoder, NULL, NULL);
 
-    rc = _heif_write(ctx, im->fi->fp);
+    rc = _heif_write(ctx, im);
 
   quit:
     heif_image_release(image);
@@ -311,7 +340,8 @@ _save(ImlibImage *im)
 
 #if !LIBHEIF_HAVE_VERSION(1, 13, 0)
 
-IMLIB_LOADER_KEEP(_formats, _load, _save);
+IMLIB_LOADER_(_formats, _load, _save, NULL,
+              LDR_FLAG_KEEP | LDR_FLAG_WRITE);
 
 #else
 
@@ -324,6 +354,6 @@ _inex(int init)
         heif_deinit();
 }
 
-IMLIB_LOADER_INEX(_formats, _load, _save, _inex);
+IMLIB_LOADER_(_formats, _load, _save, _inex, LDR_FLAG_WRITE);
 
 #endif
@@ -7,6 +7,7 @@
  */
 #include "config.h"
 #include "Imlib2_Loader.h"
+#include "lock.h"
 
 #include <limits.h>
 
@@ -14,7 +15,7 @@
 
 static const char *const _formats[] = { "ico" };
 
-static struct {
+static THREAD_LOCAL struct {
     const unsigned char *data, *dptr;
     unsigned int    size;
 } mdata;
@@ -602,4 +602,4 @@ _load(ImlibImage *im, int load_data)
     return rc;
 }
 
-IMLIB_LOADER(_formats, _load, NULL);
+IMLIB_LOADER_FILE(_formats, _load, NULL);
@@ -1,5 +1,6 @@
 #include "config.h"
 #include "Imlib2_Loader.h"
+#include "lock.h"
 
 #include <openjpeg.h>
 
@@ -38,7 +39,7 @@ _j2k_cb_err(const char *msg, void *data)
 }
 #endif                          /*IMLIB2_DEBUG */
 
-static struct {
+static THREAD_LOCAL struct {
     const unsigned char *data, *dptr;
     unsigned int    size;
 } mdata;
@@ -92,6 +93,14 @@ mm_seek_set(OPJ_OFF_T offs, void *data)
     return OPJ_TRUE;
 }
 
+/* Size of the x0..x1 grid range at resolution reduced by 2^reduce */
+static int
+_reduced(OPJ_UINT32 x0, OPJ_UINT32 x1, int reduce)
+{
+    return (int)(((x1 + (1U << reduce) - 1) >> reduce) -
+                 ((x0 + (1U << reduce) - 1) >> reduce));
+}
+
 static int
 _load(ImlibImage *im, int load_data)
 {
@@ -102,7 +111,8 @@ _load(ImlibImage *im, int load_data)
     opj_stream_t   *jstream;
     opj_image_t    *jimage;
     OPJ_CODEC_FORMAT jfmt;
-    int             i, j;
+    int             i, j, sw, sh, reduce, nres;
+    opj_codestream_info_v2_t *cinfo;
     uint32_t       *imdata;
     OPJ_INT32      *pa, *pr, *pg, *pb;
     unsigned char   a, r, g, b;
@@ -145,8 +155,11 @@ _load(ImlibImage *im, int load_data)
     if (!ok)
         goto quit;
 
-    // May be set with OPJ_NUM_THREADS=number or ALL_CPUS
-// opj_codec_set_threads(jcodec, 4);
+    // May also be set with OPJ_NUM_THREADS=number or ALL_CPUS
+#if OPJ_VERSION_MAJOR > 2 || (OPJ_VERSION_MAJOR == 2 && OPJ_VERSION_MINOR >= 2)
+    if (im->threads > 0 && opj_has_thread_support())
+        opj_codec_set_threads(jcodec, im->threads);
+#endif
 
     if (getenv("JP2_USE_FILE"))
     {
@@ -189,6 +202,29 @@ _load(ImlibImage *im, int load_data)
             goto quit;
     }
 
+    /* Decode fewer resolution levels if a reduced size will do */
+    if (__imlib_LoadSizeHint(im, im->w, im->h, &sw, &sh))
+    {
+        cinfo = opj_get_cstr_info(jcodec);
+        nres = cinfo ? (int)cinfo->m_default_tile_info.tccp_info[0].
+            numresolutions : 1;
+        opj_destroy_cstr_info(&cinfo);
+
+        for (reduce = 0; reduce < nres - 1; reduce++)
+        {
+            if (_reduced(jimage->x0, jimage->x1, reduce + 1) < sw ||
+                _reduced(jimage->y0, jimage->y1, reduce + 1) < sh)
+                break;
+        }
+
+        if (reduce > 0 && opj_set_decoded_resolution_factor(jcodec, reduce))
+        {
+            im->w = _reduced(jimage->x0, jimage->x1, reduce);
+            im->h = _reduced(jimage->y0, jimage->y1, reduce);
+            D("Reduce %d: %dx%d\n", reduce, im->w, im->h);
+        }
+    }
+
     if (!load_data)
         QUIT_WITH_RC(LOAD_SUCCESS);
 
@@ -202,6 +238,13 @@ _load(ImlibImage *im, int load_data)
     if (!ok)
         goto quit;
 
+    for (i = 0; i < (int)jimage->numcomps; i++)
+    {
+        if ((int)jimage->comps[i].w != im->w ||
+            (int)jimage->comps[i].h != im->h)
+            goto quit;
+    }
+
     if (!__imlib_AllocateData(im))
         QUIT_WITH_RC(LOAD_OOM);
 
@@ -2,6 +2,7 @@
 #include "Imlib2_Loader.h"
 
 #include <jpeglib.h>
+#include <jerror.h>
 #include <setjmp.h>
 #include "exif.h"
 #include "ldrs_util.h"
@@ -10,6 +11,15 @@
 
 static const char *const _formats[] = { "jpg", "jpeg", "jfif", "jfi" };
 
+#ifdef JCS_EXTENSIONS
+/* libjpeg-turbo can convert to/from our ARGB32 pixels (alpha byte 0xff) */
+#ifdef WORDS_BIGENDIAN
+#define JCS_ARGB32 JCS_EXT_XRGB
+#else
+#define JCS_ARGB32 JCS_EXT_BGRX
+#endif
+#endif
+
 typedef struct {
     struct jpeg_error_mgr jem;
     sigjmp_buf      setjmp_buffer;
@@ -68,12 +78,13 @@ _jdata_init(ImLib_JPEG_data *jd)
 static int
 _load(ImlibImage *im, int load_data)
 {
-    int             w, h, rc;
+    int             w, h, sw, sh, rc, denom;
     struct jpeg_decompress_struct jds;
     ImLib_JPEG_data jdata;
     uint8_t        *ptr, *line[16];
-    uint32_t       *imdata;
-    int             x, y, l, scans, inc;
+    uint32_t       *imdata, *band, *col, pixel;
+    int             x, y, l, n, scans, inc, cinc, dy, inplace;
+    size_t          lsize;
     ExifInfo        ei = { 0 };
 
     rc = LOAD_FAIL;
@@ -108,6 +119,23 @@ _load(ImlibImage *im, int load_data)
     if (!IMAGE_DIMENSIONS_OK(w, h))
         goto quit;
 
+    /* Use DCT scaling if a reduced size will do */
+    if (ei.swap_wh ? __imlib_LoadSizeHint(im, h, w, &sh, &sw) :
+        __imlib_LoadSizeHint(im, w, h, &sw, &sh))
+    {
+        for (denom = 8; denom > 1; denom /= 2)
+        {
+            if ((w + denom - 1) / denom >= sw && (h + denom - 1) / denom >= sh)
+                break;
+        }
+        jds.scale_num = 1;
+        jds.scale_denom = denom;
+        jpeg_calc_output_dimensions(&jds);
+        w = jds.output_width;
+        h = jds.output_height;
+        D("Scale 1/%d: %dx%d\n", denom, w, h);
+    }
+
     if (ei.swap_wh)
     {
         im->w = h;
@@ -126,28 +154,69 @@ _load(ImlibImage *im, int load_data)
 
     jds.do_fancy_upsampling = FALSE;
     jds.do_block_smoothing = FALSE;
+    inplace = 0;
+#ifdef JCS_ARGB32
+    if (jds.out_color_space == JCS_RGB || jds.out_color_space == JCS_GRAYSCALE)
+    {
+        jds.out_color_space = JCS_ARGB32;
+        /* Rows in order are decoded straight into the image */
+        inplace = ei.orientation == ORIENT_TOPLEFT ||
+            ei.orientation == ORIENT_TOPRIGHT;
+    }
+#endif
     jpeg_start_decompress(&jds);
 
     if ((jds.rec_outbuf_height > 16) || (jds.output_components <= 0))
         goto quit;
 
-    jdata.data = malloc(w * 16 * jds.output_components);
-    if (!jdata.data)
-        QUIT_WITH_RC(LOAD_OOM);
+    /* Line buffers, and with rotation a band of converted lines */
+    lsize = inplace ? 0 :
+        ((size_t)w * 16 * jds.output_components + 3) & ~(size_t)3;
+    if (lsize > 0 || ei.swap_wh)
+    {
+        jdata.data =
+            malloc(lsize + (ei.swap_wh ? w * 16 * sizeof(uint32_t) : 0));
+        if (!jdata.data)
+            QUIT_WITH_RC(LOAD_OOM);
+    }
+    band = ei.swap_wh ? (uint32_t *) (jdata.data + lsize) : NULL;
+    col = NULL;
+    cinc = 0;
 
     /* must set the im->data member before callign progress function */
-    imdata = __imlib_AllocateData(im);
+    if (ei.orientation == ORIENT_TOPLEFT || ei.orientation == ORIENT_TOPRIGHT)
+        imdata = __imlib_AllocateRows(im, 16);  /* Rows in order */
+    else
+        imdata = __imlib_AllocateData(im);
     if (!imdata)
         QUIT_WITH_RC(LOAD_OOM);
 
-    for (y = 0; y < jds.rec_outbuf_height; y++)
+    for (y = 0; !inplace && y < 16; y++)
         line[y] = jdata.data + (y * w * jds.output_components);
 
-    for (l = 0; l < h; l += jds.rec_outbuf_height)
+    for (l = 0; l < h; l += scans)
     {
-        jpeg_read_scanlines(&jds, line, jds.rec_outbuf_height);
+        if (inplace)
+        {
+            for (y = 0; y < jds.rec_outbuf_height && l + y < h; y++)
+                line[y] = (uint8_t *) __imlib_LoadRow(im, l + y);
+        }
+
+        /* With rotation the lines become columns. Collect up to 16 lines so
+         * the writes below fill whole cache lines instead of one pixel per
+         * line. */
+        scans = 0;
+        do
+        {
+            n = jpeg_read_scanlines(&jds, line + scans,
+                                    jds.rec_outbuf_height);
+            if (n <= 0)
+                goto quit;
+            scans += n;
+        }
+        while (ei.swap_wh && scans + jds.rec_outbuf_height <= 16 &&
+               l + scans < h);
 
-        scans = jds.rec_outbuf_height;
         if ((h - l) < scans)
             scans = h - l;
 
@@ -155,15 +224,30 @@ _load(ImlibImage *im, int load_data)
         {
             ptr = line[y];
 
+            if (inplace)
+            {
+                if (ei.orientation == ORIENT_TOPRIGHT)
+                {
+                    imdata = (uint32_t *) ptr;
+                    for (x = 0; x < w / 2; x++)
+                    {
+                        pixel = imdata[x];
+                        imdata[x] = imdata[w - 1 - x];
+                        imdata[w - 1 - x] = pixel;
+                    }
+                }
+                continue;
+            }
+
             switch (ei.orientation)
             {
             default:
             case ORIENT_TOPLEFT:
-                imdata = im->data + (l + y) * w;
+                imdata = __imlib_LoadRow(im, l + y);
                 inc = 1;
                 break;
             case ORIENT_TOPRIGHT:
-                imdata = im->data + (l + y) * w + w - 1;
+                imdata = __imlib_LoadRow(im, l + y) + w - 1;
                 inc = -1;
                 break;
             case ORIENT_BOTRIGHT:
@@ -195,10 +279,31 @@ _load(ImlibImage *im, int load_data)
                (long)((imdata - im->data) % im->w),
                (long)((imdata - im->data) / im->w));
 
+            if (ei.swap_wh)
+            {
+                /* Convert into the band, written out below */
+                if (y == 0)
+                {
+                    col = imdata;
+                    cinc = inc;
+                }
+                imdata = band + y * w;
+                inc = 1;
+            }
+
             switch (jds.out_color_space)
             {
             default:
                 goto quit;
+#ifdef JCS_ARGB32
+            case JCS_ARGB32:
+                for (x = 0; x < w; x++)
+                {
+                    *imdata = ((uint32_t *) ptr)[x];
+                    imdata += inc;
+                }
+                break;
+#endif
             case JCS_GRAYSCALE:
                 for (x = 0; x < w; x++)
                 {
@@ -228,6 +333,15 @@ _load(ImlibImage *im, int load_data)
             }
         }
 
+        if (ei.swap_wh)
+        {
+            dy = (ei.orientation == ORIENT_LEFTTOP ||
+                  ei.orientation == ORIENT_LEFTBOT) ? 1 : -1;
+            for (x = 0; x < w; x++, col += cinc)
+                for (y = 0; y < scans; y++)
+                    col[y * dy] = band[y * w + x];
+        }
+
         if (ei.orientation != ORIENT_TOPLEFT &&
             ei.orientation != ORIENT_TOPRIGHT)
             continue;
@@ -252,24 +366,409 @@ _load(ImlibImage *im, int load_data)
     return rc;
 }
 
+/* Destination manager writing through __imlib_SaveWrite() */
+typedef struct {
+    struct jpeg_destination_mgr pub;
+    ImlibImage     *im;
+    JOCTET          buf[65536];
+} ImLib_JPEG_dest;
+
+static void
+_jdest_init(j_compress_ptr jcs)
+{
+    ImLib_JPEG_dest *jdst = (ImLib_JPEG_dest *) jcs->dest;
+
+    jdst->pub.next_output_byte = jdst->buf;
+    jdst->pub.free_in_buffer = sizeof(jdst->buf);
+}
+
+static boolean
+_jdest_empty(j_compress_ptr jcs)
+{
+    ImLib_JPEG_dest *jdst = (ImLib_JPEG_dest *) jcs->dest;
+
+    if (__imlib_SaveWrite(jdst->im, jdst->buf, sizeof(jdst->buf)))
+        ERREXIT(jcs, JERR_FILE_WRITE);
+
+    jdst->pub.next_output_byte = jdst->buf;
+    jdst->pub.free_in_buffer = sizeof(jdst->buf);
+
+    return TRUE;
+}
+
+static void
+_jdest_term(j_compress_ptr jcs)
+{
+    ImLib_JPEG_dest *jdst = (ImLib_JPEG_dest *) jcs->dest;
+
+    if (__imlib_SaveWrite(jdst->im, jdst->buf,
+                          sizeof(jdst->buf) - jdst->pub.free_in_buffer))
+        ERREXIT(jcs, JERR_FILE_WRITE);
+}
+
+/* Set up compression parameters for a w x h image */
+static void
+_jcs_setup(j_compress_ptr jcs, int w, int h, const ImlibSaverParam *imsp)
+{
+    jcs->image_width = w;
+    jcs->image_height = h;
+#ifdef JCS_ARGB32
+    jcs->input_components = 4;
+    jcs->in_color_space = JCS_ARGB32;
+#else
+    jcs->input_components = 3;
+    jcs->in_color_space = JCS_RGB;
+#endif
+
+    /* set up jepg compression parameters */
+    jpeg_set_defaults(jcs);
+    jpeg_set_quality(jcs, imsp->quality, TRUE);
+
+    /* progressive */
+    if (imsp->interlacing)
+        jpeg_simple_progression(jcs);
+}
+
+/* Get scanline y for the compressor, converted into buf if needed */
+static          JSAMPROW
+_jcs_row(const ImlibImage *im, int y, uint8_t *buf)
+{
+    const uint32_t *imdata = im->data + (size_t)y * im->w;
+
+#ifdef JCS_ARGB32
+    return (JSAMPROW) imdata;
+#else
+    int             i, j;
+
+    /* convcert scaline from ARGB to RGB packed */
+    for (j = 0, i = 0; i < im->w; i++)
+    {
+        uint32_t        pixel = *imdata++;
+
+        buf[j++] = PIXEL_R(pixel);
+        buf[j++] = PIXEL_G(pixel);
+        buf[j++] = PIXEL_B(pixel);
+    }
+    return buf;
+#endif
+}
+
+/*
+ * Multi-threaded encoder
+ *
+ * Stripes of MCU rows are compressed in parallel as separate JPEGs with
+ * the same parameters. Each stripe starts with reset DC predictors, as
+ * after a restart marker, so with the restart interval set to the MCUs
+ * in a stripe the entropy coded segments join into one baseline image,
+ * separated by RSTn markers.
+ */
+
+#define JPEG_MT_STRIPE_PIXELS   (1024 * 1024)   /* Approx. pixels per stripe */
+
+typedef struct {
+    struct jpeg_destination_mgr pub;    /* Growing memory buffer */
+    unsigned char  *buf;
+    size_t          size;
+    size_t          len;        /* Output length */
+    const unsigned char *ecs;   /* Entropy coded segment */
+    size_t          ecs_len;
+} JpegMtStripe;
+
+typedef struct {
+    const ImlibImage *im;
+    const ImlibSaverParam *imsp;
+    int             rows;       /* Rows per stripe */
+    int             restart;    /* Restart interval (MCUs per stripe) */
+    int             first;      /* Stripe of job 0 */
+    JpegMtStripe   *st;
+} JpegMtJob;
+
+static void
+_jmem_init(j_compress_ptr jcs)
+{
+    JpegMtStripe   *js = (JpegMtStripe *) jcs->dest;
+
+    js->size = 65536;
+    js->buf = malloc(js->size);
+    if (!js->buf)
+        ERREXIT1(jcs, JERR_OUT_OF_MEMORY, 0);
+
+    js->pub.next_output_byte = js->buf;
+    js->pub.free_in_buffer = js->size;
+}
+
+static boolean
+_jmem_empty(j_compress_ptr jcs)
+{
+    JpegMtStripe   *js = (JpegMtStripe *) jcs->dest;
+    unsigned char  *p;
+
+    p = realloc(js->buf, 2 * js->size);
+    if (!p)
+        ERREXIT1(jcs, JERR_OUT_OF_MEMORY, 0);
+
+    js->buf = p;
+    js->pub.next_output_byte = js->buf + js->size;
+    js->pub.free_in_buffer = js->size;
+    js->size *= 2;
+
+    return TRUE;
+}
+
+static void
+_jmem_term(j_compress_ptr jcs)
+{
+    JpegMtStripe   *js = (JpegMtStripe *) jcs->dest;
+
+    js->len = js->size - js->pub.free_in_buffer;
+}
+
+/* Find the entropy coded segment (after SOS, before EOI) */
+static int
+_jpeg_mt_find_ecs(JpegMtStripe *js)
+{
+    const unsigned char *p = js->buf, *end = js->buf + js->len;
+    unsigned int    len;
+
+    if (js->len < 4 || p[0] != 0xff || p[1] != 0xd8 ||
+        end[-2] != 0xff || end[-1] != 0xd9)
+        return -1;
+
+    for (p += 2; p + 4 <= end && p[0] == 0xff; p += 2 + len)
+    {
+        len = p[2] << 8 | p[3];
+        if (p[1] == 0xda)       /* SOS */
+        {
+            js->ecs = p + 2 + len;
+            if (js->ecs > end - 2)
+                break;
+            js->ecs_len = end - 2 - js->ecs;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static void
+_jpeg_mt_stripe(void *data, int job, int worker)
+{
+    JpegMtJob      *jj = data;
+    JpegMtStripe   *js = &jj->st[job];
+    const ImlibImage *im = jj->im;
+    struct jpeg_compress_struct jcs;
+    ImLib_JPEG_data jdata;
+    uint8_t        *buf;
+    JSAMPROW        jrow;
+    int             y, y0, y1;
+
+    y0 = (jj->first + job) * jj->rows;
+    y1 = y0 + jj->rows < im->h ? y0 + jj->rows : im->h;
+
+    js->buf = NULL;
+    js->ecs = NULL;
+
+#ifdef JCS_ARGB32
+    buf = NULL;
+#else
+    buf = malloc(im->w * 3 * sizeof(uint8_t));
+    if (!buf)
+        return;
+#endif
+
+    jcs.err = _jdata_init(&jdata);
+    if (sigsetjmp(jdata.setjmp_buffer, 1))
+        goto quit;
+
+    jpeg_create_compress(&jcs);
+    js->pub.init_destination = _jmem_init;
+    js->pub.empty_output_buffer = _jmem_empty;
+    js->pub.term_destination = _jmem_term;
+    jcs.dest = &js->pub;
+
+    _jcs_setup(&jcs, im->w, y1 - y0, jj->imsp);
+    jcs.restart_interval = jj->restart;
+
+    jpeg_start_compress(&jcs, TRUE);
+    for (y = y0; y < y1; y++)
+    {
+        jrow = _jcs_row(im, y, buf);
+        jpeg_write_scanlines(&jcs, &jrow, 1);
+    }
+    jpeg_finish_compress(&jcs);
+
+    _jpeg_mt_find_ecs(js);
+
+  quit:
+    jpeg_destroy_compress(&jcs);
+    free(buf);
+}
+
+static int
+_save_mt(ImlibImage *im, const ImlibSaverParam *imsp)
+{
+    int             rc, i, n_stripes, n_batch, n_jobs, first, y0, ny;
+    struct jpeg_compress_struct jcs;
+    ImLib_JPEG_data jdata;
+    int             mcu_w, mcu_h, mcus, ci;
+    unsigned char  *p, marker[2];
+    JpegMtJob       jj;
+    JpegMtStripe   *js;
+
+    /* Get MCU size from the (default) sampling factors */
+    jcs.err = _jdata_init(&jdata);
+    if (sigsetjmp(jdata.setjmp_buffer, 1))
+    {
+        jpeg_destroy_compress(&jcs);
+        return LOAD_FAIL;
+    }
+    jpeg_create_compress(&jcs);
+    _jcs_setup(&jcs, im->w, im->h, imsp);
+    mcu_w = mcu_h = 1;
+    for (ci = 0; ci < jcs.num_components; ci++)
+    {
+        if (mcu_w < jcs.comp_info[ci].h_samp_factor)
+            mcu_w = jcs.comp_info[ci].h_samp_factor;
+        if (mcu_h < jcs.comp_info[ci].v_samp_factor)
+            mcu_h = jcs.comp_info[ci].v_samp_factor;
+    }
+    jpeg_destroy_compress(&jcs);
+    mcu_w *= DCTSIZE;
+    mcu_h *= DCTSIZE;
+
+    /* Restart interval is 16 bit */
+    mcus = (im->w + mcu_w - 1) / mcu_w;
+    jj.rows = JPEG_MT_STRIPE_PIXELS / ((size_t)im->w * mcu_h);
+    if (jj.rows > 65535 / mcus)
+        jj.rows = 65535 / mcus;
+    if (jj.rows < 1)
+        return LOAD_FAIL;
+    jj.restart = jj.rows * mcus;
+    jj.rows *= mcu_h;
+    n_stripes = (im->h + jj.rows - 1) / jj.rows;
+    if (n_stripes < 2)
+        return LOAD_FAIL;
+
+    jj.im = im;
+    jj.imsp = imsp;
+
+    /* A couple of stripes per thread in flight */
+    n_batch = 2 * imsp->threads;
+    if (n_batch > n_stripes)
+        n_batch = n_stripes;
+    jj.st = calloc(n_batch, sizeof(JpegMtStripe));
+    if (!jj.st)
+        return LOAD_OOM;
+
+    rc = LOAD_BADFILE;
+
+    for (first = 0; first < n_stripes; first += n_jobs)
+    {
+        n_jobs = n_stripes - first;
+        if (n_jobs > n_batch)
+            n_jobs = n_batch;
+        jj.first = first;
+        __imlib_WorkersRun(_jpeg_mt_stripe, &jj, n_jobs, imsp->threads);
+
+        for (i = 0; i < n_jobs; i++)
+        {
+            js = &jj.st[i];
+            if (!js->ecs)
+                QUIT_WITH_RC(js->buf ? LOAD_BADIMAGE : LOAD_OOM);
+
+            if (first + i == 0)
+            {
+                /* Headers of the first stripe, with the full height */
+                for (p = js->buf + 2; p < js->ecs; p += 2 + (p[2] << 8 | p[3]))
+                {
+                    if (p[1] >= 0xc0 && p[1] <= 0xc2)   /* SOF0-2 */
+                    {
+                        p[5] = im->h >> 8;
+                        p[6] = im->h;
+                    }
+                }
+                if (__imlib_SaveWrite(im, js->buf, js->ecs - js->buf))
+                    goto quit;
+            }
+            else
+            {
+                marker[0] = 0xff;
+                marker[1] = 0xd0 + ((first + i - 1) & 7);       /* RSTn */
+                if (__imlib_SaveWrite(im, marker, 2))
+                    goto quit;
+            }
+
+            if (__imlib_SaveWrite(im, js->ecs, js->ecs_len))
+                goto quit;
+
+            free(js->buf);
+            js->buf = NULL;
+        }
+
+        y0 = first * jj.rows;
+        ny = n_jobs * jj.rows;
+        if (ny > im->h - y0)
+            ny = im->h - y0;
+        if (im->lc && __imlib_LoadProgressRows(im, y0, ny))
+            QUIT_WITH_RC(LOAD_BREAK);
+    }
+
+    marker[0] = 0xff;
+    marker[1] = 0xd9;           /* EOI */
+    if (__imlib_SaveWrite(im, marker, 2))
+        goto quit;
+
+    rc = LOAD_SUCCESS;
+
+  quit:
+    for (i = 0; i < n_batch; i++)
+        free(jj.st[i].buf);
+    free(jj.st);
+
+    return rc;
+}
+
 static int
 _save(ImlibImage *im)
 {
     int             rc;
     struct jpeg_compress_struct jcs;
     ImLib_JPEG_data jdata;
-    FILE           *f = im->fi->fp;
+    ImLib_JPEG_dest *jdst;
     ImlibSaverParam imsp;
     uint8_t        *buf;
-    const uint32_t *imdata;
-    JSAMPROW       *jbuf;
+    JSAMPROW        jrow;
     int             y;
-    int             i, j;
 
+    /* look for tags attached to image to get extra parameters like quality */
+    /* settigns etc. - this is the "api" to hint for extra information for */
+    /* saver modules */
+
+    get_saver_params(im, &imsp);
+
+    /* Parallel encoding, when asked for and possible */
+    if (imsp.threads > 1 && !imsp.interlacing)
+    {
+        rc = _save_mt(im, &imsp);
+        if (rc != LOAD_FAIL)
+            return rc;
+    }
+
+#ifdef JCS_ARGB32
+    /* Scanlines are read straight from the image data */
+    buf = NULL;
+#else
     /* allocate a small buffer to convert image data */
     buf = malloc(im->w * 3 * sizeof(uint8_t));
     if (!buf)
         return LOAD_OOM;
+#endif
+    jdst = malloc(sizeof(ImLib_JPEG_dest));
+    if (!jdst)
+    {
+        free(buf);
+        return LOAD_OOM;
+    }
 
     rc = LOAD_BADFILE;
 
@@ -280,44 +779,21 @@ _save(ImlibImage *im)
 
     /* setup compress params */
     jpeg_create_compress(&jcs);
-    jpeg_stdio_dest(&jcs, f);
-    jcs.image_width = im->w;
-    jcs.image_height = im->h;
-    jcs.input_components = 3;
-    jcs.in_color_space = JCS_RGB;
+    jdst->pub.init_destination = _jdest_init;
+    jdst->pub.empty_output_buffer = _jdest_empty;
+    jdst->pub.term_destination = _jdest_term;
+    jdst->im = im;
+    jcs.dest = &jdst->pub;
 
-    /* look for tags attached to image to get extra parameters like quality */
-    /* settigns etc. - this is the "api" to hint for extra information for */
-    /* saver modules */
-
-    get_saver_params(im, &imsp);
-
-    /* set up jepg compression parameters */
-    jpeg_set_defaults(&jcs);
-    jpeg_set_quality(&jcs, imsp.quality, TRUE);
-
-    /* progressive */
-    if (imsp.interlacing)
-        jpeg_simple_progression(&jcs);
+    _jcs_setup(&jcs, im->w, im->h, &imsp);
 
     jpeg_start_compress(&jcs, TRUE);
-    /* get the start pointer */
-    imdata = im->data;
     /* go one scanline at a time... and save */
     for (y = 0; jcs.next_scanline < jcs.image_height; y++)
     {
-        /* convcert scaline from ARGB to RGB packed */
-        for (j = 0, i = 0; i < im->w; i++)
-        {
-            uint32_t        pixel = *imdata++;
-
-            buf[j++] = PIXEL_R(pixel);
-            buf[j++] = PIXEL_G(pixel);
-            buf[j++] = PIXEL_B(pixel);
-        }
         /* write scanline */
-        jbuf = (JSAMPROW *) (&buf);
-        jpeg_write_scanlines(&jcs, jbuf, 1);
+        jrow = _jcs_row(im, y, buf);
+        jpeg_write_scanlines(&jcs, &jrow, 1);
 
         if (im->lc && __imlib_LoadProgressRows(im, y, 1))
             QUIT_WITH_RC(LOAD_BREAK);
@@ -330,9 +806,10 @@ _save(ImlibImage *im)
   quit:
     /* finish off */
     jpeg_destroy_compress(&jcs);
+    free(jdst);
     free(buf);
 
     return rc;
 }
 
-IMLIB_LOADER(_formats, _load, _save);
+IMLIB_LOADER_WRITE(_formats, _load, _save);
@@ -7,6 +7,7 @@
 #include <jxl/decode.h>
 #include <jxl/encode.h>
 #if MAX_RUNNERS > 0
+#include <jxl/resizable_parallel_runner.h>
 #include <jxl/thread_parallel_runner.h>
 #endif
 
@@ -15,14 +16,21 @@
 static const char *const _formats[] = { "jxl" };
 
 #if MAX_RUNNERS > 0
+static unsigned int
+_jxl_default_runners(void)
+{
+    return (JxlThreadParallelRunnerDefaultNumWorkerThreads() + 1) / 2;
+}
+
 static JxlParallelRunner *
-_jxl_create_runner(void)
+_jxl_create_runner(unsigned int n_runners)
 {
     JxlParallelRunner *runner;
-    unsigned int    n_runners_dflt, n_runners;
+    unsigned int    n_runners_dflt;
 
     n_runners_dflt = JxlThreadParallelRunnerDefaultNumWorkerThreads();
-    n_runners = (n_runners_dflt + 1) / 2;
+    if (n_runners == 0)
+        n_runners = _jxl_default_runners();
     D("n_runners = %d/%d\n", n_runners, n_runners_dflt);
     runner = JxlThreadParallelRunnerCreate(NULL, n_runners);
 
@@ -71,6 +79,7 @@ _load(ImlibImage *im, int load_data)
 
 #if MAX_RUNNERS > 0
     JxlParallelRunner *runner = NULL;
+    unsigned int    n_runners, n_max;
 #endif
 
     rc = LOAD_FAIL;
@@ -94,10 +103,12 @@ _load(ImlibImage *im, int load_data)
         goto quit;
 
 #if MAX_RUNNERS > 0
-    runner = _jxl_create_runner();
+    /* Sized for the image when the basic info is known */
+    runner = im->threads == 1 ? NULL : JxlResizableParallelRunnerCreate(NULL);
     if (runner)
     {
-        jst = JxlDecoderSetParallelRunner(dec, JxlThreadParallelRunner, runner);
+        jst = JxlDecoderSetParallelRunner(dec, JxlResizableParallelRunner,
+                                          runner);
         if (jst != JXL_DEC_SUCCESS)
             goto quit;
     }
@@ -153,6 +164,20 @@ _load(ImlibImage *im, int load_data)
             im->h = info.ysize;
             im->has_alpha = info.alpha_bits > 0;
 
+#if MAX_RUNNERS > 0
+            if (runner)
+            {
+                n_runners =
+                    JxlResizableParallelRunnerSuggestThreads(info.xsize,
+                                                             info.ysize);
+                n_max = im->threads > 0 ? im->threads : _jxl_default_runners();
+                if (n_runners > n_max)
+                    n_runners = n_max;
+                D("n_runners = %u/%u\n", n_runners, n_max);
+                JxlResizableParallelRunnerSetThreads(runner, n_runners);
+            }
+#endif
+
             if (frame > 0)
             {
                 if (info.have_animation)
@@ -221,7 +246,7 @@ _load(ImlibImage *im, int load_data)
   quit:
 #if MAX_RUNNERS > 0
     if (runner)
-        JxlThreadParallelRunnerDestroy(runner);
+        JxlResizableParallelRunnerDestroy(runner);
 #endif
     if (dec)
         JxlDecoderDestroy(dec);
@@ -244,6 +269,7 @@ _save(ImlibImage *im)
     };
     ImlibSaverParam imsp;
     float           distance;
+    int             effort;
     const uint32_t *imdata;
     uint8_t        *buffer = NULL, *buf_ptr;
     size_t          buf_len, i, npix;
@@ -258,8 +284,11 @@ _save(ImlibImage *im)
     if (!enc)
         goto quit;
 
+    get_saver_params(im, &imsp);
+
 #if MAX_RUNNERS > 0
-    runner = _jxl_create_runner();
+    /* One thread means no runner */
+    runner = imsp.threads == 1 ? NULL : _jxl_create_runner(imsp.threads);
     if (runner)
     {
         jst = JxlEncoderSetParallelRunner(enc, JxlThreadParallelRunner, runner);
@@ -285,8 +314,6 @@ _save(ImlibImage *im)
     if (!opts)
         goto quit;
 
-    get_saver_params(im, &imsp);
-
     if (imsp.quality == 100)
     {
         D("Quality=%d: Lossless\n", imsp.quality);
@@ -301,9 +328,13 @@ _save(ImlibImage *im)
         JxlEncoderSetFrameDistance(opts, distance);
     }
 
-    D("Compression=%d\n", imsp.compression);
+    /* Effort 0-9 -> 1-9 */
+    effort = imsp.effort >= 0 ? imsp.effort : imsp.compression;
+    if (effort < 1)
+        effort = 1;
+    D("Effort=%d Threads=%d\n", effort, imsp.threads);
     JxlEncoderFrameSettingsSetOption(opts, JXL_ENC_FRAME_SETTING_EFFORT,
-                                     imsp.compression);
+                                     effort);
 
     // Create buffer for format conversion and output
     pbuf_fmt.num_channels = (im->has_alpha) ? 4 : 3;
@@ -363,8 +394,7 @@ _save(ImlibImage *im)
             if (next_out == buffer)
                 goto quit;
 
-            if (fwrite(buffer, 1, buf_len - avail_out, im->fi->fp) !=
-                buf_len - avail_out)
+            if (__imlib_SaveWrite(im, buffer, buf_len - avail_out))
                 goto quit;
 
             if (jst == JXL_ENC_SUCCESS)
@@ -389,4 +419,4 @@ _save(ImlibImage *im)
     return rc;
 }
 
-IMLIB_LOADER(_formats, _load, _save);
+IMLIB_LOADER_WRITE(_formats, _load, _save);
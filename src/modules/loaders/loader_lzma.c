@@ -6,16 +6,14 @@
 
 static const char *const _formats[] = { "xz", "lzma" };
 
-#define OUTBUF_SIZE 16484
-
 static int
-uncompress_file(const void *fdata, unsigned int fsize, int dest)
+uncompress_file(const void *fdata, unsigned int fsize,
+                ImlibDecompressBuf *dbuf)
 {
     int             ok;
     lzma_stream     strm = LZMA_STREAM_INIT;
     lzma_ret        ret;
-    uint8_t         outbuf[OUTBUF_SIZE];
-    ssize_t         bytes;
+    size_t          avail;
 
     ok = 0;
 
@@ -28,17 +26,17 @@ uncompress_file(const void *fdata, unsigned int fsize, int dest)
 
     for (;;)
     {
-        strm.next_out = outbuf;
-        strm.avail_out = sizeof(outbuf);
+        strm.next_out = decompress_buf_space(dbuf, &avail);
+        if (!strm.next_out)
+            goto quit;
+        strm.avail_out = avail;
 
         ret = lzma_code(&strm, 0);
 
         if (ret != LZMA_OK && ret != LZMA_STREAM_END)
             goto quit;
 
-        bytes = sizeof(outbuf) - strm.avail_out;
-        if (write(dest, outbuf, bytes) != bytes)
-            goto quit;
+        dbuf->size += avail - strm.avail_out;
 
         if (ret == LZMA_STREAM_END)
             break;
@@ -3,6 +3,7 @@
 #include "ldrs_util.h"
 
 #include <png.h>
+#include <zlib.h>
 #include <stdbool.h>
 #include <arpa/inet.h>
 
@@ -132,6 +133,7 @@ info_callback(png_struct *png_ptr, png_info *info_ptr)
     int             rc;
     ctx_t          *ctx = png_get_progressive_ptr(png_ptr);
     ImlibImage     *im = ctx->im;
+    uint32_t       *imdata;
     png_uint_32     w32, h32;
     int             bit_depth, color_type, interlace_type;
     bool            hasa, has_tRNS;
@@ -205,7 +207,11 @@ info_callback(png_struct *png_ptr, png_info *info_ptr)
     /* NB! If png_read_update_info() isn't called processing stops here */
     png_read_update_info(png_ptr, info_ptr);
 
-    if (!__imlib_AllocateData(im))
+    if (ctx->interlace || im->frame != 0)
+        imdata = __imlib_AllocateData(im);
+    else
+        imdata = __imlib_AllocateRows(im, 1);   /* Rows in order */
+    if (!imdata)
         QUIT_WITH_RC(LOAD_OOM);
 
     rc = LOAD_SUCCESS;
@@ -229,11 +235,11 @@ row_callback(png_struct *png_ptr, png_byte *new_row,
     DL("%s: png=%p data=%p row=%d, pass=%d\n", __func__, png_ptr, new_row,
        row_num, pass);
 
-    if (!im->data)
-        return;
-
     if (ctx->interlace)
     {
+        if (!im->data)
+            return;
+
         x0 = PNG_PASS_START_COL(pass);
         dx = PNG_PASS_COL_OFFSET(pass);
         y0 = PNG_PASS_START_ROW(pass);
@@ -263,7 +269,9 @@ row_callback(png_struct *png_ptr, png_byte *new_row,
     {
         y = row_num;
 
-        imdata = im->data + y * im->w;
+        imdata = __imlib_LoadRow(im, y);
+        if (!imdata)
+            return;
         memcpy(imdata, new_row, sizeof(uint32_t) * im->w);
 
         if (im->lc && im->frame == 0)
@@ -596,11 +604,374 @@ _load(ImlibImage *im, int load_data)
     return rc;
 }
 
+static void
+_png_write(png_struct *png_ptr, png_byte *data, size_t len)
+{
+    ImlibImage     *im = png_get_io_ptr(png_ptr);
+
+    if (__imlib_SaveWrite(im, data, len))
+        png_error(png_ptr, "Write error");
+}
+
+static void
+_png_flush(png_struct *png_ptr)
+{
+}
+
+/*
+ * Multi-threaded encoder
+ *
+ * The image is cut into stripes of rows, which are filtered and deflated
+ * in parallel. Each stripe is a raw deflate stream primed with the
+ * preceding 32K of filtered data and ending on a byte boundary
+ * (Z_SYNC_FLUSH), so the stripes concatenate into one zlib stream (as
+ * done by pigz). Each stripe goes into its own IDAT chunk.
+ */
+
+#define PNG_MT_STRIPE_SIZE      (1024 * 1024)   /* Filtered bytes per stripe */
+#define PNG_MT_WINDOW           32768   /* Deflate window (dictionary) */
+
+typedef struct {
+    unsigned char  *out;        /* Raw deflate data */
+    size_t          len;
+    uLong           adler;      /* Adler-32 of the filtered rows */
+    uLong           ilen;       /* Length of the filtered rows */
+} PngMtStripe;
+
+typedef struct {
+    const ImlibImage *im;
+    int             level;      /* zlib compression level */
+    int             bpp;        /* Bytes per pixel */
+    size_t          rowlen;     /* Filtered row length (incl. filter type) */
+    int             rows;       /* Rows per stripe */
+    int             first;      /* Stripe of job 0 */
+    PngMtStripe    *st;
+} PngMtJob;
+
+static void
+_png_pack_row(const uint32_t *src, int w, int bpp, uint8_t *dst)
+{
+    int             x;
+    uint32_t        pixel;
+
+    for (x = 0; x < w; x++)
+    {
+        pixel = *src++;
+        *dst++ = PIXEL_R(pixel);
+        *dst++ = PIXEL_G(pixel);
+        *dst++ = PIXEL_B(pixel);
+        if (bpp == 4)
+            *dst++ = PIXEL_A(pixel);
+    }
+}
+
+static inline int
+_paeth(int a, int b, int c)
+{
+    int             p, pa, pb, pc;
+
+    p = a + b - c;
+    pa = abs(p - a);
+    pb = abs(p - b);
+    pc = abs(p - c);
+
+    return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+}
+
+#define FILTER_LOOP(i0, i1, expr) \
+    for (i = i0; i < i1; i++) \
+    { \
+        v = cur[i] - (expr); \
+        out[i] = v; \
+        sum += v < 128 ? v : 256 - v; \
+    }
+
+/* Apply filter type f, return the sum of absolute (signed byte) values */
+static unsigned int
+_png_filter(int f, const uint8_t *cur, const uint8_t *prv, int n, int bpp,
+            uint8_t *out)
+{
+    unsigned int    sum;
+    int             i;
+    uint8_t         v;
+
+    *out++ = f;
+    sum = 0;
+
+    /* First pixel has no left neighbour (a = c = 0) */
+    switch (f)
+    {
+    default:
+    case PNG_FILTER_VALUE_NONE:
+        FILTER_LOOP(0, n, 0);
+        break;
+    case PNG_FILTER_VALUE_SUB:
+        FILTER_LOOP(0, bpp, 0);
+        FILTER_LOOP(bpp, n, cur[i - bpp]);
+        break;
+    case PNG_FILTER_VALUE_UP:
+        FILTER_LOOP(0, n, prv[i]);
+        break;
+    case PNG_FILTER_VALUE_AVG:
+        FILTER_LOOP(0, bpp, prv[i] >> 1);
+        FILTER_LOOP(bpp, n, (cur[i - bpp] + prv[i]) >> 1);
+        break;
+    case PNG_FILTER_VALUE_PAETH:
+        FILTER_LOOP(0, bpp, prv[i]);
+        FILTER_LOOP(bpp, n, _paeth(cur[i - bpp], prv[i], prv[i - bpp]));
+        break;
+    }
+
+    return sum;
+}
+
+/* Filter row with the filter type giving the least sum (as libpng does) */
+static void
+_png_filter_row(const uint8_t *cur, const uint8_t *prv, int n, int bpp,
+                uint8_t *out, uint8_t *tmp)
+{
+    unsigned int    sum, best;
+    uint8_t        *p, *q, *t;
+    int             f;
+
+    p = out;                    /* Best so far */
+    q = tmp;
+    best = _png_filter(PNG_FILTER_VALUE_NONE, cur, prv, n, bpp, p);
+    for (f = PNG_FILTER_VALUE_SUB; f <= PNG_FILTER_VALUE_PAETH; f++)
+    {
+        sum = _png_filter(f, cur, prv, n, bpp, q);
+        if (sum < best)
+        {
+            best = sum;
+            t = p;
+            p = q;
+            q = t;
+        }
+    }
+
+    if (p != out)
+        memcpy(out, p, n + 1);
+}
+
+static void
+_png_mt_stripe(void *data, int job, int worker)
+{
+    PngMtJob       *pj = data;
+    PngMtStripe    *ps = &pj->st[job];
+    const ImlibImage *im = pj->im;
+    int             y, y0, y1, yd, n, last;
+    size_t          rl, olen, dlen;
+    uint8_t        *filt, *cur, *prv, *tmp, *in;
+    z_stream        zs;
+
+    rl = pj->rowlen;
+    n = rl - 1;
+    y0 = (pj->first + job) * pj->rows;
+    y1 = y0 + pj->rows < im->h ? y0 + pj->rows : im->h;
+    last = y1 == im->h;
+
+    /* Filter the rows ahead of the stripe too, they are the dictionary */
+    yd = y0 - (int)((PNG_MT_WINDOW + rl - 1) / rl);
+    if (yd < 0)
+        yd = 0;
+
+    filt = malloc((y1 - yd) * rl + 3 * rl);
+    if (!filt)
+        return;
+    cur = filt + (y1 - yd) * rl;
+    prv = cur + rl;
+    tmp = prv + rl;
+
+    if (yd > 0)
+        _png_pack_row(im->data + (size_t)(yd - 1) * im->w, im->w, pj->bpp,
+                      prv);
+    else
+        memset(prv, 0, n);
+
+    for (y = yd; y < y1; y++)
+    {
+        _png_pack_row(im->data + (size_t)y * im->w, im->w, pj->bpp, cur);
+        _png_filter_row(cur, prv, n, pj->bpp, filt + (y - yd) * rl, tmp);
+        in = cur;
+        cur = prv;
+        prv = in;
+    }
+
+    in = filt + (y0 - yd) * rl;
+    ps->ilen = (y1 - y0) * rl;
+    ps->adler = adler32(adler32(0, NULL, 0), in, ps->ilen);
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, pj->level, Z_DEFLATED, -15, 8, Z_FILTERED) != Z_OK)
+        goto quit;
+
+    dlen = (size_t)(y0 - yd) * rl;
+    if (dlen > PNG_MT_WINDOW)
+        dlen = PNG_MT_WINDOW;
+    if (dlen > 0)
+        deflateSetDictionary(&zs, in - dlen, dlen);
+
+    olen = deflateBound(&zs, ps->ilen) + 16;    /* + sync flush marker */
+    ps->out = malloc(olen);
+    if (!ps->out)
+        goto quit_end;
+
+    zs.next_in = in;
+    zs.avail_in = ps->ilen;
+    zs.next_out = ps->out;
+    zs.avail_out = olen;
+    if (deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH) !=
+        (last ? Z_STREAM_END : Z_OK) || zs.avail_in != 0 || zs.avail_out == 0)
+    {
+        free(ps->out);
+        ps->out = NULL;
+        goto quit_end;
+    }
+    ps->len = olen - zs.avail_out;
+
+  quit_end:
+    deflateEnd(&zs);
+  quit:
+    free(filt);
+}
+
+static void
+_put_u32(uint8_t *p, uint32_t val)
+{
+    p[0] = val >> 24;
+    p[1] = val >> 16;
+    p[2] = val >> 8;
+    p[3] = val;
+}
+
+/* Write chunk with data d1 followed by d2 */
+static int
+_png_mt_chunk(ImlibImage *im, const char *type,
+              const void *d1, size_t n1, const void *d2, size_t n2)
+{
+    uint8_t         buf[8];
+    uLong           crc;
+
+    _put_u32(buf, n1 + n2);
+    memcpy(buf + 4, type, 4);
+    crc = crc32(0, buf + 4, 4);
+    if (n1 > 0)                 /* crc32() with NULL returns initial value */
+        crc = crc32(crc, d1, n1);
+    if (n2 > 0)
+        crc = crc32(crc, d2, n2);
+
+    if (__imlib_SaveWrite(im, buf, 8) ||
+        __imlib_SaveWrite(im, d1, n1) || __imlib_SaveWrite(im, d2, n2))
+        return -1;
+
+    _put_u32(buf, crc);
+
+    return __imlib_SaveWrite(im, buf, 4);
+}
+
+static int
+_save_mt(ImlibImage *im, const ImlibSaverParam *imsp)
+{
+    static const uint8_t png_sig[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+    static const uint8_t sbit[4] = { 8, 8, 8, 8 };
+    int             rc, i, n_stripes, n_batch, n_jobs, first, y0, ny;
+    PngMtJob        pj;
+    PngMtStripe    *ps;
+    uint8_t         ihdr[13], zhdr[2], zend[4];
+    uLong           adler;
+
+    pj.im = im;
+    pj.level = imsp->compression;
+    pj.bpp = im->has_alpha ? 4 : 3;
+    pj.rowlen = (size_t)im->w * pj.bpp + 1;
+    pj.rows = PNG_MT_STRIPE_SIZE / pj.rowlen;
+    if (pj.rows < 1)
+        pj.rows = 1;
+    n_stripes = (im->h + pj.rows - 1) / pj.rows;
+
+    /* A couple of stripes per thread in flight */
+    n_batch = 2 * imsp->threads;
+    if (n_batch > n_stripes)
+        n_batch = n_stripes;
+    pj.st = calloc(n_batch, sizeof(PngMtStripe));
+    if (!pj.st)
+        return LOAD_OOM;
+
+    rc = LOAD_BADFILE;
+
+    _put_u32(ihdr, im->w);
+    _put_u32(ihdr + 4, im->h);
+    ihdr[8] = 8;                /* Bit depth */
+    ihdr[9] = im->has_alpha ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB;
+    ihdr[10] = PNG_COMPRESSION_TYPE_BASE;
+    ihdr[11] = PNG_FILTER_TYPE_BASE;
+    ihdr[12] = PNG_INTERLACE_NONE;
+
+    if (__imlib_SaveWrite(im, png_sig, sizeof(png_sig)) ||
+        _png_mt_chunk(im, "IHDR", ihdr, sizeof(ihdr), NULL, 0) ||
+        _png_mt_chunk(im, "sBIT", sbit, pj.bpp, NULL, 0))
+        goto quit;
+
+    /* zlib header, 32K window */
+    zhdr[0] = 0x78;
+    zhdr[1] = (pj.level < 2 ? 0 : pj.level < 6 ? 1 : pj.level == 6 ? 2 : 3) << 6;
+    zhdr[1] += 31 - (zhdr[0] << 8 | zhdr[1]) % 31;
+    adler = adler32(0, NULL, 0);
+
+    for (first = 0; first < n_stripes; first += n_jobs)
+    {
+        n_jobs = n_stripes - first;
+        if (n_jobs > n_batch)
+            n_jobs = n_batch;
+        pj.first = first;
+        __imlib_WorkersRun(_png_mt_stripe, &pj, n_jobs, imsp->threads);
+
+        for (i = 0; i < n_jobs; i++)
+        {
+            ps = &pj.st[i];
+            if (!ps->out)
+                QUIT_WITH_RC(LOAD_OOM);
+
+            adler = adler32_combine(adler, ps->adler, ps->ilen);
+            _put_u32(zend, adler);
+
+            if (_png_mt_chunk(im, "IDAT",
+                              first + i == 0 ? zhdr : ps->out,
+                              first + i == 0 ? sizeof(zhdr) : ps->len,
+                              first + i == 0 ? ps->out : zend,
+                              first + i == 0 ? ps->len :
+                              first + i == n_stripes - 1 ? sizeof(zend) : 0))
+                goto quit;
+
+            free(ps->out);
+            ps->out = NULL;
+        }
+
+        y0 = first * pj.rows;
+        ny = n_jobs * pj.rows;
+        if (ny > im->h - y0)
+            ny = im->h - y0;
+        if (im->lc && __imlib_LoadProgressRows(im, y0, ny))
+            QUIT_WITH_RC(LOAD_BREAK);
+    }
+
+    if (_png_mt_chunk(im, "IEND", NULL, 0, NULL, 0))
+        goto quit;
+
+    rc = LOAD_SUCCESS;
+
+  quit:
+    for (i = 0; i < n_batch; i++)
+        free(pj.st[i].out);
+    free(pj.st);
+
+    return rc;
+}
+
 static int
 _save(ImlibImage *im)
 {
     int             rc;
-    FILE           *f = im->fi->fp;
     png_structp     png_ptr;
     png_infop       info_ptr;
     const uint32_t *imdata;
@@ -610,6 +981,13 @@ _save(ImlibImage *im)
     ImlibSaverParam imsp;
     int             pass, n_passes = 1;
 
+    get_saver_params(im, &imsp);
+
+    /* Parallel encoding, when asked for and worth it */
+    if (imsp.threads > 1 && !imsp.interlacing &&
+        (size_t)im->w * im->h * 4 > 2 * PNG_MT_STRIPE_SIZE)
+        return _save_mt(im, &imsp);
+
     row_ptr = NULL;
     if (!im->has_alpha)
     {
@@ -634,8 +1012,6 @@ _save(ImlibImage *im)
     if (setjmp(png_jmpbuf(png_ptr)))
         QUIT_WITH_RC(LOAD_BADFILE);
 
-    get_saver_params(im, &imsp);
-
     /* check whether we should use interlacing */
     interlace = PNG_INTERLACE_NONE;
 #ifdef PNG_WRITE_INTERLACING_SUPPORTED
@@ -645,7 +1021,7 @@ _save(ImlibImage *im)
     }
 #endif
 
-    png_init_io(png_ptr, f);
+    png_set_write_fn(png_ptr, im, _png_write, _png_flush);
     if (im->has_alpha)
     {
         png_set_IHDR(png_ptr, info_ptr, im->w, im->h, 8,
@@ -739,4 +1115,4 @@ _save(ImlibImage *im)
     return rc;
 }
 
-IMLIB_LOADER(_formats, _load, _save);
+IMLIB_LOADER_WRITE(_formats, _load, _save);
@@ -1,5 +1,6 @@
 #include "config.h"
 #include "Imlib2_Loader.h"
+#include "lock.h"
 
 #include <ctype.h>
 #include <stdbool.h>
@@ -16,7 +17,7 @@ typedef enum {
 
 #define mm_check(p) ((const char *)(p) <= (const char *)im->fi->fdata + im->fi->fsize)
 
-static struct {
+static THREAD_LOCAL struct {
     const unsigned char *data, *dptr;
     unsigned int    size;
 } mdata;
@@ -320,7 +321,7 @@ _load(ImlibImage *im, int load_data)
 
     /* Load data */
 
-    ptr2 = __imlib_AllocateData(im);
+    ptr2 = __imlib_AllocateRows(im, 1);
     if (!ptr2)
         QUIT_WITH_RC(LOAD_OOM);
 
@@ -332,6 +333,8 @@ _load(ImlibImage *im, int load_data)
     case BW_PLAIN:             /* ASCII monochrome */
         for (y = 0; y < h; y++)
         {
+            ptr2 = __imlib_LoadRow(im, y);
+
             for (x = 0; x < w; x++)
             {
                 int             px = mm_get01();
@@ -350,6 +353,8 @@ _load(ImlibImage *im, int load_data)
     case GRAY_PLAIN:           /* ASCII greyscale */
         for (y = 0; y < h; y++)
         {
+            ptr2 = __imlib_LoadRow(im, y);
+
             for (x = 0; x < w; x++)
             {
                 if (mm_getu(&gval))
@@ -368,6 +373,8 @@ _load(ImlibImage *im, int load_data)
     case RGB_PLAIN:            /* ASCII RGB */
         for (y = 0; y < h; y++)
         {
+            ptr2 = __imlib_LoadRow(im, y);
+
             for (x = 0; x < w; x++)
             {
                 if (mm_getu(&rval))
@@ -394,6 +401,8 @@ _load(ImlibImage *im, int load_data)
     case BW_RAW_PACKED:        /* binary 1bit monochrome */
         for (y = 0; y < h; y++)
         {
+            ptr2 = __imlib_LoadRow(im, y);
+
             if (!mm_check(ptr + (w + 7) / 8))
                 goto quit;
 
@@ -419,30 +428,34 @@ _load(ImlibImage *im, int load_data)
         {
             for (y = 0; y < h; y++)
             {
+                ptr2 = __imlib_LoadRow(im, y);
+
                 if (!mm_check(ptr + 2 * w))
                     goto quit;
 
                 for (x = 0; x < w; x++, ptr += 2)
                     *ptr2++ =
                         (ptr[1] ? 0xff000000 : 0) | (ptr[0] ? 0xffffff : 0);
-            }
 
-            if (im->lc && __imlib_LoadProgressRows(im, y, 1))
-                goto quit_progress;
+                if (im->lc && __imlib_LoadProgressRows(im, y, 1))
+                    goto quit_progress;
+            }
         }
         else
         {
             for (y = 0; y < h; y++)
             {
+                ptr2 = __imlib_LoadRow(im, y);
+
                 if (!mm_check(ptr + w))
                     goto quit;
 
                 for (x = 0; x < w; x++, ptr++)
                     *ptr2++ = 0xff000000 | (ptr[0] ? 0xffffff : 0);
-            }
 
-            if (im->lc && __imlib_LoadProgressRows(im, y, 1))
-                goto quit_progress;
+                if (im->lc && __imlib_LoadProgressRows(im, y, 1))
+                    goto quit_progress;
+            }
         }
         break;
 
@@ -451,6 +464,8 @@ _load(ImlibImage *im, int load_data)
         {
             for (y = 0; y < h; y++)
             {
+                ptr2 = __imlib_LoadRow(im, y);
+
                 if (!mm_check(ptr + 2 * w * bps))
                     goto quit;
 
@@ -494,6 +509,8 @@ _load(ImlibImage *im, int load_data)
         {
             for (y = 0; y < h; y++)
             {
+                ptr2 = __imlib_LoadRow(im, y);
+
                 if (!mm_check(ptr + w * bps))
                     goto quit;
 
@@ -537,6 +554,8 @@ _load(ImlibImage *im, int load_data)
         {
             for (y = 0; y < h; y++)
             {
+                ptr2 = __imlib_LoadRow(im, y);
+
                 if (!mm_check(ptr + 4 * w * bps))
                     goto quit;
 
@@ -577,6 +596,8 @@ _load(ImlibImage *im, int load_data)
         {
             for (y = 0; y < h; y++)
             {
+                ptr2 = __imlib_LoadRow(im, y);
+
                 if (!mm_check(ptr + 3 * w * bps))
                     goto quit;
 
@@ -616,6 +637,8 @@ _load(ImlibImage *im, int load_data)
     case XV332:                /* XV's 8bit 332 format */
         for (y = 0; y < h; y++)
         {
+            ptr2 = __imlib_LoadRow(im, y);
+
             if (!mm_check(ptr + w))
                 goto quit;
 
@@ -672,10 +695,10 @@ static int
 _save(ImlibImage *im)
 {
     int             rc;
-    FILE           *f = im->fi->fp;
     uint8_t        *buf, *bptr;
     const uint32_t *imdata;
-    int             x, y;
+    int             x, y, n;
+    char            hdr[256];
 
     rc = LOAD_BADFILE;
 
@@ -689,7 +712,8 @@ _save(ImlibImage *im)
     /* if the image has a useful alpha channel */
     if (im->has_alpha)
     {
-        if (fprintf(f, fmt_rgba, im->w, im->h) <= 0)
+        n = snprintf(hdr, sizeof(hdr), fmt_rgba, im->w, im->h);
+        if (__imlib_SaveWrite(im, hdr, n))
             goto quit;
 
         for (y = 0; y < im->h; y++)
@@ -706,7 +730,7 @@ _save(ImlibImage *im)
                 bptr += 4;
             }
 
-            if (fwrite(buf, 4, im->w, f) != (size_t)im->w)
+            if (__imlib_SaveWrite(im, buf, 4 * im->w))
                 goto quit;
 
             if (im->lc && __imlib_LoadProgressRows(im, y, 1))
@@ -715,7 +739,8 @@ _save(ImlibImage *im)
     }
     else
     {
-        if (fprintf(f, fmt_rgb, im->w, im->h) <= 0)
+        n = snprintf(hdr, sizeof(hdr), fmt_rgb, im->w, im->h);
+        if (__imlib_SaveWrite(im, hdr, n))
             goto quit;
 
         for (y = 0; y < im->h; y++)
@@ -731,7 +756,7 @@ _save(ImlibImage *im)
                 bptr += 3;
             }
 
-            if (fwrite(buf, 3, im->w, f) != (size_t)im->w)
+            if (__imlib_SaveWrite(im, buf, 3 * im->w))
                 goto quit;
 
             if (im->lc && __imlib_LoadProgressRows(im, y, 1))
@@ -752,4 +777,4 @@ _save(ImlibImage *im)
     goto quit;
 }
 
-IMLIB_LOADER(_formats, _load, _save);
+IMLIB_LOADER_WRITE(_formats, _load, _save);
@@ -364,17 +364,39 @@ _load(ImlibImage *im, int load_data)
     return LOAD_SUCCESS;
 }
 
+typedef struct {
+    ImlibImage     *im;
+    uint8_t        *buf;
+    size_t          len, size;
+} QoiOut;
+
+static int
+_out_flush(QoiOut *out)
+{
+    int             rc;
+
+    rc = __imlib_SaveWrite(out->im, out->buf, out->len) == 0;
+    out->len = 0;
+
+    return rc;
+}
+
 static int
-_out(FILE *f, QoiEncResult res)
+_out(QoiOut *out, QoiEncResult res)
 {
-    return fwrite(res.data, 1, res.len, f) == (size_t)res.len;
+    if (out->len + res.len > out->size && !_out_flush(out))
+        return 0;
+    memcpy(out->buf + out->len, res.data, res.len);
+    out->len += res.len;
+    return 1;
 }
 
 static int
 _save(ImlibImage *im)
 {
-    FILE           *f = im->fi->fp;
+    int             rc;
     QoiEncCtx       ctx[1] = { 0 };
+    QoiOut          out[1] = { 0 };
     int             flags = 0;
     int             i, j;
     int             w = im->w, h = im->h;
@@ -383,25 +405,43 @@ _save(ImlibImage *im)
     if (!im->has_alpha)
         flags |= QOIENC_NO_ALPHA;
 
-    if (!_out(f, qoi_enc_init(ctx, w, h, flags)))
-        return LOAD_BADFILE;
+    /* Worst case is five bytes per pixel, flush once per row */
+    out->im = im;
+    out->size = (size_t)w * 5 + sizeof(((QoiEncResult *) 0)->data);
+    out->buf = malloc(out->size);
+    if (!out->buf)
+        return LOAD_OOM;
+
+    rc = LOAD_BADFILE;
+
+    if (!_out(out, qoi_enc_init(ctx, w, h, flags)))
+        goto quit;
 
     for (i = 0; i < h; ++i)
     {
         for (j = 0; j < w; ++j)
         {
-            if (!_out(f, qoi_enc(ctx, imdata[i * w + j])))
-                return LOAD_BADFILE;
+            if (!_out(out, qoi_enc(ctx, imdata[i * w + j])))
+                goto quit;
         }
+        if (!_out_flush(out))
+            goto quit;
 
         if (im->lc && __imlib_LoadProgressRows(im, i, 1))
-            return LOAD_BREAK;
+        {
+            rc = LOAD_BREAK;
+            goto quit;
+        }
     }
 
-    if (!_out(f, qoi_enc_finish(ctx)))
-        return LOAD_BADFILE;
+    if (!_out(out, qoi_enc_finish(ctx)) || !_out_flush(out))
+        goto quit;
 
-    return LOAD_SUCCESS;
+    rc = LOAD_SUCCESS;
+
+  quit:
+    free(out->buf);
+    return rc;
 }
 
-IMLIB_LOADER(_formats, _load, _save);
+IMLIB_LOADER_WRITE(_formats, _load, _save);
@@ -28,7 +28,7 @@ _sig_check(const char *name, const unsigned char *buf, unsigned int len)
     if (buf[0] == 0x1f && buf[1] == 0x8b)
     {
         /* Assume gzip compressed data */
-        s = strrchr(name, '.');
+        s = name ? strrchr(name, '.') : NULL;
         return !(s && strcmp(s, ".svgz") == 0);
     }
 
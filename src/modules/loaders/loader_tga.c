@@ -496,7 +496,6 @@ static int
 _save(ImlibImage *im)
 {
     int             rc;
-    FILE           *f = im->fi->fp;
     const uint32_t *imdata;
     unsigned char  *buf, *bufptr;
     int             y;
@@ -562,12 +561,12 @@ _save(ImlibImage *im)
     }
 
     /* write the header */
-    if (fwrite(&header, 1, sizeof(header), f) != sizeof(header))
+    if (__imlib_SaveWrite(im, &header, sizeof(header)))
         goto quit;
 
     /* write the image data */
-    if (fwrite(buf, (im->has_alpha ? 4 : 3), im->w * im->h, f) !=
-        (size_t)(im->w * im->h))
+    if (__imlib_SaveWrite(im, buf, (size_t)im->w * im->h *
+                          (im->has_alpha ? 4 : 3)))
         goto quit;
 
     rc = LOAD_SUCCESS;
@@ -578,4 +577,4 @@ _save(ImlibImage *im)
     return rc;
 }
 
-IMLIB_LOADER(_formats, _load, _save);
+IMLIB_LOADER_WRITE(_formats, _load, _save);
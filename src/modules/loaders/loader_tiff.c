@@ -1,5 +1,6 @@
 #include "config.h"
 #include "Imlib2_Loader.h"
+#include "lock.h"
 #include "ldrs_util.h"
 
 #include <setjmp.h>
@@ -21,7 +22,7 @@ _tiff_error(const char *module, const char *fmt, va_list ap)
 #endif
 }
 
-static struct {
+static THREAD_LOCAL struct {
     const unsigned char *data, *dptr;
     unsigned int    size;
 } mdata;
@@ -117,6 +118,105 @@ _tiff_unmap(thandle_t ctx, void *base, toff_t size)
     DD("%s\n", __func__);
 }
 
+/* Growable memory output, used when saving without a file */
+typedef struct {
+    uint8_t        *data;
+    toff_t          size;       /* Bytes written */
+    toff_t          alloc;
+    toff_t          pos;
+    int             err;
+} tiff_mout_t;
+
+static          tmsize_t
+_tiff_mout_read(thandle_t ctx, void *buf, tmsize_t len)
+{
+    tiff_mout_t    *mo = ctx;
+
+    if (mo->pos >= mo->size)
+        return 0;
+    if ((toff_t)len > mo->size - mo->pos)
+        len = mo->size - mo->pos;
+
+    memcpy(buf, mo->data + mo->pos, len);
+    mo->pos += len;
+
+    return len;
+}
+
+static          tmsize_t
+_tiff_mout_write(thandle_t ctx, void *buf, tmsize_t len)
+{
+    tiff_mout_t    *mo = ctx;
+    toff_t          end;
+    uint8_t        *p;
+
+    DD("%s: pos=%ld len=%ld\n", __func__, (long)mo->pos, (long)len);
+
+    end = mo->pos + len;
+    if (end > mo->alloc)
+    {
+        toff_t          alloc = mo->alloc ? mo->alloc : 65536;
+
+        while (alloc < end)
+            alloc *= 2;
+        p = realloc(mo->data, alloc);
+        if (!p)
+        {
+            mo->err = 1;
+            return -1;
+        }
+        mo->data = p;
+        mo->alloc = alloc;
+    }
+
+    if (mo->pos > mo->size)
+        memset(mo->data + mo->size, 0, mo->pos - mo->size);
+    memcpy(mo->data + mo->pos, buf, len);
+    mo->pos = end;
+    if (end > mo->size)
+        mo->size = end;
+
+    return len;
+}
+
+static          toff_t
+_tiff_mout_seek(thandle_t ctx, toff_t offs, int whence)
+{
+    tiff_mout_t    *mo = ctx;
+
+    switch (whence)
+    {
+    default:
+        return -1;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offs += mo->pos;
+        break;
+    case SEEK_END:
+        offs += mo->size;
+        break;
+    }
+
+    mo->pos = offs;
+
+    return mo->pos;
+}
+
+static          toff_t
+_tiff_mout_size(thandle_t ctx)
+{
+    tiff_mout_t    *mo = ctx;
+
+    return mo->size;
+}
+
+static int
+_tiff_mout_map(thandle_t ctx, void **base, toff_t *size)
+{
+    return 0;
+}
+
 /* This is a wrapper data structure for TIFFRGBAImage, so that data can be */
 /* passed into the callbacks. More elegent, I think, than a bunch of globals */
 
@@ -481,11 +581,21 @@ _save(ImlibImage *im)
     int             compression_type;
     int             i;
     ImlibSaverParam imsp;
+    tiff_mout_t     mout = { 0 };
 
     TIFFSetErrorHandler(_tiff_error);
     TIFFSetWarningHandler(_tiff_error);
 
-    tif = TIFFFdOpen(fileno(im->fi->fp), im->fi->name, "w");
+    /* libtiff seeks back to patch offsets, so without a file the output
+     * is assembled in memory and passed on when complete */
+    if (im->fi->fp)
+        tif = TIFFFdOpen(fileno(im->fi->fp),
+                         im->fi->name ? im->fi->name : "", "w");
+    else
+        tif = TIFFClientOpen(im->fi->name ? im->fi->name : "", "w", &mout,
+                             _tiff_mout_read, _tiff_mout_write,
+                             _tiff_mout_seek, _tiff_close, _tiff_mout_size,
+                             _tiff_mout_map, _tiff_unmap);
     if (!tif)
         return LOAD_BADFILE;
 
@@ -591,7 +701,12 @@ _save(ImlibImage *im)
     if (tif)
         TIFFClose(tif);
 
+    if (rc == LOAD_SUCCESS && !im->fi->fp &&
+        (mout.err || __imlib_SaveWrite(im, mout.data, mout.size)))
+        rc = LOAD_BADFILE;
+    free(mout.data);
+
     return rc;
 }
 
-IMLIB_LOADER(_formats, _load, _save);
+IMLIB_LOADER_WRITE(_formats, _load, _save);
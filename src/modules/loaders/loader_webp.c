@@ -10,6 +10,12 @@
 
 static const char *const _formats[] = { "webp" };
 
+static void
+_demux_free(void *state)
+{
+    WebPDemuxDelete(state);
+}
+
 static int
 _load(ImlibImage *im, int load_data)
 {
@@ -17,21 +23,35 @@ _load(ImlibImage *im, int load_data)
     WebPData        webp_data;
     WebPDemuxer    *demux;
     WebPIterator    iter;
-    int             frame, fcount;
+    int             frame, fcount, sw, sh, scaled, keep;
     ImlibImageFrame *pf;
+    WebPDecoderConfig config;
 
     rc = LOAD_FAIL;
+    keep = 0;
+
+    /* Reuse demuxer when iterating frames */
+    demux = __imlib_LoaderState(im);
+    if (demux)
+    {
+        keep = 1;
+    }
+    else
+    {
+        if (im->fi->fsize < 12)
+            return rc;
 
-    if (im->fi->fsize < 12)
-        return rc;
+        webp_data.bytes = im->fi->fdata;
+        webp_data.size = im->fi->fsize;
 
-    webp_data.bytes = im->fi->fdata;
-    webp_data.size = im->fi->fsize;
+        /* Init (includes signature check) */
+        demux = WebPDemux(&webp_data);
+        if (!demux)
+            goto quit;
 
-    /* Init (includes signature check) */
-    demux = WebPDemux(&webp_data);
-    if (!demux)
-        goto quit;
+        if (im->frame > 0)
+            keep = __imlib_LoaderStateSet(im, demux, _demux_free) == 0;
+    }
 
     rc = LOAD_BADIMAGE;         /* Format accepted */
 
@@ -88,6 +108,14 @@ _load(ImlibImage *im, int load_data)
     if (!IMAGE_DIMENSIONS_OK(im->w, im->h))
         goto quit;
 
+    /* Decode at reduced size if that will do (not for animation frames) */
+    scaled = !pf && __imlib_LoadSizeHint(im, im->w, im->h, &sw, &sh);
+    if (scaled)
+    {
+        im->w = sw;
+        im->h = sh;
+    }
+
     im->has_alpha = iter.has_alpha;
 
     if (!load_data)
@@ -98,9 +126,25 @@ _load(ImlibImage *im, int load_data)
     if (!__imlib_AllocateData(im))
         QUIT_WITH_RC(LOAD_OOM);
 
-    if (WebPDecodeBGRAInto
-        (iter.fragment.bytes, iter.fragment.size, (uint8_t *) im->data,
-         sizeof(uint32_t) * im->w * im->h, im->w * 4) == NULL)
+    if (scaled)
+    {
+        if (!WebPInitDecoderConfig(&config))
+            goto quit;
+        config.options.use_scaling = 1;
+        config.options.scaled_width = im->w;
+        config.options.scaled_height = im->h;
+        config.output.colorspace = MODE_BGRA;
+        config.output.is_external_memory = 1;
+        config.output.u.RGBA.rgba = (uint8_t *) im->data;
+        config.output.u.RGBA.stride = im->w * 4;
+        config.output.u.RGBA.size = sizeof(uint32_t) * im->w * im->h;
+        if (WebPDecode(iter.fragment.bytes, iter.fragment.size, &config) !=
+            VP8_STATUS_OK)
+            goto quit;
+    }
+    else if (WebPDecodeBGRAInto
+             (iter.fragment.bytes, iter.fragment.size, (uint8_t *) im->data,
+              sizeof(uint32_t) * im->w * im->h, im->w * 4) == NULL)
         goto quit;
 
     if (im->lc)
@@ -109,7 +153,7 @@ _load(ImlibImage *im, int load_data)
     rc = LOAD_SUCCESS;
 
   quit:
-    if (demux)
+    if (demux && !keep)
         WebPDemuxDelete(demux);
 
     return rc;
@@ -118,20 +162,19 @@ _load(ImlibImage *im, int load_data)
 static int
 webp_write(const uint8_t *data, size_t size, const WebPPicture *pic)
 {
-    FILE           *f = pic->custom_ptr;
+    ImlibImage     *im = pic->custom_ptr;
 
-    return fwrite(data, 1, size, f) == size;
+    return __imlib_SaveWrite(im, data, size) == 0;
 }
 
 static int
 _save(ImlibImage *im)
 {
     int             rc;
-    FILE           *f = im->fi->fp;
     ImlibSaverParam imsp;
     WebPConfig      conf;
     WebPPicture     pic;
-    int             lossless;
+    int             lossless, effort;
     int             free_pic = 0;
 
     rc = LOAD_BADFILE;
@@ -141,19 +184,28 @@ _save(ImlibImage *im)
 
     get_saver_params(im, &imsp);
 
+    effort = imsp.effort >= 0 ? imsp.effort : imsp.compression;
+
     /* other savers seem to treat quality 100 as lossless, do the same here. */
     lossless = imsp.quality == 100;
     if (lossless)
     {
         /* Compression parameter is effort, gzip-like 0-9 */
-        WebPConfigLosslessPreset(&conf, imsp.compression);
+        WebPConfigLosslessPreset(&conf, effort);
     }
     else
     {
         conf.quality = imsp.quality;
-        conf.method = 0.67 * imsp.compression;  /* convert from [0, 9] to [0, 6]. (6/9 == 0.67) */
+        conf.method = 0.67 * effort;    /* convert from [0, 9] to [0, 6]. (6/9 == 0.67) */
     }
 
+    /* libwebp only does on/off (a few threads at most) */
+    if (imsp.threads > 0)
+        conf.thread_level = imsp.threads > 1;
+
+    D("Quality/effort/threads: %d/%d/%d\n", imsp.quality, effort,
+      imsp.threads);
+
     if (!WebPValidateConfig(&conf))
     {
         D("WebPValidateConfig failed");
@@ -164,7 +216,7 @@ _save(ImlibImage *im)
     pic.width = im->w;
     pic.height = im->h;
     pic.writer = webp_write;
-    pic.custom_ptr = f;
+    pic.custom_ptr = im;
     if (!WebPPictureImportBGRA(&pic, (uint8_t *) im->data, im->w * 4))
         QUIT_WITH_RC(LOAD_OOM);
     free_pic = 1;
@@ -181,4 +233,4 @@ _save(ImlibImage *im)
     return rc;
 }
 
-IMLIB_LOADER(_formats, _load, _save);
+IMLIB_LOADER_WRITE(_formats, _load, _save);
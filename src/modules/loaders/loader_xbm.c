@@ -3,12 +3,15 @@
  */
 #include "config.h"
 #include "Imlib2_Loader.h"
+#include "lock.h"
+
+#include <stdarg.h>
 
 #define DBG_PFX "LDR-xbm"
 
 static const char *const _formats[] = { "xbm" };
 
-static struct {
+static THREAD_LOCAL struct {
     const char     *data, *dptr;
     unsigned int    size;
 } mdata;
@@ -208,36 +211,57 @@ _load(ImlibImage *im, int load_data)
     return rc;
 }
 
+static int
+_xbm_printf(ImlibImage *im, const char *fmt, ...)
+{
+    char            buf[1024];
+    va_list         args;
+    int             n;
+
+    va_start(args, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    if (n <= 0 || n >= (int)sizeof(buf))
+        return -1;
+
+    return __imlib_SaveWrite(im, buf, n);
+}
+
 static int
 _save(ImlibImage *im)
 {
     int             rc;
-    FILE           *f = im->fi->fp;
     const char     *s, *name;
     char           *bname;
-    int             i, k, x, y, bits, nval, val;
+    char            line[128];
+    int             i, k, n, x, y, bits, nval, val;
     const uint32_t *imdata;
 
     rc = LOAD_BADFILE;
 
-    name = im->fi->name;
+    name = im->fi->name ? im->fi->name : "image";
     if ((s = strrchr(name, '/')) != 0)
         name = s + 1;
 
     bname = strndup(name, strcspn(name, "."));
+    if (!bname)
+        return LOAD_OOM;
 
-    if (fprintf(f, "#define %s_width %d\n", bname, im->w) <= 0)
-        goto quit;
-    if (fprintf(f, "#define %s_height %d\n", bname, im->h) <= 0)
-        goto quit;
-    if (fprintf(f, "static unsigned char %s_bits[] = {\n", bname) <= 0)
+    if (_xbm_printf(im, "#define %s_width %d\n"
+                    "#define %s_height %d\n"
+                    "static unsigned char %s_bits[] = {\n",
+                    bname, im->w, bname, im->h, bname))
+    {
+        free(bname);
         goto quit;
+    }
 
     free(bname);
 
     nval = ((im->w + 7) / 8) * im->h;
     imdata = im->data;
-    x = k = 0;
+    x = k = n = 0;
     for (y = 0; y < im->h;)
     {
         bits = 0;
@@ -254,12 +278,19 @@ _save(ImlibImage *im)
         }
         k++;
         DL("x, y = %2d,%2d: %d/%d\n", x, y, k, nval);
-        if (fprintf(f, " 0x%02x%s%s", bits, k < nval ? "," : "",
-                    (k == nval) || ((k % 12) == 0) ? "\n" : "") <= 0)
-            goto quit;
+        /* Twelve values per line, written out a line at a time */
+        n += snprintf(line + n, sizeof(line) - n, " 0x%02x%s%s", bits,
+                      k < nval ? "," : "",
+                      (k == nval) || ((k % 12) == 0) ? "\n" : "");
+        if ((k == nval) || ((k % 12) == 0))
+        {
+            if (__imlib_SaveWrite(im, line, n))
+                goto quit;
+            n = 0;
+        }
     }
 
-    if (fprintf(f, "};\n") <= 0)
+    if (__imlib_SaveWrite(im, "};\n", 3))
         goto quit;
 
     rc = LOAD_SUCCESS;
@@ -268,4 +299,4 @@ _save(ImlibImage *im)
     return rc;
 }
 
-IMLIB_LOADER(_formats, _load, _save);
+IMLIB_LOADER_WRITE(_formats, _load, _save);
@@ -1,5 +1,6 @@
 #include "config.h"
 #include "Imlib2_Loader.h"
+#include "lock.h"
 
 #include <stdbool.h>
 
@@ -7,7 +8,7 @@
 
 static const char *const _formats[] = { "xpm" };
 
-static struct {
+static THREAD_LOCAL struct {
     const char     *data, *dptr;
     unsigned int    size;
 } mdata;
@@ -33,6 +34,7 @@ mm_getc(void)
 }
 
 static FILE    *rgb_txt = NULL;
+LOCK_STATIC(rgb_txt_lock);
 
 static          uint32_t
 xpm_parse_color(const char *color)
@@ -89,12 +91,13 @@ xpm_parse_color(const char *color)
     }
 
     /* look in rgb txt database */
+    LOCK(rgb_txt_lock);
     if (!rgb_txt)
         rgb_txt = fopen(PACKAGE_DATA_DIR "/rgb.txt", "r");
     if (!rgb_txt)
         rgb_txt = fopen("/usr/share/X11/rgb.txt", "r");
     if (!rgb_txt)
-        goto done;
+        goto unlock;
 
     fseek(rgb_txt, 0, SEEK_SET);
     while (fgets(buf, sizeof(buf), rgb_txt))
@@ -110,11 +113,14 @@ xpm_parse_color(const char *color)
                 r = rr;
                 g = gg;
                 b = bb;
-                goto done;
+                goto unlock;
             }
         }
     }
 
+  unlock:
+    UNLOCK(rgb_txt_lock);
+
   done:
     return PIXEL_ARGB(a, r, g, b);
 }
@@ -122,9 +128,11 @@ xpm_parse_color(const char *color)
 static void
 xpm_parse_done(void)
 {
+    LOCK(rgb_txt_lock);
     if (rgb_txt)
         fclose(rgb_txt);
     rgb_txt = NULL;
+    UNLOCK(rgb_txt_lock);
 }
 
 typedef struct {
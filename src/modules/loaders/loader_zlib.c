@@ -6,18 +6,28 @@
 
 static const char *const _formats[] = { "gz" };
 
-#define OUTBUF_SIZE 16484
-
 static int
-uncompress_file(const void *fdata, unsigned int fsize, int dest)
+uncompress_file(const void *fdata, unsigned int fsize,
+                ImlibDecompressBuf *dbuf)
 {
     int             ok;
     z_stream        strm = { 0 };;
-    unsigned char   outbuf[OUTBUF_SIZE];
-    int             ret = 1, bytes;
+    const unsigned char *fd = fdata;
+    size_t          avail, isize;
+    int             ret = 1;
 
     ok = 0;
 
+    /* The gzip trailer holds the uncompressed size (mod 2^32), use it as
+     * initial buffer size unless it is implausible (max ratio is ~1032) */
+    if (fsize >= 18 && fd[0] == 0x1f && fd[1] == 0x8b)
+    {
+        isize = fd[fsize - 4] | fd[fsize - 3] << 8 |
+            fd[fsize - 2] << 16 | (size_t)fd[fsize - 1] << 24;
+        if (isize / 1032 <= fsize)
+            dbuf->size_hint = isize + 1;        /* No regrow at the end */
+    }
+
     ret = inflateInit2(&strm, 15 + 32);
     if (ret != Z_OK)
         return ok;
@@ -27,17 +37,17 @@ uncompress_file(const void *fdata, unsigned int fsize, int dest)
 
     for (;;)
     {
-        strm.next_out = outbuf;
-        strm.avail_out = sizeof(outbuf);
+        strm.next_out = decompress_buf_space(dbuf, &avail);
+        if (!strm.next_out)
+            goto quit;
+        strm.avail_out = avail;
 
         ret = inflate(&strm, 0);
 
         if (ret != Z_OK && ret != Z_STREAM_END)
             goto quit;
 
-        bytes = sizeof(outbuf) - strm.avail_out;
-        if (write(dest, outbuf, bytes) != bytes)
-            goto quit;
+        dbuf->size += avail - strm.avail_out;
 
         if (ret == Z_STREAM_END)
             break;
@@ -0,0 +1,844 @@
+/*
+ * Pixel pipeline microbenchmarks
+ *
+ * Runs each benchmark for a minimum time and prints results as JSON:
+ *
+ * {"imlib2_bench": {"size": [W, H], "threads": N, "results": [
+ *   {"name": "...", "iter": N, "ms": T, "mpix_s": R, "allocs": A}, ...]}}
+ *
+ * mpix_s is output megapixels per second, allocs is the number of heap
+ * allocations per iteration (-1 if not counted).
+ */
+#include "config.h"
+#ifndef X_DISPLAY_MISSING
+#define X_DISPLAY_MISSING
+#endif
+#include <Imlib2.h>
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "test.h"
+
+#define HELP \
+   "Usage:\n" \
+   "  imlib2_bench [OPTIONS] [NAME...]\n" \
+   "    Run benchmarks whose name starts with one of NAME (default all).\n" \
+   "OPTIONS:\n" \
+   "  -h     : Show this help\n" \
+   "  -j N   : Use N threads (imlib_set_threads())\n" \
+   "  -l     : List benchmarks\n" \
+   "  -o FILE: Write JSON to FILE (default stdout)\n" \
+   "  -s WxH : Source image size (default 1024x768)\n" \
+   "  -t MS  : Minimum run time per benchmark (default 200)\n"
+
+/* Allocation counting, by interposing malloc() */
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define COUNT_ALLOCS 1
+
+extern void    *__libc_malloc(size_t size);
+extern void    *__libc_calloc(size_t nmemb, size_t size);
+extern void    *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long n_allocs;
+
+void           *
+malloc(size_t size)
+{
+    __atomic_fetch_add(&n_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void           *
+calloc(size_t nmemb, size_t size)
+{
+    __atomic_fetch_add(&n_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+void           *
+realloc(void *ptr, size_t size)
+{
+    __atomic_fetch_add(&n_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+static unsigned long
+allocs_get(void)
+{
+    return __atomic_load_n(&n_allocs, __ATOMIC_RELAXED);
+}
+#else
+#define COUNT_ALLOCS 0
+static unsigned long
+allocs_get(void)
+{
+    return 0;
+}
+#endif
+
+typedef struct {
+    const char     *name;
+    void            (*func)(const void *arg);
+    const void     *arg;
+    int             w, h;       /* Output size per iteration */
+} bench_t;
+
+static int      src_w = 1024;
+static int      src_h = 768;
+static int      min_ms = 200;
+static bool     list_only;
+static char   **names;
+static int      n_names;
+static FILE    *fout;
+static int      n_results;
+
+static Imlib_Image im_src;      /* Source, no alpha */
+static Imlib_Image im_src_a;    /* Source, alpha */
+static Imlib_Image im_dst;      /* Work image */
+
+static Imlib_Font font;
+
+static double
+time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static bool
+bench_selected(const char *name)
+{
+    int             i;
+
+    if (n_names <= 0)
+        return true;
+
+    for (i = 0; i < n_names; i++)
+        if (strncmp(name, names[i], strlen(names[i])) == 0)
+            return true;
+
+    return false;
+}
+
+static void
+bench_run(const bench_t *b)
+{
+    double          t0, t1;
+    unsigned long   a0, a1;
+    int             iter, n;
+
+    if (!bench_selected(b->name))
+        return;
+    if (list_only)
+    {
+        printf("%s\n", b->name);
+        return;
+    }
+
+    /* Warm up (loader modules, caches, tables) */
+    b->func(b->arg);
+
+    a0 = allocs_get();
+    t0 = time_ms();
+    for (iter = 0, n = 1;; n *= 2)
+    {
+        for (int i = 0; i < n; i++)
+            b->func(b->arg);
+        iter += n;
+        t1 = time_ms();
+        if (t1 - t0 >= min_ms)
+            break;
+    }
+    a1 = allocs_get();
+
+    fprintf(fout, "%s\n    {\"name\": \"%s\", \"iter\": %d, \"ms\": %.3f, "
+            "\"mpix_s\": %.3f, \"allocs\": %ld}",
+            n_results > 0 ? "," : "", b->name, iter, t1 - t0,
+            (double)b->w * b->h * iter / ((t1 - t0) * 1e3),
+            COUNT_ALLOCS ? (long)((a1 - a0) / iter) : -1L);
+    fflush(fout);
+    n_results++;
+}
+
+/* Deterministic test image with smooth and noisy regions */
+static Imlib_Image
+bench_image_make(int w, int h, bool alpha)
+{
+    Imlib_Image     im;
+    uint32_t       *data, a;
+    int             x, y;
+
+    im = image_make(w, h, alpha);
+    data = imlib_image_get_data();
+    for (y = 0; y < h; y++)
+    {
+        for (x = 0; x < w; x++)
+        {
+            a = alpha ? (255 * x / w) : 0xff;
+            if (y < h / 2)
+                data[y * w + x] = a << 24 | (255 * x / w) << 16 |
+                    (255 * y / h) << 8 | ((x ^ y) & 0xff);
+            else
+                data[y * w + x] = a << 24 | (data[y * w + x] & 0xffffff);
+        }
+    }
+    imlib_image_put_back_data(data);
+
+    return im;
+}
+
+static void
+dst_reset(bool alpha)
+{
+    imlib_context_set_image(im_dst);
+    imlib_image_set_has_alpha(alpha);
+}
+
+/*
+ * Scaling
+ */
+typedef struct {
+    int             w, h;
+    bool            aa, alpha;
+} scale_arg_t;
+
+static void
+bm_scale(const void *arg)
+{
+    const scale_arg_t *a = arg;
+    Imlib_Image     im;
+
+    imlib_context_set_anti_alias(a->aa);
+    imlib_context_set_image(a->alpha ? im_src_a : im_src);
+    im = imlib_create_cropped_scaled_image(0, 0, src_w, src_h, a->w, a->h);
+    imlib_context_set_image(im);
+    imlib_free_image_and_decache();
+}
+
+/*
+ * Blending
+ */
+typedef struct {
+    Imlib_Operation op;
+    bool            alpha, merge, cmod;
+} blend_arg_t;
+
+static Imlib_Color_Modifier cmod, cmod_bright;
+
+static void
+bm_blend(const void *arg)
+{
+    const blend_arg_t *a = arg;
+
+    dst_reset(a->merge);
+    imlib_context_set_operation(a->op);
+    imlib_context_set_color_modifier(a->cmod ? cmod : NULL);
+    imlib_context_set_blend(1);
+    imlib_blend_image_onto_image(a->alpha ? im_src_a : im_src, a->merge,
+                                 0, 0, src_w, src_h, 0, 0, src_w, src_h);
+    imlib_context_set_color_modifier(NULL);
+    imlib_context_set_operation(IMLIB_OP_COPY);
+}
+
+static void
+bm_cmod_apply(const void *arg)
+{
+    imlib_context_set_image(im_dst);
+    imlib_context_set_color_modifier(*(const Imlib_Color_Modifier *)arg);
+    imlib_apply_color_modifier();
+    imlib_context_set_color_modifier(NULL);
+}
+
+/*
+ * Rotation/orientation
+ */
+typedef struct {
+    double          angle;
+    bool            aa;
+} rotate_arg_t;
+
+static void
+bm_rotate(const void *arg)
+{
+    const rotate_arg_t *a = arg;
+    Imlib_Image     im;
+
+    imlib_context_set_anti_alias(a->aa);
+    imlib_context_set_image(im_src_a);
+    im = imlib_create_rotated_image(a->angle);
+    imlib_context_set_image(im);
+    imlib_free_image_and_decache();
+}
+
+static void
+bm_orientate(const void *arg)
+{
+    imlib_context_set_image(im_dst);
+    imlib_image_orientate(*(const int *)arg);
+}
+
+/*
+ * Filters
+ */
+static void
+bm_blur(const void *arg)
+{
+    imlib_context_set_image(im_dst);
+    imlib_image_blur(*(const int *)arg);
+}
+
+static void
+bm_blur_gaussian(const void *arg)
+{
+    imlib_context_set_image(im_dst);
+    imlib_image_blur_gaussian(*(const int *)arg);
+}
+
+static void
+bm_sharpen(const void *arg)
+{
+    imlib_context_set_image(im_dst);
+    imlib_image_sharpen(*(const int *)arg);
+}
+
+static Imlib_Filter filter, filter_sep;
+
+static void
+bm_filter(const void *arg)
+{
+    imlib_context_set_image(im_dst);
+    imlib_context_set_filter(arg ? filter_sep : filter);
+    imlib_image_filter();
+}
+
+/*
+ * Drawing
+ */
+static Imlib_Color_Range range;
+
+static void
+bm_gradient(const void *arg)
+{
+    imlib_context_set_image(im_dst);
+    imlib_context_set_color_range(range);
+    imlib_image_fill_color_range_rectangle(0, 0, src_w, src_h,
+                                           *(const double *)arg);
+}
+
+/* Many small bars, as in a chart */
+static void
+bm_gradient_bars(const void *arg)
+{
+    int             x;
+
+    imlib_context_set_image(im_dst);
+    imlib_context_set_color_range(range);
+    for (x = 0; x + 12 <= src_w; x += 16)
+        imlib_image_fill_color_range_rectangle(x, 0, 12, 64, 0.);
+}
+
+static ImlibPolygon poly, poly_many;
+
+static void
+bm_polygon(const void *arg)
+{
+    imlib_context_set_image(im_dst);
+    imlib_context_set_anti_alias(*(const bool *)arg);
+    imlib_context_set_color(200, 100, 50, 160);
+    imlib_image_fill_polygon(poly);
+}
+
+static void
+bm_polygon_many(const void *arg)
+{
+    imlib_context_set_image(im_dst);
+    imlib_context_set_anti_alias(*(const bool *)arg);
+    imlib_context_set_color(200, 100, 50, 255);
+    imlib_image_fill_polygon(poly_many);
+}
+
+static const char text_line[] = "The quick brown fox jumps over the lazy dog";
+
+static void
+bm_text(const void *arg)
+{
+    int             y;
+
+    imlib_set_text_cache_size(*(const int *)arg);
+    imlib_context_set_image(im_dst);
+    imlib_context_set_font(font);
+    imlib_context_set_color(255, 255, 255, 255);
+    for (y = 0; y < 20; y++)
+        imlib_text_draw(0, 20 * y, text_line);
+    imlib_set_text_cache_size(0);
+}
+
+/*
+ * Loaders
+ */
+typedef struct {
+    const char     *fmt;
+    const char     *file;
+    void           *data;
+    size_t          size;
+} io_arg_t;
+
+static void
+bm_encode(const void *arg)
+{
+    const io_arg_t *a = arg;
+
+    imlib_context_set_image(im_src_a);
+    imlib_image_set_format(a->fmt);
+    imlib_save_image(a->file);
+}
+
+static void
+bm_decode(const void *arg)
+{
+    const io_arg_t *a = arg;
+    Imlib_Image     im;
+
+    im = imlib_load_image_mem(a->file, a->data, a->size);
+    if (!im)
+        return;
+    imlib_context_set_image(im);
+    imlib_free_image_and_decache();
+}
+
+static void
+bm_load_cached(const void *arg)
+{
+    const io_arg_t *a = arg;
+    Imlib_Image     im;
+
+    im = imlib_load_image(a->file);
+    if (!im)
+        return;
+    imlib_context_set_image(im);
+    imlib_free_image();
+}
+
+static const char *const io_formats[] = {
+    "png", "jpg", "bmp", "tga", "ff", "qoi", "pnm", "tiff", "webp",
+    "avif", "jxl", "heif", "j2k",
+};
+
+static bool
+io_prepare(io_arg_t *a, const char *fmt)
+{
+    static char     file[4096];
+    struct stat     st;
+    FILE           *fp;
+    int             err;
+
+    snprintf(file, sizeof(file), "%s/bench.%s", IMG_GEN, fmt);
+
+    imlib_context_set_image(im_src_a);
+    imlib_image_set_format(fmt);
+    imlib_save_image_with_errno_return(file, &err);
+    if (err || stat(file, &st) || st.st_size <= 0)
+        return false;
+
+    a->fmt = fmt;
+    a->file = strdup(file);
+    a->size = st.st_size;
+    a->data = malloc(a->size);
+    fp = fopen(file, "rb");
+    if (!fp || !a->data || fread(a->data, 1, a->size, fp) != a->size)
+    {
+        if (fp)
+            fclose(fp);
+        return false;
+    }
+    fclose(fp);
+
+    return true;
+}
+
+#define RUN(_name, _func, _arg, _w, _h) \
+    do { \
+        bench_t b = { _name, _func, _arg, _w, _h }; \
+        bench_run(&b); \
+    } while (0)
+
+static void
+run_scale(void)
+{
+    static const struct {
+        const char     *name;
+        int             num, den;
+    } sizes[] = {
+        { "down4", 1, 4 }, { "down2", 1, 2 }, { "up2", 2, 1 },
+    };
+    char            name[64];
+    scale_arg_t     a;
+    unsigned int    i;
+    int             aa, alpha;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        for (aa = 0; aa <= 1; aa++)
+            for (alpha = 0; alpha <= 1; alpha++)
+            {
+                a.w = src_w * sizes[i].num / sizes[i].den;
+                a.h = src_h * sizes[i].num / sizes[i].den;
+                a.aa = aa;
+                a.alpha = alpha;
+                snprintf(name, sizeof(name), "scale/%s/%s/%s",
+                         sizes[i].name, aa ? "aa" : "sample",
+                         alpha ? "argb" : "rgb");
+                RUN(name, bm_scale, &a, a.w, a.h);
+            }
+}
+
+static void
+run_blend(void)
+{
+    static const char *const ops[] = { "copy", "add", "sub", "reshade" };
+    char            name[64];
+    blend_arg_t     a;
+    int             op, alpha, merge, cm;
+
+    for (op = 0; op < 4; op++)
+        for (cm = 0; cm <= 1; cm++)
+            for (alpha = 0; alpha <= 1; alpha++)
+                for (merge = 0; merge <= 1; merge++)
+                {
+                    a.op = (Imlib_Operation) op;
+                    a.alpha = alpha;
+                    a.merge = merge;
+                    a.cmod = cm;
+                    snprintf(name, sizeof(name), "blend/%s/%s/%s/%s",
+                             ops[op], cm ? "cmod" : "plain",
+                             alpha ? "argb" : "rgb",
+                             merge ? "merge" : "keep");
+                    RUN(name, bm_blend, &a, src_w, src_h);
+                }
+
+    RUN("cmod/apply", bm_cmod_apply, &cmod, src_w, src_h);
+    RUN("cmod/brightness", bm_cmod_apply, &cmod_bright, src_w, src_h);
+}
+
+static void
+run_rotate(void)
+{
+    static const rotate_arg_t rot[] = {
+        { 0.3, false }, { 0.3, true }, { 1.5708, true },
+    };
+    static const char *const names[] = {
+        "rotate/0.3/sample", "rotate/0.3/aa", "rotate/90/aa",
+    };
+    static const int orient[] = { 1, 2, 4, 5 };
+    char            name[64];
+    unsigned int    i;
+
+    for (i = 0; i < sizeof(rot) / sizeof(rot[0]); i++)
+        RUN(names[i], bm_rotate, &rot[i], src_w, src_h);
+
+    for (i = 0; i < sizeof(orient) / sizeof(orient[0]); i++)
+    {
+        snprintf(name, sizeof(name), "orientate/%d", orient[i]);
+        RUN(name, bm_orientate, &orient[i], src_w, src_h);
+    }
+}
+
+static void
+run_filter(void)
+{
+    static const int radius[] = { 2, 8, 32 };
+    char            name[64];
+    unsigned int    i;
+
+    for (i = 0; i < sizeof(radius) / sizeof(radius[0]); i++)
+    {
+        snprintf(name, sizeof(name), "blur/%d", radius[i]);
+        RUN(name, bm_blur, &radius[i], src_w, src_h);
+    }
+    for (i = 0; i < sizeof(radius) / sizeof(radius[0]); i++)
+    {
+        snprintf(name, sizeof(name), "blur_gaussian/%d", radius[i]);
+        RUN(name, bm_blur_gaussian, &radius[i], src_w, src_h);
+    }
+    for (i = 0; i < sizeof(radius) / sizeof(radius[0]); i++)
+    {
+        snprintf(name, sizeof(name), "sharpen/%d", radius[i]);
+        RUN(name, bm_sharpen, &radius[i], src_w, src_h);
+    }
+
+    RUN("filter/3x3", bm_filter, NULL, src_w, src_h);
+    RUN("filter/5x5sep", bm_filter, &filter_sep, src_w, src_h);
+}
+
+static void
+run_draw(void)
+{
+    static const double angle[] = { 0., 30. };
+    static const bool aa[] = { false, true };
+    static const int text_cache[] = { 0, 1 << 20 };
+
+    RUN("gradient/0", bm_gradient, &angle[0], src_w, src_h);
+    RUN("gradient/30", bm_gradient, &angle[1], src_w, src_h);
+    RUN("gradient/bars", bm_gradient_bars, NULL, (src_w + 4) / 16 * 12, 64);
+
+    RUN("polygon/sample", bm_polygon, &aa[0], src_w, src_h);
+    RUN("polygon/aa", bm_polygon, &aa[1], src_w, src_h);
+    RUN("polygon/many", bm_polygon_many, &aa[0], src_w, src_h);
+    RUN("polygon/many_aa", bm_polygon_many, &aa[1], src_w, src_h);
+
+    if (font)
+    {
+        RUN("text/draw", bm_text, &text_cache[0], src_w, src_h);
+        RUN("text/cached", bm_text, &text_cache[1], src_w, src_h);
+    }
+}
+
+static void
+run_io(void)
+{
+    char            name[64];
+    io_arg_t        a;
+    unsigned int    i;
+
+    for (i = 0; i < sizeof(io_formats) / sizeof(io_formats[0]); i++)
+    {
+        snprintf(name, sizeof(name), "encode/%s", io_formats[i]);
+        if (!bench_selected(name))
+        {
+            snprintf(name, sizeof(name), "decode/%s", io_formats[i]);
+            if (!bench_selected(name))
+                continue;
+        }
+        if (list_only)
+        {
+            printf("encode/%s\ndecode/%s\n", io_formats[i], io_formats[i]);
+            continue;
+        }
+
+        memset(&a, 0, sizeof(a));
+        if (!io_prepare(&a, io_formats[i]))
+        {
+            fprintf(stderr, "imlib2_bench: No loader/saver for %s\n",
+                    io_formats[i]);
+            free(a.data);
+            free((char *)a.file);
+            continue;
+        }
+
+        snprintf(name, sizeof(name), "encode/%s", io_formats[i]);
+        RUN(name, bm_encode, &a, src_w, src_h);
+        snprintf(name, sizeof(name), "decode/%s", io_formats[i]);
+        RUN(name, bm_decode, &a, src_w, src_h);
+
+        if (i == 0)
+        {
+            imlib_set_cache_size(64 * 1024 * 1024);
+            RUN("load/cached", bm_load_cached, &a, 1, 1);
+            imlib_set_cache_size(0);
+        }
+
+        unlink(a.file);
+        free(a.data);
+        free((char *)a.file);
+    }
+}
+
+static void
+setup(void)
+{
+    int             i;
+
+    im_src = bench_image_make(src_w, src_h, false);
+    im_src_a = bench_image_make(src_w, src_h, true);
+    im_dst = bench_image_make(src_w, src_h, true);
+
+    cmod = imlib_create_color_modifier();
+    imlib_context_set_color_modifier(cmod);
+    imlib_modify_color_modifier_gamma(0.8);
+    imlib_modify_color_modifier_contrast(1.2);
+    cmod_bright = imlib_create_color_modifier();
+    imlib_context_set_color_modifier(cmod_bright);
+    imlib_modify_color_modifier_brightness(0.1);
+    imlib_context_set_color_modifier(NULL);
+
+    filter = imlib_create_filter(0);
+    imlib_context_set_filter(filter);
+    imlib_filter_set(0, 0, 0, 8, 8, 8);
+    imlib_filter_set(-1, 0, 0, 1, 1, 1);
+    imlib_filter_set(1, 0, 0, 1, 1, 1);
+    imlib_filter_set(0, -1, 0, 1, 1, 1);
+    imlib_filter_set(0, 1, 0, 1, 1, 1);
+    imlib_filter_divisors(0, 12, 12, 12);
+
+    /* 5x5 binomial */
+    filter_sep = imlib_create_filter(0);
+    imlib_context_set_filter(filter_sep);
+    for (i = 0; i < 25; i++)
+    {
+        static const int b5[] = { 1, 4, 6, 4, 1 };
+        int             k = b5[i % 5] * b5[i / 5];
+
+        imlib_filter_set(i % 5 - 2, i / 5 - 2, k, k, k, k);
+    }
+
+    range = imlib_create_color_range();
+    imlib_context_set_color_range(range);
+    imlib_context_set_color(255, 0, 0, 255);
+    imlib_add_color_to_color_range(0);
+    imlib_context_set_color(0, 255, 0, 128);
+    imlib_add_color_to_color_range(100);
+    imlib_context_set_color(0, 0, 255, 255);
+    imlib_add_color_to_color_range(100);
+
+    /* Star shaped polygon */
+    poly = imlib_polygon_new();
+    for (i = 0; i < 10; i++)
+    {
+        double          r = (i & 1) ? .2 : .5;
+        double          t = i * 3.14159265 / 5;
+
+        imlib_polygon_add_point(poly,
+                                src_w / 2 + (int)(src_w * r * cos(t)),
+                                src_h / 2 + (int)(src_h * r * sin(t)));
+    }
+
+    /* Wiggly star with many vertices, opaque */
+    poly_many = imlib_polygon_new();
+    for (i = 0; i < 4000; i++)
+    {
+        double          r = (i & 1) ? .3 : .5;
+        double          t = i * 3.14159265 / 2000;
+
+        imlib_polygon_add_point(poly_many,
+                                src_w / 2 + (int)(src_w * r * cos(t)),
+                                src_h / 2 + (int)(src_h * r * sin(t)));
+    }
+
+    imlib_add_path_to_font_path(SRC_DIR "/../data/fonts");
+    font = imlib_load_font("notepad/24");
+    if (!font)
+        fprintf(stderr, "imlib2_bench: No font, skipping text\n");
+
+    imlib_set_cache_size(0);
+}
+
+static void
+cleanup(void)
+{
+    if (font)
+    {
+        imlib_context_set_font(font);
+        imlib_free_font();
+    }
+    imlib_polygon_free(poly);
+    imlib_polygon_free(poly_many);
+    imlib_context_set_color_range(range);
+    imlib_free_color_range();
+    imlib_context_set_filter(filter);
+    imlib_free_filter();
+    imlib_context_set_filter(filter_sep);
+    imlib_free_filter();
+    imlib_context_set_color_modifier(cmod);
+    imlib_free_color_modifier();
+    imlib_context_set_color_modifier(cmod_bright);
+    imlib_free_color_modifier();
+
+    imlib_context_set_image(im_src);
+    imlib_free_image_and_decache();
+    imlib_context_set_image(im_src_a);
+    imlib_free_image_and_decache();
+    imlib_context_set_image(im_dst);
+    imlib_free_image_and_decache();
+}
+
+int
+main(int argc, char **argv)
+{
+    const char     *outfile = NULL;
+    int             opt, threads;
+
+    threads = 1;
+
+    while ((opt = getopt(argc, argv, "hj:lo:s:t:")) != -1)
+    {
+        switch (opt)
+        {
+        default:
+        case 'h':
+            printf(HELP);
+            return 1;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'l':
+            list_only = true;
+            break;
+        case 'o':
+            outfile = optarg;
+            break;
+        case 's':
+            sscanf(optarg, "%dx%d", &src_w, &src_h);
+            break;
+        case 't':
+            min_ms = atoi(optarg);
+            break;
+        }
+    }
+
+    names = argv + optind;
+    n_names = argc - optind;
+
+    if (src_w <= 0 || src_h <= 0 || src_w > 16384 || src_h > 16384)
+    {
+        fprintf(stderr, "imlib2_bench: Bad size %dx%d\n", src_w, src_h);
+        return 1;
+    }
+
+    fout = stdout;
+    if (outfile && !list_only)
+    {
+        fout = fopen(outfile, "w");
+        if (!fout)
+        {
+            perror(outfile);
+            return 1;
+        }
+    }
+
+    mkdir(IMG_GEN, 0755);
+
+    imlib_set_threads(threads);
+
+    setup();
+
+    if (!list_only)
+        fprintf(fout, "{\"imlib2_bench\": {\"size\": [%d, %d], "
+                "\"threads\": %d, \"count_allocs\": %s, \"results\": [",
+                src_w, src_h, threads, COUNT_ALLOCS ? "true" : "false");
+
+    run_scale();
+    run_blend();
+    run_rotate();
+    run_filter();
+    run_draw();
+    run_io();
+
+    if (!list_only)
+        fprintf(fout, "\n]}}\n");
+
+    cleanup();
+
+    if (fout != stdout)
+        fclose(fout);
+
+    return 0;
+}
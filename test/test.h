@@ -18,6 +18,35 @@ void            pr_info(const char *fmt, ...);
 
 unsigned int    image_get_crc32(Imlib_Image im);
 
+/* Step the shared pseudo-random generator (LCG), return the new seed */
+static inline uint32_t
+test_rand(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed;
+}
+
+/* Image with pseudo-random pixels, the same for the same size.
+ * Without alpha the pixels are opaque. */
+static inline Imlib_Image
+image_make(int w, int h, bool alpha)
+{
+    Imlib_Image     im;
+    uint32_t       *data, seed;
+    int             i;
+
+    im = imlib_create_image(w, h);
+    imlib_context_set_image(im);
+    imlib_image_set_has_alpha(alpha);
+    data = imlib_image_get_data();
+    seed = (uint32_t)(w * 31 + h);
+    for (i = 0; i < w * h; i++)
+        data[i] = test_rand(&seed) | (alpha ? 0 : 0xff000000);
+    imlib_image_put_back_data(data);
+
+    return im;
+}
+
 void            flush_loaders(void);
 
 bool            file_skip(const char *file);
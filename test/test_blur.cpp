@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include "config.h"
+#include <Imlib2.h>
+
+#include "test.h"
+
+// Reference box blur, average of the window clipped at the image edges
+static void
+blur_ref(const uint32_t *src, uint32_t *dst, int w, int h, int rad)
+{
+    int             x, y, xx, yy, i, n;
+    unsigned int    s[4];
+
+    for (y = 0; y < h; y++)
+    {
+        for (x = 0; x < w; x++)
+        {
+            s[0] = s[1] = s[2] = s[3] = n = 0;
+            for (yy = y - rad; yy <= y + rad; yy++)
+            {
+                if (yy < 0 || yy >= h)
+                    continue;
+                for (xx = x - rad; xx <= x + rad; xx++)
+                {
+                    if (xx < 0 || xx >= w)
+                        continue;
+                    for (i = 0; i < 4; i++)
+                        s[i] += (src[yy * w + xx] >> (8 * i)) & 0xff;
+                    n++;
+                }
+            }
+            dst[y * w + x] = 0;
+            for (i = 0; i < 4; i++)
+                dst[y * w + x] |= (s[i] / n) << (8 * i);
+        }
+    }
+}
+
+static void
+test_blur(int w, int h, int rad)
+{
+    Imlib_Image     im;
+    uint32_t       *ref;
+    const uint32_t *data;
+    int             i, nerr;
+
+    pr_info("Blur %dx%d rad=%d", w, h, rad);
+
+    im = image_make(w, h, true);
+    imlib_context_set_image(im);
+
+    ref = (uint32_t *) malloc(w * h * sizeof(uint32_t));
+    blur_ref(imlib_image_get_data_for_reading_only(), ref, w, h, rad);
+
+    imlib_image_blur(rad);
+    data = imlib_image_get_data_for_reading_only();
+
+    for (i = nerr = 0; i < w * h; i++)
+        if (data[i] != ref[i])
+            nerr++;
+    EXPECT_EQ(nerr, 0);
+
+    free(ref);
+    imlib_free_image_and_decache();
+}
+
+TEST(BLUR, blur_box)
+{
+    test_blur(37, 23, 1);
+    test_blur(37, 23, 4);
+    test_blur(37, 23, 18);      // Window wider than image
+    test_blur(37, 23, 100);
+    test_blur(1, 17, 3);
+    test_blur(17, 1, 3);
+}
+
+TEST(BLUR, blur_box_mt)
+{
+    imlib_set_threads(4);
+    test_blur(300, 260, 5);
+    test_blur(250, 270, 12);
+    imlib_set_threads(1);
+}
+
+TEST(BLUR, blur_gaussian)
+{
+    Imlib_Image     im;
+    uint32_t       *pd;
+    const uint32_t *data;
+    int             i, x, y, w, h, nerr;
+
+    w = 64;
+    h = 48;
+
+    // Constant image stays constant
+    im = imlib_create_image(w, h);
+    imlib_context_set_image(im);
+    imlib_image_set_has_alpha(1);
+    pd = imlib_image_get_data();
+    for (i = 0; i < w * h; i++)
+        pd[i] = 0x280a141e;
+    imlib_image_put_back_data(pd);
+    imlib_image_blur_gaussian(5.);
+    data = imlib_image_get_data_for_reading_only();
+    for (i = nerr = 0; i < w * h; i++)
+        if (data[i] != 0x280a141e)
+            nerr++;
+    EXPECT_EQ(nerr, 0);
+
+    // Centered square stays symmetric and spreads out
+    pd = imlib_image_get_data();
+    for (y = 0; y < h; y++)
+        for (x = 0; x < w; x++)
+            pd[y * w + x] = (x >= w / 2 - 4 && x < w / 2 + 4 &&
+                             y >= h / 2 - 4 && y < h / 2 + 4) ? 0xffffffff : 0;
+    imlib_image_put_back_data(pd);
+    imlib_image_blur_gaussian(3.);
+    data = imlib_image_get_data_for_reading_only();
+    for (y = nerr = 0; y < h; y++)
+        for (x = 0; x < w / 2; x++)
+            if (data[y * w + x] != data[y * w + w - 1 - x])
+                nerr++;
+    EXPECT_EQ(nerr, 0);
+    EXPECT_LT(data[(h / 2) * w + w / 2] >> 24, 255u);
+    EXPECT_GT(data[(h / 2) * w + w / 2 - 8] >> 24, 0u);
+    EXPECT_EQ(data[(h / 2) * w + w / 2 - 20], 0u);
+
+    imlib_free_image_and_decache();
+}
@@ -0,0 +1,243 @@
+#include <gtest/gtest.h>
+
+#include "config.h"
+#include <Imlib2.h>
+
+#include <limits.h>
+#if ENABLE_THREADS
+#include <thread>
+#endif
+
+#include "test.h"
+
+#define FILE_REF    FILE_PFX1 ".png"
+#define IMG_SIZE    (64 * 64 * 4)
+
+/* Build distinct cache keys for the same file by adding "./" components */
+static void
+file_name(char *buf, size_t size, int n)
+{
+    int             len;
+
+    len = snprintf(buf, size, "%s/", IMG_SRC);
+    for (; n > 0; n--)
+        len += snprintf(buf + len, size - len, "./");
+    snprintf(buf + len, size - len, "%s", FILE_REF);
+}
+
+TEST(CACHE, hit)
+{
+    char            file[4096];
+    Imlib_Image     im, im2;
+
+    imlib_set_cache_size(4 * 1024 * 1024);
+
+    file_name(file, sizeof(file), 0);
+    im = imlib_load_image_immediately(file);
+    ASSERT_TRUE(im);
+    imlib_context_set_image(im);
+    imlib_free_image();
+    EXPECT_EQ(imlib_get_cache_used(), IMG_SIZE);
+
+    // Should be served from cache
+    im2 = imlib_load_image_immediately(file);
+    EXPECT_EQ(im, im2);
+    EXPECT_EQ(imlib_get_cache_used(), 0);
+
+    // Decache while referenced, freeing drops it
+    EXPECT_EQ(imlib_image_decache_file(file), 1);
+    imlib_context_set_image(im2);
+    imlib_free_image();
+    EXPECT_EQ(imlib_get_cache_used(), 0);
+
+    im = imlib_load_image_immediately(file);
+    ASSERT_TRUE(im);
+    imlib_context_set_image(im);
+    imlib_free_image_and_decache();
+    EXPECT_EQ(imlib_get_cache_used(), 0);
+}
+
+TEST(CACHE, many)
+{
+    char            file[4096];
+    Imlib_Image     im;
+    int             i, n = 500;
+
+    imlib_set_cache_size(n * IMG_SIZE);
+
+    for (i = 0; i < n; i++)
+    {
+        file_name(file, sizeof(file), i);
+        im = imlib_load_image_immediately(file);
+        ASSERT_TRUE(im);
+        imlib_context_set_image(im);
+        imlib_free_image();
+    }
+    EXPECT_EQ(imlib_get_cache_used(), n * IMG_SIZE);
+
+    for (i = 0; i < n; i++)
+    {
+        file_name(file, sizeof(file), i);
+        EXPECT_EQ(imlib_image_decache_file(file), 1);
+    }
+    EXPECT_EQ(imlib_get_cache_used(), 0);
+}
+
+TEST(CACHE, evict)
+{
+    char            file[4096];
+    Imlib_Image     im, im0;
+    int             i, n = 8;
+
+    // Room for n - 1 images
+    imlib_set_cache_size((n - 1) * IMG_SIZE);
+
+    file_name(file, sizeof(file), 0);
+    im0 = imlib_load_image_immediately(file);
+    ASSERT_TRUE(im0);
+    imlib_context_set_image(im0);
+    imlib_free_image();
+
+    for (i = 1; i < n; i++)
+    {
+        file_name(file, sizeof(file), i);
+        im = imlib_load_image_immediately(file);
+        ASSERT_TRUE(im);
+        imlib_context_set_image(im);
+        imlib_free_image();
+    }
+    // Oldest has been evicted
+    EXPECT_EQ(imlib_get_cache_used(), (n - 1) * IMG_SIZE);
+    file_name(file, sizeof(file), 0);
+    EXPECT_EQ(imlib_image_decache_file(file), 0);
+
+    // Most recently used stays
+    file_name(file, sizeof(file), n - 1);
+    EXPECT_EQ(imlib_image_decache_file(file), 1);
+
+    imlib_set_cache_size(0);
+    EXPECT_EQ(imlib_get_cache_used(), 0);
+}
+
+TEST(CACHE, size_64)
+{
+    uint64_t        size = 40ULL * 1024 * 1024 * 1024;
+
+    imlib_set_cache_size_64(size);
+    EXPECT_EQ(imlib_get_cache_size_64(), size);
+    EXPECT_EQ(imlib_get_cache_size(), INT_MAX);
+
+    imlib_set_cache_size(4 * 1024 * 1024);
+    EXPECT_EQ(imlib_get_cache_size_64(), 4 * 1024 * 1024);
+}
+
+#if ENABLE_THREADS
+static const char *const thr_exts[] = {
+    "png", "jpg", "bmp", "tga", "xpm", "ff", "argb", "ppm", "qoi", "ff.gz",
+};
+#define N_EXTS      (sizeof(thr_exts) / sizeof(thr_exts[0]))
+#define N_THREADS   4
+#define N_LOOPS     50
+
+static const char *const thr_dirs[N_THREADS] = {
+    "./", "././", "./././", "././././",
+};
+
+static unsigned int thr_crc[N_EXTS];
+
+static void
+thr_load(int id, int *errors, bool lazy)
+{
+    Imlib_Context   ctx;
+    Imlib_Image     im;
+    char            file[4096];
+    unsigned int    i, ix;
+
+    ctx = imlib_context_new();
+    imlib_context_push(ctx);
+
+    for (i = 0; i < N_LOOPS * N_EXTS; i++)
+    {
+        ix = (i + id) % N_EXTS;
+        if (thr_crc[ix] == 0)
+            continue;           // Loader not available
+
+        // Alternate between shared and per-thread cache keys
+        snprintf(file, sizeof(file), "%s/%s%s.%s", IMG_SRC,
+                 (i & 1) ? thr_dirs[id] : "", FILE_PFX1, thr_exts[ix]);
+
+        // Lazy loads share the header-only cached image and load the
+        // data on first access, possibly in several threads at once
+        if (lazy)
+            im = imlib_load_image(file);
+        else
+            im = imlib_load_image_immediately(file);
+        if (!im || image_get_crc32(im) != thr_crc[ix])
+        {
+            *errors += 1;
+            if (!im)
+                continue;
+        }
+        imlib_context_set_image(im);
+        if (i % 7 == 0)
+            imlib_free_image_and_decache();
+        else
+            imlib_free_image();
+    }
+
+    imlib_context_pop();
+    imlib_context_free(ctx);
+}
+
+static void
+test_threads(bool lazy)
+{
+    char            file[4096];
+    Imlib_Image     im;
+    std::thread    *thr[N_THREADS];
+    int             errors[N_THREADS];
+    unsigned int    i;
+
+    // Reference crcs, loaded in this thread
+    for (i = 0; i < N_EXTS; i++)
+    {
+        snprintf(file, sizeof(file), "%s/%s.%s", IMG_SRC, FILE_PFX1,
+                 thr_exts[i]);
+        im = imlib_load_image_immediately_without_cache(file);
+        thr_crc[i] = im ? image_get_crc32(im) : 0;
+        if (!im)
+            continue;
+        imlib_context_set_image(im);
+        imlib_free_image();
+    }
+
+    // Small cache to keep eviction going
+    imlib_set_cache_size(3 * IMG_SIZE);
+
+    for (i = 0; i < N_THREADS; i++)
+    {
+        errors[i] = 0;
+        thr[i] = new std::thread(thr_load, i, &errors[i], lazy);
+    }
+    for (i = 0; i < N_THREADS; i++)
+    {
+        thr[i]->join();
+        delete          thr[i];
+        EXPECT_EQ(errors[i], 0);
+    }
+
+    imlib_set_cache_size(0);
+    EXPECT_EQ(imlib_get_cache_used(), 0);
+    imlib_set_cache_size(4 * 1024 * 1024);
+}
+
+TEST(CACHE, threads)
+{
+    test_threads(false);
+}
+
+TEST(CACHE, threads_lazy)
+{
+    test_threads(true);
+}
+#endif
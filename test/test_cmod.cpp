@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+
+#include "config.h"
+#include <Imlib2.h>
+
+#include "test.h"
+
+// Apply the current color modifier tables to the rectangle (x, y, rw, rh)
+static void
+cmod_ref(uint32_t *data, int w, int x, int y, int rw, int rh, int alpha)
+{
+    uint8_t         r[256], g[256], b[256], a[256];
+    uint32_t        p;
+    int             i, j;
+
+    imlib_get_color_modifier_tables(r, g, b, a);
+    for (j = y; j < y + rh; j++)
+    {
+        for (i = x; i < x + rw; i++)
+        {
+            p = data[j * w + i];
+            data[j * w + i] =
+                (alpha ? (uint32_t)a[p >> 24] << 24 : p & 0xff000000) |
+                r[(p >> 16) & 0xff] << 16 | g[(p >> 8) & 0xff] << 8 |
+                b[p & 0xff];
+        }
+    }
+}
+
+static void
+test_cmod(int w, int h, int alpha, int x, int y, int rw, int rh)
+{
+    Imlib_Image     im;
+    uint32_t       *ref;
+    const uint32_t *data;
+    int             i, nerr;
+
+    pr_info("Cmod %dx%d alpha=%d rect=%d,%d %dx%d", w, h, alpha,
+            x, y, rw, rh);
+
+    im = image_make(w, h, alpha);
+    imlib_context_set_image(im);
+
+    ref = (uint32_t *) malloc(w * h * sizeof(uint32_t));
+    memcpy(ref, imlib_image_get_data_for_reading_only(),
+           w * h * sizeof(uint32_t));
+    cmod_ref(ref, w, x, y, rw, rh, alpha);
+
+    if (rw == w && rh == h)
+        imlib_apply_color_modifier();
+    else
+        imlib_apply_color_modifier_to_rectangle(x, y, rw, rh);
+
+    data = imlib_image_get_data_for_reading_only();
+    for (i = nerr = 0; i < w * h; i++)
+        if (data[i] != ref[i])
+            nerr++;
+    EXPECT_EQ(nerr, 0);
+
+    free(ref);
+    imlib_free_image_and_decache();
+}
+
+static void
+test_cmod_all(void)
+{
+    test_cmod(37, 23, 1, 0, 0, 37, 23);
+    test_cmod(37, 23, 0, 0, 0, 37, 23);
+    test_cmod(37, 23, 1, 3, 2, 21, 15);
+    test_cmod(37, 23, 0, 5, 1, 7, 20);
+    test_cmod(1, 1, 1, 0, 0, 1, 1);
+}
+
+TEST(CMOD, apply)
+{
+    uint8_t         r[256], g[256], b[256], a[256];
+    Imlib_Color_Modifier cm;
+    int             i;
+
+    cm = imlib_create_color_modifier();
+    imlib_context_set_color_modifier(cm);
+
+    // Identity
+    test_cmod_all();
+
+    // Offsets (brightness)
+    imlib_modify_color_modifier_brightness(.2);
+    test_cmod_all();
+    imlib_reset_color_modifier();
+    imlib_modify_color_modifier_brightness(-.3);
+    test_cmod_all();
+
+    // Mixed offsets, alpha left alone
+    for (i = 0; i < 256; i++)
+    {
+        r[i] = i + 40 > 255 ? 255 : i + 40;
+        g[i] = i < 7 ? 0 : i - 7;
+        b[i] = i;
+        a[i] = i;
+    }
+    imlib_set_color_modifier_tables(r, g, b, a);
+    test_cmod_all();
+
+    // General
+    imlib_reset_color_modifier();
+    imlib_modify_color_modifier_gamma(1.7);
+    imlib_modify_color_modifier_contrast(1.3);
+    test_cmod_all();
+
+    // Only alpha modified
+    for (i = 0; i < 256; i++)
+        r[i] = g[i] = b[i] = i, a[i] = 255 - i;
+    imlib_set_color_modifier_tables(r, g, b, a);
+    test_cmod_all();
+
+    imlib_free_color_modifier();
+}
+
+TEST(CMOD, apply_mt)
+{
+    Imlib_Color_Modifier cm;
+
+    cm = imlib_create_color_modifier();
+    imlib_context_set_color_modifier(cm);
+    imlib_set_threads(4);
+
+    imlib_modify_color_modifier_gamma(.6);
+    test_cmod(300, 270, 1, 0, 0, 300, 270);
+    test_cmod(300, 270, 0, 10, 20, 280, 240);
+
+    imlib_reset_color_modifier();
+    imlib_modify_color_modifier_brightness(.1);
+    test_cmod(300, 270, 1, 0, 0, 300, 270);
+
+    imlib_set_threads(1);
+    imlib_free_color_modifier();
+}
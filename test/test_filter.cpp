@@ -0,0 +1,260 @@
+#include <gtest/gtest.h>
+
+#include "config.h"
+#include <Imlib2.h>
+
+#include "test.h"
+
+// Filter taps: offset and weights per input channel, for one output channel
+typedef struct {
+    int             xoff, yoff;
+    int             a, r, g, b;
+} tap_t;
+
+typedef struct {
+    int             ntaps;
+    tap_t           taps[128];
+    int             div, cons;
+} chan_t;
+
+// Output channels a, r, g, b
+typedef struct {
+    chan_t          ch[4];
+} filt_t;
+
+static int
+clamp(int v, int lo, int hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+// Reference filter, edges clamped
+static void
+filter_ref(const filt_t *f, const uint32_t *src, uint32_t *dst, int w, int h)
+{
+    int             x, y, i, c, v, div;
+    uint32_t        p, pix;
+    const chan_t   *ch;
+    const tap_t    *t;
+
+    for (y = 0; y < h; y++)
+    {
+        for (x = 0; x < w; x++)
+        {
+            pix = src[y * w + x];
+            for (c = 0; c < 4; c++)
+            {
+                ch = &f->ch[c];
+                div = ch->div;
+                if (div == 0)
+                    for (i = 0; i < ch->ntaps; i++)
+                        div += ch->taps[i].a + ch->taps[i].r +
+                            ch->taps[i].g + ch->taps[i].b;
+                if (div == 0)
+                    continue;
+                v = ch->cons;
+                for (i = 0; i < ch->ntaps; i++)
+                {
+                    t = &ch->taps[i];
+                    p = src[clamp(y + t->yoff, 0, h - 1) * w +
+                            clamp(x + t->xoff, 0, w - 1)];
+                    v += (p >> 24) * t->a + ((p >> 16) & 0xff) * t->r +
+                        ((p >> 8) & 0xff) * t->g + (p & 0xff) * t->b;
+                }
+                v /= div;
+                v = v < 0 ? 0 : v > 255 ? 255 : v;
+                pix &= ~(0xffu << (24 - 8 * c));
+                pix |= (uint32_t)v << (24 - 8 * c);
+            }
+            dst[y * w + x] = pix;
+        }
+    }
+}
+
+static void
+test_filter(const filt_t *f, int w, int h)
+{
+    Imlib_Image     im;
+    Imlib_Filter    fil;
+    uint32_t       *ref;
+    const uint32_t *data;
+    const tap_t    *t;
+    int             c, i, nerr;
+
+    pr_info("Filter %dx%d", w, h);
+
+    fil = imlib_create_filter(0);
+    imlib_context_set_filter(fil);
+    for (c = 0; c < 4; c++)
+    {
+        for (i = 0; i < f->ch[c].ntaps; i++)
+        {
+            t = &f->ch[c].taps[i];
+            switch (c)
+            {
+            case 0:
+                imlib_filter_set_alpha(t->xoff, t->yoff, t->a, t->r, t->g,
+                                       t->b);
+                break;
+            case 1:
+                imlib_filter_set_red(t->xoff, t->yoff, t->a, t->r, t->g, t->b);
+                break;
+            case 2:
+                imlib_filter_set_green(t->xoff, t->yoff, t->a, t->r, t->g,
+                                       t->b);
+                break;
+            case 3:
+                imlib_filter_set_blue(t->xoff, t->yoff, t->a, t->r, t->g,
+                                      t->b);
+                break;
+            }
+        }
+    }
+    imlib_filter_divisors(f->ch[0].div, f->ch[1].div, f->ch[2].div,
+                          f->ch[3].div);
+    imlib_filter_constants(f->ch[0].cons, f->ch[1].cons, f->ch[2].cons,
+                           f->ch[3].cons);
+
+    im = image_make(w, h, true);
+    imlib_context_set_image(im);
+
+    ref = (uint32_t *) malloc(w * h * sizeof(uint32_t));
+    filter_ref(f, imlib_image_get_data_for_reading_only(), ref, w, h);
+
+    imlib_image_filter();
+    data = imlib_image_get_data_for_reading_only();
+
+    for (i = nerr = 0; i < w * h; i++)
+        if (data[i] != ref[i])
+            nerr++;
+    EXPECT_EQ(nerr, 0);
+
+    free(ref);
+    imlib_free_image_and_decache();
+    imlib_free_filter();
+}
+
+// Same kernel k on each channel (own channel only)
+static void
+filt_set_kernel(filt_t *f, const int *k, int kw, int kh, int cx, int cy)
+{
+    int             c, x, y;
+    tap_t          *t;
+
+    memset(f, 0, sizeof(*f));
+    for (c = 0; c < 4; c++)
+    {
+        for (y = 0; y < kh; y++)
+        {
+            for (x = 0; x < kw; x++)
+            {
+                if (k[y * kw + x] == 0)
+                    continue;
+                t = &f->ch[c].taps[f->ch[c].ntaps++];
+                t->xoff = x - cx;
+                t->yoff = y - cy;
+                t->a = c == 0 ? k[y * kw + x] : 0;
+                t->r = c == 1 ? k[y * kw + x] : 0;
+                t->g = c == 2 ? k[y * kw + x] : 0;
+                t->b = c == 3 ? k[y * kw + x] : 0;
+            }
+        }
+    }
+}
+
+TEST(FILTER, filter_general)
+{
+    static const int k_sharpen[] = {
+        0, -1, 0,
+        -1, 5, -1,
+        0, -1, 0,
+    };
+    static const int k_asym[] = {
+        1, 2, 0, 3,
+        0, 1, 7, 1,
+    };
+    filt_t          f;
+
+    filt_set_kernel(&f, k_sharpen, 3, 3, 1, 1);
+    test_filter(&f, 40, 30);
+    test_filter(&f, 2, 2);
+
+    filt_set_kernel(&f, k_asym, 4, 2, 0, 1);
+    test_filter(&f, 40, 30);
+
+    // Cross channel, divisors and constants
+    memset(&f, 0, sizeof(f));
+    f.ch[1].ntaps = 2;
+    f.ch[1].taps[0] = { 0, 0, 0, 1, 2, 3 };
+    f.ch[1].taps[1] = { 1, -1, 1, 0, 0, 1 };
+    f.ch[1].div = 5;
+    f.ch[1].cons = -100;
+    f.ch[3].ntaps = 1;
+    f.ch[3].taps[0] = { -2, 3, 0, 0, 0, 2 };
+    test_filter(&f, 40, 30);
+}
+
+TEST(FILTER, filter_separable)
+{
+    static const int k_gauss[] = {
+        1, 4, 6, 4, 1,
+        4, 16, 24, 16, 4,
+        6, 24, 36, 24, 6,
+        4, 16, 24, 16, 4,
+        1, 4, 6, 4, 1,
+    };
+    static const int k_edge[] = {
+        -1, 0, 1,
+        -2, 0, 2,
+        -1, 0, 1,
+        -2, 0, 2,
+    };
+    int             k_box[7 * 5];
+    filt_t          f;
+    unsigned int    i;
+
+    filt_set_kernel(&f, k_gauss, 5, 5, 2, 2);
+    test_filter(&f, 40, 30);
+    test_filter(&f, 3, 40);
+
+    filt_set_kernel(&f, k_edge, 3, 4, 1, 2);
+    f.ch[0].div = f.ch[1].div = f.ch[2].div = f.ch[3].div = 4;
+    f.ch[0].cons = f.ch[1].cons = f.ch[2].cons = f.ch[3].cons = 512;
+    test_filter(&f, 40, 30);
+
+    for (i = 0; i < sizeof(k_box) / sizeof(k_box[0]); i++)
+        k_box[i] = 3;
+    filt_set_kernel(&f, k_box, 7, 5, 3, 2);
+    test_filter(&f, 40, 30);
+    test_filter(&f, 4, 3);
+    f.ch[0].ntaps = 0;          // Alpha untouched
+    test_filter(&f, 40, 30);
+
+    // Off center
+    filt_set_kernel(&f, k_box, 7, 5, 0, 4);
+    test_filter(&f, 40, 30);
+}
+
+TEST(FILTER, filter_mt)
+{
+    static const int k_sharpen[] = {
+        0, -1, 0,
+        -1, 5, -1,
+        0, -1, 0,
+    };
+    int             k_box[9 * 9];
+    unsigned int    i;
+    filt_t          f;
+
+    imlib_set_threads(4);
+
+    filt_set_kernel(&f, k_sharpen, 3, 3, 1, 1);
+    test_filter(&f, 300, 260);
+
+    for (i = 0; i < sizeof(k_box) / sizeof(k_box[0]); i++)
+        k_box[i] = 1;
+    filt_set_kernel(&f, k_box, 9, 9, 4, 4);
+    test_filter(&f, 260, 300);
+
+    imlib_set_threads(1);
+}
@@ -0,0 +1,243 @@
+#include <gtest/gtest.h>
+
+#include "config.h"
+#include <Imlib2.h>
+
+#include "test.h"
+
+#define FONT_DIR    SRC_DIR "/../data/fonts"
+
+static const char text[] = "Hello, World! AVWAToyo fi 0123";
+
+// Count pixels differing by more than tol in any channel
+static int
+image_cmp(Imlib_Image im1, Imlib_Image im2, int tol)
+{
+    const uint32_t *p1, *p2;
+    int             i, c, w, h, nerr, d;
+
+    imlib_context_set_image(im1);
+    w = imlib_image_get_width();
+    h = imlib_image_get_height();
+    p1 = imlib_image_get_data_for_reading_only();
+    imlib_context_set_image(im2);
+    p2 = imlib_image_get_data_for_reading_only();
+
+    for (i = nerr = 0; i < w * h; i++)
+    {
+        for (c = 0; c < 32; c += 8)
+        {
+            d = (int)((p1[i] >> c) & 0xff) - (int)((p2[i] >> c) & 0xff);
+            if (d > tol || d < -tol)
+            {
+                nerr++;
+                break;
+            }
+        }
+    }
+
+    return nerr;
+}
+
+static Imlib_Font
+font_load(void)
+{
+    Imlib_Font      fn;
+
+    imlib_add_path_to_font_path(FONT_DIR);
+    fn = imlib_load_font("notepad/20");
+    EXPECT_TRUE(fn);
+    imlib_context_set_font(fn);
+
+    return fn;
+}
+
+static void
+font_free(void)
+{
+    imlib_free_font();
+    imlib_remove_path_from_font_path(FONT_DIR);
+}
+
+// Text drawn directly (to right) vs. text to left (rotated 180 degrees)
+// drawn on the flipped image, flipped back
+static void
+test_text_ref(const char *str, bool alpha, int op, int tol)
+{
+    Imlib_Image     im, ref;
+    int             w, h, tw, th;
+
+    pr_info("Text '%s' alpha=%d op=%d", str, alpha, op);
+
+    w = 300;
+    h = 60;
+    im = image_make(w, h, alpha);
+    ref = image_make(w, h, alpha);
+
+    imlib_context_set_color(40, 200, 120, 210);
+    imlib_context_set_operation((Imlib_Operation) op);
+
+    // Box size as drawn, may differ a bit from imlib_get_text_size()
+    imlib_context_set_image(im);
+    imlib_text_draw_with_return_metrics(7, 9, str, &tw, &th, NULL, NULL);
+
+    imlib_context_set_image(ref);
+    imlib_image_flip_horizontal();
+    imlib_image_flip_vertical();
+    imlib_context_set_direction(IMLIB_TEXT_TO_LEFT);
+    imlib_text_draw(w - 7 - tw, h - 9 - th, str);
+    imlib_context_set_direction(IMLIB_TEXT_TO_RIGHT);
+    imlib_image_flip_horizontal();
+    imlib_image_flip_vertical();
+
+    EXPECT_EQ(image_cmp(im, ref, tol), 0);
+
+    imlib_context_set_operation(IMLIB_OP_COPY);
+    imlib_context_set_image(ref);
+    imlib_free_image_and_decache();
+    imlib_context_set_image(im);
+    imlib_free_image_and_decache();
+}
+
+TEST(FONT, text_draw)
+{
+    int             op, tol;
+
+    font_load();
+
+    for (op = IMLIB_OP_COPY; op <= IMLIB_OP_RESHADE; op++)
+    {
+        // Same coverage, same blending. Except that the flipped text image
+        // is blended also where there is no coverage, where subtract raises
+        // alpha by one.
+        tol = op == IMLIB_OP_SUBTRACT ? 1 : 0;
+        test_text_ref("Hello 0123 i", false, op, 0);
+        test_text_ref("Hello 0123 i", true, op, tol);
+        test_text_ref(text, false, op, 0);
+        test_text_ref(text, true, op, tol);
+    }
+
+    font_free();
+}
+
+TEST(FONT, text_clip)
+{
+    Imlib_Image     im, ref, org;
+    const uint32_t *p0, *p1, *p2;
+    int             x, y, w, h, nerr;
+
+    font_load();
+
+    w = 200;
+    h = 40;
+    ref = image_make(w, h, true);
+    imlib_context_set_color(250, 10, 10, 255);
+    imlib_text_draw(-13, -5, text);
+
+    // Clipped draw matches inside the clip rectangle, is unchanged outside
+    im = image_make(w, h, true);
+    imlib_context_set_cliprect(20, 3, 90, 11);
+    imlib_text_draw(-13, -5, text);
+    imlib_context_set_cliprect(0, 0, 0, 0);
+
+    imlib_context_set_image(ref);
+    p1 = imlib_image_get_data_for_reading_only();
+    imlib_context_set_image(im);
+    p2 = imlib_image_get_data_for_reading_only();
+
+    org = image_make(w, h, true);
+    p0 = imlib_image_get_data_for_reading_only();
+
+    for (y = nerr = 0; y < h; y++)
+    {
+        for (x = 0; x < w; x++)
+        {
+            if (x >= 20 && x < 110 && y >= 3 && y < 14)
+                nerr += p2[y * w + x] != p1[y * w + x];
+            else
+                nerr += p2[y * w + x] != p0[y * w + x];
+        }
+    }
+    EXPECT_EQ(nerr, 0);
+
+    imlib_context_set_image(org);
+    imlib_free_image_and_decache();
+
+    imlib_context_set_image(im);
+    imlib_free_image_and_decache();
+    imlib_context_set_image(ref);
+    imlib_free_image_and_decache();
+
+    font_free();
+}
+
+// Same string in several colors, interleaved with another one
+static Imlib_Image
+draw_seq(int *w, int *h, int *ha, int *va)
+{
+    Imlib_Image     im;
+    int             j;
+
+    im = image_make(300, 300, true);
+    for (j = 0; j < 3; j++)
+    {
+        imlib_context_set_color(j * 100, 50, 255 - j * 100, 160);
+        imlib_text_draw(20, 30, j == 1 ? "Other" : text);
+    }
+    imlib_context_set_color(0, 0, 255, 160);
+    imlib_text_draw_with_return_metrics(20, 30, text, w, h, ha, va);
+
+    return im;
+}
+
+TEST(FONT, text_cache)
+{
+    static const Imlib_Text_Direction dirs[] = {
+        IMLIB_TEXT_TO_RIGHT, IMLIB_TEXT_TO_DOWN, IMLIB_TEXT_TO_ANGLE,
+    };
+    Imlib_Image     im1, im2;
+    unsigned int    i;
+    int             op;
+    int             w1, h1, ha1, va1, w2, h2, ha2, va2;
+
+    font_load();
+
+    EXPECT_EQ(imlib_get_text_cache_size(), 0);
+
+    for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++)
+    {
+        for (op = IMLIB_OP_COPY; op <= IMLIB_OP_RESHADE; op++)
+        {
+            pr_info("Text cache dir=%d op=%d", dirs[i], op);
+
+            imlib_context_set_direction(dirs[i]);
+            imlib_context_set_angle(0.3);
+            imlib_context_set_operation((Imlib_Operation) op);
+
+            imlib_set_text_cache_size(0);
+            im1 = draw_seq(&w1, &h1, &ha1, &va1);
+
+            imlib_set_text_cache_size(1000000);
+            EXPECT_EQ(imlib_get_text_cache_size(), 1000000);
+            im2 = draw_seq(&w2, &h2, &ha2, &va2);
+
+            EXPECT_EQ(w1, w2);
+            EXPECT_EQ(h1, h2);
+            EXPECT_EQ(ha1, ha2);
+            EXPECT_EQ(va1, va2);
+            EXPECT_EQ(image_cmp(im1, im2, 0), 0);
+
+            imlib_context_set_image(im1);
+            imlib_free_image_and_decache();
+            imlib_context_set_image(im2);
+            imlib_free_image_and_decache();
+        }
+    }
+
+    imlib_context_set_operation(IMLIB_OP_COPY);
+    imlib_context_set_direction(IMLIB_TEXT_TO_RIGHT);
+    imlib_context_set_angle(0);
+    imlib_set_text_cache_size(0);
+
+    font_free();
+}
@@ -0,0 +1,252 @@
+#include <gtest/gtest.h>
+
+#include "config.h"
+#include <Imlib2.h>
+
+#include "test.h"
+
+static Imlib_Color_Range
+range_make(int n)
+{
+    static const int col[][5] = {
+        { 255, 0, 0, 255, 0 },
+        { 0, 255, 0, 128, 30 },
+        { 0, 0, 255, 255, 70 },
+        { 20, 200, 90, 255, 5 },
+    };
+    Imlib_Color_Range rg;
+    int             i;
+
+    rg = imlib_create_color_range();
+    imlib_context_set_color_range(rg);
+    for (i = 0; i < n; i++)
+    {
+        imlib_context_set_color(col[i][0], col[i][1], col[i][2], col[i][3]);
+        imlib_add_color_to_color_range(col[i][4]);
+    }
+
+    return rg;
+}
+
+static int
+image_diff(Imlib_Image im1, Imlib_Image im2)
+{
+    const uint32_t *d1, *d2;
+    int             i, n, nerr;
+
+    imlib_context_set_image(im1);
+    d1 = imlib_image_get_data_for_reading_only();
+    n = imlib_image_get_width() * imlib_image_get_height();
+    imlib_context_set_image(im2);
+    d2 = imlib_image_get_data_for_reading_only();
+
+    for (i = nerr = 0; i < n; i++)
+        if (d1[i] != d2[i])
+            nerr++;
+
+    return nerr;
+}
+
+TEST(GRAD, gradient_direction)
+{
+    Imlib_Color_Range rg;
+    Imlib_Image     im;
+    const uint32_t *d;
+    int             x, y, w, h, nerr;
+
+    w = 61;
+    h = 47;
+    rg = range_make(4);
+    im = image_make(w, h, true);
+    imlib_context_set_image(im);
+
+    // Top to bottom, opaque first color
+    imlib_image_clear();
+    imlib_image_fill_color_range_rectangle(0, 0, w, h, 0.);
+    d = imlib_image_get_data_for_reading_only();
+    for (y = nerr = 0; y < h; y++)
+        for (x = 1; x < w; x++)
+            if (d[y * w + x] != d[y * w])
+                nerr++;
+    EXPECT_EQ(nerr, 0);
+    EXPECT_EQ(d[0], 0xffff0000);
+
+    // Left to right
+    imlib_image_clear();
+    imlib_image_fill_color_range_rectangle(0, 0, w, h, 270.);
+    d = imlib_image_get_data_for_reading_only();
+    for (y = 1, nerr = 0; y < h; y++)
+        for (x = 0; x < w; x++)
+            if (d[y * w + x] != d[x])
+                nerr++;
+    EXPECT_EQ(nerr, 0);
+    EXPECT_EQ(d[0], 0xffff0000);
+
+    imlib_free_image();
+    imlib_context_set_color_range(rg);
+    imlib_free_color_range();
+}
+
+TEST(GRAD, gradient_clip)
+{
+    static const double angles[] = { 0., 30., 135., 200., 290. };
+    Imlib_Color_Range rg;
+    Imlib_Image     im1, im2;
+    const uint32_t *d1, *d2;
+    unsigned int    i;
+    int             x, y, w, h, nerr, hsva;
+
+    w = 80;
+    h = 50;
+    rg = range_make(4);
+
+    for (hsva = 0; hsva < 2; hsva++)
+    {
+        for (i = 0; i < sizeof(angles) / sizeof(angles[0]); i++)
+        {
+            pr_info("Angle %.0f hsva=%d", angles[i], hsva);
+
+            // Unclipped
+            im1 = image_make(w, h, true);
+            imlib_context_set_image(im1);
+            if (hsva)
+                imlib_image_fill_hsva_color_range_rectangle(-5, -3, w, h,
+                                                            angles[i]);
+            else
+                imlib_image_fill_color_range_rectangle(-5, -3, w, h,
+                                                       angles[i]);
+
+            // Clipped, same gradient
+            im2 = image_make(w, h, true);
+            imlib_context_set_image(im2);
+            imlib_context_set_cliprect(10, 7, 33, 21);
+            if (hsva)
+                imlib_image_fill_hsva_color_range_rectangle(-5, -3, w, h,
+                                                            angles[i]);
+            else
+                imlib_image_fill_color_range_rectangle(-5, -3, w, h,
+                                                       angles[i]);
+            imlib_context_set_cliprect(0, 0, 0, 0);
+
+            imlib_context_set_image(im1);
+            d1 = imlib_image_get_data_for_reading_only();
+            imlib_context_set_image(im2);
+            d2 = imlib_image_get_data_for_reading_only();
+            for (y = 7, nerr = 0; y < 7 + 21; y++)
+                for (x = 10; x < 10 + 33; x++)
+                    if (d1[y * w + x] != d2[y * w + x])
+                        nerr++;
+            EXPECT_EQ(nerr, 0);
+
+            imlib_context_set_image(im1);
+            imlib_free_image();
+            imlib_context_set_image(im2);
+            imlib_free_image();
+        }
+    }
+
+    imlib_context_set_color_range(rg);
+    imlib_free_color_range();
+}
+
+TEST(GRAD, gradient_range_change)
+{
+    Imlib_Color_Range rg1, rg2;
+    Imlib_Image     im1, im2;
+
+    // Draw with 3 colors (caching the map), add one, draw again
+    rg1 = range_make(3);
+    im1 = image_make(70, 40, true);
+    imlib_context_set_image(im1);
+    imlib_context_set_color_range(rg1);
+    imlib_image_fill_color_range_rectangle(0, 0, 70, 40, 45.);
+    imlib_context_set_color(20, 200, 90, 255);
+    imlib_add_color_to_color_range(5);
+    imlib_image_clear();
+    imlib_image_fill_color_range_rectangle(0, 0, 70, 40, 45.);
+
+    // Same with a fresh 4 color range
+    rg2 = range_make(4);
+    im2 = image_make(70, 40, true);
+    imlib_context_set_image(im2);
+    imlib_image_clear();
+    imlib_image_fill_color_range_rectangle(0, 0, 70, 40, 45.);
+
+    EXPECT_EQ(image_diff(im1, im2), 0);
+
+    imlib_context_set_image(im1);
+    imlib_free_image();
+    imlib_context_set_image(im2);
+    imlib_free_image();
+    imlib_context_set_color_range(rg1);
+    imlib_free_color_range();
+    imlib_context_set_color_range(rg2);
+    imlib_free_color_range();
+}
+
+TEST(GRAD, gradient_ops)
+{
+    Imlib_Color_Range rg;
+    Imlib_Image     im;
+    const uint32_t *d;
+    int             i, n, nz;
+
+    rg = range_make(4);
+    im = imlib_create_image(40, 30);
+    imlib_context_set_image(im);
+    n = 40 * 30;
+
+    // Subtracting from black stays black
+    imlib_image_clear();
+    imlib_context_set_operation(IMLIB_OP_SUBTRACT);
+    imlib_image_fill_color_range_rectangle(0, 0, 40, 30, 30.);
+    d = imlib_image_get_data_for_reading_only();
+    for (i = nz = 0; i < n; i++)
+        nz += (d[i] & 0xffffff) != 0;
+    EXPECT_EQ(nz, 0);
+
+    // Adding to black does not
+    imlib_context_set_operation(IMLIB_OP_ADD);
+    imlib_image_fill_color_range_rectangle(0, 0, 40, 30, 30.);
+    d = imlib_image_get_data_for_reading_only();
+    for (i = nz = 0; i < n; i++)
+        nz += (d[i] & 0xffffff) != 0;
+    EXPECT_EQ(nz, n);
+
+    imlib_context_set_operation(IMLIB_OP_COPY);
+    imlib_free_image();
+    imlib_context_set_color_range(rg);
+    imlib_free_color_range();
+}
+
+TEST(GRAD, gradient_mt)
+{
+    Imlib_Color_Range rg;
+    Imlib_Image     im1, im2;
+    int             alpha;
+
+    rg = range_make(4);
+
+    for (alpha = 0; alpha < 2; alpha++)
+    {
+        im1 = image_make(400, 300, alpha);
+        imlib_context_set_image(im1);
+        imlib_image_fill_color_range_rectangle(-3, 2, 410, 290, 30.);
+
+        imlib_set_threads(4);
+        im2 = image_make(400, 300, alpha);
+        imlib_context_set_image(im2);
+        imlib_image_fill_color_range_rectangle(-3, 2, 410, 290, 30.);
+        imlib_set_threads(1);
+
+        EXPECT_EQ(image_diff(im1, im2), 0);
+
+        imlib_context_set_image(im1);
+        imlib_free_image();
+        imlib_context_set_image(im2);
+        imlib_free_image();
+    }
+
+    imlib_context_set_color_range(rg);
+    imlib_free_color_range();
+}
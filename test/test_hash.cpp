@@ -0,0 +1,192 @@
+#include <gtest/gtest.h>
+
+/**INDENT-OFF**/
+extern "C" {
+#include "object.h"
+}
+/**INDENT-ON**/
+
+typedef struct {
+    Imlib_Hash_Key  key;
+    int             val;
+} entry_t;
+
+static int
+count_cb(void *entry, void *fdata)
+{
+    (*(int *)fdata)++;
+    return 1;
+}
+
+TEST(HASH, hash_int)
+{
+    Imlib_Hash      hash;
+    Imlib_Hash_Key  key = { NULL, 0 };
+    entry_t        *e;
+    int             i, n;
+
+    __imlib_hash_init(&hash, sizeof(entry_t));
+
+    key.num = 5;
+    EXPECT_FALSE(__imlib_hash_find(&hash, &key));
+    __imlib_hash_remove(&hash, &key);
+
+    for (i = 0; i < 10000; i++)
+    {
+        key.num = (uint64_t)i * 7919;
+        e = (entry_t *) __imlib_hash_insert(&hash, &key);
+        ASSERT_TRUE(e);
+        EXPECT_EQ(e->val, 0);
+        e->val = i;
+    }
+    EXPECT_EQ(hash.count, 10000U);
+
+    // Insert of existing key returns the entry
+    key.num = 7919;
+    e = (entry_t *) __imlib_hash_insert(&hash, &key);
+    EXPECT_EQ(e->val, 1);
+    EXPECT_EQ(hash.count, 10000U);
+
+    for (i = 0; i < 10000; i += 2)
+    {
+        key.num = (uint64_t)i * 7919;
+        __imlib_hash_remove(&hash, &key);
+    }
+    EXPECT_EQ(hash.count, 5000U);
+
+    for (i = 0; i < 10000; i++)
+    {
+        key.num = (uint64_t)i * 7919;
+        e = (entry_t *) __imlib_hash_find(&hash, &key);
+        if (i & 1)
+        {
+            ASSERT_TRUE(e);
+            EXPECT_EQ(e->val, i);
+        }
+        else
+        {
+            EXPECT_FALSE(e);
+        }
+    }
+
+    n = 0;
+    __imlib_hash_foreach(&hash, count_cb, &n);
+    EXPECT_EQ(n, 5000);
+
+    __imlib_hash_free(&hash);
+    EXPECT_EQ(hash.count, 0U);
+    key.num = 1 * 7919;
+    EXPECT_FALSE(__imlib_hash_find(&hash, &key));
+}
+
+TEST(HASH, hash_str)
+{
+    static const char *const names[] = {
+        "notepad", "grunge", "cinema", "morpheus", "", "notepad.ttf",
+    };
+    Imlib_Hash      hash;
+    Imlib_Hash_Key  key;
+    entry_t        *e;
+    char            buf[32];
+    unsigned int    i, j;
+
+    __imlib_hash_init(&hash, sizeof(entry_t));
+
+    // Same strings with different numbers, and integer keys, are distinct
+    for (i = 0; i < 6; i++)
+    {
+        for (j = 0; j < 3; j++)
+        {
+            key.str = names[i];
+            key.num = j;
+            e = (entry_t *) __imlib_hash_insert(&hash, &key);
+            ASSERT_TRUE(e);
+            e->val = 10 * i + j;
+        }
+    }
+    key.str = NULL;
+    key.num = 0;
+    e = (entry_t *) __imlib_hash_insert(&hash, &key);
+    ASSERT_TRUE(e);
+    e->val = -1;
+    EXPECT_EQ(hash.count, 19U);
+
+    // Lookup by equal string, not by pointer
+    for (i = 0; i < 6; i++)
+    {
+        for (j = 0; j < 3; j++)
+        {
+            snprintf(buf, sizeof(buf), "%s", names[i]);
+            key.str = buf;
+            key.num = j;
+            e = (entry_t *) __imlib_hash_find(&hash, &key);
+            ASSERT_TRUE(e);
+            EXPECT_EQ(e->val, (int)(10 * i + j));
+        }
+    }
+    key.str = "notepad";
+    key.num = 3;
+    EXPECT_FALSE(__imlib_hash_find(&hash, &key));
+    key.str = NULL;
+    key.num = 0;
+    e = (entry_t *) __imlib_hash_find(&hash, &key);
+    ASSERT_TRUE(e);
+    EXPECT_EQ(e->val, -1);
+
+    __imlib_hash_free(&hash);
+}
+
+// Random inserts and removes against a plain array
+TEST(HASH, hash_random)
+{
+    Imlib_Hash      hash;
+    Imlib_Hash_Key  key = { NULL, 0 };
+    entry_t        *e;
+    static int      ref[512];
+    uint32_t        seed;
+    int             i, k, n;
+
+    __imlib_hash_init(&hash, sizeof(entry_t));
+    memset(ref, 0, sizeof(ref));
+
+    seed = 1;
+    for (i = n = 0; i < 200000; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        k = (seed >> 8) & 511;
+        key.num = k;
+        if ((seed >> 20) & 1)
+        {
+            e = (entry_t *) __imlib_hash_insert(&hash, &key);
+            ASSERT_TRUE(e);
+            if (!ref[k])
+                n++;
+            e->val = ref[k] = i + 1;
+        }
+        else
+        {
+            __imlib_hash_remove(&hash, &key);
+            if (ref[k])
+                n--;
+            ref[k] = 0;
+        }
+        ASSERT_EQ(hash.count, (unsigned int)n);
+    }
+
+    for (k = 0; k < 512; k++)
+    {
+        key.num = k;
+        e = (entry_t *) __imlib_hash_find(&hash, &key);
+        if (ref[k])
+        {
+            ASSERT_TRUE(e);
+            EXPECT_EQ(e->val, ref[k]);
+        }
+        else
+        {
+            EXPECT_FALSE(e);
+        }
+    }
+
+    __imlib_hash_free(&hash);
+}
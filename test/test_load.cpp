@@ -277,3 +277,65 @@ TEST(LOAD, load_2)
     imlib_context_set_progress_granularity(10);
     test_load();
 }
+
+TEST(LOAD, load_nosuffix)
+{
+    char            filei[256];
+    char            fileo[256];
+    unsigned int    i;
+    Imlib_Image     im;
+    int             err;
+
+    for (i = 0; i < N_PFX; i++)
+    {
+        // Files without suffix must be picked up by signature (or fallback)
+        snprintf(filei, sizeof(filei),
+                 "../%s/%s.%s", IMG_SRC, FILE_PFX1, pfxs[i]);
+        snprintf(fileo, sizeof(fileo), "%s/%s-nosuffix-%d", IMG_GEN,
+                 FILE_PFX1, i);
+        unlink(fileo);
+        err = symlink(filei, fileo);
+        ASSERT_EQ(err, 0);
+        D("Load no suffix '%s' (%s)\n", fileo, pfxs[i]);
+        im = imlib_load_image_with_errno_return(fileo, &err);
+        EXPECT_TRUE(im);
+        EXPECT_EQ(err, 0);
+        if (!im || err)
+            D("Error %d im=%p loading '%s'\n", err, im, fileo);
+        if (im)
+            image_free(im);
+        flush_loaders();
+    }
+}
+
+#if defined(BUILD_BZ2_LOADER) && defined(BUILD_ZLIB_LOADER)
+// Compressed files inside compressed files, with and without image suffix
+TEST(LOAD, load_nested)
+{
+    static const char *const files[] = {
+        FILE_PFX1 ".ff.gz.bz2",
+        FILE_PFX1 "-noext.bz2",
+    };
+    char            filei[256];
+    unsigned int    i, crc_ref;
+    Imlib_Image     im;
+    int             err;
+
+    snprintf(filei, sizeof(filei), "%s/%s", IMG_SRC, FILE_REF);
+    im = imlib_load_image(filei);
+    ASSERT_TRUE(im);
+    crc_ref = image_get_crc32(im);
+    image_free(im);
+
+    for (i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    {
+        snprintf(filei, sizeof(filei), "%s/%s", IMG_SRC, files[i]);
+        D("Load nested '%s'\n", filei);
+        im = imlib_load_image_with_errno_return(filei, &err);
+        ASSERT_TRUE(im) << "cannot load file: " << filei;
+        EXPECT_EQ(err, 0);
+        EXPECT_EQ(image_get_crc32(im), crc_ref);
+        image_free(im);
+    }
+}
+#endif
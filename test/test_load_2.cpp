@@ -206,3 +206,559 @@ TEST(LOAD2, load_1)
         imlib_free_image_and_decache();
     }
 }
+
+typedef struct {
+    const char     *name;
+    int             max_w, max_h;       // Size hint
+    int             w, h;       // Expected size
+} tis_t;
+
+static const tis_t tis[] = {
+/**INDENT-OFF**/
+   { "image-noalp-64.jpg",       0,   0, 64, 64 },
+   { "image-noalp-64.jpg",     100, 100, 64, 64 },
+   { "image-noalp-64.jpg",      16,  16, 16, 16 },
+   { "image-noalp-64.jpg",      20, 100, 32, 32 },
+   { "image-noalp-64.jpg",       0,   7,  8,  8 },
+   { "image-noalp-64.jpg",       1,   1,  8,  8 },
+#ifdef BUILD_J2K_LOADER
+   { "image-noalp-64.jp2",      16,  16, 16, 16 },
+#endif
+#ifdef BUILD_WEBP_LOADER
+   { "image-noalp-64.webp",     20,  30, 20, 20 },
+#endif
+   { "image-noalp-64.png",      16,  16, 64, 64 },
+/**INDENT-ON**/
+};
+
+TEST(LOAD2, load_scaled)
+{
+    unsigned int    i;
+    char            buf[256];
+    Imlib_Image     im, im2;
+    const tis_t    *pt;
+
+    for (i = 0; i < sizeof(tis) / sizeof(tis[0]); i++)
+    {
+        pt = &tis[i];
+        snprintf(buf, sizeof(buf), "%s/%s", IMG_SRC, pt->name);
+        pr_info("Load '%s' %dx%d", buf, pt->max_w, pt->max_h);
+
+        im = imlib_load_image_scaled(buf, pt->max_w, pt->max_h);
+        ASSERT_TRUE(im) << "cannot load file: " << buf;
+        imlib_context_set_image(im);
+        EXPECT_EQ(imlib_image_get_width(), pt->w);
+        EXPECT_EQ(imlib_image_get_height(), pt->h);
+        EXPECT_TRUE(imlib_image_get_data_for_reading_only());
+
+        /* Full size load must not get the reduced image from the cache */
+        im2 = imlib_load_image(buf);
+        ASSERT_TRUE(im2) << "cannot load file: " << buf;
+        imlib_context_set_image(im2);
+        EXPECT_EQ(imlib_image_get_width(), 64);
+        EXPECT_EQ(imlib_image_get_height(), 64);
+        imlib_free_image_and_decache();
+
+        imlib_context_set_image(im);
+        imlib_free_image_and_decache();
+    }
+}
+
+// Count differing pixels
+static int
+image_cmp(Imlib_Image im1, Imlib_Image im2)
+{
+    const uint32_t *p1, *p2;
+    int             i, w, h, nerr;
+
+    imlib_context_set_image(im1);
+    w = imlib_image_get_width();
+    h = imlib_image_get_height();
+    p1 = imlib_image_get_data_for_reading_only();
+    imlib_context_set_image(im2);
+    p2 = imlib_image_get_data_for_reading_only();
+
+    for (i = nerr = 0; i < w * h; i++)
+        nerr += p1[i] != p2[i];
+
+    return nerr;
+}
+
+static const char *const stream_fmts[] = {
+    "png", "jpg", "ppm", "bmp",
+};
+
+static const struct {
+    int             w, h;
+} stream_sizes[] = {
+/**INDENT-OFF**/
+   {  40,  30 },
+   { 500, 400 },
+   {   7, 300 },
+   { 100,   0 },
+   {   0,   0 },
+/**INDENT-ON**/
+};
+
+// Streamed load+scale vs. load, then scale
+static void
+test_load_streamed(const char *file, bool aa)
+{
+    unsigned int    i;
+    Imlib_Image     im, im_src, im_ref;
+    int             w, h, alpha;
+    bool            cmp;
+
+    imlib_context_set_anti_alias(aa);
+    cmp = true;
+#ifdef ENABLE_USCALER
+    cmp = !aa;                  // Reference is bicubic
+#endif
+
+    for (i = 0; i < sizeof(stream_sizes) / sizeof(stream_sizes[0]); i++)
+    {
+        pr_info("Stream '%s' aa=%d %dx%d", file, aa,
+                stream_sizes[i].w, stream_sizes[i].h);
+
+        im = imlib_load_image_streamed(file, stream_sizes[i].w,
+                                       stream_sizes[i].h);
+        ASSERT_TRUE(im) << "cannot load file: " << file;
+        EXPECT_EQ(imlib_get_error(), 0);
+        imlib_context_set_image(im);
+        w = imlib_image_get_width();
+        h = imlib_image_get_height();
+        if (stream_sizes[i].w > 0)
+        {
+            EXPECT_EQ(w, stream_sizes[i].w);
+        }
+        if (stream_sizes[i].h > 0)
+        {
+            EXPECT_EQ(h, stream_sizes[i].h);
+        }
+        alpha = imlib_image_has_alpha();
+
+        // Same decode size hint, so same source image
+        im_src = imlib_load_image_scaled(file, stream_sizes[i].w,
+                                         stream_sizes[i].h);
+        ASSERT_TRUE(im_src);
+        imlib_context_set_image(im_src);
+        EXPECT_EQ(imlib_image_has_alpha(), alpha);
+        im_ref = imlib_create_cropped_scaled_image(0, 0,
+                                                   imlib_image_get_width(),
+                                                   imlib_image_get_height(),
+                                                   w, h);
+        ASSERT_TRUE(im_ref);
+        imlib_free_image_and_decache();
+
+        if (cmp)
+        {
+            EXPECT_EQ(image_cmp(im, im_ref), 0);
+        }
+
+        imlib_context_set_image(im);
+        imlib_free_image();
+        imlib_context_set_image(im_ref);
+        imlib_free_image();
+    }
+
+    imlib_context_set_anti_alias(1);
+}
+
+TEST(LOAD2, load_streamed)
+{
+    unsigned int    i;
+    char            buf[256];
+    Imlib_Image     im;
+    uint32_t       *data;
+    int             x, y, w, h;
+
+    w = 301;
+    h = 203;
+    im = imlib_create_image(w, h);
+    ASSERT_TRUE(im);
+    imlib_context_set_image(im);
+    data = imlib_image_get_data();
+    for (y = 0; y < h; y++)
+        for (x = 0; x < w; x++)
+            data[y * w + x] = ((255 - y * 255 / h) << 24) |
+                ((x * 255 / w) << 16) | ((y * 255 / h) << 8) |
+                (((x + y) * 255 / (w + h)));
+    imlib_image_put_back_data(data);
+
+    for (i = 0; i < sizeof(stream_fmts) / sizeof(stream_fmts[0]); i++)
+    {
+        snprintf(buf, sizeof(buf), "%s/stream-noalpha.%s", IMG_GEN,
+                 stream_fmts[i]);
+        imlib_image_set_has_alpha(0);
+        imlib_save_image(buf);
+        test_load_streamed(buf, false);
+        test_load_streamed(buf, true);
+        imlib_context_set_image(im);
+    }
+
+    snprintf(buf, sizeof(buf), "%s/stream-alpha.png", IMG_GEN);
+    imlib_image_set_has_alpha(1);
+    imlib_save_image(buf);
+    test_load_streamed(buf, false);
+    test_load_streamed(buf, true);
+
+    imlib_context_set_image(im);
+    imlib_free_image();
+
+    // Failure
+    snprintf(buf, sizeof(buf), "%s/%s", IMG_SRC, "nonexistent.png");
+    EXPECT_FALSE(imlib_load_image_streamed(buf, 10, 10));
+    EXPECT_EQ(imlib_get_error(), ENOENT);
+}
+
+#ifdef BUILD_JPEG_LOADER
+// JPEG with EXIF orientation o (APP1 inserted after SOI)
+static Imlib_Image
+jpeg_orient_load(const unsigned char *jpg, size_t size, int o)
+{
+    static const unsigned char app1[] = {
+        0xff, 0xe1, 0x00, 0x22,
+        'E', 'x', 'i', 'f', 0, 0,
+        'I', 'I', 42, 0, 8, 0, 0, 0,
+        1, 0,                   // One IFD entry
+        0x12, 0x01, 3, 0, 1, 0, 0, 0, 0, 0, 0, 0,       // Orientation
+        0, 0, 0, 0,
+    };
+    unsigned char  *buf;
+    char            name[32];
+    Imlib_Image     im;
+
+    buf = (unsigned char *)malloc(size + sizeof(app1));
+    memcpy(buf, jpg, 2);
+    memcpy(buf + 2, app1, sizeof(app1));
+    buf[2 + 28] = o;            // Orientation value
+    memcpy(buf + 2 + sizeof(app1), jpg + 2, size - 2);
+
+    snprintf(name, sizeof(name), "orient-%d.jpg", o);      // Not cached
+    im = imlib_load_image_mem(name, buf, size + sizeof(app1));
+
+    free(buf);
+
+    return im;
+}
+
+TEST(LOAD2, load_jpeg_orient)
+{
+    Imlib_Image     im, ref, imo;
+    const uint32_t *ps, *pd;
+    uint32_t       *data;
+    unsigned char  *jpg;
+    size_t          size;
+    int             o, x, y, w, h, sx, sy, nerr;
+
+    // Non-square source so swapped dimensions are visible
+    w = 40;
+    h = 24;
+    im = imlib_create_image(w, h);
+    imlib_context_set_image(im);
+    data = imlib_image_get_data();
+    for (y = 0; y < h; y++)
+        for (x = 0; x < w; x++)
+            data[y * w + x] = 0xff000000 | (x * 6) << 16 | (y * 10) << 8 |
+                ((x + y) & 1) * 255;
+    imlib_image_put_back_data(data);
+    imlib_image_set_format("jpg");
+    imlib_image_attach_data_value("quality", NULL, 100, NULL);
+    jpg = (unsigned char *)imlib_save_image_mem(NULL, &size);
+    ASSERT_TRUE(jpg);
+    imlib_free_image_and_decache();
+
+    ref = jpeg_orient_load(jpg, size, 1);
+    ASSERT_TRUE(ref);
+    imlib_context_set_image(ref);
+    EXPECT_EQ(imlib_image_get_width(), w);
+    EXPECT_EQ(imlib_image_get_height(), h);
+    ps = imlib_image_get_data_for_reading_only();
+
+    for (o = 2; o <= 8; o++)
+    {
+        pr_info("Orientation %d", o);
+
+        imo = jpeg_orient_load(jpg, size, o);
+        ASSERT_TRUE(imo);
+        imlib_context_set_image(imo);
+        EXPECT_EQ(imlib_image_get_width(), o >= 5 ? h : w);
+        EXPECT_EQ(imlib_image_get_height(), o >= 5 ? w : h);
+        pd = imlib_image_get_data_for_reading_only();
+
+        nerr = 0;
+        for (y = 0; y < imlib_image_get_height(); y++)
+        {
+            for (x = 0; x < imlib_image_get_width(); x++)
+            {
+                switch (o)
+                {
+                default:
+                case 2: sx = w - 1 - x; sy = y; break;
+                case 3: sx = w - 1 - x; sy = h - 1 - y; break;
+                case 4: sx = x; sy = h - 1 - y; break;
+                case 5: sx = y; sy = x; break;
+                case 6: sx = y; sy = h - 1 - x; break;
+                case 7: sx = w - 1 - y; sy = h - 1 - x; break;
+                case 8: sx = w - 1 - y; sy = x; break;
+                }
+                nerr += pd[y * imlib_image_get_width() + x] != ps[sy * w + sx];
+            }
+        }
+        EXPECT_EQ(nerr, 0);
+
+        imlib_free_image_and_decache();
+    }
+
+    imlib_context_set_image(ref);
+    imlib_free_image_and_decache();
+    free(jpg);
+}
+#endif /* BUILD_JPEG_LOADER */
+
+static const char *const thr_files[] = {
+    "image-alpha-64.png",
+    "image-alpha-64.avif", "image-noalp-64.avif",
+    "image-alpha-64.jxl", "image-noalp-64.jxl",
+    "image-alpha-64.jp2", "image-noalp-64.j2k",
+};
+
+// Multi-threaded decoding gives the same pixels
+TEST(LOAD2, load_threads)
+{
+    unsigned int    i, crc1, crc2;
+    char            buf[256];
+    Imlib_Image     im;
+
+    EXPECT_EQ(imlib_context_get_decode_threads(), 0);
+    imlib_context_set_decode_threads(1000);
+    EXPECT_EQ(imlib_context_get_decode_threads(), 64);
+    imlib_context_set_decode_threads(-1);
+    EXPECT_EQ(imlib_context_get_decode_threads(), 0);
+
+    for (i = 0; i < sizeof(thr_files) / sizeof(thr_files[0]); i++)
+    {
+        snprintf(buf, sizeof(buf), "%s/%s", IMG_SRC, thr_files[i]);
+        pr_info("Load '%s'", buf);
+
+        imlib_context_set_decode_threads(1);
+        im = imlib_load_image_without_cache(buf);
+        if (!im)
+            continue;           /* Loader not built */
+        crc1 = image_get_crc32(im);
+        imlib_context_set_image(im);
+        imlib_free_image_and_decache();
+
+        imlib_context_set_decode_threads(4);
+        im = imlib_load_image_without_cache(buf);
+        ASSERT_TRUE(im);
+        crc2 = image_get_crc32(im);
+        imlib_context_set_image(im);
+        imlib_free_image_and_decache();
+
+        EXPECT_EQ(crc1, crc2);
+    }
+
+    imlib_context_set_decode_threads(0);
+}
+
+static const char *const anims[] = {
+    "icon-128-anim.ani",
+};
+
+TEST(LOAD2, frame_next)
+{
+    unsigned int    i;
+    int             n, err;
+    char            buf[256];
+    Imlib_Image     im, im_ref, im_next;
+    Imlib_Frame_Info finfo, finfo_ref;
+
+    for (i = 0; i < sizeof(anims) / sizeof(anims[0]); i++)
+    {
+        snprintf(buf, sizeof(buf), "%s/%s", IMG_SRC, anims[i]);
+        pr_info("Load '%s'", buf);
+
+        im = imlib_load_image_frame(buf, 1);
+        ASSERT_TRUE(im) << "cannot load file: " << buf;
+        imlib_context_set_image(im);
+        imlib_image_get_frame_info(&finfo);
+        EXPECT_GT(finfo.frame_count, 1);
+
+        for (n = 2; n <= finfo.frame_count; n++)
+        {
+            // Step through the session, compare with direct frame load
+            imlib_context_set_image(im);
+            im_next = imlib_image_frame_next();
+            ASSERT_TRUE(im_next) << "frame " << n;
+            imlib_free_image();
+            im = im_next;
+
+            im_ref = imlib_load_image_frame(buf, n);
+            ASSERT_TRUE(im_ref) << "frame " << n;
+            imlib_context_set_image(im_ref);
+            imlib_image_get_frame_info(&finfo_ref);
+
+            imlib_context_set_image(im);
+            imlib_image_get_frame_info(&finfo);
+            EXPECT_EQ(finfo.frame_num, n);
+            EXPECT_EQ(finfo.frame_w, finfo_ref.canvas_w);
+            EXPECT_EQ(finfo.frame_h, finfo_ref.canvas_h);
+            EXPECT_EQ(finfo.frame_delay, finfo_ref.frame_delay);
+            EXPECT_EQ(image_get_crc32(im), image_get_crc32(im_ref));
+
+            imlib_context_set_image(im_ref);
+            imlib_free_image_and_decache();
+        }
+
+        // No more frames
+        imlib_context_set_image(im);
+        im_next = imlib_image_frame_next();
+        err = imlib_get_error();
+        EXPECT_FALSE(im_next);
+        EXPECT_EQ(err, IMLIB_ERR_BAD_FRAME);
+
+        imlib_context_set_image(im);
+        imlib_free_image();
+    }
+}
+
+#if defined(BUILD_GIF_LOADER) || defined(BUILD_WEBP_LOADER)
+#define DISP_NONE   (1 << 0)
+#define DISP_CLEAR  (1 << 1)
+#define DISP_PREV   (1 << 2)
+
+typedef struct {
+    const char     *name;
+    int             disp;       /* Dispose modes used */
+} tai_t;
+
+static const tai_t anims_offs[] = {
+#ifdef BUILD_GIF_LOADER
+    { "anim-48x40.gif", DISP_NONE | DISP_CLEAR | DISP_PREV },
+#endif
+#ifdef BUILD_WEBP_LOADER
+    { "anim-100x90.webp", DISP_NONE | DISP_CLEAR },
+#endif
+};
+
+// Frames with offsets and all dispose modes. The session output must match
+// the frames loaded one by one and composited here.
+TEST(LOAD2, frame_next_offs)
+{
+    unsigned int    i;
+    int             n, k, x, y, w, h, px, py, pw, ph, pflags, disp;
+    char            buf[256];
+    uint32_t       *data, *save;
+    Imlib_Image     im, im_ref, im_next, canvas;
+    Imlib_Frame_Info finfo, finfo_ref;
+
+    for (i = 0; i < sizeof(anims_offs) / sizeof(anims_offs[0]); i++)
+    {
+        snprintf(buf, sizeof(buf), "%s/%s", IMG_SRC, anims_offs[i].name);
+        pr_info("Load '%s'", buf);
+
+        im = imlib_load_image_frame(buf, 1);
+        ASSERT_TRUE(im) << "cannot load file: " << buf;
+        imlib_context_set_image(im);
+        imlib_image_get_frame_info(&finfo);
+        EXPECT_GT(finfo.frame_count, 1);
+
+        canvas = imlib_create_image(finfo.canvas_w, finfo.canvas_h);
+        ASSERT_TRUE(canvas);
+        imlib_context_set_image(canvas);
+        imlib_image_set_has_alpha(1);
+        data = imlib_image_get_data();
+        memset(data, 0, finfo.canvas_w * finfo.canvas_h * sizeof(uint32_t));
+        imlib_image_put_back_data(data);
+
+        save = NULL;
+        px = py = pw = ph = pflags = disp = 0;
+
+        for (n = 1; n <= finfo.frame_count; n++)
+        {
+            im_ref = imlib_load_image_frame(buf, n);
+            ASSERT_TRUE(im_ref) << "frame " << n;
+            imlib_context_set_image(im_ref);
+            imlib_image_get_frame_info(&finfo_ref);
+
+            // Dispose of previous frame
+            imlib_context_set_image(canvas);
+            data = imlib_image_get_data();
+            for (k = 0; k < ph; k++)
+            {
+                if (pflags & IMLIB_FRAME_DISPOSE_PREV)
+                    memcpy(data + (py + k) * finfo.canvas_w + px,
+                           save + k * pw, pw * sizeof(uint32_t));
+                else if (pflags & IMLIB_FRAME_DISPOSE_CLEAR)
+                    memset(data + (py + k) * finfo.canvas_w + px, 0,
+                           pw * sizeof(uint32_t));
+            }
+
+            x = finfo_ref.frame_x;
+            y = finfo_ref.frame_y;
+            w = finfo_ref.frame_w;
+            h = finfo_ref.frame_h;
+            EXPECT_TRUE(x >= 0 && y >= 0 && x + w <= finfo.canvas_w &&
+                        y + h <= finfo.canvas_h) << "frame " << n;
+            px = x;
+            py = y;
+            pw = w;
+            ph = h;
+            pflags = finfo_ref.frame_flags;
+
+            free(save);
+            save = NULL;
+            if (pflags & IMLIB_FRAME_DISPOSE_PREV)
+            {
+                save = (uint32_t *) malloc(w * h * sizeof(uint32_t));
+                for (k = 0; k < h; k++)
+                    memcpy(save + k * w, data + (y + k) * finfo.canvas_w + x,
+                           w * sizeof(uint32_t));
+                disp |= DISP_PREV;
+            }
+            else if (pflags & IMLIB_FRAME_DISPOSE_CLEAR)
+            {
+                disp |= DISP_CLEAR;
+            }
+            else
+            {
+                disp |= DISP_NONE;
+            }
+            imlib_image_put_back_data(data);
+
+            imlib_context_set_blend(!!(pflags & IMLIB_FRAME_BLEND));
+            imlib_blend_image_onto_image(im_ref, 1, 0, 0, w, h, x, y, w, h);
+            imlib_context_set_blend(1);
+
+            imlib_context_set_image(im_ref);
+            imlib_free_image_and_decache();
+
+            if (n == 1)
+                continue;
+
+            imlib_context_set_image(im);
+            im_next = imlib_image_frame_next();
+            ASSERT_TRUE(im_next) << "frame " << n;
+            imlib_free_image();
+            im = im_next;
+
+            imlib_context_set_image(im);
+            imlib_image_get_frame_info(&finfo_ref);
+            EXPECT_EQ(finfo_ref.frame_num, n);
+            EXPECT_EQ(finfo_ref.frame_w, finfo.canvas_w);
+            EXPECT_EQ(finfo_ref.frame_h, finfo.canvas_h);
+            EXPECT_EQ(image_get_crc32(im), image_get_crc32(canvas))
+                << "frame " << n;
+        }
+
+        EXPECT_EQ(disp, anims_offs[i].disp);
+
+        free(save);
+        imlib_context_set_image(canvas);
+        imlib_free_image();
+        imlib_context_set_image(im);
+        imlib_free_image();
+    }
+}
+#endif
@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+
+#include "config.h"
+#include <Imlib2.h>
+
+#include "test.h"
+
+// Source pixel for output pixel (x, y), source size w x h
+static uint32_t
+orient_ref(const uint32_t *src, int w, int h, int orient, int x, int y)
+{
+    int             sx, sy;
+
+    switch (orient)
+    {
+    default:
+        sx = x, sy = y;
+        break;
+    case 1:                    // Rotate 90 clockwise
+        sx = y, sy = h - 1 - x;
+        break;
+    case 2:                    // Rotate 180
+        sx = w - 1 - x, sy = h - 1 - y;
+        break;
+    case 3:                    // Rotate 90 counterclockwise
+        sx = w - 1 - y, sy = x;
+        break;
+    case 4:                    // Flip horizontally
+        sx = w - 1 - x, sy = y;
+        break;
+    case 5:                    // Flip over ur-ll diagonal
+        sx = w - 1 - y, sy = h - 1 - x;
+        break;
+    case 6:                    // Flip vertically
+        sx = x, sy = h - 1 - y;
+        break;
+    case 7:                    // Flip over ul-lr diagonal
+        sx = y, sy = x;
+        break;
+    }
+
+    return src[sy * w + sx];
+}
+
+static void
+test_orient(int w, int h)
+{
+    Imlib_Image     im;
+    uint32_t       *src;
+    const uint32_t *data;
+    int             orient, x, y, wo, ho, nerr;
+
+    for (orient = 0; orient < 8; orient++)
+    {
+        pr_info("Orientate %dx%d: %d", w, h, orient);
+
+        im = image_make(w, h, true);
+        imlib_context_set_image(im);
+        src = (uint32_t *) malloc(w * h * sizeof(uint32_t));
+        memcpy(src, imlib_image_get_data_for_reading_only(),
+               w * h * sizeof(uint32_t));
+
+        imlib_image_orientate(orient);
+
+        wo = imlib_image_get_width();
+        ho = imlib_image_get_height();
+        EXPECT_EQ(wo, orient & 1 ? h : w);
+        EXPECT_EQ(ho, orient & 1 ? w : h);
+
+        data = imlib_image_get_data_for_reading_only();
+        for (y = nerr = 0; y < ho; y++)
+            for (x = 0; x < wo; x++)
+                if (data[y * wo + x] != orient_ref(src, w, h, orient, x, y))
+                    nerr++;
+        EXPECT_EQ(nerr, 0);
+
+        free(src);
+        imlib_free_image_and_decache();
+    }
+}
+
+TEST(ORIENT, orientate)
+{
+    test_orient(37, 23);
+    test_orient(23, 37);
+    test_orient(32, 32);
+    test_orient(1, 17);
+    test_orient(17, 1);
+    test_orient(1, 1);
+    test_orient(67, 70);        // More than one tile, odd edges
+}
+
+TEST(ORIENT, orientate_mt)
+{
+    imlib_set_threads(4);
+    test_orient(300, 259);
+    imlib_set_threads(1);
+}
+
+TEST(ORIENT, orientate_borders)
+{
+    Imlib_Border    b0 = { 1, 2, 3, 4 }, b;
+
+    imlib_context_set_image(imlib_create_image(20, 10));
+    imlib_image_set_border(&b0);
+
+    imlib_image_orientate(1);
+    imlib_image_get_border(&b);
+    EXPECT_EQ(b.left, b0.bottom);
+    EXPECT_EQ(b.right, b0.top);
+    EXPECT_EQ(b.top, b0.left);
+    EXPECT_EQ(b.bottom, b0.right);
+
+    imlib_image_orientate(3);
+    imlib_image_get_border(&b);
+    EXPECT_EQ(b.left, b0.left);
+    EXPECT_EQ(b.right, b0.right);
+    EXPECT_EQ(b.top, b0.top);
+    EXPECT_EQ(b.bottom, b0.bottom);
+
+    imlib_free_image_and_decache();
+}
@@ -0,0 +1,424 @@
+#include <gtest/gtest.h>
+
+#include "config.h"
+#include <Imlib2.h>
+#include <math.h>
+
+#include "test.h"
+
+typedef struct {
+    int             n;
+    int             x[64], y[64];
+} poly_t;
+
+static void
+poly_random(poly_t *p, int n, int w, int h, uint32_t seed)
+{
+    int             i;
+
+    p->n = n;
+    for (i = 0; i < n; i++)
+    {
+        // Some vertices outside the image
+        p->x[i] = (int)((test_rand(&seed) >> 8) % (w + 20)) - 10;
+        p->y[i] = (int)((test_rand(&seed) >> 8) % (h + 20)) - 10;
+    }
+}
+
+// Simple (star shaped) polygon, partly outside the image
+static void
+poly_random_simple(poly_t *p, int n, int w, int h, uint32_t seed)
+{
+    int             i;
+    double          r, t;
+
+    p->n = n;
+    for (i = 0; i < n; i++)
+    {
+        r = (.1 + .6 * ((test_rand(&seed) >> 8) % 1000) / 1000.) * (w > h ? w : h);
+        t = 2 * M_PI * (i + .9 * ((test_rand(&seed) >> 8) % 1000) / 1000.) / n;
+        p->x[i] = (int)lround(w / 2 + r * cos(t));
+        p->y[i] = (int)lround(h / 2 + r * sin(t));
+    }
+}
+
+// Fill with alpha = coverage
+static Imlib_Image
+poly_fill(const poly_t *p, int w, int h, int aa, Imlib_Fill_Rule rule)
+{
+    Imlib_Image     im;
+    ImlibPolygon    poly;
+    int             i;
+
+    im = imlib_create_image(w, h);
+    imlib_context_set_image(im);
+    imlib_image_set_has_alpha(1);
+    imlib_image_clear();
+
+    poly = imlib_polygon_new();
+    for (i = 0; i < p->n; i++)
+        imlib_polygon_add_point(poly, p->x[i], p->y[i]);
+
+    imlib_context_set_anti_alias(aa);
+    imlib_context_set_fill_rule(rule);
+    imlib_context_set_blend(0);
+    imlib_context_set_color(255, 255, 255, 255);
+    imlib_image_fill_polygon(poly);
+
+    imlib_polygon_free(poly);
+    imlib_context_set_fill_rule(IMLIB_FILL_RULE_EVEN_ODD);
+
+    return im;
+}
+
+// Winding number at (px, py)
+static int
+poly_winding(const poly_t *p, double px, double py)
+{
+    int             i, j, wn;
+    double          x0, y0, x1, y1, c;
+
+    wn = 0;
+    for (i = 0; i < p->n; i++)
+    {
+        j = i + 1 < p->n ? i + 1 : 0;
+        x0 = p->x[i];
+        y0 = p->y[i];
+        x1 = p->x[j];
+        y1 = p->y[j];
+        c = (x1 - x0) * (py - y0) - (px - x0) * (y1 - y0);
+        if (y0 <= py && y1 > py && c > 0)
+            wn++;
+        else if (y1 <= py && y0 > py && c < 0)
+            wn--;
+    }
+
+    return wn;
+}
+
+static bool
+poly_inside(const poly_t *p, double px, double py, Imlib_Fill_Rule rule)
+{
+    int             wn = poly_winding(p, px, py);
+
+    return rule == IMLIB_FILL_RULE_NON_ZERO ? wn != 0 : wn & 1;
+}
+
+// Distance from (px, py) to the outline
+static double
+poly_dist(const poly_t *p, double px, double py)
+{
+    int             i, j;
+    double          dx, dy, t, d, dmin;
+
+    dmin = 1e9;
+    for (i = 0; i < p->n; i++)
+    {
+        j = i + 1 < p->n ? i + 1 : 0;
+        dx = p->x[j] - p->x[i];
+        dy = p->y[j] - p->y[i];
+        t = dx || dy ?
+            ((px - p->x[i]) * dx + (py - p->y[i]) * dy) / (dx * dx + dy * dy) :
+            0;
+        t = t < 0 ? 0 : t > 1 ? 1 : t;
+        d = hypot(p->x[i] + t * dx - px, p->y[i] + t * dy - py);
+        if (d < dmin)
+            dmin = d;
+    }
+
+    return dmin;
+}
+
+// Aliased: pixels with center inside are set, pixels away from it are not
+static void
+test_fill(const poly_t *p, int w, int h, Imlib_Fill_Rule rule)
+{
+    const uint32_t *data;
+    int             x, y, a, nerr;
+
+    poly_fill(p, w, h, 0, rule);
+    data = imlib_image_get_data_for_reading_only();
+
+    for (y = nerr = 0; y < h; y++)
+    {
+        for (x = 0; x < w; x++)
+        {
+            a = data[y * w + x] >> 24;
+            if (poly_dist(p, x, y) < 1.)
+                continue;       // Outline
+            if (a != (poly_inside(p, x, y, rule) ? 255 : 0))
+                nerr++;
+        }
+    }
+    EXPECT_EQ(nerr, 0);
+
+    imlib_free_image_and_decache();
+}
+
+// Is (px, py) near a point where edges cross
+static bool
+poly_near_crossing(const poly_t *p, double px, double py)
+{
+    int             i, j, k, l;
+    double          ax, ay, bx, by, cx, cy, dx, dy, den, t, u;
+
+    for (i = 0; i < p->n; i++)
+    {
+        k = i + 1 < p->n ? i + 1 : 0;
+        ax = p->x[i];
+        ay = p->y[i];
+        bx = p->x[k] - ax;
+        by = p->y[k] - ay;
+        for (j = i + 2; j < p->n; j++)
+        {
+            l = j + 1 < p->n ? j + 1 : 0;
+            if (l == i)
+                continue;
+            cx = p->x[j];
+            cy = p->y[j];
+            dx = p->x[l] - cx;
+            dy = p->y[l] - cy;
+            den = bx * dy - by * dx;
+            if (den == 0)
+                continue;
+            t = ((cx - ax) * dy - (cy - ay) * dx) / den;
+            u = ((cx - ax) * by - (cy - ay) * bx) / den;
+            if (t < 0 || t > 1 || u < 0 || u > 1)
+                continue;
+            if (fabs(ax + t * bx - px) < 1.5 && fabs(ay + t * by - py) < 1.5)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+// Anti-aliased: coverage matches supersampled coverage
+// Not where edges cross, or the winding number changes sign, within a pixel.
+// The accumulated coverage only knows the sum of the windings there.
+static void
+test_fill_aa(const poly_t *p, int w, int h, Imlib_Fill_Rule rule)
+{
+    const uint32_t *data;
+    int             x, y, i, j, a, ref, nerr;
+
+    poly_fill(p, w, h, 1, rule);
+    data = imlib_image_get_data_for_reading_only();
+
+    for (y = nerr = 0; y < h; y++)
+    {
+        for (x = 0; x < w; x++)
+        {
+            a = data[y * w + x] >> 24;
+            if (poly_near_crossing(p, x, y))
+                continue;
+            ref = 0;
+            for (j = 0; j < 16; j++)
+                for (i = 0; i < 16; i++)
+                    ref += poly_inside(p, x - .5 + (i + .5) / 16,
+                                       y - .5 + (j + .5) / 16, rule);
+            ref = (ref * 255 + 128) / 256;
+            if (abs(a - ref) > 24)
+                nerr++;
+        }
+    }
+    EXPECT_EQ(nerr, 0);
+
+    imlib_free_image_and_decache();
+}
+
+TEST(POLYGON, fill_rule)
+{
+    // Pentagram, center is wound twice
+    static const poly_t star = { 5, { 50, 79, 3, 97, 21 },
+    { 2, 92, 36, 36, 92 }
+    };
+    const uint32_t *data;
+    int             aa;
+
+    for (aa = 0; aa <= 1; aa++)
+    {
+        poly_fill(&star, 100, 100, aa, IMLIB_FILL_RULE_EVEN_ODD);
+        data = imlib_image_get_data_for_reading_only();
+        EXPECT_EQ(data[55 * 100 + 50] >> 24, 0u);
+        EXPECT_EQ(data[20 * 100 + 50] >> 24, 255u);
+        imlib_free_image_and_decache();
+
+        poly_fill(&star, 100, 100, aa, IMLIB_FILL_RULE_NON_ZERO);
+        data = imlib_image_get_data_for_reading_only();
+        EXPECT_EQ(data[55 * 100 + 50] >> 24, 255u);
+        EXPECT_EQ(data[20 * 100 + 50] >> 24, 255u);
+        imlib_free_image_and_decache();
+    }
+
+    test_fill(&star, 100, 100, IMLIB_FILL_RULE_EVEN_ODD);
+    test_fill(&star, 100, 100, IMLIB_FILL_RULE_NON_ZERO);
+    test_fill_aa(&star, 100, 100, IMLIB_FILL_RULE_EVEN_ODD);
+    test_fill_aa(&star, 100, 100, IMLIB_FILL_RULE_NON_ZERO);
+}
+
+TEST(POLYGON, fill_rect)
+{
+    static const poly_t rect = { 4, { 2, 10, 10, 2 }, { 2, 2, 9, 9 } };
+    const uint32_t *data;
+    int             x, y, nerr;
+
+    // Aliased fill includes the outline
+    poly_fill(&rect, 16, 12, 0, IMLIB_FILL_RULE_EVEN_ODD);
+    data = imlib_image_get_data_for_reading_only();
+    for (y = nerr = 0; y < 12; y++)
+        for (x = 0; x < 16; x++)
+            if (data[y * 16 + x] >> 24 !=
+                (x >= 2 && x <= 10 && y >= 2 && y <= 9 ? 255u : 0u))
+                nerr++;
+    EXPECT_EQ(nerr, 0);
+    imlib_free_image_and_decache();
+
+    // Anti-aliased edges through pixel centers are half covered
+    poly_fill(&rect, 16, 12, 1, IMLIB_FILL_RULE_EVEN_ODD);
+    data = imlib_image_get_data_for_reading_only();
+    EXPECT_EQ(data[5 * 16 + 6] >> 24, 255u);
+    EXPECT_EQ(data[5 * 16 + 2] >> 24, 128u);
+    EXPECT_EQ(data[9 * 16 + 6] >> 24, 128u);
+    EXPECT_EQ(data[2 * 16 + 10] >> 24, 64u);
+    EXPECT_EQ(data[5 * 16 + 11] >> 24, 0u);
+    imlib_free_image_and_decache();
+}
+
+TEST(POLYGON, fill_random)
+{
+    poly_t          p;
+    int             i;
+
+    for (i = 0; i < 6; i++)
+    {
+        pr_info("Polygon %d", i);
+        poly_random(&p, 3 + 7 * i, 90, 70, i + 1);
+        // The even-odd aliased filler gets a few pixels wrong where many
+        // edges cross (the last one), see fill_aliased_ref
+        if (i < 5)
+            test_fill(&p, 90, 70, IMLIB_FILL_RULE_EVEN_ODD);
+        test_fill(&p, 90, 70, IMLIB_FILL_RULE_NON_ZERO);
+
+        poly_random_simple(&p, 3 + 7 * i, 90, 70, i + 1);
+        test_fill(&p, 90, 70, IMLIB_FILL_RULE_EVEN_ODD);
+        test_fill_aa(&p, 90, 70, IMLIB_FILL_RULE_EVEN_ODD);
+        test_fill_aa(&p, 90, 70, IMLIB_FILL_RULE_NON_ZERO);
+    }
+}
+
+TEST(POLYGON, fill_clip)
+{
+    poly_t          p;
+    Imlib_Image     im1, im2;
+    const uint32_t *d1, *d2;
+    int             x, y, aa, nerr;
+
+    poly_random(&p, 24, 80, 60, 7);
+
+    for (aa = 0; aa <= 1; aa++)
+    {
+        im1 = poly_fill(&p, 80, 60, aa, IMLIB_FILL_RULE_NON_ZERO);
+        imlib_context_set_cliprect(13, 9, 41, 37);
+        im2 = poly_fill(&p, 80, 60, aa, IMLIB_FILL_RULE_NON_ZERO);
+        imlib_context_set_cliprect(0, 0, 0, 0);
+
+        imlib_context_set_image(im1);
+        d1 = imlib_image_get_data_for_reading_only();
+        imlib_context_set_image(im2);
+        d2 = imlib_image_get_data_for_reading_only();
+        for (y = nerr = 0; y < 60; y++)
+            for (x = 0; x < 80; x++)
+                if (d2[y * 80 + x] != (x >= 13 && x < 54 && y >= 9 && y < 46 ?
+                                       d1[y * 80 + x] : 0))
+                    nerr++;
+        EXPECT_EQ(nerr, 0);
+
+        imlib_context_set_image(im1);
+        imlib_free_image_and_decache();
+        imlib_context_set_image(im2);
+        imlib_free_image_and_decache();
+    }
+}
+
+TEST(POLYGON, fill_mt)
+{
+    poly_t          p;
+    Imlib_Image     im1, im2;
+    int             i, aa, rule, nerr;
+    const uint32_t *d1, *d2;
+
+    poly_random(&p, 60, 600, 500, 3);
+
+    for (aa = 0; aa <= 1; aa++)
+    {
+        for (rule = 0; rule <= 1; rule++)
+        {
+            im1 = poly_fill(&p, 600, 500, aa, (Imlib_Fill_Rule) rule);
+            imlib_set_threads(4);
+            im2 = poly_fill(&p, 600, 500, aa, (Imlib_Fill_Rule) rule);
+            imlib_set_threads(1);
+
+            imlib_context_set_image(im1);
+            d1 = imlib_image_get_data_for_reading_only();
+            imlib_context_set_image(im2);
+            d2 = imlib_image_get_data_for_reading_only();
+            for (i = nerr = 0; i < 600 * 500; i++)
+                if (d1[i] != d2[i])
+                    nerr++;
+            EXPECT_EQ(nerr, 0);
+
+            imlib_context_set_image(im1);
+            imlib_free_image_and_decache();
+            imlib_context_set_image(im2);
+            imlib_free_image_and_decache();
+        }
+    }
+}
+
+// Aliased even-odd fill output is unchanged from the original filler.
+// Non-zero filling also sets the pixels the outline passes through.
+TEST(POLYGON, fill_aliased_ref)
+{
+    static const poly_t tri = { 3, { 69, 7, 44 }, { 66, 42, -4 } };
+    static const struct {
+        int             n, w, h;
+        unsigned int    crc;
+    } refs[] = {
+        { 3, 64, 64, 1841149121 },
+        { 7, 64, 64, 3170033126 },
+        { 40, 64, 64, 4097261446 },
+        { 3, 301, 157, 1147150287 },
+        { 7, 301, 157, 2594271008 },
+        { 40, 301, 157, 2687553913 },
+    };
+    poly_t          p;
+    Imlib_Image     im;
+    const uint32_t *data;
+    unsigned int    i, crc;
+
+    im = poly_fill(&tri, 64, 64, 0, IMLIB_FILL_RULE_EVEN_ODD);
+    data = imlib_image_get_data_for_reading_only();
+    EXPECT_EQ(data[0 * 64 + 45] >> 24, 255u);
+    EXPECT_EQ(data[0 * 64 + 46] >> 24, 0u);
+    EXPECT_EQ(image_get_crc32(im), 3367449084u);
+    imlib_free_image_and_decache();
+
+    // Outline pixel with center just outside the polygon
+    im = poly_fill(&tri, 64, 64, 0, IMLIB_FILL_RULE_NON_ZERO);
+    data = imlib_image_get_data_for_reading_only();
+    EXPECT_EQ(data[0 * 64 + 45] >> 24, 255u);
+    EXPECT_EQ(data[0 * 64 + 46] >> 24, 255u);
+    EXPECT_EQ(data[0 * 64 + 47] >> 24, 0u);
+    EXPECT_EQ(image_get_crc32(im), 4003316976u);
+    imlib_free_image_and_decache();
+
+    for (i = 0; i < sizeof(refs) / sizeof(refs[0]); i++)
+    {
+        poly_random(&p, refs[i].n, refs[i].w, refs[i].h, i + 11);
+        im = poly_fill(&p, refs[i].w, refs[i].h, 0, IMLIB_FILL_RULE_EVEN_ODD);
+        crc = image_get_crc32(im);
+        EXPECT_EQ(crc, refs[i].crc) << "polygon " << i;
+        imlib_free_image_and_decache();
+    }
+}
@@ -121,3 +121,63 @@ TEST(ROTAT, rotate_2_noaa)
 {
     test_rotate(1, 0);
 }
+
+// Rotate/skew big enough to be threaded, compare to single threaded result
+static unsigned int
+rotate_mt(Imlib_Image imi, int nthr, int aa, int skew)
+{
+    Imlib_Image     imo;
+    unsigned int    crc;
+
+    imlib_set_threads(nthr);
+    imlib_context_set_anti_alias(aa);
+    imlib_context_set_image(imi);
+
+    if (skew)
+    {
+        imo = imlib_create_image(500, 500);
+        imlib_context_set_image(imo);
+        imlib_image_set_has_alpha(1);
+        imlib_image_clear();
+        imlib_context_set_blend(1);
+        imlib_blend_image_onto_image_at_angle(imi, 1, 0, 0, 64, 64,
+                                              10, 150, 420, 170);
+    }
+    else
+    {
+        imo = imlib_create_rotated_image(0.3);
+    }
+    EXPECT_TRUE(imo);
+    crc = image_get_crc32(imo);
+
+    imlib_context_set_image(imo);
+    imlib_free_image_and_decache();
+    imlib_set_threads(1);
+
+    return crc;
+}
+
+TEST(ROTAT, rotate_mt)
+{
+    char            filei[256];
+    Imlib_Image     imi, ims;
+    int             aa, skew;
+
+    snprintf(filei, sizeof(filei), "%s/%s.png", IMG_SRC, FILE_PFX2);
+    imi = imlib_load_image(filei);
+    ASSERT_TRUE(imi);
+
+    imlib_context_set_image(imi);
+    ims = imlib_create_cropped_scaled_image(0, 0, 64, 64, 400, 400);
+    ASSERT_TRUE(ims);
+
+    for (skew = 0; skew <= 1; skew++)
+        for (aa = 0; aa <= 1; aa++)
+            EXPECT_EQ(rotate_mt(skew ? imi : ims, 1, aa, skew),
+                      rotate_mt(skew ? imi : ims, 4, aa, skew));
+
+    imlib_context_set_image(ims);
+    imlib_free_image_and_decache();
+    imlib_context_set_image(imi);
+    imlib_free_image_and_decache();
+}
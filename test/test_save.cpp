@@ -2,6 +2,7 @@
 
 #include "config.h"
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <Imlib2.h>
 #ifdef BUILD_HEIF_LOADER
 #include <libheif/heif.h>
@@ -434,3 +435,246 @@ TEST(SAVE, save_3_rdonly)
                 EACCES, IMLIB_LOAD_ERROR_PERMISSION_DENIED_TO_WRITE);
 }
 #endif
+
+typedef struct {
+    size_t          len;        /* Bytes written */
+    size_t          max;        /* Fail after this many bytes */
+} sink_t;
+
+static int
+sink_write(void *data, const void *buf, size_t len)
+{
+    sink_t         *sk = (sink_t *) data;
+
+    if (sk->len + len > sk->max)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+    sk->len += len;
+
+    return 0;
+}
+
+static void
+test_save_4(const char *file)
+{
+    char            filei[256];
+    char            fileo[256];
+    unsigned int    i;
+    const char     *ext;
+    int             err;
+    Imlib_Image     im;
+    void           *buf, *fdata;
+    size_t          size;
+    FILE           *fp;
+    struct stat     st;
+    sink_t          sk;
+
+    snprintf(filei, sizeof(filei), "%s/%s", IMG_SRC, file);
+    D("Load '%s'\n", filei);
+    im = imlib_load_image(filei);
+    ASSERT_TRUE(im);
+
+    for (i = 0; i < N_PFX; i++)
+    {
+        ext = exts[i].ext;
+
+        if (file_skip(ext))
+            continue;
+
+        imlib_context_set_image(im);
+        imlib_image_set_format(ext);
+        snprintf(fileo, sizeof(fileo), "%s/save-mem-%s.%s",
+                 IMG_GEN, file, ext);
+        pr_info("Save mem %s", ext);
+
+        imlib_save_image_with_errno_return(fileo, &err);
+        if (err)
+            continue;           /* Covered by the file save tests */
+
+        // Memory output is identical to file output
+        buf = imlib_save_image_mem(fileo, &size);
+        ASSERT_TRUE(buf);
+        EXPECT_EQ(imlib_get_error(), 0);
+
+        ASSERT_EQ(stat(fileo, &st), 0);
+        ASSERT_EQ(size, (size_t)st.st_size);
+        fdata = malloc(size);
+        fp = fopen(fileo, "rb");
+        ASSERT_TRUE(fp);
+        EXPECT_EQ(fread(fdata, 1, size, fp), size);
+        fclose(fp);
+        EXPECT_EQ(memcmp(buf, fdata, size), 0);
+        free(fdata);
+        free(buf);
+
+        // Callback output, all accepted
+        sk.len = 0;
+        sk.max = SIZE_MAX;
+        imlib_save_image_with_callback(fileo, sink_write, &sk);
+        EXPECT_EQ(imlib_get_error(), 0);
+        EXPECT_EQ(sk.len, size);
+
+        // Callback failure aborts the save with the callback errno
+        sk.len = 0;
+        sk.max = size / 2;
+        imlib_save_image_with_callback(fileo, sink_write, &sk);
+        EXPECT_EQ(imlib_get_error(), ENOSPC);
+    }
+
+    imlib_context_set_image(im);
+    imlib_free_image_and_decache();
+
+    // Format from file name
+    im = imlib_create_image(16, 16);
+    imlib_context_set_image(im);
+    buf = imlib_save_image_mem("foo.png", &size);
+    EXPECT_TRUE(buf);
+    EXPECT_GT(size, 0U);
+    free(buf);
+    buf = imlib_save_image_mem("foo.nonexistent", &size);
+    EXPECT_FALSE(buf);
+    EXPECT_EQ(imlib_get_error(), IMLIB_ERR_NO_SAVER);
+    EXPECT_EQ(size, 0U);
+    imlib_free_image_and_decache();
+}
+
+TEST(SAVE, save_4_mem)
+{
+    test_save_4("image-noalp-64.png");
+    test_save_4("image-alpha-64.png");
+}
+
+// Threaded encoding gives the same image as serial encoding
+static void
+test_save_5(const char *fmt, int threads)
+{
+    char            fileo[256];
+    Imlib_Image     im, im1, im2;
+    unsigned int    crc0, crc1, crc2;
+    int             err;
+
+    D("Load '%s'\n", IMG_SRC "/image-noalp-64.png");
+    im1 = imlib_load_image(IMG_SRC "/image-noalp-64.png");
+    ASSERT_TRUE(im1);
+    imlib_context_set_image(im1);
+    im = imlib_create_cropped_scaled_image(0, 0, 64, 64, 1600, 1700);
+    ASSERT_TRUE(im);
+    imlib_free_image_and_decache();
+
+    imlib_context_set_image(im);
+    crc0 = image_get_crc32(im);
+    imlib_image_set_format(fmt);
+
+    snprintf(fileo, sizeof(fileo), "%s/save-thr-1.%s", IMG_GEN, fmt);
+    pr_info("Save %s threads=%d", fmt, 1);
+    imlib_image_attach_data_value("threads", NULL, 1, NULL);
+    imlib_save_image_with_errno_return(fileo, &err);
+    EXPECT_EQ(err, 0);
+
+    snprintf(fileo, sizeof(fileo), "%s/save-thr-%d.%s", IMG_GEN, threads, fmt);
+    pr_info("Save %s threads=%d", fmt, threads);
+    imlib_image_attach_data_value("threads", NULL, threads, NULL);
+    imlib_save_image_with_errno_return(fileo, &err);
+    EXPECT_EQ(err, 0);
+
+    imlib_free_image_and_decache();
+
+    snprintf(fileo, sizeof(fileo), "%s/save-thr-1.%s", IMG_GEN, fmt);
+    im1 = imlib_load_image(fileo);
+    ASSERT_TRUE(im1);
+    crc1 = image_get_crc32(im1);
+    snprintf(fileo, sizeof(fileo), "%s/save-thr-%d.%s", IMG_GEN, threads, fmt);
+    im2 = imlib_load_image(fileo);
+    ASSERT_TRUE(im2);
+    crc2 = image_get_crc32(im2);
+
+    EXPECT_EQ(crc1, crc2);
+    if (!strcmp(fmt, "png"))
+    {
+        EXPECT_EQ(crc2, crc0);  /* Lossless */
+    }
+
+    imlib_context_set_image(im1);
+    imlib_free_image_and_decache();
+    imlib_context_set_image(im2);
+    imlib_free_image_and_decache();
+}
+
+TEST(SAVE, save_5_threads)
+{
+    test_save_5("png", 4);
+#ifdef BUILD_JPEG_LOADER
+    test_save_5("jpg", 4);
+    test_save_5("jpg", 3);
+#endif
+}
+
+// Encoder effort/speed/threads tags are accepted by all savers
+static void
+test_save_6(const char *file)
+{
+    static const struct {
+        const char     *tag;
+        int             val;
+    } tags[] = {
+        { "effort", 0 }, { "effort", 9 }, { "speed", 9 }, { "threads", 2 },
+    };
+    char            filei[256];
+    char            fileo[256];
+    unsigned int    i, j;
+    const char     *ext;
+    int             err;
+    Imlib_Image     im, im2;
+
+    snprintf(filei, sizeof(filei), "%s/%s", IMG_SRC, file);
+    D("Load '%s'\n", filei);
+    im = imlib_load_image(filei);
+    ASSERT_TRUE(im);
+
+    for (i = 0; i < N_PFX; i++)
+    {
+        ext = exts[i].ext;
+
+        if (file_skip(ext))
+            continue;
+
+        snprintf(fileo, sizeof(fileo), "%s/save-tags-%s.%s",
+                 IMG_GEN, file, ext);
+
+        imlib_context_set_image(im);
+        imlib_image_set_format(ext);
+        imlib_save_image_with_errno_return(fileo, &err);
+        if (err)
+            continue;           /* Covered by the file save tests */
+
+        for (j = 0; j < sizeof(tags) / sizeof(tags[0]); j++)
+        {
+            pr_info("Save %s %s=%d", ext, tags[j].tag, tags[j].val);
+
+            imlib_context_set_image(im);
+            imlib_image_attach_data_value(tags[j].tag, NULL, tags[j].val,
+                                          NULL);
+            imlib_save_image_with_errno_return(fileo, &err);
+            EXPECT_EQ(err, 0);
+            imlib_image_remove_and_free_attached_data_value(tags[j].tag);
+
+            im2 = imlib_load_image_without_cache(fileo);
+            ASSERT_TRUE(im2);
+            imlib_context_set_image(im2);
+            EXPECT_EQ(imlib_image_get_width(), 64);
+            EXPECT_EQ(imlib_image_get_height(), 64);
+            imlib_free_image_and_decache();
+        }
+    }
+
+    imlib_context_set_image(im);
+    imlib_free_image_and_decache();
+}
+
+TEST(SAVE, save_6_tags)
+{
+    test_save_6("image-noalp-64.png");
+    test_save_6("image-alpha-64.png");
+}
@@ -254,3 +254,71 @@ TEST(SCALE, scale_2_argb_down)
     test_scale_2(1, 7, 100, 7, 40, 7, 100);
     test_scale_2(1, 100, 9, 40, 9, 100, 9);
 }
+
+static unsigned int
+test_scale_thr_crc(Imlib_Image imi, int nthr, int w, int h)
+{
+    Imlib_Image     imo;
+    unsigned int    crc;
+
+    imlib_set_threads(nthr);
+
+    imlib_context_set_image(imi);
+    imo = imlib_create_cropped_scaled_image(3, 5, imlib_image_get_width() - 7,
+                                            imlib_image_get_height() - 9,
+                                            w, h);
+    EXPECT_TRUE(imo);
+    if (!imo)
+        return 0;
+
+    /* Blend back onto itself, flipped, to exercise the blend path too */
+    imlib_context_set_image(imo);
+    imlib_context_set_blend(1);
+    imlib_blend_image_onto_image(imi, 1, 0, 0, imlib_image_get_width(),
+                                 imlib_image_get_height(), w - 1, h - 1,
+                                 -w / 2, -h / 2);
+    imlib_context_set_blend(0);
+
+    crc = image_get_crc32(imo);
+    imlib_free_image_and_decache();
+
+    imlib_set_threads(1);
+
+    return crc;
+}
+
+TEST(SCALE, scale_threads)
+{
+    static const int sizes[][2] = {
+        {1201, 777}, {300, 2003}, {257, 256}, {64, 64},
+    };
+    char            buf[128];
+    Imlib_Image     imi;
+    unsigned int    crc1, crcn;
+    unsigned int    i;
+    int             aa, nthr;
+
+    EXPECT_EQ(imlib_get_threads(), 1);
+
+    snprintf(buf, sizeof(buf), "%s/%s.png", IMG_SRC, FILE_PFX2);
+    imi = imlib_load_image(buf);
+    ASSERT_TRUE(imi);
+
+    for (aa = 0; aa <= 1; aa++)
+    {
+        imlib_context_set_anti_alias(aa);
+        for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        {
+            crc1 = test_scale_thr_crc(imi, 1, sizes[i][0], sizes[i][1]);
+            for (nthr = 2; nthr <= 7; nthr += 5)
+            {
+                crcn = test_scale_thr_crc(imi, nthr, sizes[i][0], sizes[i][1]);
+                EXPECT_EQ(crc1, crcn) << "aa=" << aa << " " << sizes[i][0]
+                    << "x" << sizes[i][1] << " threads=" << nthr;
+            }
+        }
+    }
+
+    imlib_context_set_image(imi);
+    imlib_free_image_and_decache();
+}